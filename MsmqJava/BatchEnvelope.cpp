@@ -0,0 +1,74 @@
+//
+// BatchEnvelope.cpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module writes and walks the frames of a batch body.
+//
+// ------------------------------------------------------------------
+
+#include <string.h>
+#include <WTypes.h>
+
+#include "BatchEnvelope.hpp"
+
+
+
+void BatchEnvelope::write(BYTE *pb, const BYTE *pbRecord, DWORD cbRecord)
+{
+	memcpy(pb, &cbRecord, sizeof(DWORD));
+	if (cbRecord > 0)
+		memcpy(pb + sizeof(DWORD), pbRecord, cbRecord);
+}
+
+
+
+BOOL BatchEnvelope::next(const BYTE *pbBody,
+	DWORD cbBody,
+	DWORD *pdwOffset,
+	const BYTE **ppbRecord,
+	DWORD *pcbRecord)
+{
+	DWORD off = *pdwOffset;
+	if (pbBody == NULL || off >= cbBody || cbBody - off < sizeof(DWORD))
+		return FALSE;
+
+	DWORD cb;
+	memcpy(&cb, pbBody + off, sizeof(DWORD));
+	off += sizeof(DWORD);
+	if (cb > cbBody - off)
+		return FALSE;
+
+	*ppbRecord = pbBody + off;
+	*pcbRecord = cb;
+	*pdwOffset = off + cb;
+	return TRUE;
+}
+
+
+
+BOOL BatchEnvelope::check(const BYTE *pbBody, DWORD cbBody, DWORD cRecords)
+{
+	DWORD off = 0;
+	const BYTE *pbRecord;
+	DWORD cbRecord;
+
+	for (DWORD i = 0; i < cRecords; i++) {
+		if (!next(pbBody, cbBody, &off, &pbRecord, &cbRecord))
+			return FALSE;
+	}
+	return off == cbBody;
+}
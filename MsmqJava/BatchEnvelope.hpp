@@ -0,0 +1,54 @@
+//
+// BatchEnvelope.hpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This is an include for the BatchEnvelope class, the framing of many
+// small records in the body of one message.
+//
+// A batch body is a sequence of frames, each a DWORD length, little
+// endian, followed by that many bytes; there is no padding.  The body
+// carries no marker of its own: a message is a batch when its
+// extension has an MQJ_EXT_BATCH record, holding the number of
+// frames, so that other messages on the queue are left alone.
+//
+// ------------------------------------------------------------------
+
+// the largest batch body, under the 4MB limit of MSMQ
+#define MQJ_BATCH_MAX_SIZE              (4 * 1024 * 1024 - 1024)
+
+
+class BatchEnvelope
+{
+public:
+	// the bytes a record of cbRecord takes in a batch
+	static DWORD frameSize(DWORD cbRecord) { return sizeof(DWORD) + cbRecord; }
+
+	// writes the frame of a record at pb, which has room for it
+	static void write(BYTE *pb, const BYTE *pbRecord, DWORD cbRecord);
+
+	// Finds the record at *pdwOffset in a batch body, and advances the
+	// offset past it.  Returns FALSE at the end of the body, or if the
+	// frame runs past it.
+	static BOOL next(const BYTE *pbBody,
+		DWORD   cbBody,
+		DWORD   *pdwOffset,
+		const BYTE **ppbRecord,
+		DWORD   *pcbRecord);
+
+	// whether a body is exactly cRecords well-formed frames
+	static BOOL check(const BYTE *pbBody, DWORD cbBody, DWORD cRecords);
+};
@@ -0,0 +1,281 @@
+//
+// BatchingSender.cpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module packs small records into batch messages, to spread the
+// per-message cost of MSMQ over many of them.
+//
+// Records are framed into a buffer as they are added.  The batch is
+// sent by the thread whose record does not fit, or by flush(), or by a
+// timer thread once the oldest record has waited dwMaxDelay.  A timed
+// send that fails is reported by the next add() or flush().
+//
+// A batch whose send fails while the queue is away is kept, and sent
+// again before any later one, so that records are neither lost nor
+// reordered.  While it is kept, the batch being filled cannot be
+// swapped out, so adds fail once it is full.
+//
+// ------------------------------------------------------------------
+
+#include <stdio.h>
+#include <process.h>
+#include <WTypes.h>   // reqd for WinBase.h
+#include <WinBase.h>  // for CriticalSection
+#include <MqOai.h>
+#include <mq.h>
+
+#include "Log.hpp"
+#include "DedupWindow.hpp"
+#include "MsmqQueue.hpp"
+#include "BufferPool.hpp"
+#include "BatchEnvelope.hpp"
+#include "Outbox.hpp"          // for isTransient
+#include "BatchingSender.hpp"
+
+
+
+BatchingSender::BatchingSender(MsmqQueue *q)
+{
+	queue = q;
+	cbMax = MQJ_BATCH_DEFAULT_SIZE;
+	dwMaxDelay = MQJ_BATCH_DEFAULT_DELAY;
+	wszLabel[0] = L'\0';
+	pTransaction = MQ_NO_TRANSACTION;
+	InitializeCriticalSection(&cs);
+	InitializeCriticalSection(&sendLock);
+	pbBatch = NULL;
+	pbSpare = NULL;
+	cbHeld = 0;
+	cHeld = 0;
+	cbBatch = 0;
+	cRecords = 0;
+	dwFirstTick = 0;
+	hrDeferred = MQ_OK;
+	hWake = NULL;
+	hStop = NULL;
+	hThread = NULL;
+}
+
+
+
+BatchingSender::~BatchingSender()
+{
+	if (hThread != NULL) {
+		SetEvent(hStop);
+		WaitForSingleObject(hThread, INFINITE);
+		CloseHandle(hThread);
+	}
+	if (hWake != NULL) CloseHandle(hWake);
+	if (hStop != NULL) CloseHandle(hStop);
+
+	if (pbBatch != NULL && pbSpare != NULL && FAILED(flush()))
+		LOG_ERROR("BatchingSender: closed with %lu records not sent", cHeld + cRecords);
+
+	BufferPool::release(pbBatch);
+	BufferPool::release(pbSpare);
+	DeleteCriticalSection(&sendLock);
+	DeleteCriticalSection(&cs);
+}
+
+
+
+HRESULT BatchingSender::open(DWORD cbMaxBatch, DWORD dwDelay, const WCHAR *wszBatchLabel, BOOL fTransactional)
+{
+	if (cbMaxBatch < BatchEnvelope::frameSize(1) || cbMaxBatch > MQJ_BATCH_MAX_SIZE)
+		return MQ_ERROR_INVALID_PARAMETER;
+
+	cbMax = cbMaxBatch;
+	dwMaxDelay = dwDelay;
+	if (wszBatchLabel != NULL)
+		wcsncpy_s(wszLabel, MQ_MAX_MSG_LABEL_LEN, wszBatchLabel, _TRUNCATE);
+	pTransaction = fTransactional ? MQ_SINGLE_MESSAGE : MQ_NO_TRANSACTION;
+
+	pbBatch = BufferPool::alloc(cbMax);
+	pbSpare = BufferPool::alloc(cbMax);
+	if (pbBatch == NULL || pbSpare == NULL)
+		return MQ_ERROR_INSUFFICIENT_RESOURCES;
+
+	hWake = CreateEventW(NULL, FALSE, FALSE, NULL);
+	hStop = CreateEventW(NULL, TRUE, FALSE, NULL);
+	if (hWake == NULL || hStop == NULL)
+		return HRESULT_FROM_WIN32(GetLastError());
+
+	hThread = (HANDLE)_beginthreadex(NULL, 0, timerMain, this, 0, NULL);
+	if (hThread == NULL)
+		return MQ_ERROR_INSUFFICIENT_RESOURCES;
+
+	return MQ_OK;
+}
+
+
+
+HRESULT BatchingSender::add(const BYTE *pbRecord, DWORD cbRecord)
+{
+	if (cbRecord > MQJ_BATCH_MAX_SIZE - sizeof(DWORD))
+		return MQ_ERROR_INVALID_PARAMETER;
+
+	DWORD cbFrame = BatchEnvelope::frameSize(cbRecord);
+	if (cbFrame > cbMax) {
+		// too big to share a batch; keep the order by sending what is
+		// pending first
+		HRESULT hr = flush();
+		return FAILED(hr) ? hr : sendOne(pbRecord, cbRecord);
+	}
+
+	for (;;) {
+		BOOL fStarted = FALSE;
+
+		EnterCriticalSection(&cs);
+		HRESULT hr = hrDeferred;
+		hrDeferred = MQ_OK;
+		if (SUCCEEDED(hr) && cbBatch + cbFrame <= cbMax) {
+			if (cRecords == 0) {
+				dwFirstTick = GetTickCount();
+				fStarted = TRUE;
+			}
+			BatchEnvelope::write(pbBatch + cbBatch, pbRecord, cbRecord);
+			cbBatch += cbFrame;
+			cRecords++;
+			LeaveCriticalSection(&cs);
+
+			if (fStarted) SetEvent(hWake);
+			return MQ_OK;
+		}
+		LeaveCriticalSection(&cs);
+
+		if (FAILED(hr)) return hr;
+
+		// full; send it, and try again in the empty one
+		hr = flush();
+		if (FAILED(hr)) return hr;
+	}
+}
+
+
+
+HRESULT BatchingSender::flush()
+{
+	HRESULT hr = MQ_OK;
+
+	EnterCriticalSection(&sendLock);
+
+	// the batch that failed last time goes first; until it does, the
+	// one being filled stays where it is
+	if (cHeld > 0) {
+		hr = queue->sendBatch(pbSpare, cbHeld, cHeld, wszLabel, pTransaction, MQ_DEFAULT_PRIORITY);
+		if (SUCCEEDED(hr) || !Outbox::isTransient(hr)) {
+			if (FAILED(hr))
+				LOG_ERROR("BatchingSender: dropping %lu records that cannot be sent (hr=0x%08x)", cHeld, hr);
+			cbHeld = 0;
+			InterlockedExchange(&cHeld, 0);
+		}
+		if (FAILED(hr)) {
+			LeaveCriticalSection(&sendLock);
+			return hr;
+		}
+	}
+
+	EnterCriticalSection(&cs);
+	BYTE *pbFull = pbBatch;
+	DWORD cbFull = cbBatch;
+	DWORD cFull = cRecords;
+	if (cFull > 0) {
+		pbBatch = pbSpare;
+		pbSpare = pbFull;
+		cbBatch = 0;
+		cRecords = 0;
+	}
+	LeaveCriticalSection(&cs);
+
+	if (cFull > 0) {
+		hr = queue->sendBatch(pbFull, cbFull, cFull, wszLabel, pTransaction, MQ_DEFAULT_PRIORITY);
+		if (FAILED(hr) && Outbox::isTransient(hr)) {
+			// keep it in the spare, where it is
+			LOG_WARN("BatchingSender: %lu records not sent yet (hr=0x%08x)", cFull, hr);
+			cbHeld = cbFull;
+			InterlockedExchange(&cHeld, (LONG)cFull);
+		}
+		else if (FAILED(hr))
+			LOG_ERROR("BatchingSender: dropping %lu records that cannot be sent (hr=0x%08x)", cFull, hr);
+	}
+
+	LeaveCriticalSection(&sendLock);
+	return hr;
+}
+
+
+
+HRESULT BatchingSender::sendOne(const BYTE *pbRecord, DWORD cbRecord)
+{
+	DWORD cbFrame = BatchEnvelope::frameSize(cbRecord);
+	BYTE *pb = BufferPool::alloc(cbFrame);
+	if (pb == NULL) return MQ_ERROR_INSUFFICIENT_RESOURCES;
+	BatchEnvelope::write(pb, pbRecord, cbRecord);
+
+	EnterCriticalSection(&sendLock);
+	HRESULT hr = queue->sendBatch(pb, cbFrame, 1, wszLabel, pTransaction, MQ_DEFAULT_PRIORITY);
+	LeaveCriticalSection(&sendLock);
+
+	BufferPool::release(pb);
+	return hr;
+}
+
+
+
+unsigned __stdcall BatchingSender::timerMain(void *pv)
+{
+	((BatchingSender *)pv)->timer();
+	return 0;
+}
+
+
+
+void BatchingSender::timer()
+{
+	HANDLE waits[2] = { hStop, hWake };
+
+	for (;;) {
+		DWORD dwWait = INFINITE;
+		EnterCriticalSection(&cs);
+		if (cRecords > 0) {
+			DWORD dwElapsed = GetTickCount() - dwFirstTick;
+			dwWait = (dwElapsed >= dwMaxDelay) ? 0 : dwMaxDelay - dwElapsed;
+		}
+		LeaveCriticalSection(&cs);
+
+		// written under sendLock, which a send in progress holds
+		if (InterlockedCompareExchange(&cHeld, 0, 0) > 0)
+			dwWait = 0;
+
+		if (dwWait == 0) {
+			HRESULT hr = flush();
+			if (FAILED(hr)) {
+				EnterCriticalSection(&cs);
+				hrDeferred = hr;
+				LeaveCriticalSection(&cs);
+
+				// not again at once: the queue is likely still away
+				if (WaitForSingleObject(hStop, MQJ_BATCH_RETRY_DELAY) == WAIT_OBJECT_0)
+					break;
+			}
+			continue;
+		}
+
+		if (WaitForMultipleObjects(2, waits, FALSE, dwWait) == WAIT_OBJECT_0)
+			break;
+	}
+}
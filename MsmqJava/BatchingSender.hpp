@@ -0,0 +1,84 @@
+//
+// BatchingSender.hpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This is an include for the BatchingSender class, which packs small
+// records into batch messages.
+//
+// ------------------------------------------------------------------
+
+#define MQJ_BATCH_DEFAULT_SIZE          (64 * 1024)
+#define MQJ_BATCH_DEFAULT_DELAY         10     // ms
+
+// how long the timer waits before sending a failed batch again
+#define MQJ_BATCH_RETRY_DELAY           1000   // ms
+
+
+class BatchingSender
+{
+private:
+	MsmqQueue       *queue;         // the send handle
+	DWORD           cbMax;
+	DWORD           dwMaxDelay;
+	WCHAR           wszLabel[MQ_MAX_MSG_LABEL_LEN];
+	ITransaction    *pTransaction;  // MQ_NO_TRANSACTION or MQ_SINGLE_MESSAGE
+
+	// guards the batch being filled
+	CRITICAL_SECTION cs;
+	BYTE            *pbBatch;
+	DWORD           cbBatch;
+	DWORD           cRecords;
+	DWORD           dwFirstTick;    // when the first record was added
+	HRESULT         hrDeferred;     // a failed timed send, for the next caller
+
+	// held while a batch is sent, so that batches go in order.  The
+	// full batch is swapped with the spare, and sent from there, so
+	// that adds go on meanwhile.  A batch whose send failed with a
+	// transient error stays in the spare, and is sent again before
+	// any other.
+	CRITICAL_SECTION sendLock;
+	BYTE            *pbSpare;
+	DWORD           cbHeld;         // of the failed batch in the spare
+	volatile LONG   cHeld;          // its records; 0 if there is none
+
+	HANDLE          hWake;          // set when a batch is started
+	HANDLE          hStop;
+	HANDLE          hThread;
+
+	HRESULT sendOne(const BYTE *pbRecord, DWORD cbRecord);
+	void    timer(void);
+	static unsigned __stdcall timerMain(void *pv);
+
+public:
+	BatchingSender(MsmqQueue *q);
+
+	// sends what is pending, and stops the timer.  Records that still
+	// cannot be sent are lost, and logged.
+	~BatchingSender();
+
+	// Batches are sent when they reach cbMax bytes, or dwMaxDelay ms
+	// after their first record was added.
+	HRESULT open(DWORD cbMax, DWORD dwMaxDelay, const WCHAR *wszLabel, BOOL fTransactional);
+
+	// Adds a record to the batch, sending the batch first if the record
+	// does not fit.  A record larger than a batch is sent on its own.
+	// Returns the failure of a timed send since the last call, if any.
+	// Whenever this fails, for that or any other reason, the record has
+	// not been added, and the caller must add it again.
+	HRESULT add(const BYTE *pbRecord, DWORD cbRecord);
+
+	// Sends the pending records now: a batch kept from a failed send
+	// first, then the one being filled.  A batch that fails with a
+	// transient error is kept, to be sent again by the next flush()
+	// or by the timer; one that fails otherwise can never be sent,
+	// and is dropped.
+	HRESULT flush(void);
+};
@@ -0,0 +1,221 @@
+//
+// BatchingSender.java
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module packs small records into batch messages.
+//
+// ------------------------------------------------------------------
+
+package ionic.Msmq;
+
+
+/**
+ * <p>A BatchingSender packs small records into batch messages, so that
+ * the cost MSMQ has for each message is shared by many records.</p>
+ *
+ * <blockquote class='code'><pre>
+ *   BatchingSender sender= new BatchingSender(queue, 64*1024, 10, "ticks", false);
+ *   for (Tick t : ticks)
+ *       sender.add(t.toBytes());
+ *   sender.close();
+ * </pre></blockquote>
+ *
+ * <p>A batch is sent when the next record does not fit in it, when
+ * {@link #flush()} is called, or when its first record has waited
+ * maxDelayMillis. A record larger than a batch is sent in a batch of
+ * its own. Records are sent in the order they were added.</p>
+ *
+ * <p>On the receiving side, {@link Message#isBatch()} tells batch
+ * messages apart, and {@link Message#records()} iterates their
+ * records. Other messages on the same queue are not affected.</p>
+ *
+ * <p>The queue must be open for SEND access, and can have only one
+ * BatchingSender at a time. The sender is closed when the queue is. A
+ * BatchingSender is safe to use from many threads.</p>
+ *
+ */
+public class BatchingSender
+{
+    /**
+     * Create a sender with the default batch size, 64k, and delay,
+     * 10ms, for non-transactional records labelled "batch".
+     *
+     * @param queue   a queue open for SEND access.
+     **/
+    public BatchingSender(Queue queue)
+        throws  MessageQueueException
+    {
+        this(queue, 0, 10, "batch", false);
+    }
+
+
+    /**
+     * Create a sender.
+     *
+     * @param queue           a queue open for SEND access.
+     * @param maxBatchBytes   the largest batch body, or 0 for the default,
+     *                        64k. MSMQ limits messages to about 4MB.
+     * @param maxDelayMillis  the longest the first record of a batch
+     *                        waits before the batch is sent.
+     * @param label           the label of the batch messages.
+     * @param transactional   whether to send each batch in a single
+     *                        message transaction, for transactional queues.
+     **/
+    public BatchingSender(Queue queue,
+                          int maxBatchBytes,
+                          int maxDelayMillis,
+                          String label,
+                          boolean transactional)
+        throws  MessageQueueException
+    {
+        if (maxBatchBytes < 0 || maxDelayMillis < 0)
+            throw new IllegalArgumentException("maxBatchBytes and maxDelayMillis must not be negative");
+        int rc= nativeOpen(queue, maxBatchBytes, maxDelayMillis, label, transactional);
+        if (rc!=0)
+            throw new MessageQueueException("Cannot open batching sender.", rc);
+        _queue= queue;
+    }
+
+
+    /**
+     * Add a record.
+     *
+     * @param record  the bytes of the record, copied before this returns.
+     **/
+    public void add(byte[] record)
+        throws  MessageQueueException
+    {
+        add(record, 0, record.length);
+    }
+
+
+    /**
+     * <p>Add part of an array as a record.</p>
+     *
+     * <p>If this throws, the record has not been added, and must be
+     * added again to be sent. That holds also when the failure is that
+     * of a batch sent by the timer since the last call, which is thrown
+     * here. A batch that failed because the queue is away, as with
+     * MQ_ERROR_QUEUE_NOT_AVAILABLE, is kept, and sent again before any
+     * later records: by the timer, every second, or by the next add or
+     * flush. Until it goes, the batch being filled cannot be sent, and
+     * adds fail once it is full. A batch that failed for any other
+     * reason could never be sent, and its records are lost.</p>
+     *
+     * @param record  the array holding the record.
+     * @param offset  where the record starts.
+     * @param length  the length of the record.
+     **/
+    public void add(byte[] record, int offset, int length)
+        throws  MessageQueueException
+    {
+        if (offset < 0 || length < 0 || offset + length > record.length)
+            throw new IndexOutOfBoundsException();
+        _lock.readLock().lock();
+        try {
+            _checkOpen();
+            int rc= nativeAdd(_queue, record, offset, length);
+            if (rc!=0)
+                throw new MessageQueueException("Cannot add record.", rc);
+        }
+        finally {
+            _lock.readLock().unlock();
+        }
+    }
+
+
+    /**
+     * <p>Send the pending records now.</p>
+     *
+     * <p>If the send fails because the queue is away, the records are
+     * kept, to be sent again; see {@link #add(byte[], int, int)}.</p>
+     *
+     **/
+    public void flush()
+        throws  MessageQueueException
+    {
+        _lock.readLock().lock();
+        try {
+            _checkOpen();
+            int rc= nativeFlush(_queue);
+            if (rc!=0)
+                throw new MessageQueueException("Cannot flush batch.", rc);
+        }
+        finally {
+            _lock.readLock().unlock();
+        }
+    }
+
+
+    /**
+     * <p>Send the pending records, and close the sender. The queue stays
+     * open, and can have another BatchingSender. If the records cannot
+     * be sent, the failure is thrown, and they are lost.</p>
+     *
+     **/
+    public void close()
+        throws  MessageQueueException
+    {
+        _lock.writeLock().lock();
+        try {
+            if (_closed) return;
+            _closed= true;
+            int rc= nativeFlush(_queue);
+            nativeClose(_queue);
+            if (rc!=0)
+                throw new MessageQueueException("Cannot flush batch.", rc);
+        }
+        finally {
+            _lock.writeLock().unlock();
+        }
+    }
+
+
+    private void _checkOpen()
+        throws  MessageQueueException
+    {
+        if (_closed)
+            throw new MessageQueueException("Sender is closed.", 0xC00E0007); // MQ_ERROR_INVALID_HANDLE
+    }
+
+
+
+    // --------------------------------------------
+    // native methods
+    private static native int nativeOpen(Queue queue, int maxBatchBytes, int maxDelay, String label, boolean transactional);
+    private static native int nativeAdd(Queue queue, byte[] record, int offset, int length);
+    private static native int nativeFlush(Queue queue);
+    private static native int nativeClose(Queue queue);
+
+
+    // --------------------------------------------
+    // private members
+    private Queue _queue;
+    private boolean _closed = false;
+    // adds and flushes run together; close waits for them
+    private java.util.concurrent.locks.ReadWriteLock _lock =
+        new java.util.concurrent.locks.ReentrantReadWriteLock();
+
+    // --------------------------------------------
+    // static initializer
+    static {
+        System.loadLibrary("MsmqJava");
+        // the native layer is initialized by the Queue class
+        try { Class.forName("ionic.Msmq.Queue"); }
+        catch (ClassNotFoundException ex1) { }
+    }
+}
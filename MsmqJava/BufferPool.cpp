@@ -0,0 +1,269 @@
+//
+// BufferPool.cpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module provides a size-class buffer pool for message bodies.
+// Each thread keeps a small cache of free buffers per size class, in
+// front of a shared arena guarded by one critical section per class.
+// The small classes are carved out of slabs, which are never returned
+// to the OS; the large classes are allocated one at a time, and the
+// arena keeps only a bounded number of them.
+//
+// ------------------------------------------------------------------
+
+#include <stdio.h>
+#include <new>
+#include <WTypes.h>   // reqd for WinBase.h
+#include <WinBase.h>  // for CriticalSection, Tls*
+
+#include "Log.hpp"
+#include "BufferPool.hpp"
+
+
+// Every buffer handed out is preceded by this header, so that release()
+// and capacity() need only the body pointer.  The header is 16 bytes on
+// both Win32 and x64, which keeps the body 16-byte aligned.
+struct PoolBlock
+{
+	PoolBlock  *next;       // free-list link, valid only while pooled
+	DWORD       sizeClass;  // index into classSize[], or OVERSIZE_CLASS
+	DWORD       capacity;   // usable bytes following the header
+#ifndef _WIN64
+	DWORD       reserved;
+#endif
+};
+
+#define OVERSIZE_CLASS     0xFFFFFFFF
+#define NUM_SLAB_CLASSES   3             // 1k, 4k, 16k come from slabs
+#define SLAB_SIZE          (256 * 1024)
+#define UNBOUNDED          0xFFFFFFFF
+
+static const DWORD classSize[BUFFERPOOL_NUM_CLASSES] =
+	{ 1024, 4096, 16384, 65536, 262144, 1048576, 4194304 };
+
+// how many free buffers of each class one thread may hold on to
+static const DWORD threadCacheLimit[BUFFERPOOL_NUM_CLASSES] =
+	{ 32, 16, 8, 4, 2, 1, 1 };
+
+// how many free buffers of each class the shared arena keeps.  Slab
+// buffers cannot be freed individually, so those are unbounded.
+static const DWORD arenaLimit[BUFFERPOOL_NUM_CLASSES] =
+	{ UNBOUNDED, UNBOUNDED, UNBOUNDED, 32, 16, 8, 4 };
+
+
+struct SharedArena
+{
+	CRITICAL_SECTION  lock;
+	PoolBlock        *freeList;
+	DWORD             freeCount;
+};
+
+struct ThreadCache
+{
+	PoolBlock  *freeList[BUFFERPOOL_NUM_CLASSES];
+	DWORD       freeCount[BUFFERPOOL_NUM_CLASSES];
+};
+
+static SharedArena  arena[BUFFERPOOL_NUM_CLASSES];
+static DWORD        tlsIndex = TLS_OUT_OF_INDEXES;
+static LONG         isInited = 0;
+
+
+
+static DWORD ClassForSize(DWORD cb)
+{
+	for (DWORD c = 0; c < BUFFERPOOL_NUM_CLASSES; c++) {
+		if (cb <= classSize[c]) return c;
+	}
+	return OVERSIZE_CLASS;
+}
+
+
+
+static PoolBlock * NewHeapBlock(DWORD sizeClass, DWORD capacity)
+{
+	// the header and the capacity must not wrap around a size_t
+	if (capacity > (size_t)-1 - sizeof(PoolBlock)) return NULL;
+
+	PoolBlock *b = (PoolBlock *) new (std::nothrow) BYTE[sizeof(PoolBlock) + capacity];
+	if (b == NULL) return NULL;
+	b->next = NULL;
+	b->sizeClass = sizeClass;
+	b->capacity = capacity;
+	return b;
+}
+
+
+
+// caller holds arena[c].lock
+static void NewSlab(DWORD c)
+{
+	BYTE *slab = (BYTE *)VirtualAlloc(NULL, SLAB_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (slab == NULL) return;
+
+	DWORD stride = sizeof(PoolBlock) + classSize[c];
+	DWORD n = SLAB_SIZE / stride;
+	LOG_DEBUG("BufferPool: new slab for class %d (%d buffers)", c, n);
+
+	for (DWORD i = 0; i < n; i++) {
+		PoolBlock *b = (PoolBlock *)(slab + i * stride);
+		b->sizeClass = c;
+		b->capacity = classSize[c];
+		b->next = arena[c].freeList;
+		arena[c].freeList = b;
+		arena[c].freeCount++;
+	}
+}
+
+
+
+static ThreadCache * GetThreadCache(BOOL create)
+{
+	if (tlsIndex == TLS_OUT_OF_INDEXES) return NULL;
+
+	ThreadCache *tc = (ThreadCache *)TlsGetValue(tlsIndex);
+	if (tc == NULL && create) {
+		tc = new (std::nothrow) ThreadCache;
+		if (tc == NULL) return NULL;
+		memset(tc, 0, sizeof(ThreadCache));
+		TlsSetValue(tlsIndex, tc);
+	}
+	return tc;
+}
+
+
+
+// returns a block to the shared arena, or to the heap if the arena is full.
+static void ReleaseShared(PoolBlock *b)
+{
+	DWORD c = b->sizeClass;
+	BOOL  fKeep;
+
+	EnterCriticalSection(&arena[c].lock);
+	fKeep = (arenaLimit[c] == UNBOUNDED) || (arena[c].freeCount < arenaLimit[c]);
+	if (fKeep) {
+		b->next = arena[c].freeList;
+		arena[c].freeList = b;
+		arena[c].freeCount++;
+	}
+	LeaveCriticalSection(&arena[c].lock);
+
+	if (!fKeep) delete[] (BYTE *)b;
+}
+
+
+
+void BufferPool::init(void)
+{
+	if (InterlockedCompareExchange(&isInited, 1, 0) != 0) return;
+
+	for (DWORD c = 0; c < BUFFERPOOL_NUM_CLASSES; c++) {
+		InitializeCriticalSection(&arena[c].lock);
+		arena[c].freeList = NULL;
+		arena[c].freeCount = 0;
+	}
+	tlsIndex = TlsAlloc();
+}
+
+
+
+BYTE * BufferPool::alloc(DWORD cbRequested)
+{
+	PoolBlock *b = NULL;
+	DWORD c = ClassForSize(cbRequested);
+
+	if (c == OVERSIZE_CLASS) {
+		b = NewHeapBlock(OVERSIZE_CLASS, cbRequested);
+		return (b == NULL) ? NULL : (BYTE *)(b + 1);
+	}
+
+	// fast path: the calling thread's own cache, no lock
+	ThreadCache *tc = GetThreadCache(TRUE);
+	if (tc != NULL && tc->freeList[c] != NULL) {
+		b = tc->freeList[c];
+		tc->freeList[c] = b->next;
+		tc->freeCount[c]--;
+		return (BYTE *)(b + 1);
+	}
+
+	EnterCriticalSection(&arena[c].lock);
+	if (arena[c].freeList == NULL && c < NUM_SLAB_CLASSES)
+		NewSlab(c);
+	b = arena[c].freeList;
+	if (b != NULL) {
+		arena[c].freeList = b->next;
+		arena[c].freeCount--;
+	}
+	LeaveCriticalSection(&arena[c].lock);
+
+	if (b == NULL)
+		b = NewHeapBlock(c, classSize[c]);
+
+	return (b == NULL) ? NULL : (BYTE *)(b + 1);
+}
+
+
+
+void BufferPool::release(BYTE *pb)
+{
+	if (pb == NULL) return;
+
+	PoolBlock *b = ((PoolBlock *)pb) - 1;
+	DWORD c = b->sizeClass;
+
+	if (c == OVERSIZE_CLASS) {
+		delete[] (BYTE *)b;
+		return;
+	}
+
+	ThreadCache *tc = GetThreadCache(TRUE);
+	if (tc != NULL && tc->freeCount[c] < threadCacheLimit[c]) {
+		b->next = tc->freeList[c];
+		tc->freeList[c] = b;
+		tc->freeCount[c]++;
+		return;
+	}
+
+	ReleaseShared(b);
+}
+
+
+
+DWORD BufferPool::capacity(BYTE *pb)
+{
+	if (pb == NULL) return 0;
+	return (((PoolBlock *)pb) - 1)->capacity;
+}
+
+
+
+void BufferPool::threadDetach(void)
+{
+	ThreadCache *tc = GetThreadCache(FALSE);
+	if (tc == NULL) return;
+
+	for (DWORD c = 0; c < BUFFERPOOL_NUM_CLASSES; c++) {
+		while (tc->freeList[c] != NULL) {
+			PoolBlock *b = tc->freeList[c];
+			tc->freeList[c] = b->next;
+			ReleaseShared(b);
+		}
+	}
+
+	TlsSetValue(tlsIndex, NULL);
+	delete tc;
+}
@@ -0,0 +1,49 @@
+//
+// BufferPool.hpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This is an include for the BufferPool class, a size-class buffer
+// pool used for message bodies.
+//
+// ------------------------------------------------------------------
+
+// Size classes run from 1k to 4MB (the MSMQ message size limit), in
+// steps of 4x.  Requests larger than the biggest class are satisfied
+// directly from the heap, and freed back to it on release.
+#define BUFFERPOOL_NUM_CLASSES   7
+#define BUFFERPOOL_MIN_SIZE      1024
+
+class BufferPool
+{
+public:
+
+	// to be called once, before any other method
+	static void  init(void);
+
+	// returns a buffer of at least cbRequested bytes, or NULL
+	static BYTE *alloc(DWORD cbRequested);
+
+	// returns a buffer obtained from alloc() to the pool.  NULL is ok.
+	static void  release(BYTE *pb);
+
+	// the usable size of a buffer obtained from alloc()
+	static DWORD capacity(BYTE *pb);
+
+	// flushes the calling thread's cache back to the shared arena.
+	// Called from DllMain on DLL_THREAD_DETACH.
+	static void  threadDetach(void);
+};
@@ -0,0 +1,307 @@
+//
+// CaptureLog.cpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module writes received messages to a capture file, and reads
+// them back, for MsmqReplay to send again.
+//
+// The file is created at its full size and mapped into memory, and
+// records are appended to the view; it is truncated to what was
+// written when the capture stops.  The header holds the wall-clock
+// time the capture started, and each record the microseconds since
+// then, so that a replay can keep the original pace.
+//
+// A record is a 32-byte header, then the label, correlation ID and
+// body, padded to 8 bytes.  The header keeps the record count of a
+// batch, so that it is replayed as one.  As in the outbox, the magic number of the
+// header is written last, and covers a CRC-32C of the rest, so that a
+// reader stops at a record torn by a crash.
+//
+// ------------------------------------------------------------------
+
+#include <stdio.h>
+#include <WTypes.h>   // reqd for WinBase.h
+#include <WinBase.h>  // for CriticalSection
+#include <MqOai.h>
+#include <mq.h>
+
+#include "Log.hpp"
+#include "Crc32c.hpp"
+#include "CaptureLog.hpp"
+
+
+#define CAPTURE_FILE_MAGIC      0x5043514D   // "MQCP"
+#define CAPTURE_RECORD_MAGIC    0x5243514D   // "MQCR"
+#define CAPTURE_VERSION         2   // 1 had no record count
+
+#define CAPTURE_ALIGN(n)        (((n) + 7) & ~7)
+
+
+struct CaptureFileHeader
+{
+	DWORD           magic;
+	DWORD           version;
+	FILETIME        ftStart;
+	DWORD           reserved[4];
+};
+
+
+struct CaptureRecordHeader
+{
+	volatile DWORD  magic;          // written last
+	DWORD           crc;            // of the rest of the header, and the data
+	LONGLONG        llMicros;
+	DWORD           cbBody;
+	WORD            cchLabel;       // without a terminator
+	BYTE            cbCorrelationId;
+	BYTE            priority;
+	DWORD           cBatchRecords;  // 0 if not a batch
+	DWORD           reserved;
+};
+
+
+// the size of a record, or 0 if it does not fit in cbRoom, as when a
+// torn header has a wild length
+static DWORD RecordSize(const CaptureRecordHeader *r, ULONGLONG cbRoom)
+{
+	ULONGLONG cb = (ULONGLONG)sizeof(CaptureRecordHeader)
+		+ (ULONGLONG)r->cchLabel * sizeof(WCHAR)
+		+ r->cbCorrelationId
+		+ r->cbBody;
+	cb = CAPTURE_ALIGN(cb);
+	return (cb > cbRoom) ? 0 : (DWORD)cb;
+}
+
+
+
+// only for a record RecordSize found to fit
+static DWORD RecordCrc(const CaptureRecordHeader *r)
+{
+	DWORD cb = r->cchLabel * sizeof(WCHAR) + r->cbCorrelationId + r->cbBody;
+	DWORD crc = Crc32c::compute(0, (const BYTE *)&r->llMicros,
+		sizeof(CaptureRecordHeader) - FIELD_OFFSET(CaptureRecordHeader, llMicros));
+	return Crc32c::compute(crc, (const BYTE *)(r + 1), cb);
+}
+
+
+
+CaptureLog::CaptureLog()
+{
+	hFile = NULL;
+	hMapping = NULL;
+	pBase = NULL;
+	cbSize = 0;
+	cbWritten = 0;
+	cCaptured = 0;
+	cDropped = 0;
+	wszPath[0] = L'\0';
+}
+
+
+
+CaptureLog::~CaptureLog()
+{
+	if (pBase != NULL) UnmapViewOfFile(pBase);
+	if (hMapping != NULL) CloseHandle(hMapping);
+	if (hFile != NULL) {
+		LARGE_INTEGER end;
+		end.QuadPart = cbWritten;
+		if (!SetFilePointerEx(hFile, end, NULL, FILE_BEGIN) || !SetEndOfFile(hFile))
+			LOG_WARN("Capture: cannot truncate %ls (error %lu)", wszPath, GetLastError());
+		CloseHandle(hFile);
+		LOG_INFO("Capture: %ld messages to %ls, %ld dropped", cCaptured, wszPath, cDropped);
+	}
+}
+
+
+
+HRESULT CaptureLog::create(const WCHAR *wszFile, DWORD cbMax)
+{
+	if (wszFile == NULL || wszFile[0] == L'\0')
+		return MQ_ERROR_INVALID_PARAMETER;
+	if (cbMax < MQJ_CAPTURE_MIN_SIZE) cbMax = MQJ_CAPTURE_MIN_SIZE;
+
+	wcsncpy_s(wszPath, MAX_PATH, wszFile, _TRUNCATE);
+	cbSize = CAPTURE_ALIGN(cbMax);
+
+	hFile = CreateFileW(wszPath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE) {
+		hFile = NULL;
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	// mapping the new file extends it, with zeros
+	hMapping = CreateFileMappingW(hFile, NULL, PAGE_READWRITE, 0, cbSize, NULL);
+	if (hMapping == NULL)
+		return HRESULT_FROM_WIN32(GetLastError());
+	pBase = (BYTE *)MapViewOfFile(hMapping, FILE_MAP_WRITE, 0, 0, cbSize);
+	if (pBase == NULL)
+		return HRESULT_FROM_WIN32(GetLastError());
+
+	CaptureFileHeader *h = (CaptureFileHeader *)pBase;
+	h->magic = CAPTURE_FILE_MAGIC;
+	h->version = CAPTURE_VERSION;
+	GetSystemTimeAsFileTime(&h->ftStart);
+	cbWritten = sizeof(CaptureFileHeader);
+
+	QueryPerformanceFrequency(&liFrequency);
+	QueryPerformanceCounter(&liStart);
+	return MQ_OK;
+}
+
+
+
+BOOL CaptureLog::append(const BYTE *pbBody, DWORD cbBody, const WCHAR *wszLabel,
+	const BYTE *pCorrelationId, DWORD cbCorrelationId, int iPriority,
+	DWORD cBatchRecords)
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	LONGLONG ticks = now.QuadPart - liStart.QuadPart;
+
+	CaptureRecordHeader h;
+	h.llMicros = (ticks / liFrequency.QuadPart) * 1000000
+		+ (ticks % liFrequency.QuadPart) * 1000000 / liFrequency.QuadPart;
+	h.cbBody = (pbBody != NULL) ? cbBody : 0;
+	h.cchLabel = (wszLabel != NULL) ? (WORD)wcsnlen(wszLabel, MQ_MAX_MSG_LABEL_LEN) : 0;
+	h.cbCorrelationId = (pCorrelationId != NULL) ? (BYTE)min(cbCorrelationId, PROPID_M_CORRELATIONID_SIZE) : 0;
+	h.priority = (BYTE)iPriority;
+	h.cBatchRecords = cBatchRecords;
+	h.reserved = 0;
+
+	DWORD cbRecord = RecordSize(&h, cbSize - cbWritten);
+	if (cbRecord == 0) {
+		if (cDropped++ == 0)
+			LOG_WARN("Capture: %ls is full; later messages are not captured", wszPath);
+		return FALSE;
+	}
+
+	CaptureRecordHeader *r = (CaptureRecordHeader *)(pBase + cbWritten);
+	BYTE *p = (BYTE *)(r + 1);
+
+	memcpy(r, &h, sizeof(h));
+	r->magic = 0;
+	memcpy(p, wszLabel, h.cchLabel * sizeof(WCHAR));
+	p += h.cchLabel * sizeof(WCHAR);
+	memcpy(p, pCorrelationId, h.cbCorrelationId);
+	p += h.cbCorrelationId;
+	memcpy(p, pbBody, h.cbBody);
+	r->crc = RecordCrc(r);
+
+	MemoryBarrier();
+	r->magic = CAPTURE_RECORD_MAGIC;
+
+	cbWritten += cbRecord;
+	cCaptured++;
+	return TRUE;
+}
+
+
+
+CaptureReader::CaptureReader()
+{
+	hFile = NULL;
+	hMapping = NULL;
+	pBase = NULL;
+	cbSize = 0;
+	cbRead = 0;
+}
+
+
+
+CaptureReader::~CaptureReader()
+{
+	if (pBase != NULL) UnmapViewOfFile(pBase);
+	if (hMapping != NULL) CloseHandle(hMapping);
+	if (hFile != NULL) CloseHandle(hFile);
+}
+
+
+
+HRESULT CaptureReader::open(const WCHAR *wszPath)
+{
+	// shared for write: a capture still running can be replayed as far
+	// as it has got
+	hFile = CreateFileW(wszPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE) {
+		hFile = NULL;
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(hFile, &size))
+		return HRESULT_FROM_WIN32(GetLastError());
+	if (size.QuadPart < (LONGLONG)sizeof(CaptureFileHeader) || size.QuadPart > 0x7FFFFFFF)
+		return MQ_ERROR_INVALID_PARAMETER;
+	cbSize = (DWORD)size.QuadPart;
+
+	hMapping = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (hMapping == NULL)
+		return HRESULT_FROM_WIN32(GetLastError());
+	pBase = (BYTE *)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, cbSize);
+	if (pBase == NULL)
+		return HRESULT_FROM_WIN32(GetLastError());
+
+	const CaptureFileHeader *h = (const CaptureFileHeader *)pBase;
+	if (h->magic != CAPTURE_FILE_MAGIC || h->version != CAPTURE_VERSION)
+		return MQ_ERROR_INVALID_PARAMETER;
+
+	cbRead = sizeof(CaptureFileHeader);
+	return MQ_OK;
+}
+
+
+
+FILETIME CaptureReader::started()
+{
+	return ((const CaptureFileHeader *)pBase)->ftStart;
+}
+
+
+
+BOOL CaptureReader::next(CaptureRecord *pRecord)
+{
+	if ((ULONGLONG)cbRead + sizeof(CaptureRecordHeader) > cbSize)
+		return FALSE;
+
+	const CaptureRecordHeader *r = (const CaptureRecordHeader *)(pBase + cbRead);
+	if (r->magic != CAPTURE_RECORD_MAGIC)
+		return FALSE;
+	DWORD cbRecord = RecordSize(r, cbSize - cbRead);
+	if (cbRecord == 0 || RecordCrc(r) != r->crc) {
+		LOG_WARN("Capture: torn record at %lu", cbRead);
+		return FALSE;
+	}
+
+	const BYTE *p = (const BYTE *)(r + 1);
+	pRecord->llMicros = r->llMicros;
+	pRecord->pwchLabel = (const WCHAR *)p;
+	pRecord->cchLabel = r->cchLabel;
+	p += r->cchLabel * sizeof(WCHAR);
+	pRecord->pCorrelationId = (r->cbCorrelationId > 0) ? p : NULL;
+	pRecord->cbCorrelationId = r->cbCorrelationId;
+	p += r->cbCorrelationId;
+	pRecord->pbBody = p;
+	pRecord->cbBody = r->cbBody;
+	pRecord->iPriority = r->priority;
+	pRecord->cBatchRecords = r->cBatchRecords;
+
+	cbRead += cbRecord;
+	return TRUE;
+}
@@ -0,0 +1,102 @@
+//
+// CaptureLog.hpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This is an include for the CaptureLog and CaptureReader classes,
+// which write and read a file of received messages, to be replayed.
+//
+// ------------------------------------------------------------------
+
+#define MQJ_CAPTURE_DEFAULT_SIZE        (256 * 1024 * 1024)
+#define MQJ_CAPTURE_MIN_SIZE            (4 * 1024 * 1024 + 64 * 1024)   // fits the largest MSMQ message
+
+
+// a message read back from a capture file.  The pointers are into the
+// mapped file, and the label is not terminated.
+struct CaptureRecord
+{
+	LONGLONG        llMicros;           // since the capture started
+	const WCHAR     *pwchLabel;
+	DWORD           cchLabel;
+	const BYTE      *pCorrelationId;    // NULL if not captured
+	DWORD           cbCorrelationId;
+	const BYTE      *pbBody;
+	DWORD           cbBody;
+	int             iPriority;
+	DWORD           cBatchRecords;      // 0 if not a batch
+};
+
+
+class CaptureLog
+{
+private:
+	HANDLE          hFile;
+	HANDLE          hMapping;
+	BYTE            *pBase;
+	DWORD           cbSize;
+	DWORD           cbWritten;
+	LARGE_INTEGER   liStart;            // QueryPerformanceCounter
+	LARGE_INTEGER   liFrequency;
+	LONG            cCaptured;
+	LONG            cDropped;           // did not fit
+	WCHAR           wszPath[MAX_PATH];
+
+public:
+	CaptureLog();
+
+	// unmaps the file, and truncates it to the records written
+	~CaptureLog();
+
+	// creates the file at wszPath, replacing any, with room for cbMax
+	// bytes of records
+	HRESULT create(const WCHAR *wszPath, DWORD cbMax);
+
+	// Appends a message, stamped with the time since create().  A batch
+	// has its cBatchRecords records in the body, framed by BatchEnvelope.
+	// Returns FALSE if the file is full; the message is dropped and
+	// counted.  Not thread-safe: the caller serializes appends.
+	BOOL append(const BYTE *pbBody, DWORD cbBody, const WCHAR *wszLabel,
+		const BYTE *pCorrelationId, DWORD cbCorrelationId, int iPriority,
+		DWORD cBatchRecords);
+
+	LONG captured(void) { return cCaptured; }
+	LONG dropped(void) { return cDropped; }
+};
+
+
+class CaptureReader
+{
+private:
+	HANDLE          hFile;
+	HANDLE          hMapping;
+	BYTE            *pBase;
+	DWORD           cbSize;
+	DWORD           cbRead;
+
+public:
+	CaptureReader();
+	~CaptureReader();
+
+	HRESULT open(const WCHAR *wszPath);
+
+	// the wall-clock time the capture started
+	FILETIME started(void);
+
+	// Reads the next record.  Returns FALSE at the end of the file, or
+	// at a record torn by a crash of the capturing process.
+	BOOL next(CaptureRecord *pRecord);
+};
@@ -0,0 +1,258 @@
+//
+// Crc32c.cpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module computes CRC-32C (Castagnoli, polynomial 0x1EDC6F41),
+// the checksum used by iSCSI and ext4.
+//
+// On processors with SSE4.2 it uses the crc32 instruction, 8 bytes at
+// a time on x64.  The instruction has a latency of 3 cycles but can
+// start one every cycle, so long buffers are cut into three lanes that
+// are computed at once, and the lane CRCs are then combined.  Elsewhere
+// it uses tables, 8 bytes at a time ("slicing by 8").  Both give the
+// same result, so a checksum made on one machine can be checked on
+// another.
+//
+// ------------------------------------------------------------------
+
+#include <string.h>
+#include <WTypes.h>
+#include <WinBase.h>
+#include <intrin.h>     // __cpuid
+#include <nmmintrin.h>  // SSE4.2
+
+#include "Crc32c.hpp"
+
+
+#define CRC32C_POLY_REFLECTED 0x82F63B78
+
+// the lane lengths of the hardware path; a buffer is cut into three
+// long lanes while it can be, then into three short ones
+#define LANE_LONG             8192
+#define LANE_SHORT            256
+
+#if defined(_M_X64) || defined(__x86_64__)
+typedef unsigned __int64 CRC_WORD;
+#define CRC_STEP(crc, pb)     _mm_crc32_u64(crc, *(const unsigned __int64 *)(pb))
+#else
+typedef unsigned int CRC_WORD;
+#define CRC_STEP(crc, pb)     _mm_crc32_u32(crc, *(const DWORD *)(pb))
+#endif
+
+
+// table[k][b] is the CRC of byte b followed by k zero bytes
+static DWORD table[8][256];
+
+// shiftLong[k][b] is the CRC register after byte k of the register holds
+// b, and LANE_LONG zero bytes follow; likewise shiftShort
+static DWORD shiftLong[4][256];
+static DWORD shiftShort[4][256];
+
+static BOOL fHardware = FALSE;
+
+
+
+// The product of the 32x32 GF(2) matrix mat and vec.
+static DWORD MatrixTimes(const DWORD *mat, DWORD vec)
+{
+	DWORD sum = 0;
+	for (; vec != 0; vec >>= 1, mat++) {
+		if (vec & 1) sum ^= *mat;
+	}
+	return sum;
+}
+
+
+
+static void MatrixSquare(DWORD *square, const DWORD *mat)
+{
+	for (int n = 0; n < 32; n++)
+		square[n] = MatrixTimes(mat, mat[n]);
+}
+
+
+
+// Fills shift[][] for feeding cbZeros zero bytes to the CRC register.
+// The operator for one zero bit is squared up to one byte, and then
+// once more for each bit of cbZeros, which must be a power of two.
+static void InitShift(DWORD shift[4][256], DWORD cbZeros)
+{
+	DWORD odd[32], even[32];
+	odd[0] = CRC32C_POLY_REFLECTED;
+	for (int n = 1; n < 32; n++)
+		odd[n] = 1u << (n - 1);
+
+	MatrixSquare(even, odd);    // 2 bits
+	MatrixSquare(odd, even);    // 4 bits
+	MatrixSquare(even, odd);    // 1 byte
+	for (; cbZeros > 1; cbZeros >>= 1) {
+		MatrixSquare(odd, even);
+		memcpy(even, odd, sizeof(even));
+	}
+
+	for (DWORD b = 0; b < 256; b++) {
+		shift[0][b] = MatrixTimes(even, b);
+		shift[1][b] = MatrixTimes(even, b << 8);
+		shift[2][b] = MatrixTimes(even, b << 16);
+		shift[3][b] = MatrixTimes(even, b << 24);
+	}
+}
+
+
+
+static DWORD Shift(DWORD shift[4][256], DWORD crc)
+{
+	return shift[0][crc & 0xFF] ^ shift[1][(crc >> 8) & 0xFF]
+		^ shift[2][(crc >> 16) & 0xFF] ^ shift[3][crc >> 24];
+}
+
+
+
+void Crc32c::init()
+{
+	for (DWORD i = 0; i < 256; i++) {
+		DWORD c = i;
+		for (int k = 0; k < 8; k++)
+			c = (c & 1) ? (c >> 1) ^ CRC32C_POLY_REFLECTED : (c >> 1);
+		table[0][i] = c;
+	}
+	for (DWORD i = 0; i < 256; i++) {
+		for (int k = 1; k < 8; k++)
+			table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+	}
+
+	InitShift(shiftLong, LANE_LONG);
+	InitShift(shiftShort, LANE_SHORT);
+
+	int info[4];
+	__cpuid(info, 1);
+	fHardware = (info[2] & (1 << 20)) != 0;   // ECX bit 20: SSE4.2
+}
+
+
+
+BOOL Crc32c::isHardware()
+{
+	return fHardware;
+}
+
+
+
+static DWORD ComputeTable(DWORD crc, const BYTE *pb, DWORD cb)
+{
+	while (cb > 0 && ((ULONG_PTR)pb & 7) != 0) {
+		crc = table[0][(crc ^ *pb++) & 0xFF] ^ (crc >> 8);
+		cb--;
+	}
+
+	while (cb >= 8) {
+		DWORD lo, hi;
+		memcpy(&lo, pb, sizeof(DWORD));
+		memcpy(&hi, pb + 4, sizeof(DWORD));
+		lo ^= crc;
+		crc = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF]
+			^ table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24]
+			^ table[3][hi & 0xFF] ^ table[2][(hi >> 8) & 0xFF]
+			^ table[1][(hi >> 16) & 0xFF] ^ table[0][hi >> 24];
+		pb += 8;
+		cb -= 8;
+	}
+
+	while (cb-- > 0)
+		crc = table[0][(crc ^ *pb++) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+
+
+// Runs the crc32 instruction over three lanes of cbLane bytes at once,
+// for as long as *pcb holds three of them.  The second and third lanes
+// start from 0; the CRC of the first is then shifted over the second
+// and the second's folded in, and so on with the third.
+static DWORD ComputeLanes(DWORD crc, const BYTE **ppb, DWORD *pcb,
+	DWORD cbLane,
+	DWORD shift[4][256])
+{
+	while (*pcb >= 3 * cbLane) {
+		const BYTE *pb = *ppb;
+		const BYTE *pbEnd = pb + cbLane;
+		CRC_WORD crc0 = crc;
+		CRC_WORD crc1 = 0;
+		CRC_WORD crc2 = 0;
+		do {
+			crc0 = CRC_STEP(crc0, pb);
+			crc1 = CRC_STEP(crc1, pb + cbLane);
+			crc2 = CRC_STEP(crc2, pb + 2 * cbLane);
+			pb += sizeof(CRC_WORD);
+		} while (pb < pbEnd);
+
+		crc = Shift(shift, (DWORD)crc0) ^ (DWORD)crc1;
+		crc = Shift(shift, crc) ^ (DWORD)crc2;
+		*ppb += 3 * cbLane;
+		*pcb -= 3 * cbLane;
+	}
+	return crc;
+}
+
+
+
+static DWORD ComputeHardware(DWORD crc, const BYTE *pb, DWORD cb)
+{
+	while (cb > 0 && ((ULONG_PTR)pb & 7) != 0) {
+		crc = _mm_crc32_u8(crc, *pb++);
+		cb--;
+	}
+
+	crc = ComputeLanes(crc, &pb, &cb, LANE_LONG, shiftLong);
+	crc = ComputeLanes(crc, &pb, &cb, LANE_SHORT, shiftShort);
+
+#if defined(_M_X64) || defined(__x86_64__)
+	unsigned __int64 crc64 = crc;
+	while (cb >= 8) {
+		crc64 = _mm_crc32_u64(crc64, *(const unsigned __int64 *)pb);
+		pb += 8;
+		cb -= 8;
+	}
+	crc = (DWORD)crc64;
+#endif
+
+	while (cb >= 4) {
+		crc = _mm_crc32_u32(crc, *(const DWORD *)pb);
+		pb += 4;
+		cb -= 4;
+	}
+
+	while (cb-- > 0)
+		crc = _mm_crc32_u8(crc, *pb++);
+	return crc;
+}
+
+
+
+DWORD Crc32c::compute(DWORD crc, const BYTE *pb, DWORD cb)
+{
+	crc = ~crc;
+	crc = fHardware ? ComputeHardware(crc, pb, cb) : ComputeTable(crc, pb, cb);
+	return ~crc;
+}
+
+
+
+DWORD Crc32c::computeTable(DWORD crc, const BYTE *pb, DWORD cb)
+{
+	return ~ComputeTable(~crc, pb, cb);
+}
@@ -0,0 +1,37 @@
+//
+// Crc32c.hpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This is an include for the CRC-32C (Castagnoli) checksum.
+//
+// ------------------------------------------------------------------
+
+class Crc32c
+{
+public:
+	// to be called once, before compute()
+	static void init(void);
+
+	// the CRC-32C of cb bytes at pb, continuing from crc; start with 0
+	static DWORD compute(DWORD crc, const BYTE *pb, DWORD cb);
+
+	// the same as compute(), always with the tables; for comparing speeds
+	static DWORD computeTable(DWORD crc, const BYTE *pb, DWORD cb);
+
+	// whether compute() uses the SSE4.2 crc32 instruction
+	static BOOL isHardware(void);
+};
@@ -0,0 +1,202 @@
+//
+// DedupWindow.cpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module keeps a window over the IDs of recently received
+// messages, so that redelivered duplicates can be dropped.
+//
+// The window holds 64-bit fingerprints of the 20-byte message IDs, in
+// a ring that evicts the oldest, indexed by a linear-probing hash set
+// at most half full.  Memory is fixed at 24 bytes per remembered ID.
+// Two distinct IDs share a fingerprint with odds of about one in
+// 2^64 / capacity, which is ignored.
+//
+// ------------------------------------------------------------------
+
+#include <new>
+#include <string.h>
+#include <WTypes.h>   // reqd for WinBase.h
+#include <WinBase.h>  // for CriticalSection
+#include <MqOai.h>
+#include <mq.h>
+
+#include "DedupWindow.hpp"
+
+
+// FNV-1a, then a final avalanche so that the low bits can index the
+// table.  0 marks an empty slot, so it is never returned.
+static ULONGLONG Fingerprint(const BYTE *pMessageId)
+{
+	ULONGLONG h = 14695981039346656037ULL;
+	for (int i = 0; i < PROPID_M_MSGID_SIZE; i++) {
+		h ^= pMessageId[i];
+		h *= 1099511628211ULL;
+	}
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	return (h == 0) ? 1 : h;
+}
+
+
+
+DedupWindow::DedupWindow()
+{
+	InitializeCriticalSection(&lock);
+	capacity = 0;
+	ring = NULL;
+	table = NULL;
+	head = 0;
+	count = 0;
+	mask = 0;
+}
+
+
+
+DedupWindow::~DedupWindow()
+{
+	delete[] ring;
+	delete[] table;
+	DeleteCriticalSection(&lock);
+}
+
+
+
+HRESULT DedupWindow::resize(DWORD dwCapacity)
+{
+	if (dwCapacity > DEDUP_MAX_CAPACITY)
+		return MQ_ERROR_INVALID_PARAMETER;
+
+	ULONGLONG *newRing = NULL;
+	ULONGLONG *newTable = NULL;
+	DWORD tableSize = 0;
+
+	if (dwCapacity > 0) {
+		tableSize = 2;
+		while (tableSize < 2 * dwCapacity)
+			tableSize <<= 1;
+		newRing = new (std::nothrow) ULONGLONG[dwCapacity];
+		newTable = new (std::nothrow) ULONGLONG[tableSize];
+		if (newRing == NULL || newTable == NULL) {
+			delete[] newRing;
+			delete[] newTable;
+			return MQ_ERROR_INSUFFICIENT_RESOURCES;
+		}
+		memset(newTable, 0, tableSize * sizeof(ULONGLONG));
+	}
+
+	EnterCriticalSection(&lock);
+	ULONGLONG *oldRing = ring;
+	ULONGLONG *oldTable = table;
+	ring = newRing;
+	table = newTable;
+	capacity = dwCapacity;
+	mask = tableSize - 1;
+	head = 0;
+	count = 0;
+	LeaveCriticalSection(&lock);
+
+	delete[] oldRing;
+	delete[] oldTable;
+	return MQ_OK;
+}
+
+
+
+// caller holds lock
+BOOL DedupWindow::contains(ULONGLONG fp)
+{
+	for (DWORD i = (DWORD)fp & mask; table[i] != 0; i = (i + 1) & mask) {
+		if (table[i] == fp)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+
+
+// caller holds lock
+void DedupWindow::insert(ULONGLONG fp)
+{
+	DWORD i = (DWORD)fp & mask;
+	while (table[i] != 0)
+		i = (i + 1) & mask;
+	table[i] = fp;
+}
+
+
+
+// caller holds lock.  Deletes by shifting later members of the probe
+// run back, so that no tombstones are needed.
+void DedupWindow::erase(ULONGLONG fp)
+{
+	DWORD i = (DWORD)fp & mask;
+	while (table[i] != fp) {
+		if (table[i] == 0) return;
+		i = (i + 1) & mask;
+	}
+
+	DWORD j = i;
+	for (;;) {
+		j = (j + 1) & mask;
+		if (table[j] == 0)
+			break;
+		// leave table[j] if its home slot lies cyclically in (i, j]
+		DWORD k = (DWORD)table[j] & mask;
+		if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		table[i] = table[j];
+		i = j;
+	}
+	table[i] = 0;
+}
+
+
+
+BOOL DedupWindow::checkAndAdd(const BYTE *pMessageId)
+{
+	if (capacity == 0)
+		return FALSE;
+
+	ULONGLONG fp = Fingerprint(pMessageId);
+	BOOL fSeen = FALSE;
+
+	EnterCriticalSection(&lock);
+	if (capacity == 0) {
+		// disabled meanwhile
+	}
+	else if (contains(fp)) {
+		fSeen = TRUE;
+	}
+	else {
+		DWORD slot;
+		if (count == capacity) {
+			erase(ring[head]);
+			slot = head;
+			head = (head + 1) % capacity;
+		}
+		else {
+			slot = (head + count) % capacity;
+			count++;
+		}
+		ring[slot] = fp;
+		insert(fp);
+	}
+	LeaveCriticalSection(&lock);
+
+	return fSeen;
+}
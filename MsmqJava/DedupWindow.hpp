@@ -0,0 +1,53 @@
+//
+// DedupWindow.hpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This is an include for the DedupWindow class, which remembers the
+// IDs of the most recently received messages.
+//
+// ------------------------------------------------------------------
+
+#define DEDUP_MAX_CAPACITY     (1024 * 1024)
+
+
+class DedupWindow
+{
+private:
+	CRITICAL_SECTION  lock;
+	DWORD             capacity;    // IDs remembered; 0 when disabled
+	ULONGLONG         *ring;       // fingerprints, oldest at head
+	DWORD             head;
+	DWORD             count;
+	ULONGLONG         *table;      // open-addressed set over the ring
+	DWORD             mask;
+
+	BOOL contains(ULONGLONG fp);
+	void insert(ULONGLONG fp);
+	void erase(ULONGLONG fp);
+
+public:
+	DedupWindow();
+	~DedupWindow();
+
+	// sets the number of IDs to remember, forgetting those seen so
+	// far.  0 disables the window.
+	HRESULT resize(DWORD dwCapacity);
+
+	// returns TRUE if the message ID is in the window.  Otherwise adds
+	// it, evicting the oldest if the window is full, and returns FALSE.
+	BOOL checkAndAdd(const BYTE *pMessageId);
+};
@@ -0,0 +1,321 @@
+//
+// FairConsumer.java
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module consumes from a set of weighted Queues with a pool of
+// worker threads.
+//
+// ------------------------------------------------------------------
+
+package ionic.Msmq;
+
+
+/**
+ * <p>A FairConsumer receives from a set of queues with a pool of
+ * worker threads, sharing the workers among the queues in proportion
+ * to their weights.</p>
+ *
+ * <blockquote class='code'><pre>
+ *   FairConsumer consumer= new FairConsumer();
+ *   consumer.addQueue(orders, 4);
+ *   consumer.addQueue(reports, 1);
+ *   consumer.start(new FairConsumer.MessageHandler() {
+ *           public void onMessage(Queue q, Message msg) { ... }
+ *       }, 8);
+ *   ...
+ *   consumer.stop();
+ * </pre></blockquote>
+ *
+ * <p>Queues are served in deficit round-robin order: while both queues
+ * above have messages, four messages are taken from <tt>orders</tt> for
+ * each one from <tt>reports</tt>. A queue with no messages does not use
+ * up its share, and is not polled; it rejoins the round when a message
+ * arrives. Within a queue, MSMQ delivers messages of higher priority
+ * first; see {@link Message#setPriority(int)}.</p>
+ *
+ * <p>The queues must be open for RECEIVE access. Like a {@link
+ * QueueSelector}, a FairConsumer binds the receive handles of its
+ * queues, so a queue can be added to only one FairConsumer or
+ * QueueSelector during its lifetime.</p>
+ *
+ */
+public class FairConsumer
+{
+    /**
+     * Receives the messages taken by a FairConsumer. It is called on
+     * the worker threads, concurrently.
+     */
+    public interface MessageHandler
+    {
+        void onMessage(Queue queue, Message msg);
+    }
+
+
+    /**
+     * Create a consumer, with no queues.
+     *
+     **/
+    public FairConsumer()
+        throws  MessageQueueException
+    {
+        int rc= nativeCreate();
+        if (rc!=0)
+            throw new MessageQueueException("Cannot create consumer.", rc);
+    }
+
+
+    /**
+     * <p>Add a queue, or change the weight of a queue already added.
+     * Queues can be added before or after {@link #start}.</p>
+     *
+     * @param queue   a queue open for RECEIVE access.
+     * @param weight  the number of messages taken from the queue in each
+     *                round, at least 1.
+     **/
+    public void addQueue(Queue queue, int weight)
+        throws  MessageQueueException
+    {
+        if (weight < 1)
+            throw new IllegalArgumentException("weight must be at least 1");
+        long handle= _acquire();
+        try {
+            synchronized (_queues) {
+                int rc= nativeAdd(handle, queue, weight);
+                if (rc!=0)
+                    throw new MessageQueueException("Cannot add queue.", rc);
+                _queues.put(queue._queueSlot, queue);
+            }
+        }
+        finally {
+            _release();
+        }
+    }
+
+
+    /**
+     * Stop receiving from a queue.
+     *
+     **/
+    public void removeQueue(Queue queue)
+        throws  MessageQueueException
+    {
+        long handle= _acquire();
+        try {
+            synchronized (_queues) {
+                _queues.remove(queue._queueSlot);
+                int rc= nativeRemove(handle, queue, queue._queueSlot);
+                if (rc!=0)
+                    throw new MessageQueueException("Cannot remove queue.", rc);
+            }
+        }
+        finally {
+            _release();
+        }
+    }
+
+
+    /**
+     * <p>Start the worker threads. Each worker receives a message from
+     * the queue whose turn it is, and passes it to the handler. A
+     * RuntimeException thrown by the handler goes to the worker
+     * thread's uncaught exception handler, and the worker carries
+     * on.</p>
+     *
+     * @param handler  called with each message received.
+     * @param workers  the number of worker threads.
+     **/
+    public synchronized void start(final MessageHandler handler, int workers)
+        throws  MessageQueueException
+    {
+        if (_closed)
+            throw new MessageQueueException("Consumer is closed.", 0xC00E0007); // MQ_ERROR_INVALID_HANDLE
+        if (_workers != null)
+            throw new IllegalStateException("Consumer already started.");
+        if (workers < 1)
+            throw new IllegalArgumentException("workers must be at least 1");
+
+        _workers= new Thread[workers];
+        for (int i=0; i < workers; i++) {
+            _workers[i]= new Thread("MsmqJava fair consumer " + i) {
+                    public void run() { _work(handler); }
+                };
+            _workers[i].setDaemon(true);
+            _workers[i].start();
+        }
+    }
+
+
+    /**
+     * <p>Stop the consumer, and wait for the workers to finish the
+     * messages they are handling. The consumer cannot be started
+     * again.</p>
+     *
+     * @throws MessageQueueException if a worker stopped early because
+     *         it could not receive.
+     **/
+    public void stop()
+        throws  MessageQueueException
+    {
+        Thread[] workers;
+        synchronized (this) {
+            workers= _workers;
+            if (!_closed) {
+                _closed= true;
+                nativeClose(_handle, _users);
+                if (_users == 0) {
+                    nativeDestroy(_handle);
+                    _handle= 0;
+                }
+            }
+        }
+
+        if (workers != null) {
+            for (Thread t : workers) {
+                if (t == Thread.currentThread()) continue;
+                try { t.join(); }
+                catch (InterruptedException ex1) {
+                    Thread.currentThread().interrupt();
+                    break;
+                }
+            }
+        }
+        synchronized (_queues) { _queues.clear(); }
+
+        MessageQueueException failure;
+        synchronized (this) { failure= _failure; }
+        if (failure != null) throw failure;
+    }
+
+
+    private void _work(MessageHandler handler)
+    {
+        for (;;) {
+            long handle;
+            int slot;
+            try {
+                handle= _acquire();
+            }
+            catch (MessageQueueException ex1) {
+                return;  // stopped
+            }
+            try {
+                slot= nativeNext(handle, -1);
+            }
+            finally {
+                _release();
+            }
+
+            if (slot < 0) {
+                if (slot == Queue.MQ_ERROR_IO_TIMEOUT) continue;
+                synchronized (this) {
+                    if (!_closed && _failure == null)
+                        _failure= new MessageQueueException("Cannot select.", slot);
+                }
+                return;
+            }
+
+            Queue q;
+            synchronized (_queues) { q= _queues.get(slot); }
+            if (q == null) continue;  // removed
+
+            Message msg;
+            try {
+                msg= q.tryReceive(0);
+            }
+            catch (MessageQueueException ex1) {
+                // the queue is dropped from the round, and comes back
+                // if the selector reports it again
+                msg= null;
+            }
+            if (msg == null) {
+                // empty, or taken by another worker
+                try {
+                    handle= _acquire();
+                }
+                catch (MessageQueueException ex2) {
+                    return;
+                }
+                try {
+                    nativeDrained(handle, slot);
+                }
+                finally {
+                    _release();
+                }
+                continue;
+            }
+
+            try {
+                handler.onMessage(q, msg);
+            }
+            catch (RuntimeException ex1) {
+                Thread t= Thread.currentThread();
+                t.getUncaughtExceptionHandler().uncaughtException(t, ex1);
+            }
+        }
+    }
+
+
+    // The native scheduler is destroyed by the last user out after
+    // stop(), as for the QueueSelector.
+    private synchronized long _acquire()
+        throws  MessageQueueException
+    {
+        if (_closed)
+            throw new MessageQueueException("Consumer is closed.", 0xC00E0007); // MQ_ERROR_INVALID_HANDLE
+        _users++;
+        return _handle;
+    }
+
+    private synchronized void _release()
+    {
+        if (--_users == 0 && _closed) {
+            nativeDestroy(_handle);
+            _handle= 0;
+        }
+    }
+
+
+
+    // --------------------------------------------
+    // native methods
+    private native int nativeCreate();
+    private static native int nativeAdd(long handle, Queue queue, int weight);
+    private static native int nativeRemove(long handle, Queue queue, int slot);
+    private static native int nativeNext(long handle, int timeout);
+    private static native void nativeDrained(long handle, int slot);
+    private static native void nativeClose(long handle, int waiters);
+    private static native void nativeDestroy(long handle);
+
+
+    // --------------------------------------------
+    // private members
+    long _handle = 0;  // the native FairScheduler pointer
+    private int _users = 0;
+    private boolean _closed = false;
+    private Thread[] _workers;
+    private MessageQueueException _failure;
+    private java.util.Map<Integer, Queue> _queues = new java.util.HashMap<Integer, Queue>();
+
+    // --------------------------------------------
+    // static initializer
+    static {
+        System.loadLibrary("MsmqJava");
+        // the native layer is initialized by the Queue class
+        try { Class.forName("ionic.Msmq.Queue"); }
+        catch (ClassNotFoundException ex1) { }
+    }
+}
@@ -0,0 +1,293 @@
+//
+// FairScheduler.cpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module shares receivers among weighted queues, in deficit
+// round-robin order.
+//
+// A queue with messages is "active", and sits in the active list.
+// The queue at the head of the list is handed out until it has been
+// handed out weight times in this round, then it goes to the back of
+// the list with its allowance topped up.  A queue that a receiver
+// finds empty leaves the list, and the QueueSelector reports it again
+// when a message arrives.  So a busy queue of weight 4 gets four
+// messages for every one of a busy queue of weight 1, and an idle
+// queue costs nothing.
+//
+// The cost of a message is one, not its size: the body size is not
+// known until the message has been received.  Within a queue, MSMQ
+// already delivers higher priority messages first.
+//
+// ------------------------------------------------------------------
+
+#include <stdio.h>
+#include <WTypes.h>   // reqd for WinBase.h
+#include <WinBase.h>  // for CriticalSection
+#include <MqOai.h>
+#include <mq.h>
+
+#include "Log.hpp"
+#include "DedupWindow.hpp"
+#include "MsmqQueue.hpp"
+#include "QueueSelector.hpp"
+#include "FairScheduler.hpp"
+
+
+#define FAIR_MAX_READY 64
+
+
+struct FairLane
+{
+	int         slot;
+	int         weight;
+	int         deficit;        // messages left in this round
+	BOOL        active;
+	FairLane    *next;          // all lanes
+	FairLane    *nextActive;    // the active list
+};
+
+
+
+FairScheduler::FairScheduler()
+{
+	InitializeCriticalSection(&cs);
+	lanes = NULL;
+	activeHead = NULL;
+	activeTail = NULL;
+	cWaiting = 0;
+	closed = FALSE;
+}
+
+
+
+FairScheduler::~FairScheduler()
+{
+	while (lanes != NULL) {
+		FairLane *lane = lanes;
+		lanes = lane->next;
+		delete lane;
+	}
+	DeleteCriticalSection(&cs);
+}
+
+
+
+HRESULT FairScheduler::open()
+{
+	return selector.open();
+}
+
+
+
+// caller holds cs
+FairLane *FairScheduler::findLane(int slot)
+{
+	for (FairLane *lane = lanes; lane != NULL; lane = lane->next)
+		if (lane->slot == slot) return lane;
+	return NULL;
+}
+
+
+
+// caller holds cs
+void FairScheduler::activate(int *pSlots, int n)
+{
+	for (int i = 0; i < n; i++) {
+		FairLane *lane = findLane(pSlots[i]);
+		if (lane == NULL || lane->active) continue;
+		lane->active = TRUE;
+		lane->deficit = lane->weight;
+		lane->nextActive = NULL;
+		if (activeTail != NULL) activeTail->nextActive = lane;
+		else activeHead = lane;
+		activeTail = lane;
+	}
+}
+
+
+
+// caller holds cs
+void FairScheduler::deactivate(FairLane *lane)
+{
+	if (!lane->active) return;
+	lane->active = FALSE;
+
+	FairLane **pp = &activeHead;
+	FairLane *prev = NULL;
+	while (*pp != NULL && *pp != lane) {
+		prev = *pp;
+		pp = &(*pp)->nextActive;
+	}
+	if (*pp == NULL) return;
+	*pp = lane->nextActive;
+	if (activeTail == lane) activeTail = prev;
+}
+
+
+
+HRESULT FairScheduler::add(MsmqQueue *q, int slot, int weight)
+{
+	if (weight < 1) return MQ_ERROR_INVALID_PARAMETER;
+
+	EnterCriticalSection(&cs);
+	FairLane *lane = findLane(slot);
+	if (lane != NULL) {
+		// already added; just change the weight
+		lane->weight = weight;
+		if (lane->deficit > weight) lane->deficit = weight;
+		LeaveCriticalSection(&cs);
+		return MQ_OK;
+	}
+	LeaveCriticalSection(&cs);
+
+	HRESULT hr = selector.add(q, slot);
+	if (FAILED(hr)) return hr;
+
+	lane = new FairLane;
+	lane->slot = slot;
+	lane->weight = weight;
+	lane->deficit = 0;
+	lane->active = FALSE;
+	lane->nextActive = NULL;
+
+	EnterCriticalSection(&cs);
+	lane->next = lanes;
+	lanes = lane;
+	LeaveCriticalSection(&cs);
+
+	return MQ_OK;
+}
+
+
+
+HRESULT FairScheduler::remove(MsmqQueue *q, int slot)
+{
+	if (q != NULL) selector.remove(q);
+
+	EnterCriticalSection(&cs);
+	FairLane **pp = &lanes;
+	while (*pp != NULL && (*pp)->slot != slot)
+		pp = &(*pp)->next;
+	FairLane *lane = *pp;
+	if (lane != NULL) {
+		deactivate(lane);
+		*pp = lane->next;
+		delete lane;
+	}
+	LeaveCriticalSection(&cs);
+
+	return (lane != NULL) ? MQ_OK : MQ_ERROR_INVALID_PARAMETER;
+}
+
+
+
+HRESULT FairScheduler::next(DWORD dwTimeout, int *pSlot)
+{
+	DWORD dwStart = GetTickCount();
+	int slots[FAIR_MAX_READY];
+	int n;
+
+	for (;;) {
+		BOOL fTurnEnded = FALSE;
+
+		EnterCriticalSection(&cs);
+		if (closed) {
+			LeaveCriticalSection(&cs);
+			return MQ_ERROR_INVALID_HANDLE;
+		}
+		FairLane *lane = activeHead;
+		if (lane != NULL) {
+			*pSlot = lane->slot;
+			if (--lane->deficit <= 0) {
+				// end of this lane's turn; to the back of the round
+				lane->deficit += lane->weight;
+				if (lane->nextActive != NULL) {
+					activeHead = lane->nextActive;
+					activeTail->nextActive = lane;
+					activeTail = lane;
+					lane->nextActive = NULL;
+				}
+				fTurnEnded = TRUE;
+			}
+		}
+		LeaveCriticalSection(&cs);
+
+		if (lane != NULL) {
+			if (fTurnEnded) {
+				// let queues that have become ready join the round,
+				// without waiting
+				n = selector.select(0, slots, FAIR_MAX_READY);
+				if (n > 0) {
+					EnterCriticalSection(&cs);
+					activate(slots, n);
+					LeaveCriticalSection(&cs);
+				}
+			}
+			return MQ_OK;
+		}
+
+		// nothing active: wait for a queue to have a message
+		DWORD dwWait = dwTimeout;
+		if (dwTimeout != INFINITE) {
+			DWORD dwElapsed = GetTickCount() - dwStart;
+			if (dwElapsed >= dwTimeout) return MQ_ERROR_IO_TIMEOUT;
+			dwWait = dwTimeout - dwElapsed;
+		}
+
+		EnterCriticalSection(&cs);
+		cWaiting++;
+		LeaveCriticalSection(&cs);
+
+		n = selector.select(dwWait, slots, FAIR_MAX_READY);
+
+		EnterCriticalSection(&cs);
+		cWaiting--;
+		int cWake = 0;
+		if (n > 0) {
+			activate(slots, n);
+			// the other waiters can now take from the active list
+			cWake = cWaiting;
+		}
+		LeaveCriticalSection(&cs);
+
+		if (n < 0) return (HRESULT)n;
+		for (int i = 0; i < cWake; i++)
+			selector.wakeup();
+		// on timeout or wakeup (n == 0), go around: the timeout is
+		// checked above
+	}
+}
+
+
+
+void FairScheduler::drained(int slot)
+{
+	EnterCriticalSection(&cs);
+	FairLane *lane = findLane(slot);
+	if (lane != NULL) deactivate(lane);
+	LeaveCriticalSection(&cs);
+}
+
+
+
+void FairScheduler::close(int cWaiters)
+{
+	EnterCriticalSection(&cs);
+	closed = TRUE;
+	LeaveCriticalSection(&cs);
+	selector.close(cWaiters);
+}
@@ -0,0 +1,68 @@
+//
+// FairScheduler.hpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This is an include for the FairScheduler class, which decides which
+// of a set of weighted queues to receive from next.
+//
+// ------------------------------------------------------------------
+
+struct FairLane;
+
+
+class FairScheduler
+{
+private:
+	QueueSelector   selector;
+
+	// guards the lanes and the active list.  Never held while waiting
+	// in the selector.
+	CRITICAL_SECTION cs;
+
+	FairLane        *lanes;
+	FairLane        *activeHead;    // lanes with messages, in round order
+	FairLane        *activeTail;
+	int             cWaiting;       // threads waiting in the selector
+	BOOL            closed;
+
+	FairLane *findLane(int slot);
+	void activate(int *pSlots, int n);
+	void deactivate(FairLane *lane);
+
+public:
+	FairScheduler();
+	~FairScheduler();
+
+	HRESULT open(void);
+
+	// adds a queue open for receive; weight is the number of messages
+	// taken from it in each round while it has messages.
+	HRESULT add(MsmqQueue *q, int slot, int weight);
+	HRESULT remove(MsmqQueue *q, int slot);
+
+	// waits up to dwTimeout for a queue to have a message, and stores
+	// in *pSlot the slot of the queue to receive from next.  Returns
+	// MQ_ERROR_IO_TIMEOUT if nothing arrives.
+	HRESULT next(DWORD dwTimeout, int *pSlot);
+
+	// to be called when a receive on the queue in slot found it empty
+	void drained(int slot);
+
+	// wakes up cWaiters threads in next(), which then return
+	// MQ_ERROR_INVALID_HANDLE
+	void close(int cWaiters);
+};
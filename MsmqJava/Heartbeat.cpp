@@ -0,0 +1,122 @@
+//
+// Heartbeat.cpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module sends heartbeats: empty messages carrying a latency
+// probe, sent on a handle that has sent nothing for an interval, so
+// that receivers keep measuring transit time while a queue is idle.
+// Receivers using this library record the probe and drop the message.
+//
+// A heartbeat is sent outside of any transaction, unless the queue
+// rejects that, in which case this and later ones go in single-message
+// transactions.  Heartbeats expire after MQJ_HEARTBEAT_TTL_INTERVALS
+// intervals, so they do not pile up in a queue nobody reads.
+//
+// ------------------------------------------------------------------
+
+#include <stdio.h>
+#include <process.h>
+#include <WTypes.h>   // reqd for WinBase.h
+#include <WinBase.h>  // for CriticalSection
+#include <MqOai.h>
+#include <mq.h>
+
+#include "Log.hpp"
+#include "DedupWindow.hpp"
+#include "MsmqQueue.hpp"
+#include "Heartbeat.hpp"
+
+
+
+Heartbeat::Heartbeat(MsmqQueue *q)
+{
+	queue = q;
+	dwInterval = 0;
+	pTransaction = MQ_NO_TRANSACTION;
+	hStop = NULL;
+	hThread = NULL;
+}
+
+
+
+Heartbeat::~Heartbeat()
+{
+	if (hThread != NULL) {
+		SetEvent(hStop);
+		WaitForSingleObject(hThread, INFINITE);
+		CloseHandle(hThread);
+	}
+	if (hStop != NULL) CloseHandle(hStop);
+}
+
+
+
+HRESULT Heartbeat::open(DWORD dwIntervalMillis)
+{
+	if (dwIntervalMillis == 0)
+		return MQ_ERROR_INVALID_PARAMETER;
+	dwInterval = dwIntervalMillis;
+
+	hStop = CreateEventW(NULL, TRUE, FALSE, NULL);
+	if (hStop == NULL)
+		return HRESULT_FROM_WIN32(GetLastError());
+
+	hThread = (HANDLE)_beginthreadex(NULL, 0, runMain, this, 0, NULL);
+	if (hThread == NULL)
+		return MQ_ERROR_INSUFFICIENT_RESOURCES;
+
+	return MQ_OK;
+}
+
+
+
+unsigned __stdcall Heartbeat::runMain(void *pv)
+{
+	((Heartbeat *)pv)->run();
+	return 0;
+}
+
+
+
+void Heartbeat::run()
+{
+	// in seconds, as MSMQ wants it; at least one
+	DWORD dwTimeToBeReceived = (dwInterval / 1000 + 1) * MQJ_HEARTBEAT_TTL_INTERVALS;
+	HRESULT hrLast = MQ_OK;
+
+	for (;;) {
+		DWORD dwIdle = GetTickCount() - queue->getLastSendTick();
+		DWORD dwWait = dwInterval - dwIdle;
+
+		if (dwIdle >= dwInterval) {
+			HRESULT hr = queue->sendHeartbeat(dwTimeToBeReceived, pTransaction);
+			if (hr == MQ_ERROR_TRANSACTION_USAGE && pTransaction == MQ_NO_TRANSACTION) {
+				pTransaction = MQ_SINGLE_MESSAGE;
+				hr = queue->sendHeartbeat(dwTimeToBeReceived, pTransaction);
+			}
+
+			// log a failure once, not every interval
+			if (FAILED(hr) && hr != hrLast)
+				LOG_WARN("heartbeat: send failed (hr=0x%08x)", hr);
+			hrLast = hr;
+			dwWait = dwInterval;
+		}
+
+		if (WaitForSingleObject(hStop, dwWait) == WAIT_OBJECT_0)
+			break;
+	}
+}
@@ -0,0 +1,52 @@
+//
+// Heartbeat.hpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This is an include for the Heartbeat class, which sends synthetic
+// messages on a send handle that has been idle.
+//
+// ------------------------------------------------------------------
+
+// a heartbeat that is not received within this many intervals expires
+#define MQJ_HEARTBEAT_TTL_INTERVALS     10
+
+#define MQJ_HEARTBEAT_LABEL             L"MsmqJava heartbeat"
+
+
+class Heartbeat
+{
+private:
+	MsmqQueue       *queue;         // the send handle
+	DWORD           dwInterval;     // ms
+	ITransaction    *pTransaction;  // becomes MQ_SINGLE_MESSAGE on a transactional queue
+
+	HANDLE          hStop;
+	HANDLE          hThread;
+
+	void    run(void);
+	static unsigned __stdcall runMain(void *pv);
+
+public:
+	Heartbeat(MsmqQueue *q);
+
+	// stops the thread
+	~Heartbeat();
+
+	// Sends a heartbeat whenever nothing has been sent on the handle
+	// for dwInterval ms.
+	HRESULT open(DWORD dwInterval);
+};
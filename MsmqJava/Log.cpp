@@ -0,0 +1,197 @@
+//
+// Log.cpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module implements the diagnostic log of the native layer.
+//
+// A thread that logs formats its message into a slot of a fixed ring
+// of records, and goes on; it never takes a lock, never allocates, and
+// never writes to a file.  A background thread empties the ring to
+// stdout a few times a second, or, when the log is bridged to Java,
+// a Java thread takes the records and publishes them to
+// java.util.logging.
+//
+// The ring is a bounded queue in the style of Dmitry Vyukov: each slot
+// carries a sequence number that tells producers and consumers whose
+// turn it is, so that they only contend on the two positions.
+//
+// ------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <process.h>
+#include <WTypes.h>   // reqd for WinBase.h
+#include <WinBase.h>  // for Interlocked*
+
+#include "Log.hpp"
+
+
+#define LOG_RING_SIZE     1024    // a power of 2
+#define LOG_POLL_MILLIS   100     // how often the writer thread looks
+
+
+struct LogRecord
+{
+	volatile LONG   sequence;
+	int             level;
+	DWORD           dwThreadId;
+	char            szText[LOG_RECORD_LEN];
+};
+
+
+#if DEBUG
+volatile LONG Log::level = LOG_LEVEL_DEBUG;
+#else
+volatile LONG Log::level = LOG_LEVEL_WARN;
+#endif
+
+static LogRecord       ring[LOG_RING_SIZE];
+static volatile LONG   enqueuePos = 0;
+static volatile LONG   dequeuePos = 0;
+static volatile LONG   cDropped = 0;
+static volatile LONG   fBridged = FALSE;
+
+static const char *levelNames[] = { "OFF", "ERROR", "WARN", "INFO", "DEBUG", "TRACE" };
+
+
+
+static unsigned __stdcall writerMain(void *)
+{
+	int lvl;
+	DWORD dwThreadId;
+	char szText[LOG_RECORD_LEN];
+	LONG cReported = 0;
+
+	for (;;) {
+		BOOL fWrote = FALSE;
+		while (!fBridged && Log::take(&lvl, &dwThreadId, szText)) {
+			fprintf(stdout, "MsmqJava %s [%lu] %s\n", levelNames[lvl], dwThreadId, szText);
+			fWrote = TRUE;
+		}
+
+		LONG c = cDropped;
+		if (!fBridged && c != cReported) {
+			fprintf(stdout, "MsmqJava WARN %ld log records dropped\n", c - cReported);
+			cReported = c;
+			fWrote = TRUE;
+		}
+
+		if (fWrote) fflush(stdout);
+		Sleep(LOG_POLL_MILLIS);
+	}
+	return 0;
+}
+
+
+
+void Log::init()
+{
+	for (LONG i = 0; i < LOG_RING_SIZE; i++)
+		ring[i].sequence = i;
+
+	char szLevel[16];
+	DWORD cch = GetEnvironmentVariableA("MSMQJAVA_LOG_LEVEL", szLevel, sizeof(szLevel));
+	if (cch > 0 && cch < sizeof(szLevel)) {
+		for (int i = LOG_LEVEL_OFF; i <= LOG_LEVEL_TRACE; i++)
+			if (_stricmp(szLevel, levelNames[i]) == 0) level = i;
+	}
+
+	HANDLE hThread = (HANDLE)_beginthreadex(NULL, 0, writerMain, NULL, 0, NULL);
+	if (hThread != NULL) CloseHandle(hThread);
+}
+
+
+
+void Log::write(int lvl, const char *szFormat, ...)
+{
+	LogRecord *r;
+	LONG pos = enqueuePos;
+
+	for (;;) {
+		r = &ring[pos & (LOG_RING_SIZE - 1)];
+		LONG seq = r->sequence;
+		MemoryBarrier();
+		LONG dif = seq - pos;
+		if (dif == 0) {
+			// the slot is free; claim it
+			if (InterlockedCompareExchange(&enqueuePos, pos + 1, pos) == pos)
+				break;
+		}
+		else if (dif < 0) {
+			// the slot still holds an unread record: the ring is full
+			InterlockedIncrement(&cDropped);
+			return;
+		}
+		pos = enqueuePos;
+	}
+
+	r->level = lvl;
+	r->dwThreadId = GetCurrentThreadId();
+	va_list args;
+	va_start(args, szFormat);
+	_vsnprintf_s(r->szText, LOG_RECORD_LEN, _TRUNCATE, szFormat, args);
+	va_end(args);
+
+	MemoryBarrier();
+	r->sequence = pos + 1;   // publish
+}
+
+
+
+BOOL Log::take(int *pLevel, DWORD *pThreadId, char *szText)
+{
+	LogRecord *r;
+	LONG pos = dequeuePos;
+
+	for (;;) {
+		r = &ring[pos & (LOG_RING_SIZE - 1)];
+		LONG seq = r->sequence;
+		MemoryBarrier();
+		LONG dif = seq - (pos + 1);
+		if (dif == 0) {
+			if (InterlockedCompareExchange(&dequeuePos, pos + 1, pos) == pos)
+				break;
+		}
+		else if (dif < 0) {
+			return FALSE;   // empty
+		}
+		pos = dequeuePos;
+	}
+
+	*pLevel = r->level;
+	*pThreadId = r->dwThreadId;
+	memcpy(szText, r->szText, LOG_RECORD_LEN);
+
+	MemoryBarrier();
+	r->sequence = pos + LOG_RING_SIZE;   // free the slot for the next lap
+	return TRUE;
+}
+
+
+
+void Log::setBridged(BOOL f)
+{
+	InterlockedExchange(&fBridged, f);
+}
+
+
+
+LONG Log::dropped()
+{
+	return cDropped;
+}
@@ -0,0 +1,69 @@
+//
+// Log.hpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This is an include for the Log class, the leveled diagnostic log of
+// the native layer.
+//
+// ------------------------------------------------------------------
+
+#define LOG_LEVEL_OFF     0
+#define LOG_LEVEL_ERROR   1
+#define LOG_LEVEL_WARN    2
+#define LOG_LEVEL_INFO    3
+#define LOG_LEVEL_DEBUG   4
+#define LOG_LEVEL_TRACE   5
+
+// the longest message kept, including the terminator; longer ones
+// are truncated
+#define LOG_RECORD_LEN    240
+
+// The arguments are evaluated, and the message formatted, only when
+// the level is enabled.  Messages have no trailing newline.
+#define LOG(lvl, ...)    do { if ((lvl) <= Log::level) Log::write((lvl), __VA_ARGS__); } while (0)
+#define LOG_ERROR(...)   LOG(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...)    LOG(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...)    LOG(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...)   LOG(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_TRACE(...)   LOG(LOG_LEVEL_TRACE, __VA_ARGS__)
+
+
+class Log
+{
+public:
+	// the most verbose level written; LOG_LEVEL_OFF writes nothing
+	static volatile LONG level;
+
+	// to be called once, before any other method.  Reads the initial
+	// level from the MSMQJAVA_LOG_LEVEL environment variable, and
+	// starts the writer thread.
+	static void init(void);
+
+	// queues a record.  Does no I/O, and never blocks; if the queue is
+	// full the record is dropped and counted.
+	static void write(int lvl, const char *szFormat, ...);
+
+	// takes the oldest queued record.  Returns FALSE if there is none.
+	static BOOL take(int *pLevel, DWORD *pThreadId, char *szText);
+
+	// when bridged, records are left for take() instead of being
+	// written to stdout
+	static void setBridged(BOOL fBridged);
+
+	// the number of records dropped because the queue was full
+	static LONG dropped(void);
+};
@@ -0,0 +1,223 @@
+//
+// Lz4Codec.cpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module implements the LZ4 block format, as described in
+// https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+//
+// The compressor is the simple single-pass, greedy, hash-table
+// variety; it trades some ratio for speed, which is the point of LZ4.
+// Its output can be read by any conforming LZ4 block decoder, and the
+// decompressor here checks every length and offset against the input
+// and output bounds, since the input arrives off the wire.
+//
+// ------------------------------------------------------------------
+
+#include <string.h>
+#include <WTypes.h>
+
+#include "Lz4Codec.hpp"
+
+
+#define MINMATCH       4
+#define LASTLITERALS   5    // the last 5 bytes are always literals
+#define MFLIMIT        12   // a match may not start within the last 12 bytes
+#define HASH_LOG       12
+#define MAX_DISTANCE   65535
+#define MAX_INPUT_SIZE 0x7E000000
+
+
+static inline DWORD Read32(const BYTE *p)
+{
+	DWORD v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+
+static inline DWORD Hash32(DWORD v)
+{
+	return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+
+// writes the 255-run continuation bytes of a length
+static inline BYTE * WriteLength(BYTE *op, DWORD len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (BYTE)len;
+	return op;
+}
+
+
+
+DWORD Lz4Codec::bound(DWORD cbSrc)
+{
+	return (cbSrc > MAX_INPUT_SIZE) ? 0 : cbSrc + (cbSrc / 255) + 16;
+}
+
+
+
+DWORD Lz4Codec::compress(const BYTE *pbSrc, DWORD cbSrc, BYTE *pbDst, DWORD cbDst)
+{
+	if (cbSrc > MAX_INPUT_SIZE) return 0;
+
+	const BYTE *ip = pbSrc;
+	const BYTE *anchor = pbSrc;
+	const BYTE *iend = pbSrc + cbSrc;
+	BYTE       *op = pbDst;
+	BYTE       *oend = pbDst + cbDst;
+	DWORD       table[1 << HASH_LOG];
+
+	memset(table, 0, sizeof(table));
+
+	if (cbSrc > MFLIMIT) {
+		const BYTE *mflimit = iend - MFLIMIT;
+		const BYTE *matchlimit = iend - LASTLITERALS;
+
+		while (ip <= mflimit) {
+			DWORD h = Hash32(Read32(ip));
+			const BYTE *ref = pbSrc + table[h];
+			table[h] = (DWORD)(ip - pbSrc);
+
+			if (ref >= ip || ip - ref > MAX_DISTANCE || Read32(ref) != Read32(ip)) {
+				ip++;
+				continue;
+			}
+
+			// extend the match backwards over pending literals, then forwards
+			while (ip > anchor && ref > pbSrc && ip[-1] == ref[-1]) {
+				ip--;
+				ref--;
+			}
+			const BYTE *mp = ip + MINMATCH;
+			const BYTE *rp = ref + MINMATCH;
+			while (mp < matchlimit && *mp == *rp) {
+				mp++;
+				rp++;
+			}
+
+			DWORD litLen = (DWORD)(ip - anchor);
+			DWORD matchLen = (DWORD)(mp - ip) - MINMATCH;
+			if ((size_t)(oend - op) < 1 + litLen / 255 + 1 + litLen + 2 + matchLen / 255 + 1)
+				return 0;
+
+			BYTE *token = op++;
+			if (litLen >= 15) {
+				*token = 15 << 4;
+				op = WriteLength(op, litLen - 15);
+			}
+			else
+				*token = (BYTE)(litLen << 4);
+			memcpy(op, anchor, litLen);
+			op += litLen;
+
+			DWORD offset = (DWORD)(ip - ref);
+			*op++ = (BYTE)offset;
+			*op++ = (BYTE)(offset >> 8);
+
+			if (matchLen >= 15) {
+				*token |= 15;
+				op = WriteLength(op, matchLen - 15);
+			}
+			else
+				*token |= (BYTE)matchLen;
+
+			ip = mp;
+			anchor = ip;
+
+			// prime the table with a position inside the match
+			table[Hash32(Read32(ip - 2))] = (DWORD)(ip - 2 - pbSrc);
+		}
+	}
+
+	// the last sequence is literals only
+	DWORD litLen = (DWORD)(iend - anchor);
+	if ((size_t)(oend - op) < 1 + litLen / 255 + 1 + litLen)
+		return 0;
+	if (litLen >= 15) {
+		*op++ = 15 << 4;
+		op = WriteLength(op, litLen - 15);
+	}
+	else
+		*op++ = (BYTE)(litLen << 4);
+	memcpy(op, anchor, litLen);
+	op += litLen;
+
+	return (DWORD)(op - pbDst);
+}
+
+
+
+int Lz4Codec::decompress(const BYTE *pbSrc, DWORD cbSrc, BYTE *pbDst, DWORD cbDst)
+{
+	const BYTE *ip = pbSrc;
+	const BYTE *iend = pbSrc + cbSrc;
+	BYTE       *op = pbDst;
+	BYTE       *oend = pbDst + cbDst;
+
+	for (;;) {
+		if (ip >= iend) return -1;
+		BYTE  token = *ip++;
+		DWORD b;
+
+		// A length may run on through any number of 255 bytes.  Each
+		// takes an input byte, so a 64-bit sum cannot wrap, and the
+		// checks after bound it.
+		ULONGLONG litLen = token >> 4;
+		if (litLen == 15) {
+			do {
+				if (ip >= iend) return -1;
+				b = *ip++;
+				litLen += b;
+			} while (b == 255);
+		}
+		if (litLen > (ULONGLONG)(iend - ip) || litLen > (ULONGLONG)(oend - op)) return -1;
+		memcpy(op, ip, (size_t)litLen);
+		op += (DWORD)litLen;
+		ip += (DWORD)litLen;
+
+		if (ip == iend) break;  // the last sequence has no match
+
+		if (iend - ip < 2) return -1;
+		DWORD offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (DWORD)(op - pbDst)) return -1;
+
+		ULONGLONG matchLen = token & 15;
+		if (matchLen == 15) {
+			do {
+				if (ip >= iend) return -1;
+				b = *ip++;
+				matchLen += b;
+			} while (b == 255);
+		}
+		matchLen += MINMATCH;
+		if (matchLen > (ULONGLONG)(oend - op)) return -1;
+
+		// byte by byte; the match may overlap the output
+		const BYTE *m = op - offset;
+		for (DWORD k = 0; k < (DWORD)matchLen; k++)
+			op[k] = m[k];
+		op += (DWORD)matchLen;
+	}
+
+	return (int)(op - pbDst);
+}
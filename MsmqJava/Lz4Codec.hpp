@@ -0,0 +1,42 @@
+//
+// Lz4Codec.hpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This is an include for the Lz4Codec class, a compressor and
+// decompressor for the LZ4 block format.
+//
+// ------------------------------------------------------------------
+
+// A block cannot expand by more than this: the longest match takes
+// one input byte per 255 bytes of output.
+#define LZ4_MAX_RATIO                   255
+
+
+class Lz4Codec
+{
+public:
+
+	// the largest compressed size for cbSrc bytes of input
+	static DWORD bound(DWORD cbSrc);
+
+	// returns the compressed size, or 0 if it does not fit in cbDst
+	static DWORD compress(const BYTE *pbSrc, DWORD cbSrc, BYTE *pbDst, DWORD cbDst);
+
+	// returns the decompressed size, or -1 if the input is malformed
+	// or does not fit in cbDst
+	static int   decompress(const BYTE *pbSrc, DWORD cbSrc, BYTE *pbDst, DWORD cbDst);
+};
@@ -45,7 +45,26 @@ public class Message {
     byte[] _messageBody ;
     String _label ;
     byte[] _correlationId ; // up to PROPID_M_CORRELATIONID_SIZE bytes
-    boolean _highPriority;
+    byte[] _messageId ;     // PROPID_M_MSGID_SIZE bytes, set by MSMQ
+    int _priority = DEFAULT_PRIORITY;
+    int _recordCount ;      // records in a batch message, or 0
+    int _timeToReachQueue = NO_TIME_LIMIT;   // seconds; for sending only
+    int _timeToBeReceived = NO_TIME_LIMIT;
+    byte[] _dedupId ;       // DEDUP_ID_SIZE bytes; for sending only
+
+    // A received Message keeps its properties in a native record, and
+    // creates the Java objects only when a getter first asks for them.
+    // _loaded has a bit set for each property that has been copied out
+    // of the record, or set by the application, since.
+    static final int LOADED_BODY = 1;
+    static final int LOADED_LABEL = 2;
+    static final int LOADED_CORRELATION_ID = 4;
+    static final int LOADED_MESSAGE_ID = 8;
+    static final int LOADED_PRIORITY = 16;
+    static final int LOADED_RECORD_COUNT = 32;
+    long _nativeBuffer ;               // address of the native record, or 0
+    int _loaded ;
+    MessageCleaner _cleaner ;          // frees the record if release() is never called
 
 
     /**
@@ -60,7 +79,7 @@ public class Message {
      */
     public void setBodyAsString(String value)
         throws java.io.UnsupportedEncodingException
-    { _messageBody= value.getBytes(_encoding); }
+    { setBody(value.getBytes(_encoding)); }
 
 
     /**
@@ -77,7 +96,7 @@ public class Message {
      */
     public String getBodyAsString()
         throws java.io.UnsupportedEncodingException
-    { return new String(_messageBody, _encoding); }
+    { return new String(getBody(), _encoding); }
 
 
     /**
@@ -93,7 +112,7 @@ public class Message {
 
     public void setCorrelationIdAsString(String value)
         throws java.io.UnsupportedEncodingException
-    { _correlationId= value.getBytes(_utf8); }
+    { setCorrelationId(value.getBytes(_utf8)); }
 
 
     /**
@@ -106,7 +125,7 @@ public class Message {
      */
     public String getCorrelationIdAsString()
         throws java.io.UnsupportedEncodingException
-    { return new String(_correlationId, _utf8); }
+    { return new String(getCorrelationId(), _utf8); }
 
 
     /**
@@ -116,14 +135,158 @@ public class Message {
      * @see    #getBody()
      * @see    #setBodyAsString(String)
      */
-    public void setBody(byte[] value)          { _messageBody= value; }
+    public synchronized void setBody(byte[] value)
+    {
+        _messageBody= value;
+        _loaded|= LOADED_BODY;
+    }
 
     /**
-     * Gets the message body.
+     * <p>Gets the message body.</p>
+     *
+     * <p>For a received message, the first call copies the body out of
+     * the native buffer it was received into.</p>
      *
      * @return the message body, as a byte array.
      */
-    public byte[] getBody()                    { return _messageBody; }
+    public synchronized byte[] getBody()
+    {
+        if ((_loaded & LOADED_BODY) == 0 && _nativeBuffer != 0) {
+            _messageBody= nativeGetBody(_nativeBuffer);
+            _loaded|= LOADED_BODY;
+        }
+        return _messageBody;
+    }
+
+
+    /**
+     * <p>Gets the message body as a read-only ByteBuffer.</p>
+     *
+     * <p>The buffer is a view of the same array {@link #getBody()}
+     * returns, so for a received message the body is copied out of the
+     * native buffer on the first call, and the view stays valid after
+     * {@link #release()}.</p>
+     *
+     * @return the message body, or null if there is none.
+     */
+    public synchronized java.nio.ByteBuffer getBodyBuffer()
+    {
+        byte[] body= getBody();
+        return (body == null) ? null : java.nio.ByteBuffer.wrap(body).asReadOnlyBuffer();
+    }
+
+
+    /**
+     * <p>Returns the native buffer of a received message to the buffer
+     * pool.</p>
+     *
+     * <p>A received message holds its body, label and correlation ID
+     * in a native buffer until they are first asked for. Messages
+     * obtained from {@link Queue#receivePooled(int)} must be released
+     * explicitly; for other messages the buffer is released when the
+     * Message is garbage collected, and calling this method just
+     * returns it sooner.</p>
+     *
+     * <p>Properties that were already read, or set, remain available.
+     * Those that were not are discarded. It is safe to call this method
+     * more than once, and on messages that were not received.</p>
+     */
+    public synchronized void release()
+    {
+        if (_cleaner != null)
+            _cleaner.clean();
+        else if (_nativeBuffer != 0)
+            nativeReleaseBuffer(_nativeBuffer);
+        _cleaner= null;
+        _nativeBuffer= 0;
+    }
+
+
+    // Called by Queue on a freshly received message, unless the caller
+    // has promised to call release().
+    void attachCleaner()
+    {
+        if (_nativeBuffer != 0)
+            _cleaner= MessageCleaner.register(this, _nativeBuffer);
+    }
+
+    /**
+     * <p>Gets the number of records in a batch message, sent by a
+     * {@link BatchingSender}.</p>
+     *
+     * @return the number of records, or 0 if this is not a batch.
+     */
+    public synchronized int getRecordCount()
+    {
+        if ((_loaded & LOADED_RECORD_COUNT) == 0 && _nativeBuffer != 0) {
+            _recordCount= nativeGetRecordCount(_nativeBuffer);
+            _loaded|= LOADED_RECORD_COUNT;
+        }
+        return _recordCount;
+    }
+
+
+    /**
+     * Gets whether this is a batch message, sent by a {@link
+     * BatchingSender}.
+     *
+     * @return true if the body holds batched records.
+     */
+    public boolean isBatch()           { return getRecordCount() > 0; }
+
+
+    /**
+     * <p>Iterates the records of a batch message, in the order they were
+     * added to the {@link BatchingSender}. A message that is not a batch
+     * yields its body, once.</p>
+     *
+     * <p>Each record is a read-only view of the buffer returned by
+     * {@link #getBodyBuffer()}.</p>
+     *
+     * @return an iterator over the records.
+     */
+    public synchronized java.util.Iterator<java.nio.ByteBuffer> records()
+    {
+        final java.nio.ByteBuffer body= getBodyBuffer();
+        final int count= getRecordCount();
+        if (count == 0) {
+            java.util.List<java.nio.ByteBuffer> one= (body == null)
+                ? java.util.Collections.<java.nio.ByteBuffer>emptyList()
+                : java.util.Collections.singletonList(body);
+            return one.iterator();
+        }
+
+        // each record is a little-endian int length, then the bytes; the
+        // native layer checked the framing when the message was received
+        body.order(java.nio.ByteOrder.LITTLE_ENDIAN);
+        return new java.util.Iterator<java.nio.ByteBuffer>() {
+            private int _remaining= count;
+
+            public boolean hasNext() { return _remaining > 0; }
+
+            public java.nio.ByteBuffer next()
+            {
+                if (_remaining == 0)
+                    throw new java.util.NoSuchElementException();
+                int length= body.getInt();
+                java.nio.ByteBuffer record= body.slice();
+                record.limit(length);
+                body.position(body.position() + length);
+                _remaining--;
+                return record;
+            }
+
+            public void remove() { throw new UnsupportedOperationException(); }
+        };
+    }
+
+    private static native byte[] nativeGetBody(long buffer);
+    private static native String nativeGetLabel(long buffer);
+    private static native byte[] nativeGetCorrelationId(long buffer);
+    private static native byte[] nativeGetMessageId(long buffer);
+    private static native int nativeGetPriority(long buffer);
+    private static native int nativeGetRecordCount(long buffer);
+    static native void nativeReleaseBuffer(long buffer);
 
 
 
@@ -132,14 +295,25 @@ public class Message {
      *
      * @param  value   the string to use as the label on the message.
      */
-    public void setLabel(String value)         { _label= value; }
+    public synchronized void setLabel(String value)
+    {
+        _label= value;
+        _loaded|= LOADED_LABEL;
+    }
 
     /**
      * Gets the message body.
      *
      * @return the message label.
      */
-    public String getLabel()                   { return _label; }
+    public synchronized String getLabel()
+    {
+        if ((_loaded & LOADED_LABEL) == 0 && _nativeBuffer != 0) {
+            _label= nativeGetLabel(_nativeBuffer);
+            _loaded|= LOADED_LABEL;
+        }
+        return _label;
+    }
 
 
 
@@ -151,7 +325,11 @@ public class Message {
      * @param  value  the byte array to use as the correlation ID on the
      *                message.
      */
-    public void setCorrelationId(byte[] value) { _correlationId= value; }
+    public synchronized void setCorrelationId(byte[] value)
+    {
+        _correlationId= value;
+        _loaded|= LOADED_CORRELATION_ID;
+    }
 
     /**
      * <p>Gets the correlation Id on the message. </p>
@@ -160,26 +338,230 @@ public class Message {
      *
      * @return the correlation ID on the message.
      */
-    public byte[] getCorrelationId()           { return _correlationId; }
+    public synchronized byte[] getCorrelationId()
+    {
+        if ((_loaded & LOADED_CORRELATION_ID) == 0 && _nativeBuffer != 0) {
+            _correlationId= nativeGetCorrelationId(_nativeBuffer);
+            _loaded|= LOADED_CORRELATION_ID;
+        }
+        return _correlationId;
+    }
+
+
+    /**
+     * <p>Gets the ID that MSMQ assigned to the message when it was
+     * sent.</p>
+     *
+     * <p>The ID is 20 bytes long, and unique to each message sent. A
+     * message that is sent again by its producer gets a new ID, but a
+     * message that MSMQ delivers twice keeps its own.</p>
+     *
+     * @return the message ID, or null if the message was not received.
+     */
+    public synchronized byte[] getMessageId()
+    {
+        if ((_loaded & LOADED_MESSAGE_ID) == 0 && _nativeBuffer != 0) {
+            _messageId= nativeGetMessageId(_nativeBuffer);
+            _loaded|= LOADED_MESSAGE_ID;
+        }
+        return _messageId;
+    }
+
+
+    /**
+     * The lowest MSMQ message priority.
+     */
+    public static final int MIN_PRIORITY = 0;
+
+    /**
+     * The priority of messages that don't set one.
+     */
+    public static final int DEFAULT_PRIORITY = 3;
+
+    /**
+     * The highest MSMQ message priority.
+     */
+    public static final int MAX_PRIORITY = 7;
+
+
+    /**
+     * <p>Sets the MSMQ priority of the message, from 0 (lowest) to 7
+     * (highest).</p>
+     *
+     * <p>MSMQ delivers the messages in a queue highest priority first,
+     * and in the order sent within a priority. Transactional queues
+     * ignore the priority; their messages all have priority 0.</p>
+     *
+     * @param  value   the priority, between MIN_PRIORITY and MAX_PRIORITY.
+     */
+    public synchronized void setPriority(int value)
+    {
+        if (value < MIN_PRIORITY || value > MAX_PRIORITY)
+            throw new IllegalArgumentException("priority must be between 0 and 7");
+        _priority= value;
+        _loaded|= LOADED_PRIORITY;
+    }
+
+
+    /**
+     * <p>Gets the MSMQ priority of the message.</p>
+     *
+     * @return  the priority, from 0 (lowest) to 7 (highest).
+     */
+    public synchronized int getPriority()
+    {
+        if ((_loaded & LOADED_PRIORITY) == 0 && _nativeBuffer != 0) {
+            _priority= nativeGetPriority(_nativeBuffer);
+            _loaded|= LOADED_PRIORITY;
+        }
+        return _priority;
+    }
 
 
     /**
      * Sets whether the message should be trated as high priority or not.
+     * High priority is MAX_PRIORITY; otherwise the message gets
+     * DEFAULT_PRIORITY.
      *
      * @param  value   true if the message should be delivered with high
      *                 priority.
      */
-    public void setHighPriority(boolean value) { _highPriority= value; }
+    public void setHighPriority(boolean value) { setPriority(value ? MAX_PRIORITY : DEFAULT_PRIORITY); }
 
 
     /**
-     * <p>Gets whether the message will be treated with high priority.</p>
-     *
-     * <p>This only makes sense for outgoing messages.</p>
+     * <p>Gets whether the message will be treated with high priority,
+     * that is, with a priority above DEFAULT_PRIORITY.</p>
      *
      * @return  true if the message will be trated with high priority.
      */
-    public boolean getHighPriority()           { return _highPriority; }
+    public boolean getHighPriority()           { return getPriority() > DEFAULT_PRIORITY; }
+
+
+    /**
+     * The time limit of a message that has none.
+     */
+    public static final int NO_TIME_LIMIT = -1;
+
+
+    /**
+     * <p>Sets how long MSMQ keeps the message before it is received.</p>
+     *
+     * <p>The time runs from when the message is sent. A message not
+     * received in time is discarded by MSMQ, so that consumers coming
+     * back from an outage do not work through data nobody wants any
+     * more. A message waiting in the outbox is dropped there once its
+     * time is up.</p>
+     *
+     * <p>This is for sending; a received Message does not report
+     * it.</p>
+     *
+     * @param seconds  the time limit, or NO_TIME_LIMIT.
+     * @see Queue#setMaxAge(int)
+     */
+    public void setTimeToBeReceived(int seconds)
+    {
+        if (seconds < 0 && seconds != NO_TIME_LIMIT)
+            throw new IllegalArgumentException("seconds must not be negative");
+        _timeToBeReceived= seconds;
+    }
+
+
+    /**
+     * @return the time limit for receiving the message, in seconds, or
+     *         NO_TIME_LIMIT.
+     */
+    public int getTimeToBeReceived()          { return _timeToBeReceived; }
+
+
+    /**
+     * <p>Sets how long MSMQ tries to deliver the message to its
+     * queue.</p>
+     *
+     * <p>The time runs from when the message is sent. A message that
+     * has not reached its queue in time, as when the destination is
+     * away, is discarded. Without a limit, MSMQ uses its own default,
+     * which is days.</p>
+     *
+     * @param seconds  the time limit, or NO_TIME_LIMIT.
+     */
+    public void setTimeToReachQueue(int seconds)
+    {
+        if (seconds < 0 && seconds != NO_TIME_LIMIT)
+            throw new IllegalArgumentException("seconds must not be negative");
+        _timeToReachQueue= seconds;
+    }
+
+
+    /**
+     * @return the time limit for delivering the message to its queue,
+     *         in seconds, or NO_TIME_LIMIT.
+     */
+    public int getTimeToReachQueue()          { return _timeToReachQueue; }
+
+
+    /**
+     * The length of a dedup ID.
+     */
+    public static final int DEDUP_ID_SIZE = 20;
+
+
+    /**
+     * <p>Sets the ID by which receivers with a duplicate window tell a
+     * message sent twice from two different messages.</p>
+     *
+     * <p>MSMQ gives a message a new message ID each time it is sent, so
+     * a producer that sends again after a failure it is not sure about
+     * must keep the same dedup ID for the retry to be dropped. A
+     * Message that has none is given one when it is first sent, and
+     * keeps it when the same object is sent again.</p>
+     *
+     * <p>This is for sending; a received Message does not report
+     * it.</p>
+     *
+     * @param  value   DEDUP_ID_SIZE bytes, or null to have one chosen
+     *                 on the next send.
+     * @see Queue#setDuplicateWindow(int)
+     */
+    public synchronized void setDedupId(byte[] value)
+    {
+        if (value != null && value.length != DEDUP_ID_SIZE)
+            throw new IllegalArgumentException("a dedup ID is 20 bytes");
+        _dedupId= value;
+    }
+
+
+    /**
+     * @return the dedup ID, or null if the message has not been sent and
+     *         none was set.
+     */
+    public synchronized byte[] getDedupId()   { return _dedupId; }
+
+
+    // The dedup ID to send with, chosen now if there is none: 12 bytes
+    // that tell this process from others, then a counter.
+    synchronized byte[] _dedupIdForSend()
+    {
+        if (_dedupId == null) {
+            long n= _nextDedupId.incrementAndGet();
+            _dedupId= java.nio.ByteBuffer.allocate(DEDUP_ID_SIZE)
+                .put(_dedupPrefix)
+                .putLong(n)
+                .array();
+        }
+        return _dedupId;
+    }
+
+    private static final byte[] _dedupPrefix;
+    private static final java.util.concurrent.atomic.AtomicLong _nextDedupId =
+        new java.util.concurrent.atomic.AtomicLong();
+    static {
+        java.util.UUID uuid= java.util.UUID.randomUUID();
+        _dedupPrefix= java.nio.ByteBuffer.allocate(DEDUP_ID_SIZE - 8)
+            .putLong(uuid.getMostSignificantBits())
+            .putInt((int)uuid.getLeastSignificantBits())
+            .array();
+    }
 
 
     Message()    { }
@@ -0,0 +1,137 @@
+//
+// MessageCleaner.java
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module releases the native buffers of received Messages, and
+// aborts the Transactions, that become unreachable without being
+// released or ended.
+//
+// ------------------------------------------------------------------
+
+package ionic.Msmq;
+
+
+/**
+ * A phantom reference to a received Message, which returns the
+ * message's native buffer to the pool once the Message has been
+ * collected; or to a Transaction, which aborts it. A single daemon
+ * thread waits on the reference queue.
+ *
+ * Registered cleaners are kept in a doubly-linked list, so that they
+ * stay reachable until they have run, without a per-message
+ * collection entry.
+ */
+final class MessageCleaner extends java.lang.ref.PhantomReference<Object>
+{
+    private static final java.lang.ref.ReferenceQueue<Object> _queue =
+        new java.lang.ref.ReferenceQueue<Object>();
+    private static final Object _lock = new Object();
+    private static MessageCleaner _head;
+    private static Thread _thread;
+
+    private MessageCleaner _prev;
+    private MessageCleaner _next;
+    private long _address;
+    private boolean _isTransaction;
+
+
+    private MessageCleaner(Object referent, long address, boolean isTransaction)
+    {
+        super(referent, _queue);
+        _address= address;
+        _isTransaction= isTransaction;
+    }
+
+
+    static MessageCleaner register(Message msg, long address)
+    {
+        return _register(new MessageCleaner(msg, address, false));
+    }
+
+
+    static MessageCleaner register(Transaction tx, long handle)
+    {
+        return _register(new MessageCleaner(tx, handle, true));
+    }
+
+
+    private static MessageCleaner _register(MessageCleaner c)
+    {
+        synchronized (_lock) {
+            c._next= _head;
+            if (_head != null) _head._prev= c;
+            _head= c;
+            if (_thread == null) _startThread();
+        }
+        return c;
+    }
+
+
+    /**
+     * Releases the native buffer, or aborts the transaction, at most
+     * once.
+     */
+    void clean()
+    {
+        long address= take();
+        if (address == 0) return;
+        if (_isTransaction)
+            Transaction.nativeAbort(address);
+        else
+            Message.nativeReleaseBuffer(address);
+    }
+
+
+    /**
+     * Unregisters this cleaner without running it.
+     *
+     * @return the address it held, or 0 if it had already run.
+     */
+    long take()
+    {
+        synchronized (_lock) {
+            long address= _address;
+            if (address == 0) return 0;
+            _address= 0;
+
+            if (_prev != null) _prev._next= _next;
+            else _head= _next;
+            if (_next != null) _next._prev= _prev;
+            _prev= _next= null;
+            return address;
+        }
+    }
+
+
+    // caller holds _lock
+    private static void _startThread()
+    {
+        _thread= new Thread("MsmqJava message cleaner") {
+                public void run()
+                {
+                    for (;;) {
+                        try {
+                            ((MessageCleaner) _queue.remove()).clean();
+                        }
+                        catch (InterruptedException ex1) { }
+                    }
+                }
+            };
+        _thread.setDaemon(true);
+        _thread.start();
+    }
+}
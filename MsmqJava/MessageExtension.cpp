@@ -0,0 +1,86 @@
+//
+// MessageExtension.cpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module builds and parses the MsmqJava records carried in the
+// PROPID_M_EXTENSION message property.
+//
+// ------------------------------------------------------------------
+
+#include <string.h>
+#include <WTypes.h>
+
+#include "MessageExtension.hpp"
+
+
+#define PREAMBLE_LEN  4
+
+
+MessageExtension::MessageExtension()
+{
+	cb = 0;
+}
+
+
+
+BOOL MessageExtension::add(BYTE type, const void *pvPayload, BYTE cbPayload)
+{
+	DWORD start = (cb == 0) ? PREAMBLE_LEN : cb;
+	if (start + 2 + cbPayload > MQJ_MAX_EXTENSION_LEN)
+		return FALSE;
+
+	if (cb == 0) {
+		buffer[0] = 'M';
+		buffer[1] = 'J';
+		buffer[2] = MQJ_EXTENSION_VERSION;
+		buffer[3] = 0;
+	}
+
+	buffer[start] = type;
+	buffer[start + 1] = cbPayload;
+	if (cbPayload > 0)
+		memcpy(buffer + start + 2, pvPayload, cbPayload);
+	cb = start + 2 + cbPayload;
+	return TRUE;
+}
+
+
+
+const BYTE * MessageExtension::find(const BYTE *pbExtension,
+	DWORD cbExtension,
+	BYTE  type,
+	BYTE  *pcbPayload)
+{
+	if (pbExtension == NULL || cbExtension < PREAMBLE_LEN)
+		return NULL;
+	if (pbExtension[0] != 'M' || pbExtension[1] != 'J' || pbExtension[2] != MQJ_EXTENSION_VERSION)
+		return NULL;
+
+	DWORD i = PREAMBLE_LEN;
+	while (i + 2 <= cbExtension) {
+		BYTE t = pbExtension[i];
+		BYTE len = pbExtension[i + 1];
+		if (i + 2 + len > cbExtension)
+			return NULL;  // truncated
+		if (t == type) {
+			if (pcbPayload != NULL) *pcbPayload = len;
+			return pbExtension + i + 2;
+		}
+		i += 2 + len;
+	}
+	return NULL;
+}
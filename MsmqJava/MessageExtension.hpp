@@ -0,0 +1,64 @@
+//
+// MessageExtension.hpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This is an include for the MessageExtension class, which builds and
+// parses the records MsmqJava carries in PROPID_M_EXTENSION.
+//
+// The layout is a 4-byte preamble, 'M' 'J' <version> <reserved>,
+// followed by records of <type> <length> <payload[length]>.  Readers
+// skip records of unknown type, and ignore extensions that don't start
+// with the preamble, so that messages from other MSMQ clients pass
+// through untouched.
+//
+// ------------------------------------------------------------------
+
+#define MQJ_MAX_EXTENSION_LEN        256
+#define MQJ_EXTENSION_VERSION        1
+
+// record types
+#define MQJ_EXT_COMPRESSION          1   // BYTE codec, DWORD original size
+#define MQJ_EXT_BATCH                2   // DWORD record count; see BatchEnvelope.hpp
+#define MQJ_EXT_CHECKSUM             3   // DWORD CRC-32C of the body as sent
+#define MQJ_EXT_PROBE                4   // ULONGLONG FILETIME of the send, DWORD producer ID
+#define MQJ_EXT_HEARTBEAT            5   // no payload; see Heartbeat.hpp
+#define MQJ_EXT_DEDUP_ID             6   // MQJ_DEDUP_ID_SIZE bytes chosen by the sender
+
+
+class MessageExtension
+{
+private:
+	BYTE    buffer[MQJ_MAX_EXTENSION_LEN];
+	DWORD   cb;
+
+public:
+	MessageExtension();
+
+	// appends a record; returns FALSE if it does not fit
+	BOOL add(BYTE type, const void *pvPayload, BYTE cbPayload);
+
+	BOOL isEmpty(void)   { return cb == 0; }
+	BYTE *data(void)     { return buffer; }
+	DWORD length(void)   { return cb; }
+
+	// finds the first record of the given type in a received
+	// extension.  Returns its payload, or NULL if there is none.
+	static const BYTE * find(const BYTE *pbExtension,
+		DWORD   cbExtension,
+		BYTE    type,
+		BYTE    *pcbPayload);
+};
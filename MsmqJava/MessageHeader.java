@@ -0,0 +1,134 @@
+//
+// MessageHeader.java
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module represents the properties of a message, without its
+// body, as peeked by Queue.peekHeader().
+//
+// ------------------------------------------------------------------
+
+package ionic.Msmq;
+
+
+/**
+ * <p>The properties of a message in a {@link Queue}, but not its body,
+ * as returned by {@link Queue#peekHeader(int)}.</p>
+ *
+ * <p>The message stays in the queue. A router can decide what to do
+ * with it from the header alone, then take it with {@link
+ * Queue#receiveCurrent(MessageHeader)}, read its body with {@link
+ * Queue#fetchBody(MessageHeader)}, or drop it with {@link
+ * Queue#discardCurrent(MessageHeader)}, none of which copy the body
+ * unless asked to. Each of these names the message by its lookup ID,
+ * so they act on this message even if others have arrived ahead of it
+ * since, and find nothing once another receiver has taken it.</p>
+ *
+ */
+public class MessageHeader
+{
+    // indexes into the values array filled by Queue.nativePeekHeader
+    static final int LOOKUP_ID = 0;
+    static final int BODY_SIZE = 1;
+    static final int PRIORITY = 2;
+    static final int SENT_TIME = 3;
+    static final int ARRIVED_TIME = 4;
+    static final int COUNT = 5;
+
+    // PROPID_M_CORRELATIONID_SIZE and PROPID_M_MSGID_SIZE
+    static final int CORRELATION_ID_SIZE = 20;
+    static final int MESSAGE_ID_SIZE = 20;
+
+    private static String _utf8 = "UTF-8";
+    private long[] _values;
+    private String _label;
+    private byte[] _correlationId;
+    private byte[] _messageId;
+
+
+    MessageHeader(long[] values, String label, byte[] correlationId, byte[] messageId)
+    {
+        _values= values;
+        _label= label;
+        _correlationId= correlationId;
+        _messageId= messageId;
+    }
+
+
+    /**
+     * @return the MSMQ lookup ID, which names the message within its
+     *         queue.
+     */
+    public long getLookupId()                { return _values[LOOKUP_ID]; }
+
+    /**
+     * @return the message label.
+     */
+    public String getLabel()                 { return _label; }
+
+    /**
+     * @return the correlation ID, PROPID_M_CORRELATIONID_SIZE bytes.
+     */
+    public byte[] getCorrelationId()         { return _correlationId; }
+
+    /**
+     * @return the correlation ID, decoded as UTF-8.
+     * @see Message#getCorrelationIdAsString()
+     */
+    public String getCorrelationIdAsString()
+        throws java.io.UnsupportedEncodingException
+    { return new String(_correlationId, _utf8); }
+
+    /**
+     * @return the message ID, assigned by MSMQ.
+     */
+    public byte[] getMessageId()             { return _messageId; }
+
+    /**
+     * <p>Gets the size of the body, in bytes, as {@link
+     * Message#getBody()} would return it: a body compressed by this
+     * library reports its size before compression.</p>
+     *
+     * @return the size of the body.
+     */
+    public int getBodySize()                 { return (int)_values[BODY_SIZE]; }
+
+    /**
+     * @return the priority, from 0 (lowest) to 7 (highest).
+     */
+    public int getPriority()                 { return (int)_values[PRIORITY]; }
+
+    /**
+     * @return when the message was sent, by the sender's clock, in
+     *         milliseconds since 1970, to a resolution of one second.
+     */
+    public long getSentTime()                { return _values[SENT_TIME] * 1000; }
+
+    /**
+     * @return when the message arrived in the queue, in milliseconds
+     *         since 1970, to a resolution of one second.
+     */
+    public long getArrivedTime()             { return _values[ARRIVED_TIME] * 1000; }
+
+
+    public String toString()
+    {
+        return "label=" + getLabel()
+            + ", body=" + getBodySize() + " bytes"
+            + ", priority=" + getPriority()
+            + ", lookupId=" + getLookupId();
+    }
+}
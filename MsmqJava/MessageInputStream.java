@@ -0,0 +1,203 @@
+//
+// MessageInputStream.java
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module provides an InputStream that reassembles a large body
+// from the chunk messages written by a MessageOutputStream.
+//
+// ------------------------------------------------------------------
+
+package ionic.Msmq;
+
+
+/**
+ * <p>An InputStream that reads a body written by a
+ * {@link MessageOutputStream}, receiving one chunk message at a time as
+ * the stream is read. Obtain one from
+ * {@link Queue#openInputStream(int)}.</p>
+ *
+ * <p>The stream checks that each chunk belongs to the same stream as
+ * the first one, and arrives in sequence. If not, reading fails with an
+ * IOException. In a non-transactional stream, the offending message
+ * has been removed from the queue by then; use a transactional stream
+ * to have every chunk put back instead.</p>
+ *
+ */
+public class MessageInputStream extends java.io.InputStream
+{
+
+    MessageInputStream(Queue queue, int timeout, boolean transactional)
+        throws  MessageQueueException, java.io.IOException
+    {
+        _queue= queue;
+        _timeout= timeout;
+        if (transactional)
+            _tx= Transaction.begin();
+
+        try {
+            _nextChunk();
+        }
+        catch (MessageQueueException ex1) {
+            _abortQuietly();
+            throw ex1;
+        }
+        catch (java.io.IOException ex2) {
+            _abortQuietly();
+            throw ex2;
+        }
+    }
+
+
+    /**
+     * Gets the ID of this stream, as carried in each chunk.
+     *
+     * @return the 12-byte stream ID.
+     */
+    public byte[] getStreamId() { return _streamId.clone(); }
+
+
+    /**
+     * Gets the label of the chunk messages.
+     *
+     * @return the label of the stream.
+     */
+    public String getLabel() { return _label; }
+
+
+    public int read()
+        throws java.io.IOException
+    {
+        if (!_fill()) return -1;
+        return _chunk[_pos++] & 0xFF;
+    }
+
+
+    public int read(byte[] b, int off, int len)
+        throws java.io.IOException
+    {
+        if (len == 0) return 0;
+        if (!_fill()) return -1;
+        int n= Math.min(len, _chunk.length - _pos);
+        System.arraycopy(_chunk, _pos, b, off, n);
+        _pos+= n;
+        return n;
+    }
+
+
+    public int available()
+    {
+        return (_chunk == null) ? 0 : _chunk.length - _pos;
+    }
+
+
+    /**
+     * <p>Closes the stream.</p>
+     *
+     * <p>For a transactional stream, the receive is committed if the
+     * last chunk has been received, and aborted otherwise, which puts
+     * all of the chunks back on the queue.</p>
+     */
+    public void close()
+        throws java.io.IOException
+    {
+        if (_closed) return;
+        _closed= true;
+        _chunk= null;
+        if (_tx == null || !_tx.isActive()) return;
+        try {
+            if (_last) _tx.commit();
+            else _tx.abort();
+        }
+        catch (MessageQueueException ex1) {
+            throw new java.io.IOException("Cannot complete stream: " + ex1.toString(), ex1);
+        }
+    }
+
+
+
+    // returns false at the end of the stream
+    private boolean _fill()
+        throws java.io.IOException
+    {
+        if (_closed) throw new java.io.IOException("Stream is closed.");
+        while (_pos == _chunk.length) {
+            if (_last) return false;
+            try {
+                _nextChunk();
+            }
+            catch (MessageQueueException ex1) {
+                throw new java.io.IOException("Cannot receive chunk " + (_seq + 1) + ": " + ex1.toString(), ex1);
+            }
+        }
+        return true;
+    }
+
+
+    private void _nextChunk()
+        throws  MessageQueueException, java.io.IOException
+    {
+        Message msg= (_tx != null) ? _queue.receive(_timeout, _tx) : _queue.receive(_timeout);
+        byte[] h= msg.getCorrelationId();
+        if (!MessageOutputStream.isChunkHeader(h))
+            throw new java.io.IOException("Message is not a stream chunk.");
+
+        int seq= MessageOutputStream.chunkSequence(h);
+        if (_streamId == null) {
+            if (seq != 0)
+                throw new java.io.IOException("Message is not the first chunk of a stream (seq " + seq + ").");
+            _streamId= java.util.Arrays.copyOfRange(h, 2, 2 + MessageOutputStream.STREAM_ID_SIZE);
+            _label= msg.getLabel();
+        }
+        else {
+            for (int i= 0; i < MessageOutputStream.STREAM_ID_SIZE; i++) {
+                if (h[2 + i] != _streamId[i])
+                    throw new java.io.IOException("Chunk belongs to another stream.");
+            }
+            if (seq != _seq + 1)
+                throw new java.io.IOException("Chunk out of sequence: expected " + (_seq + 1) + ", got " + seq + ".");
+        }
+
+        _seq= seq;
+        _last= MessageOutputStream.isLastChunk(h);
+        _chunk= msg.getBody();
+        if (_chunk == null) _chunk= new byte[0];
+        _pos= 0;
+    }
+
+
+    private void _abortQuietly()
+    {
+        try {
+            if (_tx != null && _tx.isActive()) _tx.abort();
+        }
+        catch (MessageQueueException ex1) { }
+    }
+
+
+    // --------------------------------------------
+    // private members
+    private Queue _queue;
+    private int _timeout;
+    private Transaction _tx;
+    private byte[] _streamId;
+    private String _label;
+    private byte[] _chunk;
+    private int _pos;
+    private int _seq;
+    private boolean _last;
+    private boolean _closed;
+}
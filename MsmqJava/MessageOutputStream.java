@@ -0,0 +1,225 @@
+//
+// MessageOutputStream.java
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module provides an OutputStream that writes a large body to a
+// Queue as a sequence of chunk messages.
+//
+// ------------------------------------------------------------------
+
+package ionic.Msmq;
+
+
+/**
+ * <p>An OutputStream that splits the data written to it into chunk
+ * messages, so that bodies beyond the MSMQ message size limit can be
+ * sent. Obtain one from {@link Queue#openOutputStream(String)}.</p>
+ *
+ * <p>Each chunk is a Message whose body holds up to
+ * {@link #DEFAULT_CHUNK_SIZE} bytes of the stream, and whose
+ * correlation ID (20 bytes) holds the chunk header:</p>
+ *
+ * <blockquote class='code'><pre>
+ *   [0..1]    magic, 'M' 'S'
+ *   [2..13]   stream ID, random
+ *   [14..17]  sequence number, big-endian, starting at 0
+ *   [18]      flags; 0x01 marks the last chunk
+ *   [19]      reserved, 0
+ * </pre></blockquote>
+ *
+ * <p>Only one chunk is held in memory at a time.</p>
+ *
+ */
+public class MessageOutputStream extends java.io.OutputStream
+{
+    /**
+     * The size of the body of each chunk message, 1 MB.
+     */
+    public static final int DEFAULT_CHUNK_SIZE = 1024 * 1024;
+
+    static final int STREAM_ID_SIZE = 12;
+    static final int FLAG_LAST = 0x01;
+    private static final java.security.SecureRandom _random = new java.security.SecureRandom();
+
+
+    MessageOutputStream(Queue queue, String label, boolean transactional, int chunkSize)
+        throws  MessageQueueException
+    {
+        _queue= queue;
+        _label= label;
+        _buffer= new byte[chunkSize];
+        _streamId= new byte[STREAM_ID_SIZE];
+        _random.nextBytes(_streamId);
+        if (transactional)
+            _tx= Transaction.begin();
+    }
+
+
+    /**
+     * Gets the ID of this stream, as carried in each chunk.
+     *
+     * @return the 12-byte stream ID.
+     */
+    public byte[] getStreamId() { return _streamId.clone(); }
+
+
+    public void write(int b)
+        throws java.io.IOException
+    {
+        _checkOpen();
+        if (_count == _buffer.length) _sendChunk(false);
+        _buffer[_count++]= (byte) b;
+    }
+
+
+    public void write(byte[] b, int off, int len)
+        throws java.io.IOException
+    {
+        _checkOpen();
+        while (len > 0) {
+            if (_count == _buffer.length) _sendChunk(false);
+            int n= Math.min(len, _buffer.length - _count);
+            System.arraycopy(b, off, _buffer, _count, n);
+            _count+= n;
+            off+= n;
+            len-= n;
+        }
+    }
+
+
+    /**
+     * <p>Sends the final chunk, and commits the transaction if the
+     * stream is transactional.</p>
+     *
+     * <p>If sending or committing fails, a transactional stream is
+     * aborted, and none of its chunks are delivered.</p>
+     */
+    public void close()
+        throws java.io.IOException
+    {
+        if (_closed) return;
+        try {
+            _sendChunk(true);
+            if (_tx != null) _tx.commit();
+        }
+        catch (MessageQueueException ex1) {
+            throw new java.io.IOException("Cannot complete stream: " + ex1.toString(), ex1);
+        }
+        finally {
+            _closed= true;
+            _abortQuietly();
+        }
+    }
+
+
+    /**
+     * <p>Abandons the stream without sending the final chunk.</p>
+     *
+     * <p>For a transactional stream, none of the chunks are delivered.
+     * Otherwise, the chunks sent so far remain on the queue, and the
+     * reader will fail when it runs out of chunks.</p>
+     */
+    public void abort()
+        throws  MessageQueueException
+    {
+        _closed= true;
+        if (_tx != null && _tx.isActive()) _tx.abort();
+    }
+
+
+
+    private void _sendChunk(boolean last)
+        throws java.io.IOException
+    {
+        byte[] body= (_count == _buffer.length) ? _buffer : java.util.Arrays.copyOf(_buffer, _count);
+        Message msg= new Message(body, _label, chunkHeader(_streamId, _seq, last));
+        try {
+            if (_tx != null)
+                _queue.send(msg, _tx);
+            else
+                _queue.send(msg);
+        }
+        catch (MessageQueueException ex1) {
+            _abortQuietly();
+            _closed= true;
+            throw new java.io.IOException("Cannot send chunk " + _seq + ": " + ex1.toString(), ex1);
+        }
+        _seq++;
+        _count= 0;
+    }
+
+
+    private void _checkOpen()
+        throws java.io.IOException
+    {
+        if (_closed) throw new java.io.IOException("Stream is closed.");
+    }
+
+
+    private void _abortQuietly()
+    {
+        try {
+            if (_tx != null && _tx.isActive()) _tx.abort();
+        }
+        catch (MessageQueueException ex1) { }
+    }
+
+
+    static byte[] chunkHeader(byte[] streamId, int seq, boolean last)
+    {
+        byte[] h= new byte[20];
+        h[0]= 'M';
+        h[1]= 'S';
+        System.arraycopy(streamId, 0, h, 2, STREAM_ID_SIZE);
+        h[14]= (byte)(seq >>> 24);
+        h[15]= (byte)(seq >>> 16);
+        h[16]= (byte)(seq >>> 8);
+        h[17]= (byte) seq;
+        h[18]= (byte)(last ? FLAG_LAST : 0);
+        return h;
+    }
+
+
+    static boolean isChunkHeader(byte[] h)
+    {
+        return h != null && h.length >= 20 && h[0] == 'M' && h[1] == 'S';
+    }
+
+
+    static int chunkSequence(byte[] h)
+    {
+        return ((h[14] & 0xFF) << 24) | ((h[15] & 0xFF) << 16) | ((h[16] & 0xFF) << 8) | (h[17] & 0xFF);
+    }
+
+
+    static boolean isLastChunk(byte[] h)
+    {
+        return (h[18] & FLAG_LAST) != 0;
+    }
+
+
+    // --------------------------------------------
+    // private members
+    private Queue _queue;
+    private String _label;
+    private byte[] _buffer;
+    private int _count;
+    private byte[] _streamId;
+    private int _seq;
+    private Transaction _tx;
+    private boolean _closed;
+}
@@ -0,0 +1,166 @@
+//
+// MessageProps.hpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This is an include for the MQMSGPROPS layouts used to send and
+// receive messages.
+//
+// A layout is a fixed set of message properties, with the slot of each
+// known at compile time.  There is one layout per combination of the
+// optional properties, chosen by a template argument, so the code
+// that fills a layout has no runtime branches and no index
+// bookkeeping.  The properties every layout has come first, and the
+// optional ones follow, each taking a slot only if its flag is set.
+//
+// To add a property: give it a flag, a slot after the last one, and a
+// line in the constructor.
+//
+// ------------------------------------------------------------------
+
+// optional properties of a receive
+#define MQJ_RECV_CORRELATIONID          0x01
+#define MQJ_RECV_MSGID                  0x02
+#define MQJ_RECV_PRIORITY               0x04
+#define MQJ_RECV_LAYOUTS                8      // combinations of the above
+
+// optional properties of a send
+#define MQJ_SEND_BODY                   0x01
+#define MQJ_SEND_PRIORITY               0x02
+#define MQJ_SEND_EXTENSION              0x04
+#define MQJ_SEND_TTL                    0x08   // both time limits
+#define MQJ_SEND_LAYOUTS                16
+
+
+// the slot after prev, if the layout has the property; otherwise the
+// property has no slot, and this equals prev
+#define MQJ_SLOT_AFTER(prev, Props, flag)   ((prev) + (((Props) & (flag)) ? 1 : 0))
+
+
+template <int N>
+class PropertyLayout
+{
+public:
+	MSGPROPID       id[N];
+	MQPROPVARIANT   var[N];
+	MQMSGPROPS      props;
+
+	PropertyLayout()
+	{
+		props.cProp = N;
+		props.aPropID = id;
+		props.aPropVar = var;
+		props.aStatus = NULL;
+	}
+
+	void define(int slot, MSGPROPID propId, VARTYPE vt)
+	{
+		id[slot] = propId;
+		var[slot].vt = vt;
+	}
+
+	void setVector(int slot, BYTE *pb, DWORD cb)
+	{
+		var[slot].caub.pElems = pb;
+		var[slot].caub.cElems = cb;
+	}
+};
+
+
+
+template <int Props>
+struct ReceiveSlots
+{
+	enum {
+		BODY_SIZE = 0,
+		BODY,
+		LABEL_LEN,
+		LABEL,
+		EXTENSION_LEN,
+		EXTENSION,
+		CORRELATIONID,
+		MSGID = MQJ_SLOT_AFTER(CORRELATIONID, Props, MQJ_RECV_CORRELATIONID),
+		PRIORITY = MQJ_SLOT_AFTER(MSGID, Props, MQJ_RECV_MSGID),
+		COUNT = MQJ_SLOT_AFTER(PRIORITY, Props, MQJ_RECV_PRIORITY)
+	};
+};
+
+
+template <int Props>
+class ReceiveLayout : public ReceiveSlots<Props>,
+	public PropertyLayout<ReceiveSlots<Props>::COUNT>
+{
+	typedef ReceiveSlots<Props> S;
+
+public:
+	ReceiveLayout()
+	{
+		this->define(S::BODY_SIZE, PROPID_M_BODY_SIZE, VT_UI4);
+		this->define(S::BODY, PROPID_M_BODY, VT_VECTOR | VT_UI1);
+		this->define(S::LABEL_LEN, PROPID_M_LABEL_LEN, VT_UI4);
+		this->define(S::LABEL, PROPID_M_LABEL, VT_LPWSTR);
+		this->define(S::EXTENSION_LEN, PROPID_M_EXTENSION_LEN, VT_UI4);
+		this->define(S::EXTENSION, PROPID_M_EXTENSION, VT_VECTOR | VT_UI1);
+		if (Props & MQJ_RECV_CORRELATIONID)
+			this->define(S::CORRELATIONID, PROPID_M_CORRELATIONID, VT_VECTOR | VT_UI1);
+		if (Props & MQJ_RECV_MSGID)
+			this->define(S::MSGID, PROPID_M_MSGID, VT_VECTOR | VT_UI1);
+		if (Props & MQJ_RECV_PRIORITY)
+			this->define(S::PRIORITY, PROPID_M_PRIORITY, VT_UI1);
+	}
+};
+
+
+
+template <int Props>
+struct SendSlots
+{
+	enum {
+		CORRELATIONID = 0,
+		LABEL,
+		BODY,
+		PRIORITY = MQJ_SLOT_AFTER(BODY, Props, MQJ_SEND_BODY),
+		EXTENSION = MQJ_SLOT_AFTER(PRIORITY, Props, MQJ_SEND_PRIORITY),
+		TIME_TO_REACH_QUEUE = MQJ_SLOT_AFTER(EXTENSION, Props, MQJ_SEND_EXTENSION),
+		TIME_TO_BE_RECEIVED = MQJ_SLOT_AFTER(TIME_TO_REACH_QUEUE, Props, MQJ_SEND_TTL),
+		COUNT = MQJ_SLOT_AFTER(TIME_TO_BE_RECEIVED, Props, MQJ_SEND_TTL)
+	};
+};
+
+
+template <int Props>
+class SendLayout : public SendSlots<Props>,
+	public PropertyLayout<SendSlots<Props>::COUNT>
+{
+	typedef SendSlots<Props> S;
+
+public:
+	SendLayout()
+	{
+		this->define(S::CORRELATIONID, PROPID_M_CORRELATIONID, VT_VECTOR | VT_UI1);
+		this->define(S::LABEL, PROPID_M_LABEL, VT_LPWSTR);
+		if (Props & MQJ_SEND_BODY)
+			this->define(S::BODY, PROPID_M_BODY, VT_VECTOR | VT_UI1);
+		if (Props & MQJ_SEND_PRIORITY)
+			this->define(S::PRIORITY, PROPID_M_PRIORITY, VT_UI1);
+		if (Props & MQJ_SEND_EXTENSION)
+			this->define(S::EXTENSION, PROPID_M_EXTENSION, VT_VECTOR | VT_UI1);
+		if (Props & MQJ_SEND_TTL) {
+			this->define(S::TIME_TO_REACH_QUEUE, PROPID_M_TIME_TO_REACH_QUEUE, VT_UI4);
+			this->define(S::TIME_TO_BE_RECEIVED, PROPID_M_TIME_TO_BE_RECEIVED, VT_UI4);
+		}
+	}
+};
@@ -72,7 +72,7 @@ public class MessageQueueException extends java.lang.Exception {
     }
 
 
-    private static String HrToString(int hr) {
+    static String HrToString(int hr) {
         if (hr== 0)
             return "SUCCESS";
         if (hr==0xC00E0002)
@@ -107,6 +107,22 @@ public class MessageQueueException extends java.lang.Exception {
             return "MQ_ERROR_UNSUPPORTED_ACCESS_MODE";
         if (hr== 0xC00E0069)
             return "MQ_ERROR_REMOTE_MACHINE_NOT_AVAILABLE";
+        if (hr==0xC00E001A)
+            return "MQ_ERROR_BUFFER_OVERFLOW";
+        if (hr==0xC00E0027)
+            return "MQ_ERROR_INSUFFICIENT_RESOURCES";
+        if (hr==0xC00E0050)
+            return "MQ_ERROR_TRANSACTION_USAGE";
+        if (hr==0xE00E0001)
+            return "MQJ_ERROR_BAD_COMPRESSED_BODY";
+        if (hr==0xE00E0002)
+            return "MQJ_ERROR_SELECTOR_CONFLICT";
+        if (hr==0xE00E0003)
+            return "MQJ_ERROR_OUTBOX_FULL";
+        if (hr==0xE00E0004)
+            return "MQJ_ERROR_BAD_BATCH";
+        if (hr==0xE00E0005)
+            return "MQJ_ERROR_BAD_CHECKSUM";
 
         return "unknown hr (" + hr + ")";
     }
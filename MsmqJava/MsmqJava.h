@@ -17,19 +17,19 @@ JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeInit
 
 /*
  * Class:     ionic_Msmq_Queue
- * Method:    nativeCreateQueue
- * Signature: (Ljava/lang/String;Ljava/lang/String;I)I
+ * Method:    nativeCreateAll
+ * Signature: ([Ljava/lang/String;[Ljava/lang/String;[ZI[Ljava/lang/String;[I)I
  */
-JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeCreateQueue
-  (JNIEnv *, jclass, jstring, jstring, jint);
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeCreateAll
+  (JNIEnv *, jclass, jobjectArray, jobjectArray, jbooleanArray, jint, jobjectArray, jintArray);
 
 /*
  * Class:     ionic_Msmq_Queue
- * Method:    nativeDeleteQueue
- * Signature: (Ljava/lang/String;)I
+ * Method:    nativeDeleteAll
+ * Signature: ([Ljava/lang/String;I[I)I
  */
-JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeDeleteQueue
-  (JNIEnv *, jclass, jstring);
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeDeleteAll
+  (JNIEnv *, jclass, jobjectArray, jint, jintArray);
 
 /*
  * Class:     ionic_Msmq_Queue
@@ -66,18 +66,162 @@ JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeSend
 /*
  * Class:     ionic_Msmq_Queue
  * Method:    nativeReceiveBytes
- * Signature: (Lionic/Msmq/Message;II)I
+ * Signature: (Lionic/Msmq/Message;IIJ)Z
  */
-JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeReceiveBytes
-  (JNIEnv *, jobject, jobject, jint, jint);
+JNIEXPORT jboolean JNICALL Java_ionic_Msmq_Queue_nativeReceiveBytes
+  (JNIEnv *, jobject, jobject, jint, jint, jlong);
 
 /*
  * Class:     ionic_Msmq_Queue
  * Method:    nativeSendBytes
- * Signature: ([BLjava/lang/String;[BIZ)I
+ * Signature: ([BLjava/lang/String;[B[BJIIIZ)I
  */
 JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeSendBytes
-  (JNIEnv *, jobject, jbyteArray, jstring, jbyteArray, jint, jboolean);
+  (JNIEnv *, jobject, jbyteArray, jstring, jbyteArray, jbyteArray, jlong, jint, jint, jint, jboolean);
+
+/*
+ * Class:     ionic_Msmq_Queue
+ * Method:    nativeSendToAll
+ * Signature: ([Lionic/Msmq/Queue;[BLjava/lang/String;[B[BJIII[I)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeSendToAll
+  (JNIEnv *, jclass, jobjectArray, jbyteArray, jstring, jbyteArray, jbyteArray, jlong, jint, jint, jint, jintArray);
+
+/*
+ * Class:     ionic_Msmq_Queue
+ * Method:    nativeSetCompression
+ * Signature: (II)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeSetCompression
+  (JNIEnv *, jobject, jint, jint);
+
+/*
+ * Class:     ionic_Msmq_Queue
+ * Method:    nativeSetDedupWindow
+ * Signature: (I)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeSetDedupWindow
+  (JNIEnv *, jobject, jint);
+
+/*
+ * Class:     ionic_Msmq_Queue
+ * Method:    nativeSetChecksum
+ * Signature: (Z)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeSetChecksum
+  (JNIEnv *, jobject, jboolean);
+
+/*
+ * Class:     ionic_Msmq_Queue
+ * Method:    nativePeekHeader
+ * Signature: (I[J[Ljava/lang/String;[B[B)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativePeekHeader
+  (JNIEnv *, jobject, jint, jlongArray, jobjectArray, jbyteArray, jbyteArray);
+
+/*
+ * Class:     ionic_Msmq_Queue
+ * Method:    nativeReceiveCurrent
+ * Signature: (Lionic/Msmq/Message;JIJ)Z
+ */
+JNIEXPORT jboolean JNICALL Java_ionic_Msmq_Queue_nativeReceiveCurrent
+  (JNIEnv *, jobject, jobject, jlong, jint, jlong);
+
+/*
+ * Class:     ionic_Msmq_Queue
+ * Method:    nativeDiscardCurrent
+ * Signature: (JJ)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeDiscardCurrent
+  (JNIEnv *, jobject, jlong, jlong);
+
+/*
+ * Class:     ionic_Msmq_Queue
+ * Method:    nativePurge
+ * Signature: (ILionic/Msmq/Queue$LabelFilter;[I)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativePurge
+  (JNIEnv *, jobject, jint, jobject, jintArray);
+
+/*
+ * Class:     ionic_Msmq_Queue
+ * Method:    nativeSetMaxAge
+ * Signature: (I)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeSetMaxAge
+  (JNIEnv *, jobject, jint);
+
+/*
+ * Class:     ionic_Msmq_Queue
+ * Method:    nativeSetLatencyProbe
+ * Signature: (ZI)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeSetLatencyProbe
+  (JNIEnv *, jobject, jboolean, jint);
+
+/*
+ * Class:     ionic_Msmq_Queue
+ * Method:    nativeSetHeartbeat
+ * Signature: (I)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeSetHeartbeat
+  (JNIEnv *, jobject, jint);
+
+/*
+ * Class:     ionic_Msmq_Queue
+ * Method:    nativeEnableOutbox
+ * Signature: (Ljava/lang/String;II)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeEnableOutbox
+  (JNIEnv *, jobject, jstring, jint, jint);
+
+/*
+ * Class:     ionic_Msmq_Queue
+ * Method:    nativeGetOutboxPending
+ * Signature: ()J
+ */
+JNIEXPORT jlong JNICALL Java_ionic_Msmq_Queue_nativeGetOutboxPending
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     ionic_Msmq_Queue
+ * Method:    nativeStartCapture
+ * Signature: (Ljava/lang/String;I)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeStartCapture
+  (JNIEnv *, jobject, jstring, jint);
+
+/*
+ * Class:     ionic_Msmq_Queue
+ * Method:    nativeStopCapture
+ * Signature: ()I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeStopCapture
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     ionic_Msmq_Queue
+ * Method:    nativeGetStatistics
+ * Signature: ([J)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeGetStatistics
+  (JNIEnv *, jobject, jlongArray);
+
+/*
+ * Class:     ionic_Msmq_Queue
+ * Method:    nativeGetBacklog
+ * Signature: ([J)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeGetBacklog
+  (JNIEnv *, jobject, jlongArray);
+
+/*
+ * Class:     ionic_Msmq_Queue
+ * Method:    nativeSetBacklogInterval
+ * Signature: (I)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeSetBacklogInterval
+  (JNIEnv *, jobject, jint);
 
 /*
  * Class:     ionic_Msmq_Queue
@@ -31,20 +31,172 @@
 // http://msdn.microsoft.com/library/default.asp?url=/library/en-us/msmq/msmq_ref_functions_4o37.asp
 
 #include <stdio.h>
+#include <time.h>
 #include <MqOai.h>
 #include <mq.h>
 
+#include "Log.hpp"
+#include "DedupWindow.hpp"
 #include "MsmqQueue.hpp"
+#include "QueueSelector.hpp"
+#include "Outbox.hpp"
+#include "CaptureLog.hpp"
+#include "BatchEnvelope.hpp"
+#include "BatchingSender.hpp"
+#include "Heartbeat.hpp"
+#include "BufferPool.hpp"
+#include "Crc32c.hpp"
+#include "Lz4Codec.hpp"
+#include "MessageExtension.hpp"
+#include "MessageProps.hpp"
 
 extern void _PrintByteArray(BYTE *b, int offset, int length);
 
 
 
-#if DEBUG
-#define DIAG(...) { printf(__VA_ARGS__); }
-#else
-#define DIAG(...) { if(FALSE) {}}
-#endif
+// nanoseconds elapsed since *pStart, from QueryPerformanceCounter
+static LONGLONG ElapsedNanos(const LARGE_INTEGER *pStart)
+{
+	static LONGLONG freq = 0;
+	LARGE_INTEGER now;
+
+	if (freq == 0) {
+		LARGE_INTEGER f;
+		QueryPerformanceFrequency(&f);
+		freq = f.QuadPart;
+	}
+	QueryPerformanceCounter(&now);
+	return (LONGLONG)((double)(now.QuadPart - pStart->QuadPart) * 1e9 / (double)freq);
+}
+
+
+
+// receiveWith() got a heartbeat, which receiveBytes() drops.  A peek
+// leaves it in the queue, to be removed.
+#define MQJ_S_HEARTBEAT   ((HRESULT)0x200E0001L)
+
+// the payload of an MQJ_EXT_PROBE record
+#define PROBE_LEN         (sizeof(ULONGLONG) + sizeof(DWORD))
+
+
+// The time for a latency probe, in 100 ns units since 1601.  Clocks
+// on different machines agree only as well as they are synchronized;
+// before Windows 8, the time also moves in steps of 10 to 16 ms.
+static ULONGLONG ProbeTime()
+{
+	typedef VOID (WINAPI *GetTimeFn)(FILETIME *);
+	static GetTimeFn pfnGetTime = NULL;
+	FILETIME ft;
+
+	if (pfnGetTime == NULL) {
+		GetTimeFn pfn = (GetTimeFn)GetProcAddress(GetModuleHandleW(L"kernel32.dll"),
+			"GetSystemTimePreciseAsFileTime");
+		pfnGetTime = (pfn != NULL) ? pfn : (GetTimeFn)GetSystemTimeAsFileTime;
+	}
+	pfnGetTime(&ft);
+	return ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+}
+
+
+
+// Microseconds are counted exactly up to 16, then in 8 buckets per
+// power of two, so a percentile is within about 12% of the true value.
+// QueueStatistics.java maps buckets back to times the same way.
+static int TransitBucket(LONGLONG llMicros)
+{
+	if (llMicros < 0) return 0;
+	if (llMicros < 16) return (int)llMicros;
+	int e = 0;
+	while ((llMicros >> e) >= 16) e++;
+	int b = 8 * e + (int)(llMicros >> e);
+	return (b < MQJ_TRANSIT_BUCKETS) ? b : MQJ_TRANSIT_BUCKETS - 1;
+}
+
+
+
+MsmqQueue::MsmqQueue()
+{
+	hQueue = NULL;
+	compressionCodec = MQJ_CODEC_NONE;
+	compressionThreshold = 0;
+	fChecksum = FALSE;
+	dwMaxAge = 0;
+	fProbe = FALSE;
+	dwProducerId = GetCurrentProcessId();
+	hCompletionPort = NULL;
+	selector = NULL;
+	memset((void *)stats, 0, sizeof(stats));
+	wszFormatName[0] = L'\0';
+	dwAccessMode = 0;
+	dwShareMode = MQ_DENY_NONE;
+	outbox = NULL;
+	batcher = NULL;
+	heartbeat = NULL;
+	dwLastSendTick = GetTickCount();
+	capture = NULL;
+	InitializeCriticalSection(&captureLock);
+	InitializeCriticalSection(&reconnectLock);
+	InitializeCriticalSection(&backlogLock);
+	fBacklogValid = FALSE;
+	dwBacklogTick = 0;
+	dwBacklogInterval = MQJ_DEFAULT_BACKLOG_INTERVAL;
+	backlogRefreshing = 0;
+}
+
+
+
+MsmqQueue::~MsmqQueue()
+{
+	DeleteCriticalSection(&backlogLock);
+	DeleteCriticalSection(&reconnectLock);
+	DeleteCriticalSection(&captureLock);
+}
+
+
+
+void MsmqQueue::setCompression(int codec, DWORD dwThreshold)
+{
+	compressionCodec = codec;
+	compressionThreshold = dwThreshold;
+}
+
+
+
+void MsmqQueue::setChecksum(BOOL fEnable)
+{
+	fChecksum = fEnable;
+}
+
+
+
+void MsmqQueue::setMaxAge(DWORD dwSeconds)
+{
+	dwMaxAge = dwSeconds;
+}
+
+
+
+void MsmqQueue::setLatencyProbe(BOOL fEnable, DWORD dwProducer)
+{
+	dwProducerId = dwProducer;
+	fProbe = fEnable;
+}
+
+
+
+void MsmqQueue::addStat(MsmqQueueStat stat, LONGLONG value)
+{
+	InterlockedExchangeAdd64(&stats[stat], value);
+}
+
+
+
+LONGLONG MsmqQueue::getStat(MsmqQueueStat stat)
+{
+	// an interlocked read; a plain one could tear on Win32
+	return InterlockedCompareExchange64(&stats[stat], 0, 0);
+}
+
 
 
 HRESULT MsmqQueue::createQueue(char *szQueuePath,
@@ -65,7 +217,7 @@ HRESULT MsmqQueue::createQueue(char *szQueuePath,
 	HRESULT        aQueueStatus[NUMBEROFPROPERTIES];
 	DWORD          i = 0;
 
-	if (szQueuePath == NULL)
+	if (szQueuePath == NULL || szQueueLabel == NULL)
 		return MQ_ERROR_INVALID_PARAMETER;
 
 	WCHAR wszPathName[MQ_MAX_Q_NAME_LEN];
@@ -76,10 +228,10 @@ HRESULT MsmqQueue::createQueue(char *szQueuePath,
 		(LPCSTR)szQueuePath,
 		len,
 		(LPWSTR)wszPathName,
-		(int) sizeof(wszPathName)) == 0)
+		(int) (sizeof(wszPathName) / sizeof(WCHAR))) == 0)
 		return MQ_ERROR_INVALID_PARAMETER;
 
-	if (len < sizeof(wszPathName))
+	if (len < sizeof(wszPathName) / sizeof(WCHAR))
 		wszPathName[len] = 0; // need this to terminate
 
 	WCHAR wszLabel[MQ_MAX_Q_LABEL_LEN];
@@ -90,15 +242,16 @@ HRESULT MsmqQueue::createQueue(char *szQueuePath,
 		(LPCSTR)szQueueLabel,
 		len,
 		(LPWSTR)wszLabel,
-		(int) sizeof(wszLabel)) == 0)
+		(int) (sizeof(wszLabel) / sizeof(WCHAR))) == 0
+		&& len > 0)
 	{
 		return MQ_ERROR_INVALID_PARAMETER;
 	}
-	if (len < sizeof(wszLabel))
+	if (len < sizeof(wszLabel) / sizeof(WCHAR))
 		wszLabel[len] = 0; // need this to terminate
 
 
-	DIAG("attempting to create queue with name= '%S', label='%S'\n", wszPathName, wszLabel);
+	LOG_DEBUG("attempting to create queue with name= '%S', label='%S'", wszPathName, wszLabel);
 
 	// Set the PROPID_Q_PATHNAME property with the path name provided.
 	aQueuePropId[i] = PROPID_Q_PATHNAME;
@@ -130,6 +283,14 @@ HRESULT MsmqQueue::createQueue(char *szQueuePath,
 		&QueueProps,         // Address of queue property structure
 		wszFormatName,       // Pointer to format name buffer
 		p_dwFormatNameBufferLength);  // Pointer to receive the queue's format name length
+
+	// the caller may want to open it all the same
+	if (hr == MQ_ERROR_QUEUE_EXISTS)
+	{
+		HRESULT hrLookup = MQPathNameToFormatName(wszPathName, wszFormatName, p_dwFormatNameBufferLength);
+		if (FAILED(hrLookup))
+			wszFormatName[0] = L'\0';
+	}
 	return hr;
 
 };
@@ -160,12 +321,12 @@ HRESULT MsmqQueue::deleteQueue(char *szQueuePath)
 		(LPCSTR)szDestFormatName,
 		len,
 		(LPWSTR)wszPathName,
-		(int) sizeof(wszPathName)) == 0)
+		(int) (sizeof(wszPathName) / sizeof(WCHAR))) == 0)
 	{
 		return MQ_ERROR_INVALID_PARAMETER;
 	}
 
-	if (len < sizeof(wszPathName))
+	if (len < sizeof(wszPathName) / sizeof(WCHAR))
 		wszPathName[len] = 0; // need this to terminate
 
 	hr = MQDeleteQueue(wszPathName);
@@ -182,7 +343,7 @@ HRESULT MsmqQueue::openQueue(char *szQueuePath, int openmode)
 	// removed initialization
 	//CHAR szDestFormatName[MQ_MAX_Q_NAME_LEN] = "DIRECT=OS:";
 	CHAR  szDestFormatName[MQ_MAX_Q_NAME_LEN];
-	WCHAR wszDestFormatName[2 * MQ_MAX_Q_NAME_LEN];
+	WCHAR *wszDestFormatName = wszFormatName;   // kept, for MQMgmtGetInfo
 	long  accessmode = openmode;  // bit field: MQ_{RECEIVE,SEND,PEEK,ADMIN}_ACCESS,
 	long  sharemode = MQ_DENY_NONE;
 
@@ -207,7 +368,7 @@ HRESULT MsmqQueue::openQueue(char *szQueuePath, int openmode)
 		(LPCSTR)szDestFormatName,
 		(int) sizeof(szDestFormatName),
 		(LPWSTR)wszDestFormatName,
-		(int) sizeof(wszDestFormatName)) == 0)
+		(int) (sizeof(wszFormatName) / sizeof(WCHAR))) == 0)
 	{
 		return MQ_ERROR_INVALID_PARAMETER;
 	}
@@ -215,11 +376,8 @@ HRESULT MsmqQueue::openQueue(char *szQueuePath, int openmode)
 	HRESULT hr = MQ_OK;
 
 	// dinoch Mon, 18 Apr 2005  16:12
-	DIAG("open: ");
-	DIAG("fmtname(%ls) ", wszDestFormatName);
-	DIAG("accessmode(%d) ", accessmode);
-	DIAG("sharemode(%d) ", sharemode);
-	DIAG("\n");
+	LOG_DEBUG("open: fmtname(%ls) accessmode(%d) sharemode(%d)",
+		wszDestFormatName, accessmode, sharemode);
 
 	hr = MQOpenQueue(
 		wszDestFormatName,           // Format name of the queue
@@ -235,7 +393,7 @@ HRESULT MsmqQueue::openQueue(char *szQueuePath, int openmode)
 		int iCount = 0;
 		while ((hr == MQ_ERROR_QUEUE_NOT_FOUND) && (iCount < 120))
 		{
-			DIAG(".");
+			LOG_TRACE("open: queue not found, retry %d", iCount);
 
 			// Wait a bit.
 			iCount++;
@@ -253,13 +411,214 @@ HRESULT MsmqQueue::openQueue(char *szQueuePath, int openmode)
 	{
 		MQCloseQueue(hQueue);
 	}
+	else
+	{
+		dwAccessMode = accessmode;
+		dwShareMode = sharemode;
+	}
 
 	return hr;
 };
 
 
 
+// Whether hr, from an operation on h, means the handle died under us,
+// as when the queue manager restarts, rather than that the operation
+// failed.  An operation that was cancelled because another thread
+// reconnected and closed h is as good as stale.
+BOOL MsmqQueue::isStaleHandle(HRESULT hr, QUEUEHANDLE h)
+{
+	return hr == MQ_ERROR_STALE_HANDLE ||
+		hr == MQ_ERROR_INVALID_HANDLE ||
+		hr == MQ_ERROR_SERVICE_NOT_AVAILABLE ||
+		(hr == MQ_ERROR_OPERATION_CANCELLED && h != hQueue);
+}
+
+
+
+// Reopens the handle from the cached format name, if it is still
+// hStale; another thread that saw the same failure may have done so
+// already.  Does not go through the long retry of openQueue: the queue
+// existed a moment ago.
+//
+// The new handle is swapped in before the stale one is closed, so that
+// a thread that reads hQueue meanwhile gets one or the other; those
+// still waiting on the stale one are cancelled by the close, and retry
+// on the new one.
+HRESULT MsmqQueue::reconnect(QUEUEHANDLE hStale)
+{
+	HRESULT hr = MQ_OK;
+
+	EnterCriticalSection(&reconnectLock);
+	if (hQueue == hStale && wszFormatName[0] != L'\0')
+	{
+		QUEUEHANDLE h = NULL;
+		DWORD dwDelay = MQJ_RECONNECT_FIRST_DELAY;
+		for (int i = 0; i < MQJ_RECONNECT_ATTEMPTS; i++)
+		{
+			if (i > 0) {
+				Sleep(dwDelay);
+				dwDelay *= 4;
+			}
+			hr = MQOpenQueue(wszFormatName, dwAccessMode, dwShareMode, &h);
+			if (SUCCEEDED(hr))
+				break;
+			h = NULL;
+		}
+
+		// on failure hQueue becomes NULL, so the next call fails with
+		// MQ_ERROR_INVALID_HANDLE, and tries again
+		hQueue = h;
+
+		// the new handle is not bound to the completion port of the
+		// selector the queue was registered with; bind it, and peek
+		// again, or drop the queue from the selector
+		hCompletionPort = NULL;
+		if (h != NULL)
+			QueueSelector::reattach(this);
+		else
+			QueueSelector::detach(this);
+
+		if (hStale != NULL)
+			MQCloseQueue(hStale);
+
+		if (SUCCEEDED(hr)) {
+			addStat(STAT_RECONNECTS, 1);
+			LOG_INFO("reconnected to %ls", wszFormatName);
+		}
+		else {
+			LOG_WARN("cannot reconnect to %ls (hr=0x%08x)", wszFormatName, hr);
+		}
+	}
+	LeaveCriticalSection(&reconnectLock);
+
+	return hr;
+}
+
+
+
+
+
+
+
+HRESULT MsmqQueue::setDedupWindow(DWORD dwCapacity)
+{
+	return dedup.resize(dwCapacity);
+}
+
+
+
+HRESULT MsmqQueue::enableOutbox(const WCHAR *wszDirectory, DWORD cbSegment, int cMaxSegments)
+{
+	if ((dwAccessMode & MQ_SEND_ACCESS) == 0) return MQ_ERROR_INVALID_HANDLE;
+	if (outbox != NULL) return MQ_ERROR_INVALID_PARAMETER;
+
+	Outbox *o = new Outbox(this);
+	HRESULT hr = o->open(wszDirectory, cbSegment, cMaxSegments);
+	if (SUCCEEDED(hr) && InterlockedCompareExchangePointer((PVOID volatile *)&outbox, o, NULL) != NULL)
+		hr = MQ_ERROR_INVALID_PARAMETER;   // enabled by another thread meanwhile
+	if (FAILED(hr))
+		delete o;
+	return hr;
+}
+
+
+
+HRESULT MsmqQueue::enableBatching(DWORD cbMaxBatch, DWORD dwMaxDelay, const WCHAR *wszLabel, BOOL fTransactional)
+{
+	if ((dwAccessMode & MQ_SEND_ACCESS) == 0) return MQ_ERROR_INVALID_HANDLE;
+	if (batcher != NULL) return MQ_ERROR_INVALID_PARAMETER;
+
+	BatchingSender *b = new BatchingSender(this);
+	HRESULT hr = b->open(cbMaxBatch, dwMaxDelay, wszLabel, fTransactional);
+	if (SUCCEEDED(hr) && InterlockedCompareExchangePointer((PVOID volatile *)&batcher, b, NULL) != NULL)
+		hr = MQ_ERROR_INVALID_PARAMETER;   // enabled by another thread meanwhile
+	if (FAILED(hr))
+		delete b;
+	return hr;
+}
+
+
+
+void MsmqQueue::disableBatching()
+{
+	BatchingSender *b = (BatchingSender *)InterlockedExchangePointer((PVOID volatile *)&batcher, NULL);
+	if (b != NULL)
+		delete b;   // sends what is pending
+}
+
+
+
+HRESULT MsmqQueue::setHeartbeat(DWORD dwInterval)
+{
+	if ((dwAccessMode & MQ_SEND_ACCESS) == 0) return MQ_ERROR_INVALID_HANDLE;
+
+	Heartbeat *h = NULL;
+	if (dwInterval > 0) {
+		h = new Heartbeat(this);
+		HRESULT hr = h->open(dwInterval);
+		if (FAILED(hr)) {
+			delete h;
+			return hr;
+		}
+	}
+
+	// the old one, if any, is stopped after the new one starts
+	Heartbeat *old = (Heartbeat *)InterlockedExchangePointer((PVOID volatile *)&heartbeat, h);
+	if (old != NULL)
+		delete old;
+	return MQ_OK;
+}
+
+
+
+HRESULT MsmqQueue::startCapture(const WCHAR *wszPath, DWORD cbMax)
+{
+	if ((dwAccessMode & MQ_RECEIVE_ACCESS) == 0) return MQ_ERROR_INVALID_HANDLE;
+
+	CaptureLog *c = new CaptureLog();
+	HRESULT hr = c->create(wszPath, cbMax);
 
+	EnterCriticalSection(&captureLock);
+	if (SUCCEEDED(hr) && capture != NULL)
+		hr = MQ_ERROR_INVALID_PARAMETER;   // already capturing
+	if (SUCCEEDED(hr))
+		capture = c;
+	LeaveCriticalSection(&captureLock);
+
+	if (FAILED(hr))
+		delete c;
+	return hr;
+}
+
+
+
+void MsmqQueue::stopCapture()
+{
+	EnterCriticalSection(&captureLock);
+	CaptureLog *c = capture;
+	capture = NULL;
+	LeaveCriticalSection(&captureLock);
+
+	if (c != NULL)
+		delete c;
+}
+
+
+
+void MsmqQueue::captureMessage(BYTE *pbMessageBody,
+	DWORD dwBodyLen,
+	WCHAR *wszMessageLabel,
+	BYTE  *pCorrelationId,
+	int   iPriority,
+	DWORD cBatchRecords)
+{
+	EnterCriticalSection(&captureLock);
+	if (capture != NULL)
+		capture->append(pbMessageBody, dwBodyLen, wszMessageLabel,
+			pCorrelationId, PROPID_M_CORRELATIONID_SIZE, iPriority, cBatchRecords);
+	LeaveCriticalSection(&captureLock);
+}
 
 
 
@@ -267,158 +626,682 @@ HRESULT MsmqQueue::receiveBytes(BYTE  **ppbMessageBody,
 	DWORD *dwpBodyLen,
 	WCHAR *wszMessageLabel,
 	BYTE  *pCorrelationId, // sz PROPID_M_CORRELATIONID_SIZE
+	BYTE  *pMessageId,     // sz PROPID_M_MSGID_SIZE
+	BYTE  *pPriority,
+	DWORD *pcBatchRecords,
 	DWORD dwTimeOut,
-	int   ReadOrPeek
+	int   ReadOrPeek,
+	ITransaction *pTransaction
 	)
 {
-	// for receive message
-	const int     NUMBEROFPROPERTIES = 6;
-	MQMSGPROPS    MsgProps;
-	MQPROPVARIANT fields[NUMBEROFPROPERTIES];
-	MSGPROPID     propId[NUMBEROFPROPERTIES];
-	DWORD         i = 0;
-	DWORD         dwAction = (ReadOrPeek == 1) ? MQ_ACTION_RECEIVE : MQ_ACTION_PEEK_CURRENT;
-	HRESULT       hr = S_OK;
-	int           iBodyLen = 0;
-	int           iBody = 0;
-	int           iLabelLen = 0;
-	ULONG         ulLabelLen = MQ_MAX_MSG_LABEL_LEN;
-
-	// initialize all out variables to NULL
-	if (NULL != wszMessageLabel)
-		*wszMessageLabel = L'\0';
-	if (NULL != pCorrelationId)
-		memset(pCorrelationId, 0, PROPID_M_CORRELATIONID_SIZE);
+	DWORD   dwStart = GetTickCount();
+	BYTE    messageId[PROPID_M_MSGID_SIZE];
+	BYTE    dedupId[MQJ_DEDUP_ID_SIZE];
+	DWORD   cBatchRecords;
+
+	// the dedup window needs the ID even if the caller does not, and
+	// the capture the record count
+	if (NULL == pMessageId)
+		pMessageId = messageId;
+	if (NULL == pcBatchRecords)
+		pcBatchRecords = &cBatchRecords;
+
+	// A receive in a transaction may yet be aborted, and the message
+	// put back; recording its ID now would drop it when it comes again.
+	BOOL fCheckDuplicates = (pTransaction == MQ_NO_TRANSACTION || pTransaction == MQ_SINGLE_MESSAGE);
+
+	for (;;)
+	{
+		HRESULT hr;
+		for (int iAttempt = 0; ; iAttempt++)
+		{
+			QUEUEHANDLE h = hQueue;
+			DWORD dwWait = dwTimeOut;
+			hr = (dwMaxAge != 0 && ReadOrPeek == 1) ? dropExpired(&dwWait, pTransaction) : MQ_OK;
+			if (SUCCEEDED(hr))
+				hr = receiveOnce(ppbMessageBody,
+					dwpBodyLen,
+					wszMessageLabel,
+					pCorrelationId,
+					pMessageId,
+					pPriority,
+					pcBatchRecords,
+					dedupId,
+					dwWait,
+					ReadOrPeek,
+					NULL,
+					pTransaction);
+
+			// on a stale handle, reopen it and try once more
+			if (iAttempt > 0 || !isStaleHandle(hr, h) || FAILED(reconnect(h)))
+				break;
+		}
 
-	int MAX_INITIAL_BODY_SIZE = 1024;
-	*ppbMessageBody = new BYTE[MAX_INITIAL_BODY_SIZE];
+		if (hr != MQJ_S_HEARTBEAT)
+		{
+			// Peeks neither check nor record IDs: the message is still
+			// there, to be received later.
+			if (FAILED(hr) || ReadOrPeek != 1)
+				return hr;
+
+			if (!fCheckDuplicates || !dedup.checkAndAdd(dedupId)) {
+				if (capture != NULL)
+					captureMessage(*ppbMessageBody, *dwpBodyLen, wszMessageLabel, pCorrelationId,
+						(pPriority != NULL) ? *pPriority : MQ_DEFAULT_PRIORITY, *pcBatchRecords);
+				return hr;
+			}
+			addStat(STAT_DUPLICATES_DROPPED, 1);
+		}
 
-	// prepare the property array PROPVARIANT of
-	// message properties that we want to receive
-	propId[i] = PROPID_M_BODY_SIZE;
-	fields[i].vt = VT_UI4;
-	fields[i].ulVal = *dwpBodyLen;
-	iBodyLen = i;
-	i++;
+		// A heartbeat or a duplicate.  It is off the queue now, so drop
+		// it, and wait for the next one in what is left of the timeout.
+		BufferPool::release(*ppbMessageBody);
+		*ppbMessageBody = NULL;
 
-	propId[i] = PROPID_M_BODY;
-	fields[i].vt = VT_VECTOR | VT_UI1;
-	fields[i].caub.cElems = *dwpBodyLen;
-	fields[i].caub.pElems = (unsigned char *)*ppbMessageBody;
-	iBody = i;
-	i++;
+		// a peeked heartbeat is still at the head; peekHeader() finds
+		// its lookup ID, and removes it
+		if (ReadOrPeek != 1) {
+			MessageHeader header;
+			hr = peekHeader(&header, 0);
+			if (FAILED(hr) && hr != MQ_ERROR_IO_TIMEOUT)
+				return hr;
+		}
 
-	if (NULL != pCorrelationId)
-	{
-		propId[i] = PROPID_M_CORRELATIONID;
-		fields[i].vt = VT_VECTOR | VT_UI1;
-		fields[i].caub.pElems = (LPBYTE)pCorrelationId;
-		fields[i].caub.cElems = PROPID_M_CORRELATIONID_SIZE;
-		i++;
+		if (dwTimeOut != INFINITE) {
+			DWORD dwElapsed = GetTickCount() - dwStart;
+			dwTimeOut = (dwElapsed >= dwTimeOut) ? 0 : dwTimeOut - dwElapsed;
+			dwStart += dwElapsed;
+		}
 	}
+}
 
-	propId[i] = PROPID_M_LABEL_LEN;
-	fields[i].vt = VT_UI4;
-	fields[i].ulVal = ulLabelLen;
-	iLabelLen = i;
-	i++;
 
-	propId[i] = PROPID_M_LABEL;
-	fields[i].vt = VT_LPWSTR;
-	fields[i].pwszVal = wszMessageLabel;
-	i++;
 
-	// Set the MQMSGPROPS structure
-	MsgProps.cProp = i;            // Number of properties.
-	MsgProps.aPropID = propId;      // Id of properties.
-	MsgProps.aPropVar = fields; // Value of properties.
-	MsgProps.aStatus = NULL;         // No Error report.
-
-	hr = MQReceiveMessage(
-		hQueue,              // handle to the Queue.
-		dwTimeOut,           // Max time (msec) to wait for the message.
-		dwAction,            // Action.
-		&MsgProps,           // properties to retrieve.
-		NULL,                // No overlaped structure.
-		NULL,                // No callback function.
-		NULL,                // No Cursor.
-		NULL                 // transaction
-		);
+HRESULT MsmqQueue::receiveOnce(BYTE  **ppbMessageBody,
+	DWORD *dwpBodyLen,
+	WCHAR *wszMessageLabel,
+	BYTE  *pCorrelationId, // sz PROPID_M_CORRELATIONID_SIZE
+	BYTE  *pMessageId,     // sz PROPID_M_MSGID_SIZE
+	BYTE  *pPriority,
+	DWORD *pcBatchRecords,
+	BYTE  *pDedupId,       // sz MQJ_DEDUP_ID_SIZE
+	DWORD dwTimeOut,
+	int   ReadOrPeek,
+	const ULONGLONG *pLookupId,
+	ITransaction *pTransaction
+	)
+{
+	typedef HRESULT (MsmqQueue::*ReceiveFn)(BYTE **, DWORD *, WCHAR *, BYTE *, BYTE *,
+		BYTE *, DWORD *, BYTE *, DWORD, int, const ULONGLONG *, ITransaction *);
+
+	// one layout for each combination of the optional properties,
+	// indexed by their MQJ_RECV_ flags
+	static const ReceiveFn receivers[MQJ_RECV_LAYOUTS] = {
+		&MsmqQueue::receiveWith<0>,
+		&MsmqQueue::receiveWith<1>,
+		&MsmqQueue::receiveWith<2>,
+		&MsmqQueue::receiveWith<3>,
+		&MsmqQueue::receiveWith<4>,
+		&MsmqQueue::receiveWith<5>,
+		&MsmqQueue::receiveWith<6>,
+		&MsmqQueue::receiveWith<7>
+	};
+
+	// initialize all out variables to NULL
+	if (NULL != wszMessageLabel)
+		*wszMessageLabel = L'\0';
+	if (NULL != pCorrelationId)
+		memset(pCorrelationId, 0, PROPID_M_CORRELATIONID_SIZE);
+	if (NULL != pMessageId)
+		memset(pMessageId, 0, PROPID_M_MSGID_SIZE);
+	if (NULL != pPriority)
+		*pPriority = 0;
+	if (NULL != pcBatchRecords)
+		*pcBatchRecords = 0;
+	if (NULL != pDedupId)
+		memset(pDedupId, 0, MQJ_DEDUP_ID_SIZE);
+
+	int props = ((NULL != pCorrelationId) ? MQJ_RECV_CORRELATIONID : 0)
+		| ((NULL != pMessageId) ? MQJ_RECV_MSGID : 0)
+		| ((NULL != pPriority) ? MQJ_RECV_PRIORITY : 0);
+
+	return (this->*receivers[props])(ppbMessageBody,
+		dwpBodyLen,
+		wszMessageLabel,
+		pCorrelationId,
+		pMessageId,
+		pPriority,
+		pcBatchRecords,
+		pDedupId,
+		dwTimeOut,
+		ReadOrPeek,
+		pLookupId,
+		pTransaction);
+}
+
+
+
+template <int Props>
+HRESULT MsmqQueue::receiveWith(BYTE  **ppbMessageBody,
+	DWORD *dwpBodyLen,
+	WCHAR *wszMessageLabel,
+	BYTE  *pCorrelationId,
+	BYTE  *pMessageId,
+	BYTE  *pPriority,
+	DWORD *pcBatchRecords,
+	BYTE  *pDedupId,
+	DWORD dwTimeOut,
+	int   ReadOrPeek,
+	const ULONGLONG *pLookupId,
+	ITransaction *pTransaction
+	)
+{
+	typedef ReceiveLayout<Props> L;
+	L             layout;
+	HRESULT       hr = S_OK;
+	BYTE          extension[MQJ_MAX_EXTENSION_LEN];
+	BYTE          *pbExtension = extension;   // pooled if a foreign extension overflows
+
+	// The body comes from the BufferPool; the caller must return it with
+	// BufferPool::release().  Most messages fit in the smallest class, so
+	// start there and size up only on MQ_ERROR_BUFFER_OVERFLOW.
+	*ppbMessageBody = BufferPool::alloc(BUFFERPOOL_MIN_SIZE);
+	if (NULL == *ppbMessageBody)
+		return MQ_ERROR_INSUFFICIENT_RESOURCES;
+
+	layout.var[L::BODY_SIZE].ulVal = 0;
+	layout.setVector(L::BODY, *ppbMessageBody, BufferPool::capacity(*ppbMessageBody));
+	layout.var[L::LABEL_LEN].ulVal = MQ_MAX_MSG_LABEL_LEN;
+	layout.var[L::LABEL].pwszVal = wszMessageLabel;
+	// the extension carries the compression marker, if any
+	layout.var[L::EXTENSION_LEN].ulVal = 0;
+	layout.setVector(L::EXTENSION, extension, sizeof(extension));
+	if (Props & MQJ_RECV_CORRELATIONID)
+		layout.setVector(L::CORRELATIONID, pCorrelationId, PROPID_M_CORRELATIONID_SIZE);
+	if (Props & MQJ_RECV_MSGID)
+		layout.setVector(L::MSGID, pMessageId, PROPID_M_MSGID_SIZE);
+
+	hr = receiveProps(&layout.props, dwTimeOut, ReadOrPeek, pLookupId, pTransaction);
 
 	// handle the case where the buffer is too small
 	do
 	{
 		if (MQ_ERROR_BUFFER_OVERFLOW == hr)
 		{
-			if (NULL != *ppbMessageBody)
+			BufferPool::release(*ppbMessageBody);
+			*ppbMessageBody = BufferPool::alloc(layout.var[L::BODY_SIZE].ulVal);
+			if (NULL == *ppbMessageBody)
 			{
-				delete[] * ppbMessageBody;
-				*ppbMessageBody = NULL;
+				if (pbExtension != extension)
+					BufferPool::release(pbExtension);
+				return MQ_ERROR_INSUFFICIENT_RESOURCES;
 			}
-			INT iNewMsgLen = fields[iBodyLen].ulVal;
-			*ppbMessageBody = new BYTE[iNewMsgLen];
-
-			fields[iBody].caub.cElems =
-				fields[iBodyLen].ulVal;
-			fields[iBody].caub.pElems =
-				(unsigned char *)*ppbMessageBody;
-
-			hr = MQReceiveMessage(
-				hQueue,              // handle to the Queue.
-				dwTimeOut,           // Max time (msec) to wait for the message.
-				dwAction,            // Action.
-				&MsgProps,           // properties to retrieve.
-				NULL,                // No overlapped structure.
-				NULL,                // No callback function.
-				NULL,                // No Cursor.
-				NULL                 // transaction
-				);
+			layout.setVector(L::BODY, *ppbMessageBody, BufferPool::capacity(*ppbMessageBody));
+
+			// ours are small, but another sender's extension may not be
+			if (layout.var[L::EXTENSION_LEN].ulVal > layout.var[L::EXTENSION].caub.cElems)
+			{
+				if (pbExtension != extension)
+					BufferPool::release(pbExtension);
+				pbExtension = BufferPool::alloc(layout.var[L::EXTENSION_LEN].ulVal);
+				if (NULL == pbExtension)
+				{
+					BufferPool::release(*ppbMessageBody);
+					*ppbMessageBody = NULL;
+					return MQ_ERROR_INSUFFICIENT_RESOURCES;
+				}
+				layout.setVector(L::EXTENSION, pbExtension, BufferPool::capacity(pbExtension));
+			}
+
+			hr = receiveProps(&layout.props, dwTimeOut, ReadOrPeek, pLookupId, pTransaction);
 		}
 
 		if (hr == MQ_ERROR_LABEL_BUFFER_TOO_SMALL)
 		{
-			fields[iLabelLen].ulVal = ulLabelLen;
-			fields[iLabelLen + 1].pwszVal = wszMessageLabel;
-
-			hr = MQReceiveMessage(
-				hQueue,              // handle to the Queue.
-				dwTimeOut,           // Max time (msec) to wait for the message.
-				dwAction,            // Action.
-				&MsgProps,           // properties to retrieve.
-				NULL,                // No overlapped structure.
-				NULL,                // No callback function.
-				NULL,                // No Cursor.
-				NULL                 // transaction
-				);
+			layout.var[L::LABEL_LEN].ulVal = MQ_MAX_MSG_LABEL_LEN;
+			layout.var[L::LABEL].pwszVal = wszMessageLabel;
+
+			hr = receiveProps(&layout.props, dwTimeOut, ReadOrPeek, pLookupId, pTransaction);
 		}
 	} while (MQ_ERROR_BUFFER_OVERFLOW == hr);
 
 	if (FAILED(hr))
 	{
-		delete[] * ppbMessageBody;
+		BufferPool::release(*ppbMessageBody);
 		*ppbMessageBody = NULL;
+		if (pbExtension != extension)
+			BufferPool::release(pbExtension);
 		return hr;
 	}
 
-	//     printf("receive: hr 0x%08x\n", hr );
-	//     printf("       : body: %d bytes (0x%x)\n", fields[iBodyLen].ulVal * 2,
-	//            fields[iBodyLen].ulVal * 2);
-	//     _PrintByteArray((BYTE*)*ppbMessageBody, 0, fields[iBodyLen].ulVal * 2);
-	//     printf("       : label: %d bytes (0x%X)\n", fields[iLabelLen].ulVal * 2,
-	//            fields[iLabelLen].ulVal * 2);
-	//     _PrintByteArray((BYTE*)wszMessageLabel, 0, fields[iLabelLen].ulVal * 2);
+	*dwpBodyLen = layout.var[L::BODY_SIZE].ulVal;
+	if (Props & MQJ_RECV_PRIORITY)
+		*pPriority = layout.var[L::PRIORITY].bVal;
+	addStat(STAT_MESSAGES_RECEIVED, 1);
+	addStat(STAT_BYTES_RECEIVED, *dwpBodyLen);
 
-	*dwpBodyLen = fields[iBodyLen].ulVal;
+	// a peek leaves the probe to be counted when the message is taken
+	BOOL fHeartbeat = (ReadOrPeek == 1)
+		? recordProbe(pbExtension, layout.var[L::EXTENSION_LEN].ulVal)
+		: MessageExtension::find(pbExtension, layout.var[L::EXTENSION_LEN].ulVal,
+			MQJ_EXT_HEARTBEAT, NULL) != NULL;
+
+	if (NULL != pDedupId)
+	{
+		BYTE cbRecord = 0;
+		const BYTE *pRecord = MessageExtension::find(pbExtension,
+			layout.var[L::EXTENSION_LEN].ulVal, MQJ_EXT_DEDUP_ID, &cbRecord);
+		if (pRecord != NULL && cbRecord >= MQJ_DEDUP_ID_SIZE)
+			memcpy(pDedupId, pRecord, MQJ_DEDUP_ID_SIZE);
+		else if (Props & MQJ_RECV_MSGID)
+			memcpy(pDedupId, pMessageId, MQJ_DEDUP_ID_SIZE);
+	}
+
+	hr = unwrapBody(ppbMessageBody, dwpBodyLen, pcBatchRecords, pbExtension,
+		layout.var[L::EXTENSION_LEN].ulVal);
+	if (pbExtension != extension)
+		BufferPool::release(pbExtension);
+	if (FAILED(hr))
+		return hr;
 
 	if (0 == *dwpBodyLen)
 	{
-		delete[] * ppbMessageBody;
+		BufferPool::release(*ppbMessageBody);
 		*ppbMessageBody = NULL;
 	}
 
-	ulLabelLen = fields[iLabelLen].ulVal;
+	return fHeartbeat ? MQJ_S_HEARTBEAT : hr;
+};
+
+
+
+HRESULT MsmqQueue::receiveProps(MQMSGPROPS *pProps,
+	DWORD dwTimeOut,
+	int   ReadOrPeek,
+	const ULONGLONG *pLookupId,
+	ITransaction *pTransaction
+	)
+{
+	if (NULL != pLookupId)
+		return MQReceiveMessageByLookupId(hQueue,
+			*pLookupId,
+			(ReadOrPeek == 1) ? MQ_LOOKUP_RECEIVE_CURRENT : MQ_LOOKUP_PEEK_CURRENT,
+			pProps,
+			NULL,                // No overlapped structure.
+			NULL,                // No callback function.
+			pTransaction);
+
+	return MQReceiveMessage(hQueue,
+		dwTimeOut,               // Max time (msec) to wait for the message.
+		(ReadOrPeek == 1) ? MQ_ACTION_RECEIVE : MQ_ACTION_PEEK_CURRENT,
+		pProps,
+		NULL,                    // No overlapped structure.
+		NULL,                    // No callback function.
+		NULL,                    // No Cursor.
+		pTransaction);
+}
+
+
+
+HRESULT MsmqQueue::peekHeader(MessageHeader *pHeader, DWORD dwTimeOut)
+{
+	enum {
+		LOOKUPID = 0, BODY_SIZE, PRIORITY, SENTTIME, ARRIVEDTIME,
+		LABEL_LEN, LABEL, CORRELATIONID, MSGID,
+		EXTENSION_LEN, EXTENSION,          // last, to be dropped on overflow
+		COUNT
+	};
+	PropertyLayout<COUNT> layout;
+	BYTE          extension[MQJ_MAX_EXTENSION_LEN];
+	HRESULT       hr;
+
+	layout.define(LOOKUPID, PROPID_M_LOOKUPID, VT_UI8);
+	layout.define(BODY_SIZE, PROPID_M_BODY_SIZE, VT_UI4);
+	layout.define(PRIORITY, PROPID_M_PRIORITY, VT_UI1);
+	layout.define(SENTTIME, PROPID_M_SENTTIME, VT_UI4);
+	layout.define(ARRIVEDTIME, PROPID_M_ARRIVEDTIME, VT_UI4);
+	layout.define(LABEL_LEN, PROPID_M_LABEL_LEN, VT_UI4);
+	layout.define(LABEL, PROPID_M_LABEL, VT_LPWSTR);
+	layout.define(CORRELATIONID, PROPID_M_CORRELATIONID, VT_VECTOR | VT_UI1);
+	layout.define(MSGID, PROPID_M_MSGID, VT_VECTOR | VT_UI1);
+	layout.define(EXTENSION_LEN, PROPID_M_EXTENSION_LEN, VT_UI4);
+	layout.define(EXTENSION, PROPID_M_EXTENSION, VT_VECTOR | VT_UI1);
+
+	layout.var[LABEL].pwszVal = pHeader->wszLabel;
+	layout.setVector(CORRELATIONID, pHeader->correlationId, PROPID_M_CORRELATIONID_SIZE);
+	layout.setVector(MSGID, pHeader->messageId, PROPID_M_MSGID_SIZE);
+	layout.setVector(EXTENSION, extension, sizeof(extension));
+
+	DWORD dwStart = GetTickCount();
+	for (;;)
+	{
+		layout.props.cProp = COUNT;
+		for (int iAttempt = 0; ; iAttempt++)
+		{
+			QUEUEHANDLE h = hQueue;
+			layout.var[LABEL_LEN].ulVal = MQ_MAX_MSG_LABEL_LEN;
+			layout.var[EXTENSION_LEN].ulVal = 0;
+			hr = receiveProps(&layout.props, dwTimeOut, 0, NULL, MQ_NO_TRANSACTION);
+
+			// another sender's extension may not fit; the body size is then
+			// the size as sent
+			if (hr == MQ_ERROR_BUFFER_OVERFLOW && layout.props.cProp == COUNT) {
+				layout.props.cProp = EXTENSION_LEN;
+				layout.var[EXTENSION_LEN].ulVal = 0;
+				continue;
+			}
+
+			// on a stale handle, reopen it and try once more
+			if (iAttempt > 0 || !isStaleHandle(hr, h) || FAILED(reconnect(h)))
+				break;
+		}
+		if (FAILED(hr)) return hr;
+
+		// ours fit, so an extension that did not is not a heartbeat
+		if (layout.props.cProp < COUNT ||
+			MessageExtension::find(extension, layout.var[EXTENSION_LEN].ulVal,
+				MQJ_EXT_HEARTBEAT, NULL) == NULL)
+			break;
+
+		hr = discardHeartbeat(layout.var[LOOKUPID].uhVal.QuadPart,
+			extension, layout.var[EXTENSION_LEN].ulVal);
+		if (FAILED(hr)) return hr;
+
+		if (dwTimeOut != INFINITE) {
+			DWORD dwElapsed = GetTickCount() - dwStart;
+			dwTimeOut = (dwElapsed >= dwTimeOut) ? 0 : dwTimeOut - dwElapsed;
+			dwStart += dwElapsed;
+		}
+	}
+
+	pHeader->lookupId = layout.var[LOOKUPID].uhVal.QuadPart;
+	pHeader->dwBodySize = layout.var[BODY_SIZE].ulVal;
+	pHeader->priority = layout.var[PRIORITY].bVal;
+	pHeader->dwSentTime = layout.var[SENTTIME].ulVal;
+	pHeader->dwArrivedTime = layout.var[ARRIVEDTIME].ulVal;
+
+	BYTE cbRecord = 0;
+	const BYTE *pRecord = (layout.props.cProp < COUNT) ? NULL :
+		MessageExtension::find(extension, layout.var[EXTENSION_LEN].ulVal,
+			MQJ_EXT_COMPRESSION, &cbRecord);
+	if (pRecord != NULL && cbRecord >= 1 + sizeof(DWORD))
+		memcpy(&pHeader->dwBodySize, pRecord + 1, sizeof(DWORD));
+
+	return MQ_OK;
+}
+
+
+
+HRESULT MsmqQueue::receiveByLookupId(ULONGLONG lookupId,
+	BYTE  **ppbMessageBody,
+	DWORD *dwpBodyLen,
+	WCHAR *wszMessageLabel,
+	BYTE  *pCorrelationId,
+	BYTE  *pMessageId,
+	BYTE  *pPriority,
+	DWORD *pcBatchRecords,
+	int   ReadOrPeek,
+	ITransaction *pTransaction
+	)
+{
+	HRESULT hr;
+	DWORD   cBatchRecords;
+	if (NULL == pcBatchRecords)
+		pcBatchRecords = &cBatchRecords;    // for the capture
+
+	for (int iAttempt = 0; ; iAttempt++)
+	{
+		QUEUEHANDLE h = hQueue;
+		hr = receiveOnce(ppbMessageBody,
+			dwpBodyLen,
+			wszMessageLabel,
+			pCorrelationId,
+			pMessageId,
+			pPriority,
+			pcBatchRecords,
+			NULL,
+			0,
+			ReadOrPeek,
+			&lookupId,
+			pTransaction);
+
+		// lookup IDs outlive the handle, so a reopened one finds it too
+		if (iAttempt > 0 || !isStaleHandle(hr, h) || FAILED(reconnect(h)))
+			break;
+	}
+
+	// peekHeader() does not hand out heartbeats, but a lookup ID may
+	// come from elsewhere
+	if (hr == MQJ_S_HEARTBEAT) {
+		BufferPool::release(*ppbMessageBody);
+		*ppbMessageBody = NULL;
+		hr = (ReadOrPeek == 1) ? MQ_OK : discardHeartbeat(lookupId, NULL, 0);
+		return FAILED(hr) ? hr : MQ_ERROR_MESSAGE_NOT_FOUND;
+	}
 
+	if (SUCCEEDED(hr) && ReadOrPeek == 1 && capture != NULL)
+		captureMessage(*ppbMessageBody, *dwpBodyLen, wszMessageLabel, pCorrelationId,
+			(pPriority != NULL) ? *pPriority : MQ_DEFAULT_PRIORITY, *pcBatchRecords);
 	return hr;
+}
+
+
+
+HRESULT MsmqQueue::discardByLookupId(ULONGLONG lookupId, ITransaction *pTransaction)
+{
+	return receiveProps(NULL, 0, 1, &lookupId, pTransaction);
+}
+
+
+
+// Discards the messages at the head of the queue that were sent more
+// than dwMaxAge seconds ago.  Only the sent time and lookup ID are
+// peeked, and the message is then received by its lookup ID with no
+// properties, so that a message another receiver took in between is
+// not mistaken for it.  Waits up to *pdwTimeOut for a message, and
+// takes the time waited off it.
+HRESULT MsmqQueue::dropExpired(DWORD *pdwTimeOut, ITransaction *pTransaction)
+{
+	MQMSGPROPS    msgProps;
+	MSGPROPID     msgPropId[2];
+	MQPROPVARIANT msgPropVar[2];
+	HRESULT       hr;
+
+	msgPropId[0] = PROPID_M_SENTTIME;
+	msgPropVar[0].vt = VT_UI4;
+	msgPropId[1] = PROPID_M_LOOKUPID;
+	msgPropVar[1].vt = VT_UI8;
+	msgProps.cProp = 2;
+	msgProps.aPropID = msgPropId;
+	msgProps.aPropVar = msgPropVar;
+	msgProps.aStatus = NULL;
+
+	for (;;) {
+		DWORD dwStart = GetTickCount();
+		hr = MQReceiveMessage(hQueue,
+			*pdwTimeOut,
+			MQ_ACTION_PEEK_CURRENT,
+			&msgProps,
+			NULL,
+			NULL,
+			NULL,
+			MQ_NO_TRANSACTION);
+		if (*pdwTimeOut != INFINITE) {
+			DWORD dwElapsed = GetTickCount() - dwStart;
+			*pdwTimeOut = (dwElapsed >= *pdwTimeOut) ? 0 : *pdwTimeOut - dwElapsed;
+		}
+		if (FAILED(hr)) return hr;
+
+		// the sent time is by the sender's clock
+		LONGLONG age = (LONGLONG)time(NULL) - (LONGLONG)msgPropVar[0].ulVal;
+		if (age <= (LONGLONG)dwMaxAge)
+			return MQ_OK;
+
+		hr = discardByLookupId(msgPropVar[1].uhVal.QuadPart, pTransaction);
+		if (hr == MQ_ERROR_MESSAGE_NOT_FOUND)
+			continue;                                // another receiver took it
+		if (FAILED(hr)) return hr;
+		addStat(STAT_MESSAGES_EXPIRED, 1);
+	}
+}
+
+
+
+// Receives the heartbeat by its lookup ID, so that a message that took
+// its place at the head is not removed instead.  The probe in
+// pbExtension, if given, is counted once the heartbeat is taken.
+HRESULT MsmqQueue::discardHeartbeat(ULONGLONG lookupId,
+	const BYTE *pbExtension,
+	DWORD cbExtension)
+{
+	HRESULT hr = discardByLookupId(lookupId, MQ_NO_TRANSACTION);
+	if (hr == MQ_ERROR_TRANSACTION_USAGE)
+		hr = discardByLookupId(lookupId, MQ_SINGLE_MESSAGE);
+	if (hr == MQ_ERROR_MESSAGE_NOT_FOUND)
+		return MQ_OK;                            // another receiver took it
+	if (FAILED(hr))
+		return hr;
+
+	if (pbExtension != NULL)
+		recordProbe(pbExtension, cbExtension);
+	else
+		addStat(STAT_HEARTBEATS_RECEIVED, 1);
+	return MQ_OK;
+}
+
+
+
+BOOL MsmqQueue::recordProbe(const BYTE *pbExtension, DWORD cbExtension)
+{
+	BYTE cbRecord = 0;
+	const BYTE *pRecord = MessageExtension::find(pbExtension, cbExtension,
+		MQJ_EXT_PROBE, &cbRecord);
+	if (pRecord != NULL && cbRecord >= PROBE_LEN)
+	{
+		ULONGLONG sent;
+		memcpy(&sent, pRecord, sizeof(ULONGLONG));
+
+		// a sender's clock ahead of ours counts as no time at all
+		LONGLONG llMicros = ((LONGLONG)(ProbeTime() - sent)) / 10;
+		if (llMicros < 0) llMicros = 0;
+
+		addStat(STAT_PROBES_RECEIVED, 1);
+		addStat(STAT_TRANSIT_MICROS, llMicros);
+		addStat((MsmqQueueStat)(STAT_TRANSIT_HISTOGRAM + TransitBucket(llMicros)), 1);
+	}
+
+	if (MessageExtension::find(pbExtension, cbExtension, MQJ_EXT_HEARTBEAT, NULL) == NULL)
+		return FALSE;
+	addStat(STAT_HEARTBEATS_RECEIVED, 1);
+	return TRUE;
+}
+
+
+
+// Undoes what sendBytes did to the body, according to the records in
+// the received extension.  On failure, the body is released.
+HRESULT MsmqQueue::unwrapBody(BYTE  **ppbMessageBody,
+	DWORD *dwpBodyLen,
+	DWORD *pcBatchRecords,
+	const BYTE *pbExtension,
+	DWORD cbExtension
+	)
+{
+	BYTE cbRecord = 0;
+
+	// the checksum covers the body as sent, so it is checked before
+	// anything else looks at the body
+	const BYTE *pRecord = MessageExtension::find(pbExtension, cbExtension,
+		MQJ_EXT_CHECKSUM, &cbRecord);
+	if (pRecord != NULL)
+	{
+		LARGE_INTEGER start;
+		QueryPerformanceCounter(&start);
+
+		DWORD crcSent = 0;
+		if (cbRecord >= sizeof(DWORD))
+			memcpy(&crcSent, pRecord, sizeof(DWORD));
+		DWORD crc = Crc32c::compute(0, *ppbMessageBody, *dwpBodyLen);
+
+		addStat(STAT_CHECKSUM_NANOS, ElapsedNanos(&start));
+
+		if (cbRecord < sizeof(DWORD) || crc != crcSent)
+		{
+			LOG_WARN("receive: bad checksum (0x%08x, expected 0x%08x, %lu bytes)",
+				crc, crcSent, *dwpBodyLen);
+			addStat(STAT_CHECKSUM_FAILURES, 1);
+			BufferPool::release(*ppbMessageBody);
+			*ppbMessageBody = NULL;
+			return MQJ_ERROR_BAD_CHECKSUM;
+		}
+	}
+
+	pRecord = MessageExtension::find(pbExtension, cbExtension,
+		MQJ_EXT_COMPRESSION, &cbRecord);
+
+	if (pRecord != NULL)
+	{
+		DWORD dwOriginalLen;
+		if (cbRecord < 1 + sizeof(DWORD) || pRecord[0] != MQJ_CODEC_LZ4)
+		{
+			BufferPool::release(*ppbMessageBody);
+			*ppbMessageBody = NULL;
+			return MQJ_ERROR_BAD_COMPRESSED_BODY;
+		}
+		memcpy(&dwOriginalLen, pRecord + 1, sizeof(DWORD));
+
+		// the length comes from the sender, and sizes the buffer
+		if (dwOriginalLen > MQJ_MAX_BODY_SIZE ||
+			(ULONGLONG)dwOriginalLen > (ULONGLONG)*dwpBodyLen * LZ4_MAX_RATIO)
+		{
+			LOG_WARN("receive: compressed body of %lu bytes claims %lu", *dwpBodyLen, dwOriginalLen);
+			BufferPool::release(*ppbMessageBody);
+			*ppbMessageBody = NULL;
+			return MQ_ERROR_INVALID_PARAMETER;
+		}
+
+		LARGE_INTEGER start;
+		QueryPerformanceCounter(&start);
+
+		BYTE *pbOriginal = BufferPool::alloc(dwOriginalLen);
+		int n = (pbOriginal == NULL) ? -1 :
+			Lz4Codec::decompress(*ppbMessageBody, *dwpBodyLen, pbOriginal, dwOriginalLen);
+
+		BufferPool::release(*ppbMessageBody);
+		*ppbMessageBody = pbOriginal;
+		if (n != (int)dwOriginalLen)
+		{
+			LOG_WARN("receive: bad compressed body (%d of %d bytes)", n, dwOriginalLen);
+			BufferPool::release(*ppbMessageBody);
+			*ppbMessageBody = NULL;
+			return (pbOriginal == NULL) ? MQ_ERROR_INSUFFICIENT_RESOURCES : MQJ_ERROR_BAD_COMPRESSED_BODY;
+		}
+		*dwpBodyLen = dwOriginalLen;
+
+		addStat(STAT_MESSAGES_DECOMPRESSED, 1);
+		addStat(STAT_DECOMPRESS_NANOS, ElapsedNanos(&start));
+	}
+
+	// a batch is checked whole here, so that readers of its records
+	// need not fear a frame running off the end
+	pRecord = MessageExtension::find(pbExtension, cbExtension, MQJ_EXT_BATCH, &cbRecord);
+	if (pRecord != NULL)
+	{
+		DWORD cRecords = 0;
+		if (cbRecord >= sizeof(DWORD))
+			memcpy(&cRecords, pRecord, sizeof(DWORD));
+		if (cRecords == 0 || !BatchEnvelope::check(*ppbMessageBody, *dwpBodyLen, cRecords))
+		{
+			LOG_WARN("receive: bad batch (%lu records in %lu bytes)", cRecords, *dwpBodyLen);
+			BufferPool::release(*ppbMessageBody);
+			*ppbMessageBody = NULL;
+			return MQJ_ERROR_BAD_BATCH;
+		}
+		if (NULL != pcBatchRecords)
+			*pcBatchRecords = cRecords;
+	}
+
+	return S_OK;
 };
 
 
@@ -430,17 +1313,89 @@ HRESULT MsmqQueue::sendBytes(BYTE    *pbMessageBody,
 	WCHAR   *wszMessageLabel,
 	BYTE    *pCorrelationId,
 	DWORD   dwCorIdLen,
-	DWORD   transactionFlag,
-	BOOL    fHighPriority
+	ITransaction *pTransaction,
+	int     iPriority,
+	DWORD   dwTimeToReachQueue,
+	DWORD   dwTimeToBeReceived,
+	const BYTE *pDedupId
+	)
+{
+	return sendMessage(pbMessageBody, dwBodyLen, wszMessageLabel,
+		pCorrelationId, dwCorIdLen, pTransaction, iPriority,
+		dwTimeToReachQueue, dwTimeToBeReceived, pDedupId, 0, FALSE);
+}
+
+
+
+HRESULT MsmqQueue::sendBatch(BYTE    *pbBatch,
+	DWORD   cbBatch,
+	DWORD   cRecords,
+	WCHAR   *wszMessageLabel,
+	ITransaction *pTransaction,
+	int     iPriority
+	)
+{
+	return sendMessage(pbBatch, cbBatch, wszMessageLabel,
+		NULL, 0, pTransaction, iPriority, MQJ_NO_TTL, MQJ_NO_TTL, NULL, cRecords, FALSE);
+}
+
+
+
+HRESULT MsmqQueue::sendHeartbeat(DWORD dwTimeToBeReceived, ITransaction *pTransaction)
+{
+	static WCHAR wszLabel[] = MQJ_HEARTBEAT_LABEL;
+
+	HRESULT hr = sendMessage(NULL, 0, wszLabel,
+		NULL, 0, pTransaction, MQ_DEFAULT_PRIORITY, MQJ_NO_TTL, dwTimeToBeReceived, NULL, 0, TRUE);
+	if (SUCCEEDED(hr))
+		addStat(STAT_HEARTBEATS_SENT, 1);
+	return hr;
+}
+
+
+
+HRESULT MsmqQueue::sendMessage(BYTE    *pbMessageBody,
+	DWORD   dwBodyLen,
+	WCHAR   *wszMessageLabel,
+	BYTE    *pCorrelationId,
+	DWORD   dwCorIdLen,
+	ITransaction *pTransaction,
+	int     iPriority,
+	DWORD   dwTimeToReachQueue,
+	DWORD   dwTimeToBeReceived,
+	const BYTE *pDedupId,
+	DWORD   cBatchRecords,
+	BOOL    fHeartbeat
 	)
 {
-	const int     MAX_NUM_PROPERTIES = 4;    // Max. Number of properties for send message
-	MQMSGPROPS    MsgProps;
-	MSGPROPID     propId[MAX_NUM_PROPERTIES];
-	MQPROPVARIANT aPropVariant[MAX_NUM_PROPERTIES];
-	DWORD         i = 0;
+	typedef HRESULT (MsmqQueue::*SendFn)(BYTE *, DWORD, WCHAR *, BYTE *, int,
+		DWORD, DWORD, MessageExtension *, ITransaction *);
+
+	// one layout for each combination of the optional properties,
+	// indexed by their MQJ_SEND_ flags
+	static const SendFn senders[MQJ_SEND_LAYOUTS] = {
+		&MsmqQueue::sendWith<0>,
+		&MsmqQueue::sendWith<1>,
+		&MsmqQueue::sendWith<2>,
+		&MsmqQueue::sendWith<3>,
+		&MsmqQueue::sendWith<4>,
+		&MsmqQueue::sendWith<5>,
+		&MsmqQueue::sendWith<6>,
+		&MsmqQueue::sendWith<7>,
+		&MsmqQueue::sendWith<8>,
+		&MsmqQueue::sendWith<9>,
+		&MsmqQueue::sendWith<10>,
+		&MsmqQueue::sendWith<11>,
+		&MsmqQueue::sendWith<12>,
+		&MsmqQueue::sendWith<13>,
+		&MsmqQueue::sendWith<14>,
+		&MsmqQueue::sendWith<15>
+	};
+
 	HRESULT       hr = S_OK;
 	BYTE          corId[PROPID_M_CORRELATIONID_SIZE];
+	BYTE          *pbCompressed = NULL;
+	MessageExtension extension;
 
 	memset(corId, 0, PROPID_M_CORRELATIONID_SIZE);
 
@@ -451,54 +1406,419 @@ HRESULT MsmqQueue::sendBytes(BYTE    *pbMessageBody,
 		memcpy(corId, pCorrelationId, dwCorIdLen);
 	}
 
-	if (NULL != pbMessageBody)
+	if (NULL != pbMessageBody
+		&& compressionCodec == MQJ_CODEC_LZ4
+		&& dwBodyLen >= compressionThreshold
+		&& dwBodyLen > 0)
 	{
-		// Set the PROPID_M_BODY property.
-		propId[i] = PROPID_M_BODY;
-		aPropVariant[i].vt = VT_VECTOR | VT_UI1;
-		aPropVariant[i].caub.cElems = dwBodyLen;
-		aPropVariant[i].caub.pElems = const_cast<BYTE *>(pbMessageBody);
-		i++;
-	}
-
-	propId[i] = PROPID_M_CORRELATIONID;
-	aPropVariant[i].vt = VT_VECTOR | VT_UI1;
-	aPropVariant[i].caub.pElems = (LPBYTE)corId;
-	aPropVariant[i].caub.cElems = PROPID_M_CORRELATIONID_SIZE;
-	i++;
+		LARGE_INTEGER start;
+		QueryPerformanceCounter(&start);
 
-	propId[i] = PROPID_M_LABEL;
-	aPropVariant[i].vt = VT_LPWSTR;
-	aPropVariant[i].pwszVal = wszMessageLabel;
-	i++;
+		DWORD cbBound = Lz4Codec::bound(dwBodyLen);
+		pbCompressed = (cbBound == 0) ? NULL : BufferPool::alloc(cbBound);
+		DWORD cbCompressed = (pbCompressed == NULL) ? 0 :
+			Lz4Codec::compress(pbMessageBody, dwBodyLen, pbCompressed, cbBound);
+
+		addStat(STAT_COMPRESS_NANOS, ElapsedNanos(&start));
+
+		// send it raw if it did not shrink
+		if (cbCompressed > 0 && cbCompressed < dwBodyLen)
+		{
+			BYTE record[1 + sizeof(DWORD)];
+			record[0] = MQJ_CODEC_LZ4;
+			memcpy(record + 1, &dwBodyLen, sizeof(DWORD));
+			extension.add(MQJ_EXT_COMPRESSION, record, sizeof(record));
+
+			addStat(STAT_MESSAGES_COMPRESSED, 1);
+			addStat(STAT_BYTES_BEFORE_COMPRESSION, dwBodyLen);
+			addStat(STAT_BYTES_AFTER_COMPRESSION, cbCompressed);
+
+			pbMessageBody = pbCompressed;
+			dwBodyLen = cbCompressed;
+		}
+	}
+
+	if (cBatchRecords > 0)
+		extension.add(MQJ_EXT_BATCH, &cBatchRecords, sizeof(DWORD));
+
+	if (NULL != pDedupId)
+		extension.add(MQJ_EXT_DEDUP_ID, pDedupId, MQJ_DEDUP_ID_SIZE);
 
-	if (fHighPriority)
+	if (fChecksum)
 	{
-		// Set the PROPID_M_PRIORITY property.
-		propId[i] = PROPID_M_PRIORITY;
-		aPropVariant[i].vt = VT_UI1;
-		aPropVariant[i].bVal = 7;       // Highest priority
-		i++;
-	}
-
-	// Set the MQMSGPROPS structure
-	MsgProps.cProp = i;  // Number of properties.
-	MsgProps.aPropID = propId;      // Id of properties.
-	MsgProps.aPropVar = aPropVariant; // Value of properties.
-	MsgProps.aStatus = NULL;         // No Error report.
-
-	hr = MQSendMessage(hQueue,          // handle to the Queue.
-		&MsgProps,       // Message properties to be sent.
-		(ITransaction *)transactionFlag
-		);
+		LARGE_INTEGER start;
+		QueryPerformanceCounter(&start);
+
+		DWORD crc = Crc32c::compute(0, pbMessageBody, (NULL == pbMessageBody) ? 0 : dwBodyLen);
+		extension.add(MQJ_EXT_CHECKSUM, &crc, sizeof(DWORD));
+
+		addStat(STAT_CHECKSUM_NANOS, ElapsedNanos(&start));
+	}
+
+	// stamped last, as near to the send as it can be
+	if (fProbe || fHeartbeat)
+	{
+		BYTE record[PROBE_LEN];
+		ULONGLONG now = ProbeTime();
+		memcpy(record, &now, sizeof(ULONGLONG));
+		memcpy(record + sizeof(ULONGLONG), &dwProducerId, sizeof(DWORD));
+		extension.add(MQJ_EXT_PROBE, record, sizeof(record));
+	}
+	if (fHeartbeat)
+		extension.add(MQJ_EXT_HEARTBEAT, NULL, 0);
+
+	int props = ((NULL != pbMessageBody) ? MQJ_SEND_BODY : 0)
+		| ((iPriority != MQ_DEFAULT_PRIORITY) ? MQJ_SEND_PRIORITY : 0)
+		| (extension.isEmpty() ? 0 : MQJ_SEND_EXTENSION)
+		| ((dwTimeToReachQueue != MQJ_NO_TTL || dwTimeToBeReceived != MQJ_NO_TTL) ? MQJ_SEND_TTL : 0);
+
+	hr = (this->*senders[props])(pbMessageBody, dwBodyLen, wszMessageLabel,
+		corId, iPriority, dwTimeToReachQueue, dwTimeToBeReceived, &extension, pTransaction);
+
+	BufferPool::release(pbCompressed);
+
+	if (SUCCEEDED(hr))
+	{
+		addStat(STAT_MESSAGES_SENT, 1);
+		addStat(STAT_BYTES_SENT, dwBodyLen);
+		dwLastSendTick = GetTickCount();
+	}
 	return hr;
 };
 
 
 
+template <int Props>
+HRESULT MsmqQueue::sendWith(BYTE    *pbMessageBody,
+	DWORD   dwBodyLen,
+	WCHAR   *wszMessageLabel,
+	BYTE    *pCorrelationId,   // sz PROPID_M_CORRELATIONID_SIZE
+	int     iPriority,
+	DWORD   dwTimeToReachQueue,
+	DWORD   dwTimeToBeReceived,
+	MessageExtension *pExtension,
+	ITransaction *pTransaction
+	)
+{
+	typedef SendLayout<Props> L;
+	L             layout;
+	HRESULT       hr;
+
+	layout.setVector(L::CORRELATIONID, pCorrelationId, PROPID_M_CORRELATIONID_SIZE);
+	layout.var[L::LABEL].pwszVal = wszMessageLabel;
+	if (Props & MQJ_SEND_BODY)
+		layout.setVector(L::BODY, pbMessageBody, dwBodyLen);
+	if (Props & MQJ_SEND_PRIORITY)
+		layout.var[L::PRIORITY].bVal = (UCHAR)iPriority;   // MQ_MIN_PRIORITY to MQ_MAX_PRIORITY
+	if (Props & MQJ_SEND_EXTENSION)
+		layout.setVector(L::EXTENSION, pExtension->data(), pExtension->length());
+	if (Props & MQJ_SEND_TTL) {
+		// unset, each has its MSMQ default
+		layout.var[L::TIME_TO_REACH_QUEUE].ulVal =
+			(dwTimeToReachQueue == MQJ_NO_TTL) ? LONG_LIVED : dwTimeToReachQueue;
+		layout.var[L::TIME_TO_BE_RECEIVED].ulVal = dwTimeToBeReceived;
+	}
+
+	for (int iAttempt = 0; ; iAttempt++)
+	{
+		QUEUEHANDLE h = hQueue;
+		hr = MQSendMessage(h,               // handle to the Queue.
+			&layout.props,   // Message properties to be sent.
+			pTransaction     // MQ_NO_TRANSACTION, MQ_SINGLE_MESSAGE, or a real one
+			);
+
+		// on a stale handle, reopen it and try once more
+		if (iAttempt > 0 || !isStaleHandle(hr, h) || FAILED(reconnect(h)))
+			break;
+	}
+
+	return hr;
+}
+
+
+
+void MsmqQueue::setBacklogInterval(DWORD dwInterval)
+{
+	EnterCriticalSection(&backlogLock);
+	dwBacklogInterval = dwInterval;
+	LeaveCriticalSection(&backlogLock);
+}
+
+
+
+// asks the queue manager for the counts, and peeks at the head of the
+// queue for the age of the oldest message
+HRESULT MsmqQueue::sampleBacklog(LONGLONG *pValues)
+{
+	const int     NUMBEROFPROPERTIES = 2;
+	WCHAR         wszObjectName[2 * MQ_MAX_Q_NAME_LEN + 8];
+	MQMGMTPROPS   mgmtProps;
+	MGMTPROPID    mgmtPropId[NUMBEROFPROPERTIES];
+	MQPROPVARIANT mgmtPropVar[NUMBEROFPROPERTIES];
+	HRESULT       hr;
+
+	swprintf_s(wszObjectName, sizeof(wszObjectName) / sizeof(WCHAR), L"QUEUE=%s", wszFormatName);
+
+	mgmtPropId[0] = PROPID_MGMT_QUEUE_MESSAGE_COUNT;
+	mgmtPropVar[0].vt = VT_NULL;
+	mgmtPropId[1] = PROPID_MGMT_QUEUE_BYTES_IN_QUEUE;
+	mgmtPropVar[1].vt = VT_NULL;
+	mgmtProps.cProp = NUMBEROFPROPERTIES;
+	mgmtProps.aPropID = mgmtPropId;
+	mgmtProps.aPropVar = mgmtPropVar;
+	mgmtProps.aStatus = NULL;
+
+	// For a remote queue this reports on the local outgoing queue.
+	hr = MQMgmtGetInfo(NULL, wszObjectName, &mgmtProps);
+	if (hr == MQ_ERROR_QUEUE_NOT_ACTIVE) {
+		// the queue manager has not loaded it: nothing has arrived
+		pValues[BACKLOG_MESSAGE_COUNT] = 0;
+		pValues[BACKLOG_BYTES_IN_QUEUE] = 0;
+	}
+	else if (FAILED(hr)) {
+		LOG_DEBUG("MQMgmtGetInfo(%ls): hr=0x%08x", wszObjectName, hr);
+		return hr;
+	}
+	else {
+		pValues[BACKLOG_MESSAGE_COUNT] = mgmtPropVar[0].ulVal;
+		pValues[BACKLOG_BYTES_IN_QUEUE] = mgmtPropVar[1].ulVal;
+	}
+
+	pValues[BACKLOG_OLDEST_AGE_MILLIS] = -1;
+	if (pValues[BACKLOG_MESSAGE_COUNT] > 0) {
+		MQMSGPROPS    msgProps;
+		MSGPROPID     msgPropId[1];
+		MQPROPVARIANT msgPropVar[1];
+
+		msgPropId[0] = PROPID_M_ARRIVEDTIME;
+		msgPropVar[0].vt = VT_UI4;
+		msgProps.cProp = 1;
+		msgProps.aPropID = msgPropId;
+		msgProps.aPropVar = msgPropVar;
+		msgProps.aStatus = NULL;
+
+		// fails with MQ_ERROR_ACCESS_DENIED on a send handle; the age
+		// is then left unknown.
+		hr = MQReceiveMessage(hQueue,
+			0,
+			MQ_ACTION_PEEK_CURRENT,
+			&msgProps,
+			NULL,
+			NULL,
+			NULL,
+			MQ_NO_TRANSACTION);
+		if (SUCCEEDED(hr)) {
+			LONGLONG age = (LONGLONG)time(NULL) - (LONGLONG)msgPropVar[0].ulVal;
+			pValues[BACKLOG_OLDEST_AGE_MILLIS] = (age < 0) ? 0 : age * 1000;
+		}
+	}
+
+	return MQ_OK;
+}
+
+
+
+HRESULT MsmqQueue::getBacklog(LONGLONG *pValues)
+{
+	HRESULT hr = MQ_OK;
+
+	EnterCriticalSection(&backlogLock);
+	BOOL fValid = fBacklogValid;
+	BOOL fStale = !fValid || (GetTickCount() - dwBacklogTick >= dwBacklogInterval);
+	LeaveCriticalSection(&backlogLock);
+
+	// Refresh if stale, unless someone else already is and there are
+	// cached values to fall back on.
+	if (fStale) {
+		BOOL fOwner = (InterlockedCompareExchange(&backlogRefreshing, 1, 0) == 0);
+		if (fOwner || !fValid) {
+			LONGLONG values[BACKLOG_COUNT];
+			hr = sampleBacklog(values);
+			if (SUCCEEDED(hr)) {
+				EnterCriticalSection(&backlogLock);
+				memcpy(backlog, values, sizeof(backlog));
+				dwBacklogTick = GetTickCount();
+				fBacklogValid = TRUE;
+				LeaveCriticalSection(&backlogLock);
+			}
+			if (fOwner) InterlockedExchange(&backlogRefreshing, 0);
+			if (FAILED(hr)) return hr;
+		}
+	}
+
+	EnterCriticalSection(&backlogLock);
+	memcpy(pValues, backlog, sizeof(backlog));
+	LeaveCriticalSection(&backlogLock);
+	return hr;
+}
+
+
+
+HRESULT MsmqQueue::beginPeek(LPOVERLAPPED pOverlapped)
+{
+	// no properties: this only waits for a message to arrive, and the
+	// completion goes to the port the handle is bound to.
+	memset(pOverlapped, 0, sizeof(OVERLAPPED));
+	return MQReceiveMessage(hQueue,
+		INFINITE,
+		MQ_ACTION_PEEK_CURRENT,
+		NULL,
+		pOverlapped,
+		NULL,
+		NULL,
+		NULL);
+}
+
+
+
+// Receives the message at hCursor, or at the head, with no properties
+// at all.  A transactional queue refuses MQ_NO_TRANSACTION; *ppTransaction
+// is then switched to MQ_SINGLE_MESSAGE, for this and later calls.
+static HRESULT DiscardAt(HANDLE hQueue, HANDLE hCursor, ITransaction **ppTransaction)
+{
+	HRESULT hr = MQReceiveMessage(hQueue,
+		0,
+		MQ_ACTION_RECEIVE,
+		NULL,
+		NULL,
+		NULL,
+		hCursor,
+		*ppTransaction);
+	if (hr == MQ_ERROR_TRANSACTION_USAGE && *ppTransaction == MQ_NO_TRANSACTION) {
+		*ppTransaction = MQ_SINGLE_MESSAGE;
+		hr = MQReceiveMessage(hQueue,
+			0,
+			MQ_ACTION_RECEIVE,
+			NULL,
+			NULL,
+			NULL,
+			hCursor,
+			*ppTransaction);
+	}
+	return hr;
+}
+
+
+
+HRESULT MsmqQueue::purge(DWORD cMax,
+	PurgeFilter pfnFilter,
+	void  *pContext,
+	DWORD *pcPurged)
+{
+	HRESULT hr;
+	*pcPurged = 0;
+
+	ITransaction *pTransaction = MQ_NO_TRANSACTION;   // see DiscardAt
+
+	if (cMax == MQJ_PURGE_ALL && pfnFilter == NULL) {
+		// The count comes from the queue manager.  If it cannot be had,
+		// as for a remote queue, receive the messages one by one instead.
+		// It is sampled before the purge, so it is approximate: messages
+		// that arrive in between are purged but not counted, and those
+		// received by another reader in between are counted.
+		LONGLONG values[BACKLOG_COUNT];
+		if (SUCCEEDED(sampleBacklog(values))) {
+			hr = MQPurgeQueue(hQueue);
+			if (SUCCEEDED(hr))
+				*pcPurged = (DWORD)values[BACKLOG_MESSAGE_COUNT];
+			return hr;
+		}
+	}
+
+	if (pfnFilter == NULL) {
+		// no properties at all: nothing of the message is transferred
+		while (*pcPurged < cMax) {
+			hr = DiscardAt(hQueue, NULL, &pTransaction);
+			if (hr == MQ_ERROR_IO_TIMEOUT) break;  // empty
+			if (FAILED(hr)) return hr;
+			(*pcPurged)++;
+		}
+		return MQ_OK;
+	}
+
+	// Walk the queue with a cursor, peeking only the label.  A message
+	// that is kept is stepped over; one that is discarded is received at
+	// the cursor, which moves the cursor on to the next.
+	HANDLE hCursor;
+	hr = MQCreateCursor(hQueue, &hCursor);
+	if (FAILED(hr)) return hr;
+
+	WCHAR         wszLabel[MQ_MAX_MSG_LABEL_LEN];
+	MQMSGPROPS    msgProps;
+	MSGPROPID     msgPropId[2];
+	MQPROPVARIANT msgPropVar[2];
+	DWORD         dwAction = MQ_ACTION_PEEK_CURRENT;
+
+	msgPropId[0] = PROPID_M_LABEL_LEN;
+	msgPropVar[0].vt = VT_UI4;
+	msgPropId[1] = PROPID_M_LABEL;
+	msgPropVar[1].vt = VT_LPWSTR;
+	msgProps.cProp = 2;
+	msgProps.aPropID = msgPropId;
+	msgProps.aPropVar = msgPropVar;
+	msgProps.aStatus = NULL;
+
+	while (*pcPurged < cMax) {
+		msgPropVar[0].ulVal = MQ_MAX_MSG_LABEL_LEN;
+		msgPropVar[1].pwszVal = wszLabel;
+		hr = MQReceiveMessage(hQueue,
+			0,
+			dwAction,
+			&msgProps,
+			NULL,
+			NULL,
+			hCursor,
+			MQ_NO_TRANSACTION);
+		if (hr == MQ_ERROR_IO_TIMEOUT) {         // the end of the queue
+			hr = MQ_OK;
+			break;
+		}
+		if (hr == MQ_ERROR_MESSAGE_ALREADY_RECEIVED) {
+			// another reader took it from under the cursor
+			dwAction = MQ_ACTION_PEEK_NEXT;
+			continue;
+		}
+		if (FAILED(hr)) break;
+
+		hr = pfnFilter(pContext, wszLabel);
+		if (FAILED(hr)) break;
+		if (hr == S_FALSE) {
+			dwAction = MQ_ACTION_PEEK_NEXT;
+			continue;
+		}
+
+		hr = DiscardAt(hQueue, hCursor, &pTransaction);
+		if (hr == MQ_ERROR_MESSAGE_ALREADY_RECEIVED) {
+			dwAction = MQ_ACTION_PEEK_NEXT;
+			continue;
+		}
+		if (FAILED(hr)) break;
+		(*pcPurged)++;
+		dwAction = MQ_ACTION_PEEK_CURRENT;
+	}
+
+	MQCloseCursor(hCursor);
+	return hr;
+}
+
+
+
 HRESULT MsmqQueue::closeQueue()
 {
 	HRESULT hr = MQ_OK;
+
+	// the heartbeat, the batcher and the forwarder send on this handle;
+	// stop them first
+	setHeartbeat(0);
+	disableBatching();
+	if (outbox != NULL) {
+		delete outbox;
+		outbox = NULL;
+	}
+
+	stopCapture();
+
+	if (hQueue == NULL) return hr;   // a reconnect failed
 	hr = MQCloseQueue(hQueue);
 	return hr;
 };
\ No newline at end of file
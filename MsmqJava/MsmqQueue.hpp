@@ -25,14 +25,391 @@
 //
 // ------------------------------------------------------------------
 
+// HRESULTs of MsmqJava's own.  These have the customer bit set, so
+// they cannot collide with MQ_ERROR_* or system codes.
+#define MQJ_ERROR_BAD_COMPRESSED_BODY   ((HRESULT)0xE00E0001L)
+#define MQJ_ERROR_SELECTOR_CONFLICT     ((HRESULT)0xE00E0002L)
+#define MQJ_ERROR_OUTBOX_FULL           ((HRESULT)0xE00E0003L)
+#define MQJ_ERROR_BAD_BATCH             ((HRESULT)0xE00E0004L)
+#define MQJ_ERROR_BAD_CHECKSUM          ((HRESULT)0xE00E0005L)
+
+// body compression codecs; the values match Queue.Compression in Java
+#define MQJ_CODEC_NONE                  0
+#define MQJ_CODEC_LZ4                   1
+
+
+// Transit times of received latency probes are counted in buckets of
+// microseconds, 8 per power of two, up to about four hours.
+#define MQJ_TRANSIT_BUCKETS             256
+
+
+// Counters kept per queue handle, and reported by Queue.getStatistics().
+// The order here must match the index constants in QueueStatistics.java.
+enum MsmqQueueStat
+{
+	STAT_MESSAGES_SENT = 0,
+	STAT_BYTES_SENT,                  // body bytes on the wire
+	STAT_MESSAGES_RECEIVED,
+	STAT_BYTES_RECEIVED,              // body bytes on the wire
+	STAT_MESSAGES_COMPRESSED,
+	STAT_BYTES_BEFORE_COMPRESSION,
+	STAT_BYTES_AFTER_COMPRESSION,
+	STAT_COMPRESS_NANOS,
+	STAT_MESSAGES_DECOMPRESSED,
+	STAT_DECOMPRESS_NANOS,
+	STAT_DUPLICATES_DROPPED,
+	STAT_RECONNECTS,
+	STAT_CHECKSUM_NANOS,              // computing and checking body checksums
+	STAT_CHECKSUM_FAILURES,
+	STAT_MESSAGES_EXPIRED,            // discarded unread, older than the max age
+	STAT_HEARTBEATS_SENT,
+	STAT_HEARTBEATS_RECEIVED,         // dropped once their probe is recorded
+	STAT_PROBES_RECEIVED,             // heartbeats included
+	STAT_TRANSIT_MICROS,              // summed over the probes received
+	STAT_TRANSIT_HISTOGRAM,           // the first of MQJ_TRANSIT_BUCKETS counts
+	STAT_COUNT = STAT_TRANSIT_HISTOGRAM + MQJ_TRANSIT_BUCKETS
+};
+
+
+// The backlog of a queue, as reported by Queue.getBacklog().  The
+// order here must match the index constants in QueueBacklog.java.
+enum MsmqBacklogValue
+{
+	BACKLOG_MESSAGE_COUNT = 0,
+	BACKLOG_BYTES_IN_QUEUE,
+	BACKLOG_OLDEST_AGE_MILLIS,        // -1 if empty, or not open for receive
+	BACKLOG_COUNT
+};
+
+#define MQJ_DEFAULT_BACKLOG_INTERVAL    1000   // ms
+
+// A handle that fails with a stale handle error is reopened, waiting
+// MQJ_RECONNECT_FIRST_DELAY ms before the second attempt, and four
+// times longer before each one after that.
+#define MQJ_RECONNECT_ATTEMPTS          4
+#define MQJ_RECONNECT_FIRST_DELAY       100    // ms
+
+#define MQJ_PURGE_ALL                   0xFFFFFFFF
+
+// decides whether purge() discards the message with wszLabel: S_OK to
+// discard it, S_FALSE to keep it, or a failure to stop the purge
+typedef HRESULT (*PurgeFilter)(void *pContext, const WCHAR *wszLabel);
+
+// the largest body MSMQ sends; a compressed body claiming to expand past
+// it did not come from sendBytes()
+#define MQJ_MAX_BODY_SIZE               (4 * 1024 * 1024)
+
+// a message time limit, in seconds, that is not set
+#define MQJ_NO_TTL                      INFINITE
+
+// An ID chosen by the sender, and kept when it sends the message again.
+// The duplicate window uses it in place of the MSMQ message ID, which
+// is new on every send.
+#define MQJ_DEDUP_ID_SIZE               PROPID_M_MSGID_SIZE
+
+
+// what peekHeader() reads of a message: all but the body
+struct MessageHeader
+{
+	ULONGLONG       lookupId;
+	DWORD           dwBodySize;     // before compression
+	BYTE            priority;
+	DWORD           dwSentTime;     // time_t seconds, by the sender's clock
+	DWORD           dwArrivedTime;
+	WCHAR           wszLabel[MQ_MAX_MSG_LABEL_LEN];
+	BYTE            correlationId[PROPID_M_CORRELATIONID_SIZE];
+	BYTE            messageId[PROPID_M_MSGID_SIZE];
+};
+
+
+class QueueSelector;
+class Outbox;
+class BatchingSender;
+class CaptureLog;
+class MessageExtension;
+class Heartbeat;
+
+
 class MsmqQueue
 {
 private:
 	QUEUEHANDLE             hQueue;
+	int                     compressionCodec;
+	DWORD                   compressionThreshold;
+	BOOL                    fChecksum;
+	DWORD                   dwMaxAge;       // seconds; 0 for no limit
+	BOOL                    fProbe;
+	DWORD                   dwProducerId;   // carried in each probe
+	volatile LONGLONG       stats[STAT_COUNT];
+
+	// Set when the handle is registered with a QueueSelector.  A handle
+	// stays bound to the selector's completion port until it is closed.
+	HANDLE                  hCompletionPort;
+	QueueSelector           *selector;
+	friend class QueueSelector;
+
+	// as passed to MQOpenQueue, kept to reopen the handle
+	WCHAR                   wszFormatName[2 * MQ_MAX_Q_NAME_LEN];
+	DWORD                   dwAccessMode;
+	DWORD                   dwShareMode;
+
+	// held while the handle is being reopened
+	CRITICAL_SECTION        reconnectLock;
+
+	BOOL isStaleHandle(HRESULT hr, QUEUEHANDLE h);
+	HRESULT reconnect(QUEUEHANDLE hStale);
+
+	// The last backlog sample, and when it was taken.  At most one
+	// caller refreshes it per interval; the others read the cached one.
+	CRITICAL_SECTION        backlogLock;
+	LONGLONG                backlog[BACKLOG_COUNT];
+	DWORD                   dwBacklogTick;
+	BOOL                    fBacklogValid;
+	DWORD                   dwBacklogInterval;
+	volatile LONG           backlogRefreshing;
+
+	HRESULT sampleBacklog(LONGLONG *pValues);
+
+	// IDs of recently received messages; disabled unless sized
+	DedupWindow             dedup;
+
+	// the journal for sends that fail; NULL unless enabled
+	Outbox                  *outbox;
+
+	// packs records sent with BatchingSender; NULL unless enabled
+	BatchingSender          *batcher;
+
+	// sends heartbeats while the handle is idle; NULL unless enabled
+	Heartbeat               *heartbeat;
+	volatile DWORD          dwLastSendTick;
+	friend class Heartbeat;
+
+	HRESULT sendHeartbeat(
+		DWORD   dwTimeToBeReceived,
+		ITransaction *pTransaction
+		);
+
+	// Counts the transit time of the probe in a received extension, if
+	// there is one.  Returns TRUE if the message is a heartbeat.
+	BOOL recordProbe(
+		const BYTE *pbExtension,
+		DWORD   cbExtension
+		);
+
+	// Removes a heartbeat that a peek found, so that the application
+	// never sees one.  Succeeds if another receiver took it first.
+	HRESULT discardHeartbeat(
+		ULONGLONG lookupId,
+		const BYTE *pbExtension,
+		DWORD   cbExtension
+		);
+
+	// where received messages are copied; NULL unless capturing.
+	// captureLock serializes appends, and guards the pointer.
+	CaptureLog              *capture;
+	CRITICAL_SECTION        captureLock;
+
+	void captureMessage(
+		BYTE    *pbMessageBody,
+		DWORD   dwBodyLen,
+		WCHAR   *wszMessageLabel,
+		BYTE    *pCorrelationId,
+		int     iPriority,
+		DWORD   cBatchRecords
+		);
+
+	HRESULT receiveOnce(
+		BYTE    **ppbMessageBody,
+		DWORD   *dwBodyLen,
+		WCHAR   *swzMessageLabel,
+		BYTE    *pCorrelationId,
+		BYTE    *pMessageId,
+		BYTE    *pPriority,
+		DWORD   *pcBatchRecords,    // 0 unless the body is a batch
+		BYTE    *pDedupId,          // the sender's ID, else the message ID
+		DWORD   dwTimeOut,
+		int     ReadOrPeek,
+		const ULONGLONG *pLookupId, // NULL for the head of the queue
+		ITransaction *pTransaction
+		);
+
+	// receiveOnce() with the MQMSGPROPS layout for the optional
+	// properties in Props, a combination of MQJ_RECV_ flags
+	template <int Props>
+	HRESULT receiveWith(
+		BYTE    **ppbMessageBody,
+		DWORD   *dwpBodyLen,
+		WCHAR   *swzMessageLabel,
+		BYTE    *pCorrelationId,
+		BYTE    *pMessageId,
+		BYTE    *pPriority,
+		DWORD   *pcBatchRecords,
+		BYTE    *pDedupId,
+		DWORD   dwTimeOut,
+		int     ReadOrPeek,
+		const ULONGLONG *pLookupId,
+		ITransaction *pTransaction
+		);
+
+	// MQReceiveMessage at the head of the queue, or
+	// MQReceiveMessageByLookupId if pLookupId is not NULL
+	HRESULT receiveProps(
+		MQMSGPROPS *pProps,
+		DWORD   dwTimeOut,
+		int     ReadOrPeek,
+		const ULONGLONG *pLookupId,
+		ITransaction *pTransaction
+		);
+
+	HRESULT dropExpired(
+		DWORD   *pdwTimeOut,
+		ITransaction *pTransaction
+		);
+
+	HRESULT unwrapBody(
+		BYTE    **ppbMessageBody,
+		DWORD   *dwpBodyLen,
+		DWORD   *pcBatchRecords,
+		const BYTE *pbExtension,
+		DWORD   cbExtension
+		);
+
+	HRESULT sendMessage(
+		BYTE    *pbMessageBody,
+		DWORD   dwBodyLen,
+		WCHAR   *swzMessageLabel,
+		BYTE    *pCorrelationId,
+		DWORD   dwCorIdLen,
+		ITransaction *pTransaction,
+		int     iPriority,
+		DWORD   dwTimeToReachQueue,
+		DWORD   dwTimeToBeReceived,
+		const BYTE *pDedupId,       // MQJ_DEDUP_ID_SIZE bytes, or NULL
+		DWORD   cBatchRecords,      // 0 unless the body is a batch
+		BOOL    fHeartbeat
+		);
+
+	// sends with the MQMSGPROPS layout for the optional properties in
+	// Props, a combination of MQJ_SEND_ flags
+	template <int Props>
+	HRESULT sendWith(
+		BYTE    *pbMessageBody,
+		DWORD   dwBodyLen,
+		WCHAR   *swzMessageLabel,
+		BYTE    *pCorrelationId,
+		int     iPriority,
+		DWORD   dwTimeToReachQueue,
+		DWORD   dwTimeToBeReceived,
+		MessageExtension *pExtension,
+		ITransaction *pTransaction
+		);
 
 public:
 
-	HRESULT createQueue(
+	MsmqQueue();
+	~MsmqQueue();
+
+	// Bodies of at least dwThreshold bytes are compressed on send, if
+	// that makes them smaller.  Receivers decompress whatever carries
+	// the compression marker, regardless of this setting.
+	void setCompression(
+		int     codec,
+		DWORD   dwThreshold
+		);
+
+	// Bodies are sent with a CRC-32C in the extension.  Receivers check
+	// whatever carries one, regardless of this setting.
+	void setChecksum(
+		BOOL    fEnable
+		);
+
+	// Received messages sent more than dwSeconds ago are discarded,
+	// after a peek at their sent time, without reading their bodies.
+	// 0 turns this off.  Peeks see them still.
+	void setMaxAge(
+		DWORD   dwSeconds
+		);
+
+	// Messages are sent with a latency probe: the time of the send, by
+	// this machine's clock, and the producer ID.  Receivers count the
+	// transit time of whatever carries one, regardless of this setting.
+	void setLatencyProbe(
+		BOOL    fEnable,
+		DWORD   dwProducerId
+		);
+
+	// Sends a heartbeat, an empty message with a probe, whenever the
+	// handle has sent nothing for dwInterval ms.  0 turns this off;
+	// closeQueue() stops it.
+	HRESULT setHeartbeat(
+		DWORD   dwInterval
+		);
+
+	DWORD getLastSendTick(void) { return dwLastSendTick; }
+
+	// The backlog is sampled from the queue manager at most once per
+	// dwInterval ms; callers in between get the cached values.
+	void setBacklogInterval(
+		DWORD   dwInterval
+		);
+
+	HRESULT getBacklog(
+		LONGLONG *pValues          // BACKLOG_COUNT values
+		);
+
+	// Received messages whose ID is among the last dwCapacity received
+	// are dropped.  The ID is the one the sender chose, if it chose
+	// one, else the MSMQ message ID.  Receives in a transaction are not
+	// checked: if it aborts, the message comes back, and must not be
+	// taken for a duplicate.  0 turns this off.
+	HRESULT setDedupWindow(
+		DWORD   dwCapacity
+		);
+
+	// Journals sends that fail with a transient error in files under
+	// wszDirectory, and forwards them when the destination is back.
+	// Enabled at most once per send handle; closeQueue() stops it.
+	HRESULT enableOutbox(
+		const WCHAR *wszDirectory,
+		DWORD   cbSegment,
+		int     cMaxSegments
+		);
+
+	// NULL unless enableOutbox() succeeded
+	Outbox *getOutbox(void) { return outbox; }
+
+	// Packs the records added to getBatcher() into batch messages; see
+	// BatchingSender.  Enabled at most once per send handle, until
+	// disableBatching(), which sends what is pending.
+	HRESULT enableBatching(
+		DWORD   cbMaxBatch,
+		DWORD   dwMaxDelay,
+		const WCHAR *wszLabel,
+		BOOL    fTransactional
+		);
+
+	void disableBatching(void);
+
+	// NULL unless enableBatching() succeeded
+	BatchingSender *getBatcher(void) { return batcher; }
+
+	// Copies each message received, but not peeked, to a capture file
+	// at wszPath of at most cbMax bytes, for MsmqReplay.  Capturing
+	// stops when the file is full, or on stopCapture() or closeQueue().
+	HRESULT startCapture(
+		const WCHAR *wszPath,
+		DWORD   cbMax
+		);
+
+	void stopCapture(void);
+
+	void addStat(MsmqQueueStat stat, LONGLONG value);
+	LONGLONG getStat(MsmqQueueStat stat);
+
+	// Creates a queue, and returns its format name.  If it exists
+	// already, the format name is looked up, and MQ_ERROR_QUEUE_EXISTS
+	// returned.  These two use no handle, so need no instance.
+	static HRESULT createQueue(
 		char    *szQueuePath,
 		char    *szQueueLabel,
 		LPWSTR  wszFormatName,
@@ -40,7 +417,7 @@ public:
 		int     isTransactional
 		);
 
-	HRESULT deleteQueue(
+	static HRESULT deleteQueue(
 		char    *szQueuePath
 		);
 
@@ -71,8 +448,44 @@ public:
 		DWORD   *dwBodyLen,
 		WCHAR   *swzMessageLabel,
 		BYTE    *pCorrelationId,
+		BYTE    *pMessageId,
+		BYTE    *pPriority,
+		DWORD   *pcBatchRecords,    // 0 unless the body is a batch
 		DWORD   dwTimeOut,
-		int     ReadOrPeek
+		int     ReadOrPeek,
+		ITransaction *pTransaction
+		);
+
+	// Peeks at the message at the head of the queue, without its body,
+	// removing the heartbeats in front of it.  The lookup ID names the
+	// message to the calls below, which fail with
+	// MQ_ERROR_MESSAGE_NOT_FOUND once it is gone.
+	HRESULT peekHeader(
+		MessageHeader *pHeader,
+		DWORD   dwTimeOut
+		);
+
+	// receiveBytes() for the message with the given lookup ID.  The
+	// duplicate window and the max age do not apply: the caller has
+	// chosen the message.  A heartbeat is removed, and reported as
+	// MQ_ERROR_MESSAGE_NOT_FOUND.
+	HRESULT receiveByLookupId(
+		ULONGLONG lookupId,
+		BYTE    **ppbMessageBody,
+		DWORD   *dwBodyLen,
+		WCHAR   *swzMessageLabel,
+		BYTE    *pCorrelationId,
+		BYTE    *pMessageId,
+		BYTE    *pPriority,
+		DWORD   *pcBatchRecords,
+		int     ReadOrPeek,
+		ITransaction *pTransaction
+		);
+
+	// removes the message with the given lookup ID, reading nothing
+	HRESULT discardByLookupId(
+		ULONGLONG lookupId,
+		ITransaction *pTransaction
 		);
 
 	HRESULT sendBytes(
@@ -81,8 +494,41 @@ public:
 		WCHAR   *swzMessageLabel,
 		BYTE    *pCorrelationId,
 		DWORD   dwCorIdLen,
-		DWORD   transactionFlag,
-		BOOL    fHighPriority
+		ITransaction *pTransaction,
+		int     iPriority,          // 0 (lowest) to 7 (highest)
+		DWORD   dwTimeToReachQueue, // seconds, or MQJ_NO_TTL
+		DWORD   dwTimeToBeReceived,
+		const BYTE *pDedupId        // MQJ_DEDUP_ID_SIZE bytes, or NULL
+		);
+
+	// sends cRecords records framed by BatchEnvelope, as one message
+	HRESULT sendBatch(
+		BYTE    *pbBatch,
+		DWORD   cbBatch,
+		DWORD   cRecords,
+		WCHAR   *swzMessageLabel,
+		ITransaction *pTransaction,
+		int     iPriority
+		);
+
+	// starts an overlapped peek, that completes when a message is
+	// available.  Returns MQ_INFORMATION_OPERATION_PENDING or MQ_OK.
+	HRESULT beginPeek(
+		LPOVERLAPPED pOverlapped
+		);
+
+	// Discards up to cMax messages without reading their bodies, and
+	// counts them in *pcPurged.  With a filter, only messages whose
+	// label it accepts are discarded.  With neither a limit nor a
+	// filter the queue is purged at once, and the count is the number
+	// it held just before, so it is approximate while other senders or
+	// receivers are active.  On a transactional queue each message is
+	// received in a transaction of its own.
+	HRESULT purge(
+		DWORD   cMax,               // or MQJ_PURGE_ALL
+		PurgeFilter pfnFilter,      // or NULL
+		void    *pContext,
+		DWORD   *pcPurged
 		);
 
 	HRESULT closeQueue(void);
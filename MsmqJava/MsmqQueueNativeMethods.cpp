@@ -35,15 +35,24 @@
 #include <MqOai.h>
 #include <mq.h>
 
+#include "Log.hpp"
 #include "MsmqJava.h"
+#include "ionic_Msmq_Message.h"
+#include "ionic_Msmq_Transaction.h"
+#include "ionic_Msmq_QueueSelector.h"
+#include "ionic_Msmq_FairConsumer.h"
+#include "ionic_Msmq_NativeLog.h"
+#include "ionic_Msmq_BatchingSender.h"
+#include "DedupWindow.hpp"
 #include "MsmqQueue.hpp"
-
-
-#if DEBUG
-#define DIAG(...) { printf(__VA_ARGS__); }
-#else
-#define DIAG(...) { if(FALSE) {}}
-#endif
+#include "QueueSelector.hpp"
+#include "FairScheduler.hpp"
+#include "Crc32c.hpp"
+#include "Outbox.hpp"
+#include "BatchingSender.hpp"
+#include "CaptureLog.hpp"
+#include "QueueProvisioner.hpp"
+#include "BufferPool.hpp"
 
 
 // NB:
@@ -58,7 +67,7 @@
 // and the sending handle is qhandles[N*2+1].
 //
 
-#define MAX_QUEUES 32
+#define MAX_QUEUES 1024
 static  MsmqQueue *qhandles[MAX_QUEUES * 2];
 static  int isInited = -1;
 
@@ -192,6 +201,62 @@ void SetJavaByteArray(JNIEnv * jniEnv, jobject object, char * fieldName, const B
 }
 
 
+// The MessageQueueException class, and its (String, int) constructor,
+// looked up once by nativeInit.  mqutil.dll holds the message texts
+// for the MSMQ HRESULTs.
+static jclass    clsMessageQueueException = NULL;
+static jmethodID ctorMessageQueueException = NULL;
+static HMODULE   hMqUtil = NULL;
+
+
+void InitExceptions(JNIEnv *jniEnv)
+{
+	jclass cls = jniEnv->FindClass("ionic/Msmq/MessageQueueException");
+	if (cls != NULL) {
+		clsMessageQueueException = (jclass)jniEnv->NewGlobalRef(cls);
+		ctorMessageQueueException = jniEnv->GetMethodID(cls, "<init>", "(Ljava/lang/String;I)V");
+	}
+	hMqUtil = LoadLibraryExA("mqutil.dll", NULL, LOAD_LIBRARY_AS_DATAFILE);
+}
+
+
+// Throws a MessageQueueException whose message is szContext followed
+// by the system's text for hr.  The caller returns at once.
+void ThrowMessageQueueException(JNIEnv *jniEnv, const char *szContext, HRESULT hr)
+{
+	if (clsMessageQueueException == NULL || ctorMessageQueueException == NULL) return;
+
+	WCHAR wszText[256];
+	DWORD cch = FormatMessageW(FORMAT_MESSAGE_FROM_HMODULE | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+		hMqUtil, (DWORD)hr, 0, wszText, sizeof(wszText) / sizeof(WCHAR), NULL);
+	while (cch > 0 && (wszText[cch - 1] == L'\r' || wszText[cch - 1] == L'\n' || wszText[cch - 1] == L' '))
+		cch--;
+	wszText[cch] = L'\0';
+
+	WCHAR wszMessage[320];
+	int len = (cch > 0)
+		? swprintf_s(wszMessage, sizeof(wszMessage) / sizeof(WCHAR), L"%S %s", szContext, wszText)
+		: swprintf_s(wszMessage, sizeof(wszMessage) / sizeof(WCHAR), L"%S", szContext);
+	if (len < 0) len = 0;
+
+	jstring message = jniEnv->NewString((const jchar *)wszMessage, len);
+	jobject ex = jniEnv->NewObject(clsMessageQueueException, ctorMessageQueueException, message, (jint)hr);
+	if (ex != NULL)
+		jniEnv->Throw((jthrowable)ex);
+}
+
+
+
+BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
+{
+	// threads that exit hand their cached body buffers back to the
+	// shared arena, so that they can be reused by other threads.
+	if (fdwReason == DLL_THREAD_DETACH)
+		BufferPool::threadDetach();
+	return TRUE;
+}
+
+
 
 
 // static //
@@ -202,6 +267,11 @@ JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeInit
 	// to be called once, by static initializer in Java class
 	InitializeCriticalSection(&CriticalSection);
 	InitQueueHandles();
+	Log::init();
+	Crc32c::init();
+	InitExceptions(jniEnv);
+	BufferPool::init();
+	QueueSelector::init();
 	return 0;
 }
 
@@ -209,64 +279,128 @@ JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeInit
 
 
 
-// static //
-JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeCreateQueue
-(JNIEnv *jniEnv, jclass clazz, jstring queuePath, jstring queueLabel, jint isTransactional)
+// A copy of a Java string, in modified UTF-8 like GetStringUTFChars, that
+// outlives the call; NULL for a null string.  Free with delete[].
+static char *DupStringUTF(JNIEnv *jniEnv, jstring s)
+{
+	if (s == NULL) return NULL;
+	const char *sz = jniEnv->GetStringUTFChars(s, 0);
+	size_t cb = strlen(sz) + 1;
+	char *copy = new char[cb];
+	memcpy(copy, sz, cb);
+	jniEnv->ReleaseStringUTFChars(s, sz);
+	return copy;
+}
+
 
+static void FreeProvisionRequests(ProvisionRequest *requests, jsize n)
 {
-	HRESULT hr = 0;
-	try {
-		MsmqQueue   *q = new MsmqQueue();
+	for (jsize i = 0; i < n; i++) {
+		delete[] requests[i].szPath;
+		delete[] requests[i].szLabel;
+	}
+	delete[] requests;
+}
 
-		const char * szQueuePath = jniEnv->GetStringUTFChars(queuePath, 0);
-		const char * szQueueLabel = jniEnv->GetStringUTFChars(queueLabel, 0);
-		WCHAR wszFormatName[256]; // MQ_MAX_Q_NAME_LEN ?
-		DWORD dwFormatNameBufferLength = 256;
 
-		hr = q->createQueue((char *)szQueuePath,
-			(char *)szQueueLabel,
-			(LPWSTR)wszFormatName,
-			&dwFormatNameBufferLength,
-			isTransactional);
+// static //
+// The strings are copied out first: the workers cannot use this JNIEnv.
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeCreateAll
+(JNIEnv *jniEnv,
+jclass clazz,
+jobjectArray paths,
+jobjectArray labels,
+jbooleanArray transactional,
+jint parallelism,
+jobjectArray formatNames,
+jintArray results)
+{
+	HRESULT hr = 0;
+	try {
+		jsize n = jniEnv->GetArrayLength(paths);
+		if (jniEnv->GetArrayLength(labels) < n ||
+			jniEnv->GetArrayLength(transactional) < n ||
+			jniEnv->GetArrayLength(formatNames) < n ||
+			jniEnv->GetArrayLength(results) < n ||
+			parallelism < 1)
+			return MQ_ERROR_INVALID_PARAMETER;
+
+		ProvisionRequest *requests = new ProvisionRequest[n];
+		jboolean *tx = jniEnv->GetBooleanArrayElements(transactional, 0);
+		for (jsize i = 0; i < n; i++) {
+			jstring path = (jstring)jniEnv->GetObjectArrayElement(paths, i);
+			jstring label = (jstring)jniEnv->GetObjectArrayElement(labels, i);
+			requests[i].szPath = DupStringUTF(jniEnv, path);
+			requests[i].szLabel = DupStringUTF(jniEnv, label);
+			requests[i].isTransactional = tx[i] ? 1 : 0;
+			requests[i].wszFormatName[0] = L'\0';
+			requests[i].hr = MQ_OK;
+			if (path != NULL) jniEnv->DeleteLocalRef(path);
+			if (label != NULL) jniEnv->DeleteLocalRef(label);
+		}
+		jniEnv->ReleaseBooleanArrayElements(transactional, tx, JNI_ABORT);
+
+		QueueProvisioner::createAll(requests, n, parallelism);
+
+		for (jsize i = 0; i < n; i++) {
+			jint rc = (jint)requests[i].hr;
+			jniEnv->SetIntArrayRegion(results, i, 1, &rc);
+			if (requests[i].wszFormatName[0] != L'\0') {
+				jstring name = jniEnv->NewString((const jchar *)requests[i].wszFormatName,
+					(jsize)wcslen(requests[i].wszFormatName));
+				jniEnv->SetObjectArrayElement(formatNames, i, name);
+				jniEnv->DeleteLocalRef(name);
+			}
+		}
 
-		jniEnv->ReleaseStringUTFChars(queuePath, szQueuePath);
-		jniEnv->ReleaseStringUTFChars(queueLabel, szQueueLabel);
+		FreeProvisionRequests(requests, n);
 	}
 	catch (...) {
-		DIAG("createQueue caught an error..\n");
+		LOG_ERROR("createAll caught an error");
 		jniEnv->ExceptionDescribe();
 		jniEnv->ExceptionClear();
 		hr = -99;
 	}
 
-	fflush(stdout);
 	return (jint)hr;
 }
 
 
 // static //
-JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeDeleteQueue
-(JNIEnv *jniEnv, jclass clazz, jstring queuePath)
-
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeDeleteAll
+(JNIEnv *jniEnv, jclass clazz, jobjectArray queueNames, jint parallelism, jintArray results)
 {
 	HRESULT hr = 0;
 	try {
-		MsmqQueue   *q = new MsmqQueue();
+		jsize n = jniEnv->GetArrayLength(queueNames);
+		if (jniEnv->GetArrayLength(results) < n || parallelism < 1)
+			return MQ_ERROR_INVALID_PARAMETER;
+
+		ProvisionRequest *requests = new ProvisionRequest[n];
+		for (jsize i = 0; i < n; i++) {
+			jstring name = (jstring)jniEnv->GetObjectArrayElement(queueNames, i);
+			requests[i].szPath = DupStringUTF(jniEnv, name);
+			requests[i].szLabel = NULL;
+			requests[i].hr = MQ_OK;
+			if (name != NULL) jniEnv->DeleteLocalRef(name);
+		}
 
-		const char * szQueuePath = jniEnv->GetStringUTFChars(queuePath, 0);
+		QueueProvisioner::deleteAll(requests, n, parallelism);
 
-		hr = q->deleteQueue((char *)szQueuePath);
+		for (jsize i = 0; i < n; i++) {
+			jint rc = (jint)requests[i].hr;
+			jniEnv->SetIntArrayRegion(results, i, 1, &rc);
+		}
 
-		jniEnv->ReleaseStringUTFChars(queuePath, szQueuePath);
+		FreeProvisionRequests(requests, n);
 	}
 	catch (...) {
-		DIAG("deleteQueue caught an error..\n");
+		LOG_ERROR("deleteAll caught an error");
 		jniEnv->ExceptionDescribe();
 		jniEnv->ExceptionClear();
 		hr = -99;
 	}
 
-	fflush(stdout);
 	return (jint)hr;
 }
 
@@ -285,7 +419,7 @@ jint OpenQueueWithAccess
 		MsmqQueue * receiver = NULL;
 
 		const char *szQueuePath = jniEnv->GetStringUTFChars(queuePath, 0);
-		DIAG("OpenQueueWithAccess (%s)\n", szQueuePath);
+		LOG_DEBUG("OpenQueueWithAccess (%s)", szQueuePath);
 
 		if (access & MQ_RECEIVE_ACCESS) {
 			receiver = new MsmqQueue();
@@ -322,13 +456,12 @@ jint OpenQueueWithAccess
 
 	}
 	catch (...) {
-		DIAG("openQueue : Exception. \n");
+		LOG_ERROR("openQueue : Exception");
 		jniEnv->ExceptionDescribe();
 		jniEnv->ExceptionClear();
 		hr = -99;
 	}
 
-	fflush(stdout);
 
 	return (jint)hr;
 }
@@ -413,75 +546,385 @@ JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeOpenQueueForReceive
 
 
 
-JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeReceiveBytes
-(JNIEnv *jniEnv, jobject object, jobject msg, jint timeout, jint ReadOrPeek)
+// A received message, as held on behalf of a Java Message until it
+// is released.  The record itself and the body both come from the
+// BufferPool.  Java objects for the body, label and correlation ID
+// are created only when the Message getters first ask for them.
+struct ReceivedMessage
+{
+	BYTE    *pbBody;
+	DWORD   dwBodyLen;
+	WCHAR   wszLabel[MQ_MAX_MSG_LABEL_LEN];
+	BYTE    correlationId[PROPID_M_CORRELATIONID_SIZE];
+	BYTE    messageId[PROPID_M_MSGID_SIZE];
+	BYTE    priority;
+	DWORD   cBatchRecords;      // 0 unless the body is a batch
+};
+
+
+ReceivedMessage * NewReceivedMessage()
+{
+	ReceivedMessage *rm = (ReceivedMessage *)BufferPool::alloc(sizeof(ReceivedMessage));
+	if (rm != NULL) {
+		rm->pbBody = NULL;
+		rm->dwBodyLen = 0;
+		rm->wszLabel[0] = L'\0';
+		rm->cBatchRecords = 0;
+	}
+	return rm;
+}
+
+
+void FreeReceivedMessage(ReceivedMessage *rm)
+{
+	if (rm == NULL) return;
+	BufferPool::release(rm->pbBody);
+	BufferPool::release((BYTE *)rm);
+}
+
+
+
+// hands the record to the Message; see Message.release()
+HRESULT AttachReceivedMessage(JNIEnv *jniEnv, jobject msg, ReceivedMessage *rm)
+{
+	jclass cls = jniEnv->GetObjectClass(msg);
+	jfieldID fieldId = jniEnv->GetFieldID(cls, "_nativeBuffer", "J");
+	if (fieldId == 0) return -5;
+	jniEnv->SetLongField(msg, fieldId, (jlong)(INT_PTR)rm);
+	return 0;
+}
+
+
+
+// Returns true if a message was received into msg, and false if the
+// timeout expired.  Any other failure is thrown as a
+// MessageQueueException, so that polling with a short timeout does not
+// cost an exception per empty poll.
+JNIEXPORT jboolean JNICALL Java_ionic_Msmq_Queue_nativeReceiveBytes
+(JNIEnv *jniEnv, jobject object, jobject msg, jint timeout, jint ReadOrPeek, jlong transaction)
 {
 	HRESULT  hr = 0;
+	ReceivedMessage *rm = NULL;
+
+	try {
+		MsmqQueue *q = GetReceiverQueue(jniEnv, object, NULL, &hr);
+		if (hr == 0 && q == NULL) hr = MQ_ERROR_INVALID_HANDLE;  // not open for receive
+		if (hr == 0) {
+			rm = NewReceivedMessage();
+			if (rm == NULL) hr = MQ_ERROR_INSUFFICIENT_RESOURCES;
+		}
+
+		if (hr == 0) {
+			hr = q->receiveBytes(&rm->pbBody,
+				&rm->dwBodyLen,
+				rm->wszLabel,
+				rm->correlationId,
+				rm->messageId,
+				&rm->priority,
+				&rm->cBatchRecords,
+				timeout,
+				ReadOrPeek,
+				(ITransaction *)(INT_PTR)transaction);
+		}
+
+		if (hr == 0) {
+			hr = AttachReceivedMessage(jniEnv, msg, rm);
+			if (hr == 0) rm = NULL;
+		}
+
+		FreeReceivedMessage(rm);
+	}
+	catch (...) {
+		LOG_ERROR("Read() : Exception");
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	if (hr == MQ_ERROR_IO_TIMEOUT) return JNI_FALSE;
+	if (hr != 0) {
+		ThrowMessageQueueException(jniEnv, "Cannot receive.", hr);
+		return JNI_FALSE;
+	}
+	return JNI_TRUE;
+}
+
 
+
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativePeekHeader
+(JNIEnv *jniEnv, jobject object, jint timeout, jlongArray values, jobjectArray label,
+jbyteArray correlationId, jbyteArray messageId)
+{
+	HRESULT hr = 0;
 	try {
 		MsmqQueue *q = GetReceiverQueue(jniEnv, object, NULL, &hr);
 		if (hr != 0) return (jint)hr;
+		if (q == NULL) return MQ_ERROR_INVALID_HANDLE;  // not open for receive
+
+		MessageHeader header;
+		hr = q->peekHeader(&header, timeout);
+		if (hr != 0) return (jint)hr;
+
+		// in the order of MessageHeader.java
+		jlong v[5];
+		v[0] = (jlong)header.lookupId;
+		v[1] = header.dwBodySize;
+		v[2] = header.priority;
+		v[3] = header.dwSentTime;
+		v[4] = header.dwArrivedTime;
+		jniEnv->SetLongArrayRegion(values, 0, 5, v);
+		jniEnv->SetByteArrayRegion(correlationId, 0, PROPID_M_CORRELATIONID_SIZE,
+			(jbyte *)header.correlationId);
+		jniEnv->SetByteArrayRegion(messageId, 0, PROPID_M_MSGID_SIZE,
+			(jbyte *)header.messageId);
+
+		jstring s = jniEnv->NewString((const jchar *)header.wszLabel,
+			(jsize)wcslen(header.wszLabel));
+		jniEnv->SetObjectArrayElement(label, 0, s);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
 
-		// get message from the Queue
-		WCHAR wszMessageLabel[MQ_MAX_MSG_LABEL_LEN] = L"";
-		BYTE pCorrelationId[PROPID_M_CORRELATIONID_SIZE];
 
-		// initialize variables
-		BYTE* pbMessage = NULL;
-		DWORD dwMessageLength = 0;
+// Like nativeReceiveBytes, for the message with the given lookup ID.
+// Returns false if it is no longer in the queue.
+JNIEXPORT jboolean JNICALL Java_ionic_Msmq_Queue_nativeReceiveCurrent
+(JNIEnv *jniEnv, jobject object, jobject msg, jlong lookupId, jint ReadOrPeek, jlong transaction)
+{
+	HRESULT  hr = 0;
+	ReceivedMessage *rm = NULL;
+
+	try {
+		MsmqQueue *q = GetReceiverQueue(jniEnv, object, NULL, &hr);
+		if (hr == 0 && q == NULL) hr = MQ_ERROR_INVALID_HANDLE;
+		if (hr == 0) {
+			rm = NewReceivedMessage();
+			if (rm == NULL) hr = MQ_ERROR_INSUFFICIENT_RESOURCES;
+		}
 
-		hr = q->receiveBytes(&pbMessage,
-			&dwMessageLength,
-			(WCHAR*)wszMessageLabel,
-			pCorrelationId,
-			timeout,
-			ReadOrPeek);
+		if (hr == 0) {
+			hr = q->receiveByLookupId((ULONGLONG)lookupId,
+				&rm->pbBody,
+				&rm->dwBodyLen,
+				rm->wszLabel,
+				rm->correlationId,
+				rm->messageId,
+				&rm->priority,
+				&rm->cBatchRecords,
+				ReadOrPeek,
+				(ITransaction *)(INT_PTR)transaction);
+		}
 
 		if (hr == 0) {
-			CHAR szLabel[MQ_MAX_MSG_LABEL_LEN];
-			int len = wcslen(wszMessageLabel);
-			int rc = 0;
-
-			if (len > 0)
-				rc = WideCharToMultiByte(
-				(UINT)CP_ACP,             // code page
-				(DWORD)0,                 // conversion flags
-				(LPCWSTR)wszMessageLabel, // wide-character string to convert
-				len,                       // number of chars in string.
-				(LPSTR)szLabel,           // buffer for new string
-				MQ_MAX_MSG_LABEL_LEN,      // size of buffer
-				(LPCSTR)NULL,             // default for unmappable chars
-				(LPBOOL)NULL              // set when default char used
-				);
-			// terminate
-			if (rc>0)
-				szLabel[rc] = '\0';
-			else if (rc<0)
-				szLabel[0] = '\0';
-
-			SetJavaByteArray(jniEnv, msg, "_messageBody", pbMessage, dwMessageLength);
-			SetJavaString(jniEnv, msg, "_label", (char *)szLabel);
-			SetJavaByteArray(jniEnv, msg, "_correlationId", pCorrelationId, PROPID_M_CORRELATIONID_SIZE);
-			//SetJavaString(jniEnv, msg, "_correlationId", (char *) wszCorrelationId);
+			hr = AttachReceivedMessage(jniEnv, msg, rm);
+			if (hr == 0) rm = NULL;
 		}
 
-		delete[] pbMessage;
+		FreeReceivedMessage(rm);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	if (hr == MQ_ERROR_MESSAGE_NOT_FOUND) return JNI_FALSE;
+	if (hr != 0) {
+		ThrowMessageQueueException(jniEnv, "Cannot receive.", hr);
+		return JNI_FALSE;
+	}
+	return JNI_TRUE;
+}
+
+
+
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeDiscardCurrent
+(JNIEnv *jniEnv, jobject object, jlong lookupId, jlong transaction)
+{
+	HRESULT hr = 0;
+	try {
+		MsmqQueue *q = GetReceiverQueue(jniEnv, object, NULL, &hr);
+		if (hr != 0) return (jint)hr;
+		if (q == NULL) return MQ_ERROR_INVALID_HANDLE;  // not open for receive
 
-		if (hr != 0)  return hr;
+		hr = q->discardByLookupId((ULONGLONG)lookupId, (ITransaction *)(INT_PTR)transaction);
 	}
 	catch (...) {
-		DIAG("Read() : Exception\n");
 		jniEnv->ExceptionDescribe();
 		jniEnv->ExceptionClear();
 		hr = -99;
 	}
 
-	fflush(stdout);
 	return (jint)hr;
 }
 
 
 
+// static //
+JNIEXPORT jbyteArray JNICALL Java_ionic_Msmq_Message_nativeGetBody
+(JNIEnv *jniEnv, jclass clazz, jlong buffer)
+{
+	ReceivedMessage *rm = (ReceivedMessage *)(INT_PTR)buffer;
+
+	jbyteArray value = jniEnv->NewByteArray(rm->dwBodyLen);
+	if (value != NULL && rm->dwBodyLen > 0)
+		jniEnv->SetByteArrayRegion(value, 0, rm->dwBodyLen, (jbyte *)rm->pbBody);
+	return value;
+}
+
+
+// static //
+JNIEXPORT jstring JNICALL Java_ionic_Msmq_Message_nativeGetLabel
+(JNIEnv *jniEnv, jclass clazz, jlong buffer)
+{
+	ReceivedMessage *rm = (ReceivedMessage *)(INT_PTR)buffer;
+	CHAR szLabel[MQ_MAX_MSG_LABEL_LEN];
+	int len = wcslen(rm->wszLabel);
+	int rc = 0;
+
+	szLabel[0] = '\0';
+	if (len > 0)
+		rc = WideCharToMultiByte(
+		(UINT)CP_ACP,             // code page
+		(DWORD)0,                 // conversion flags
+		(LPCWSTR)rm->wszLabel,    // wide-character string to convert
+		len,                       // number of chars in string.
+		(LPSTR)szLabel,           // buffer for new string
+		MQ_MAX_MSG_LABEL_LEN - 1,  // size of buffer, less the terminator
+		(LPCSTR)NULL,             // default for unmappable chars
+		(LPBOOL)NULL              // set when default char used
+		);
+	// terminate
+	if (rc>0)
+		szLabel[rc] = '\0';
+
+	return jniEnv->NewStringUTF(szLabel);
+}
+
+
+// static //
+JNIEXPORT jbyteArray JNICALL Java_ionic_Msmq_Message_nativeGetCorrelationId
+(JNIEnv *jniEnv, jclass clazz, jlong buffer)
+{
+	ReceivedMessage *rm = (ReceivedMessage *)(INT_PTR)buffer;
+
+	jbyteArray value = jniEnv->NewByteArray(PROPID_M_CORRELATIONID_SIZE);
+	if (value != NULL)
+		jniEnv->SetByteArrayRegion(value, 0, PROPID_M_CORRELATIONID_SIZE, (jbyte *)rm->correlationId);
+	return value;
+}
+
+
+// static //
+JNIEXPORT jbyteArray JNICALL Java_ionic_Msmq_Message_nativeGetMessageId
+(JNIEnv *jniEnv, jclass clazz, jlong buffer)
+{
+	ReceivedMessage *rm = (ReceivedMessage *)(INT_PTR)buffer;
+
+	jbyteArray value = jniEnv->NewByteArray(PROPID_M_MSGID_SIZE);
+	if (value != NULL)
+		jniEnv->SetByteArrayRegion(value, 0, PROPID_M_MSGID_SIZE, (jbyte *)rm->messageId);
+	return value;
+}
+
+
+// static //
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Message_nativeGetPriority
+(JNIEnv *jniEnv, jclass clazz, jlong buffer)
+{
+	return ((ReceivedMessage *)(INT_PTR)buffer)->priority;
+}
+
+
+// static //
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Message_nativeGetRecordCount
+(JNIEnv *jniEnv, jclass clazz, jlong buffer)
+{
+	return (jint)((ReceivedMessage *)(INT_PTR)buffer)->cBatchRecords;
+}
+
+
+// static //
+JNIEXPORT void JNICALL Java_ionic_Msmq_Message_nativeReleaseBuffer
+(JNIEnv *jniEnv, jclass clazz, jlong buffer)
+{
+	FreeReceivedMessage((ReceivedMessage *)(INT_PTR)buffer);
+}
+
+
+
+
+/// not a JNI call ///
+// converts a label from Java to the MSMQ form, truncating it to fit
+void LabelToWide(const char *szLabel, WCHAR *wszLabel)
+{
+	wszLabel[0] = L'\0';
+
+	int len = strlen(szLabel);
+	if (len > 0) {
+		int rc = MultiByteToWideChar((UINT)CP_ACP,
+			(DWORD)0,
+			(LPCSTR)szLabel,
+			len,
+			(LPWSTR)wszLabel,
+			MQ_MAX_MSG_LABEL_LEN - 1);   // in chars, less the terminator
+		// terminate
+		if (rc>0)
+			wszLabel[rc] = L'\0';
+	}
+}
+
+
+
+// Sends through the queue's outbox, if it has one.  An async send
+// needs one.
+HRESULT SendOrJournal(MsmqQueue *q,
+	BYTE    *pbBody,
+	DWORD   cbBody,
+	WCHAR   *wszLabel,
+	BYTE    *pCorrelationId,
+	DWORD   cbCorrelationId,
+	ITransaction *pTransaction,
+	int     iPriority,
+	DWORD   dwTimeToReachQueue,
+	DWORD   dwTimeToBeReceived,
+	const BYTE *pDedupId,
+	BOOL    fAsync)
+{
+	Outbox *o = q->getOutbox();
+	if (o != NULL)
+		return o->send(pbBody, cbBody, wszLabel, pCorrelationId, cbCorrelationId,
+			pTransaction, iPriority, dwTimeToReachQueue, dwTimeToBeReceived, pDedupId, fAsync);
+	if (fAsync)
+		return MQ_ERROR_INVALID_PARAMETER;
+	return q->sendBytes(pbBody, cbBody, wszLabel, pCorrelationId, cbCorrelationId,
+		pTransaction, iPriority, dwTimeToReachQueue, dwTimeToBeReceived, pDedupId);
+}
+
+
+
+// Copies the sender's dedup ID out of a Java array.  Returns NULL in
+// *ppDedupId if there is none, and fails if it is the wrong size.
+HRESULT GetDedupId(JNIEnv *jniEnv, jbyteArray dedupId, BYTE *pBuffer, const BYTE **ppDedupId)
+{
+	*ppDedupId = NULL;
+	if (dedupId == NULL)
+		return 0;
+	if (jniEnv->GetArrayLength(dedupId) != MQJ_DEDUP_ID_SIZE)
+		return MQ_ERROR_INVALID_PARAMETER;
+	jniEnv->GetByteArrayRegion(dedupId, 0, MQJ_DEDUP_ID_SIZE, (jbyte *)pBuffer);
+	*ppDedupId = pBuffer;
+	return 0;
+}
+
+
 
 JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeSendBytes
 (JNIEnv *jniEnv,
@@ -489,13 +932,25 @@ jobject object,
 jbyteArray message,
 jstring label,
 jbyteArray correlationId,
-jint transactionFlag,
-jboolean fPriorityFlag)
+jbyteArray dedupId,
+jlong transactionFlag,
+jint priority,
+jint timeToReachQueue,
+jint timeToBeReceived,
+jboolean async)
 {
 	HRESULT hr = 0;
 	try {
+		if (priority < MQ_MIN_PRIORITY || priority > MQ_MAX_PRIORITY) return MQ_ERROR_INVALID_PARAMETER;
+
+		BYTE dedupBuffer[MQJ_DEDUP_ID_SIZE];
+		const BYTE *pDedupId;
+		hr = GetDedupId(jniEnv, dedupId, dedupBuffer, &pDedupId);
+		if (hr != 0) return (jint)hr;
+
 		MsmqQueue   *q = GetSenderQueue(jniEnv, object, NULL, &hr);
 		if (hr != 0) return (jint)hr;
+		if (q == NULL) return MQ_ERROR_INVALID_HANDLE;  // not open for send
 
 		jsize bodyLen = jniEnv->GetArrayLength(message);
 		jbyte *body = jniEnv->GetByteArrayElements(message, 0);
@@ -509,30 +964,20 @@ jboolean fPriorityFlag)
 		//const char *szCorrelationId = jniEnv->GetStringUTFChars(correlationId, 0);
 
 		WCHAR wszLabel[MQ_MAX_MSG_LABEL_LEN];
-		memset(wszLabel, 0, sizeof(MQ_MAX_MSG_LABEL_LEN));
-
-		int len = strlen(szLabel);
-		if (len > 0) {
-			int rc = MultiByteToWideChar((UINT)CP_ACP,
-				(DWORD)0,
-				(LPCSTR)szLabel,
-				len,
-				(LPWSTR)wszLabel,
-				(int) sizeof(wszLabel));
-			// terminate
-			if (rc>0)
-				wszLabel[rc] = L'\0';
-			else if (rc<0)
-				wszLabel[0] = L'\0';
-		}
+		LabelToWide(szLabel, wszLabel);
 
-		hr = q->sendBytes((BYTE *)body,
+		hr = SendOrJournal(q,
+			(BYTE *)body,
 			bodyLen,
 			(WCHAR *)wszLabel,
 			(BYTE *)corId,
 			corIdLen,
-			transactionFlag,
-			fPriorityFlag);
+			(ITransaction *)(INT_PTR)transactionFlag,
+			priority,
+			(DWORD)timeToReachQueue,    // -1 is MQJ_NO_TTL
+			(DWORD)timeToBeReceived,
+			pDedupId,
+			async ? TRUE : FALSE);
 
 		jniEnv->ReleaseByteArrayElements(message, body, 0);
 		jniEnv->ReleaseStringUTFChars(label, szLabel);
@@ -545,13 +990,985 @@ jboolean fPriorityFlag)
 		hr = -99;
 	}
 
-	fflush(stdout);
 	return (jint)hr;
 }
 
 
 
 
+// static //
+// Sends one message to each of the target queues.  The body is pinned
+// and the label converted once for all of them.  results[i] gets the
+// HRESULT for targets[i].  The return value is a failure that is not
+// particular to a target, which leaves results unset, or 0.
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeSendToAll
+(JNIEnv *jniEnv,
+jclass clazz,
+jobjectArray targets,
+jbyteArray message,
+jstring label,
+jbyteArray correlationId,
+jbyteArray dedupId,
+jlong transactionFlag,
+jint priority,
+jint timeToReachQueue,
+jint timeToBeReceived,
+jintArray results)
+{
+	HRESULT hr = 0;
+	try {
+		if (message == NULL || label == NULL) return MQ_ERROR_INVALID_PARAMETER;
+		jsize nTargets = jniEnv->GetArrayLength(targets);
+		if (jniEnv->GetArrayLength(results) < nTargets) return MQ_ERROR_INVALID_PARAMETER;
+		if (priority < MQ_MIN_PRIORITY || priority > MQ_MAX_PRIORITY) return MQ_ERROR_INVALID_PARAMETER;
+
+		// the same ID goes to every target: each has its own window
+		BYTE dedupBuffer[MQJ_DEDUP_ID_SIZE];
+		const BYTE *pDedupId;
+		hr = GetDedupId(jniEnv, dedupId, dedupBuffer, &pDedupId);
+		if (hr != 0) return (jint)hr;
+
+		jsize bodyLen = jniEnv->GetArrayLength(message);
+		jbyte *body = jniEnv->GetByteArrayElements(message, 0);
+		const char *szLabel = jniEnv->GetStringUTFChars(label, 0);
+		jsize corIdLen = 0;
+		jbyte *corId = NULL;
+		if (correlationId != NULL) {
+			corIdLen = jniEnv->GetArrayLength(correlationId);
+			corId = jniEnv->GetByteArrayElements(correlationId, 0);
+		}
+
+		WCHAR wszLabel[MQ_MAX_MSG_LABEL_LEN];
+		LabelToWide(szLabel, wszLabel);
+
+		for (jsize i = 0; i < nTargets; i++) {
+			HRESULT hrTarget = 0;
+			jobject target = jniEnv->GetObjectArrayElement(targets, i);
+			MsmqQueue *q = (target == NULL) ? NULL : GetSenderQueue(jniEnv, target, NULL, &hrTarget);
+			if (hrTarget == 0 && q == NULL)
+				hrTarget = MQ_ERROR_INVALID_HANDLE;  // not open for send
+
+			if (hrTarget == 0)
+				hrTarget = SendOrJournal(q,
+				(BYTE *)body,
+				bodyLen,
+				(WCHAR *)wszLabel,
+				(BYTE *)corId,
+				corIdLen,
+				(ITransaction *)(INT_PTR)transactionFlag,
+				priority,
+				(DWORD)timeToReachQueue,
+				(DWORD)timeToBeReceived,
+				pDedupId,
+				FALSE);
+
+			jint rc = (jint)hrTarget;
+			jniEnv->SetIntArrayRegion(results, i, 1, &rc);
+			if (target != NULL) jniEnv->DeleteLocalRef(target);
+		}
+
+		// nothing was written to the arrays, so there is nothing to copy back
+		jniEnv->ReleaseByteArrayElements(message, body, JNI_ABORT);
+		jniEnv->ReleaseStringUTFChars(label, szLabel);
+		if (corId != NULL)
+			jniEnv->ReleaseByteArrayElements(correlationId, corId, JNI_ABORT);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+
+
+
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeSetCompression
+(JNIEnv *jniEnv, jobject object, jint codec, jint threshold)
+{
+	HRESULT hr = 0;
+	try {
+		if (codec != MQJ_CODEC_NONE && codec != MQJ_CODEC_LZ4) return MQ_ERROR_INVALID_PARAMETER;
+		if (threshold < 0) return MQ_ERROR_INVALID_PARAMETER;
+
+		MsmqQueue *q = GetSenderQueue(jniEnv, object, NULL, &hr);
+		if (hr != 0) return (jint)hr;
+		if (q == NULL) return MQ_ERROR_INVALID_HANDLE;  // not open for send
+
+		q->setCompression(codec, (DWORD)threshold);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeSetChecksum
+(JNIEnv *jniEnv, jobject object, jboolean enable)
+{
+	HRESULT hr = 0;
+	try {
+		MsmqQueue *q = GetSenderQueue(jniEnv, object, NULL, &hr);
+		if (hr != 0) return (jint)hr;
+		if (q == NULL) return MQ_ERROR_INVALID_HANDLE;  // not open for send
+
+		q->setChecksum(enable ? TRUE : FALSE);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeSetDedupWindow
+(JNIEnv *jniEnv, jobject object, jint capacity)
+{
+	HRESULT hr = 0;
+	try {
+		if (capacity < 0) return MQ_ERROR_INVALID_PARAMETER;
+
+		MsmqQueue *q = GetReceiverQueue(jniEnv, object, NULL, &hr);
+		if (hr != 0) return (jint)hr;
+		if (q == NULL) return MQ_ERROR_INVALID_HANDLE;  // not open for receive
+
+		hr = q->setDedupWindow((DWORD)capacity);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeSetMaxAge
+(JNIEnv *jniEnv, jobject object, jint seconds)
+{
+	HRESULT hr = 0;
+	try {
+		if (seconds < 0) return MQ_ERROR_INVALID_PARAMETER;
+
+		MsmqQueue *q = GetReceiverQueue(jniEnv, object, NULL, &hr);
+		if (hr != 0) return (jint)hr;
+		if (q == NULL) return MQ_ERROR_INVALID_HANDLE;  // not open for receive
+
+		q->setMaxAge((DWORD)seconds);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeSetLatencyProbe
+(JNIEnv *jniEnv, jobject object, jboolean enable, jint producerId)
+{
+	HRESULT hr = 0;
+	try {
+		MsmqQueue *q = GetSenderQueue(jniEnv, object, NULL, &hr);
+		if (hr != 0) return (jint)hr;
+		if (q == NULL) return MQ_ERROR_INVALID_HANDLE;  // not open for send
+
+		q->setLatencyProbe(enable ? TRUE : FALSE, (DWORD)producerId);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeSetHeartbeat
+(JNIEnv *jniEnv, jobject object, jint interval)
+{
+	HRESULT hr = 0;
+	try {
+		if (interval < 0) return MQ_ERROR_INVALID_PARAMETER;
+
+		MsmqQueue *q = GetSenderQueue(jniEnv, object, NULL, &hr);
+		if (hr != 0) return (jint)hr;
+		if (q == NULL) return MQ_ERROR_INVALID_HANDLE;  // not open for send
+
+		hr = q->setHeartbeat((DWORD)interval);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeEnableOutbox
+(JNIEnv *jniEnv, jobject object, jstring directory, jint segmentSize, jint maxSegments)
+{
+	HRESULT hr = 0;
+	try {
+		MsmqQueue *q = GetSenderQueue(jniEnv, object, NULL, &hr);
+		if (hr != 0) return (jint)hr;
+		if (q == NULL) return MQ_ERROR_INVALID_HANDLE;  // not open for send
+		if (directory == NULL || segmentSize < 0 || maxSegments < 1) return MQ_ERROR_INVALID_PARAMETER;
+
+		// the path, as UTF-16 with a terminator
+		jsize len = jniEnv->GetStringLength(directory);
+		if (len >= MAX_PATH) return MQ_ERROR_INVALID_PARAMETER;
+		WCHAR wszDirectory[MAX_PATH];
+		jniEnv->GetStringRegion(directory, 0, len, (jchar *)wszDirectory);
+		wszDirectory[len] = L'\0';
+
+		hr = q->enableOutbox(wszDirectory,
+			(segmentSize == 0) ? MQJ_OUTBOX_DEFAULT_SEGMENT : (DWORD)segmentSize,
+			maxSegments);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+
+// The number of messages waiting in the outbox, or -1 if there is none.
+JNIEXPORT jlong JNICALL Java_ionic_Msmq_Queue_nativeGetOutboxPending
+(JNIEnv *jniEnv, jobject object)
+{
+	HRESULT hr = 0;
+	MsmqQueue *q = GetSenderQueue(jniEnv, object, NULL, &hr);
+	if (hr != 0 || q == NULL || q->getOutbox() == NULL) return -1;
+	return (jlong)q->getOutbox()->pending();
+}
+
+
+
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeStartCapture
+(JNIEnv *jniEnv, jobject object, jstring path, jint maxBytes)
+{
+	HRESULT hr = 0;
+	try {
+		MsmqQueue *q = GetReceiverQueue(jniEnv, object, NULL, &hr);
+		if (hr != 0) return (jint)hr;
+		if (q == NULL) return MQ_ERROR_INVALID_HANDLE;  // not open for receive
+		if (path == NULL || maxBytes < 0) return MQ_ERROR_INVALID_PARAMETER;
+
+		// the path, as UTF-16 with a terminator
+		jsize len = jniEnv->GetStringLength(path);
+		if (len >= MAX_PATH) return MQ_ERROR_INVALID_PARAMETER;
+		WCHAR wszPath[MAX_PATH];
+		jniEnv->GetStringRegion(path, 0, len, (jchar *)wszPath);
+		wszPath[len] = L'\0';
+
+		hr = q->startCapture(wszPath,
+			(maxBytes == 0) ? MQJ_CAPTURE_DEFAULT_SIZE : (DWORD)maxBytes);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeStopCapture
+(JNIEnv *jniEnv, jobject object)
+{
+	HRESULT hr = 0;
+	MsmqQueue *q = GetReceiverQueue(jniEnv, object, NULL, &hr);
+	if (hr != 0) return (jint)hr;
+	if (q != NULL) q->stopCapture();
+	return 0;
+}
+
+
+
+// Fills values[] with the counters of the receive and send handles,
+// summed, in MsmqQueueStat order.
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeGetStatistics
+(JNIEnv *jniEnv, jobject object, jlongArray values)
+{
+	HRESULT hr_r = 0;
+	HRESULT hr_s = 0;
+	HRESULT hr = 0;
+	try {
+		MsmqQueue *r = GetReceiverQueue(jniEnv, object, NULL, &hr_r);
+		MsmqQueue *s = GetSenderQueue(jniEnv, object, NULL, &hr_s);
+		if (hr_r != 0) return (jint)hr_r;
+		if (hr_s != 0) return (jint)hr_s;
+
+		jlong counters[STAT_COUNT];
+		for (int i = 0; i < STAT_COUNT; i++) {
+			counters[i] = 0;
+			if (r != NULL) counters[i] += r->getStat((MsmqQueueStat)i);
+			if (s != NULL) counters[i] += s->getStat((MsmqQueueStat)i);
+		}
+
+		jsize n = jniEnv->GetArrayLength(values);
+		if (n > STAT_COUNT) n = STAT_COUNT;
+		jniEnv->SetLongArrayRegion(values, 0, n, counters);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+
+
+// Fills values[] with the backlog of the queue, in MsmqBacklogValue
+// order.  The receive handle is used if there is one, since only it
+// can peek at the age of the oldest message.
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeGetBacklog
+(JNIEnv *jniEnv, jobject object, jlongArray values)
+{
+	HRESULT hr_r = 0;
+	HRESULT hr_s = 0;
+	HRESULT hr = 0;
+	try {
+		MsmqQueue *r = GetReceiverQueue(jniEnv, object, NULL, &hr_r);
+		MsmqQueue *s = GetSenderQueue(jniEnv, object, NULL, &hr_s);
+		if (hr_r != 0) return (jint)hr_r;
+		if (hr_s != 0) return (jint)hr_s;
+		MsmqQueue *q = (r != NULL) ? r : s;
+		if (q == NULL) return MQ_ERROR_INVALID_HANDLE;
+
+		LONGLONG backlog[BACKLOG_COUNT];
+		hr = q->getBacklog(backlog);
+		if (SUCCEEDED(hr)) {
+			jsize n = jniEnv->GetArrayLength(values);
+			if (n > BACKLOG_COUNT) n = BACKLOG_COUNT;
+			jniEnv->SetLongArrayRegion(values, 0, n, (jlong *)backlog);
+		}
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeSetBacklogInterval
+(JNIEnv *jniEnv, jobject object, jint interval)
+{
+	HRESULT hr_r = 0;
+	HRESULT hr_s = 0;
+	HRESULT hr = 0;
+	try {
+		if (interval < 0) return MQ_ERROR_INVALID_PARAMETER;
+
+		MsmqQueue *r = GetReceiverQueue(jniEnv, object, NULL, &hr_r);
+		MsmqQueue *s = GetSenderQueue(jniEnv, object, NULL, &hr_s);
+		if (hr_r != 0) return (jint)hr_r;
+		if (hr_s != 0) return (jint)hr_s;
+
+		if (r != NULL) r->setBacklogInterval((DWORD)interval);
+		if (s != NULL) s->setBacklogInterval((DWORD)interval);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+
+
+
+// the Queue.LabelFilter that purge() asks about each message
+struct LabelFilterContext
+{
+	JNIEnv      *jniEnv;
+	jobject     filter;
+	jmethodID   accept;
+};
+
+
+static HRESULT CallLabelFilter(void *pContext, const WCHAR *wszLabel)
+{
+	LabelFilterContext *ctx = (LabelFilterContext *)pContext;
+	JNIEnv *jniEnv = ctx->jniEnv;
+
+	jstring label = jniEnv->NewString((const jchar *)wszLabel, (jsize)wcslen(wszLabel));
+	if (label == NULL) return E_OUTOFMEMORY;
+	jboolean accepted = jniEnv->CallBooleanMethod(ctx->filter, ctx->accept, label);
+	jniEnv->DeleteLocalRef(label);
+
+	// an exception thrown by the filter stops the purge, and is left
+	// pending for the caller
+	if (jniEnv->ExceptionCheck()) return E_ABORT;
+	return accepted ? S_OK : S_FALSE;
+}
+
+
+
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativePurge
+(JNIEnv *jniEnv, jobject object, jint maxCount, jobject filter, jintArray purged)
+{
+	HRESULT hr = 0;
+	DWORD   cPurged = 0;
+	try {
+		MsmqQueue *q = GetReceiverQueue(jniEnv, object, NULL, &hr);
+		if (hr != 0) return (jint)hr;
+		if (q == NULL) return MQ_ERROR_INVALID_HANDLE;  // not open for receive
+
+		DWORD cMax = (maxCount < 0) ? MQJ_PURGE_ALL : (DWORD)maxCount;
+		if (filter == NULL) {
+			hr = q->purge(cMax, NULL, NULL, &cPurged);
+		}
+		else {
+			LabelFilterContext ctx;
+			ctx.jniEnv = jniEnv;
+			ctx.filter = filter;
+			ctx.accept = jniEnv->GetMethodID(jniEnv->GetObjectClass(filter),
+				"accept", "(Ljava/lang/String;)Z");
+			if (ctx.accept == NULL) return -99;
+			hr = q->purge(cMax, CallLabelFilter, &ctx, &cPurged);
+			if (hr == E_ABORT && jniEnv->ExceptionCheck())
+				return 0;                             // Java throws it
+		}
+
+		jint count = (jint)cPurged;
+		jniEnv->SetIntArrayRegion(purged, 0, 1, &count);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+
+// ------------------------------------------------------------------
+// Transactions
+//
+// The Java Transaction object holds the ITransaction pointer in its
+// _handle field.  Send and receive take that value as their
+// transaction flag, the same way MSMQ itself overloads the
+// ITransaction* argument with MQ_SINGLE_MESSAGE and friends.  Commit
+// and abort take the pointer the Java side has already cleared from
+// the field, so that only one of them can release it.
+// ------------------------------------------------------------------
+
+ITransaction * GetTransaction(JNIEnv *jniEnv, jobject object, jfieldID *pFieldId)
+{
+	jclass cls = jniEnv->GetObjectClass(object);
+	*pFieldId = jniEnv->GetFieldID(cls, "_handle", "J");
+	if (*pFieldId == 0) return NULL;
+	return (ITransaction *)(INT_PTR)jniEnv->GetLongField(object, *pFieldId);
+}
+
+
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Transaction_nativeBegin
+(JNIEnv *jniEnv, jobject object)
+{
+	HRESULT hr = 0;
+	try {
+		ITransaction *pXact = NULL;
+		jfieldID fieldId;
+		if (GetTransaction(jniEnv, object, &fieldId) != NULL) return MQ_ERROR_TRANSACTION_USAGE;
+		if (fieldId == 0) return -3;
+
+		hr = MQBeginTransaction(&pXact);
+		if (SUCCEEDED(hr))
+			jniEnv->SetLongField(object, fieldId, (jlong)(INT_PTR)pXact);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+/// not a JNI call ///
+jint EndTransaction
+(JNIEnv *jniEnv, jlong handle, BOOL fCommit)
+{
+	HRESULT hr = 0;
+	try {
+		ITransaction *pXact = (ITransaction *)(INT_PTR)handle;
+		if (pXact == NULL) return MQ_ERROR_TRANSACTION_USAGE;
+
+		if (fCommit)
+			hr = pXact->Commit(FALSE, 0, 0);
+		else
+			hr = pXact->Abort(NULL, FALSE, FALSE);
+		pXact->Release();
+		if (hr != 0) LOG_WARN("EndTransaction(%d): hr=0x%08x", fCommit, hr);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+// static //
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Transaction_nativeCommit
+(JNIEnv *jniEnv, jclass clazz, jlong handle)
+{
+	return EndTransaction(jniEnv, handle, TRUE);
+}
+
+
+// static //
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Transaction_nativeAbort
+(JNIEnv *jniEnv, jclass clazz, jlong handle)
+{
+	return EndTransaction(jniEnv, handle, FALSE);
+}
+
+
+
+
+
+// ------------------------------------------------------------------
+// QueueSelector
+//
+// The Java QueueSelector holds the native QueueSelector pointer in
+// its _handle field, and passes it to the static natives below.  The
+// Java side makes sure the pointer is not destroyed while another
+// thread is using it.
+// ------------------------------------------------------------------
+
+JNIEXPORT jint JNICALL Java_ionic_Msmq_QueueSelector_nativeCreate
+(JNIEnv *jniEnv, jobject object)
+{
+	HRESULT hr = 0;
+	try {
+		jclass cls = jniEnv->GetObjectClass(object);
+		jfieldID fieldId = jniEnv->GetFieldID(cls, "_handle", "J");
+		if (fieldId == 0) return -3;
+
+		QueueSelector *sel = new QueueSelector();
+		hr = sel->open();
+		if (hr != 0) {
+			delete sel;
+			return (jint)hr;
+		}
+		jniEnv->SetLongField(object, fieldId, (jlong)(INT_PTR)sel);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+// static //
+JNIEXPORT jint JNICALL Java_ionic_Msmq_QueueSelector_nativeRegister
+(JNIEnv *jniEnv, jclass clazz, jlong handle, jobject queue)
+{
+	HRESULT hr = 0;
+	int slot;
+	try {
+		MsmqQueue *q = GetReceiverQueue(jniEnv, queue, &slot, &hr);
+		if (hr != 0) return (jint)hr;
+		if (q == NULL) return MQ_ERROR_INVALID_HANDLE;  // not open for receive
+
+		hr = ((QueueSelector *)(INT_PTR)handle)->add(q, slot);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+// static //
+JNIEXPORT jint JNICALL Java_ionic_Msmq_QueueSelector_nativeUnregister
+(JNIEnv *jniEnv, jclass clazz, jlong handle, jobject queue)
+{
+	HRESULT hr = 0;
+	try {
+		MsmqQueue *q = GetReceiverQueue(jniEnv, queue, NULL, &hr);
+		if (hr != 0) return (jint)hr;
+		if (q == NULL) return MQ_ERROR_INVALID_HANDLE;
+
+		hr = ((QueueSelector *)(INT_PTR)handle)->remove(q);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+// static //
+// Returns the number of slots stored in readySlots, or a failed HRESULT.
+JNIEXPORT jint JNICALL Java_ionic_Msmq_QueueSelector_nativeSelect
+(JNIEnv *jniEnv, jclass clazz, jlong handle, jint timeout, jintArray readySlots)
+{
+	int n = 0;
+	try {
+		int slots[MAX_QUEUES];
+		jsize cSlots = jniEnv->GetArrayLength(readySlots);
+		if (cSlots > MAX_QUEUES) cSlots = MAX_QUEUES;
+
+		n = ((QueueSelector *)(INT_PTR)handle)->select((DWORD)timeout, slots, cSlots);
+		if (n > 0)
+			jniEnv->SetIntArrayRegion(readySlots, 0, n, (jint *)slots);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		n = -99;
+	}
+
+	return (jint)n;
+}
+
+
+// static //
+JNIEXPORT jint JNICALL Java_ionic_Msmq_QueueSelector_nativeWakeup
+(JNIEnv *jniEnv, jclass clazz, jlong handle)
+{
+	return (jint)((QueueSelector *)(INT_PTR)handle)->wakeup();
+}
+
+
+// static //
+JNIEXPORT void JNICALL Java_ionic_Msmq_QueueSelector_nativeClose
+(JNIEnv *jniEnv, jclass clazz, jlong handle, jint waiters)
+{
+	((QueueSelector *)(INT_PTR)handle)->close(waiters);
+}
+
+
+// static //
+JNIEXPORT void JNICALL Java_ionic_Msmq_QueueSelector_nativeDestroy
+(JNIEnv *jniEnv, jclass clazz, jlong handle)
+{
+	delete (QueueSelector *)(INT_PTR)handle;
+}
+
+
+
+
+
+// ------------------------------------------------------------------
+// FairConsumer
+//
+// Like the QueueSelector, the Java FairConsumer holds the native
+// FairScheduler pointer in its _handle field.  The scheduler only
+// picks the queue; the Java side receives from it.
+// ------------------------------------------------------------------
+
+JNIEXPORT jint JNICALL Java_ionic_Msmq_FairConsumer_nativeCreate
+(JNIEnv *jniEnv, jobject object)
+{
+	HRESULT hr = 0;
+	try {
+		jclass cls = jniEnv->GetObjectClass(object);
+		jfieldID fieldId = jniEnv->GetFieldID(cls, "_handle", "J");
+		if (fieldId == 0) return -3;
+
+		FairScheduler *fs = new FairScheduler();
+		hr = fs->open();
+		if (hr != 0) {
+			delete fs;
+			return (jint)hr;
+		}
+		jniEnv->SetLongField(object, fieldId, (jlong)(INT_PTR)fs);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+// static //
+JNIEXPORT jint JNICALL Java_ionic_Msmq_FairConsumer_nativeAdd
+(JNIEnv *jniEnv, jclass clazz, jlong handle, jobject queue, jint weight)
+{
+	HRESULT hr = 0;
+	int slot;
+	try {
+		MsmqQueue *q = GetReceiverQueue(jniEnv, queue, &slot, &hr);
+		if (hr != 0) return (jint)hr;
+		if (q == NULL) return MQ_ERROR_INVALID_HANDLE;  // not open for receive
+
+		hr = ((FairScheduler *)(INT_PTR)handle)->add(q, slot, weight);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+// static //
+// The slot is passed in, so that a queue that has been closed can
+// still be removed.
+JNIEXPORT jint JNICALL Java_ionic_Msmq_FairConsumer_nativeRemove
+(JNIEnv *jniEnv, jclass clazz, jlong handle, jobject queue, jint slot)
+{
+	HRESULT hr = 0;
+	try {
+		MsmqQueue *q = GetReceiverQueue(jniEnv, queue, NULL, &hr);
+		if (hr != 0) q = NULL;
+
+		hr = ((FairScheduler *)(INT_PTR)handle)->remove(q, slot);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+// static //
+// Returns the slot of the queue to receive from, or a failed HRESULT.
+JNIEXPORT jint JNICALL Java_ionic_Msmq_FairConsumer_nativeNext
+(JNIEnv *jniEnv, jclass clazz, jlong handle, jint timeout)
+{
+	int slot = 0;
+	HRESULT hr = ((FairScheduler *)(INT_PTR)handle)->next((DWORD)timeout, &slot);
+	return (hr == MQ_OK) ? (jint)slot : (jint)hr;
+}
+
+
+// static //
+JNIEXPORT void JNICALL Java_ionic_Msmq_FairConsumer_nativeDrained
+(JNIEnv *jniEnv, jclass clazz, jlong handle, jint slot)
+{
+	((FairScheduler *)(INT_PTR)handle)->drained(slot);
+}
+
+
+// static //
+JNIEXPORT void JNICALL Java_ionic_Msmq_FairConsumer_nativeClose
+(JNIEnv *jniEnv, jclass clazz, jlong handle, jint waiters)
+{
+	((FairScheduler *)(INT_PTR)handle)->close(waiters);
+}
+
+
+// static //
+JNIEXPORT void JNICALL Java_ionic_Msmq_FairConsumer_nativeDestroy
+(JNIEnv *jniEnv, jclass clazz, jlong handle)
+{
+	delete (FairScheduler *)(INT_PTR)handle;
+}
+
+
+
+// ------------------------------------------------------------------
+// BatchingSender
+//
+// The native BatchingSender belongs to the send handle of the Queue,
+// like the outbox, and is stopped when the queue is closed.
+// ------------------------------------------------------------------
+
+// static //
+JNIEXPORT jint JNICALL Java_ionic_Msmq_BatchingSender_nativeOpen
+(JNIEnv *jniEnv, jclass clazz, jobject queue, jint maxBatchBytes, jint maxDelay, jstring label, jboolean transactional)
+{
+	HRESULT hr = 0;
+	try {
+		MsmqQueue *q = GetSenderQueue(jniEnv, queue, NULL, &hr);
+		if (hr != 0) return (jint)hr;
+		if (q == NULL) return MQ_ERROR_INVALID_HANDLE;  // not open for send
+		if (label == NULL || maxBatchBytes < 0 || maxDelay < 0) return MQ_ERROR_INVALID_PARAMETER;
+
+		const char *szLabel = jniEnv->GetStringUTFChars(label, 0);
+		WCHAR wszLabel[MQ_MAX_MSG_LABEL_LEN];
+		LabelToWide(szLabel, wszLabel);
+		jniEnv->ReleaseStringUTFChars(label, szLabel);
+
+		hr = q->enableBatching(
+			(maxBatchBytes == 0) ? MQJ_BATCH_DEFAULT_SIZE : (DWORD)maxBatchBytes,
+			(DWORD)maxDelay,
+			wszLabel,
+			transactional ? TRUE : FALSE);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+// static //
+JNIEXPORT jint JNICALL Java_ionic_Msmq_BatchingSender_nativeAdd
+(JNIEnv *jniEnv, jclass clazz, jobject queue, jbyteArray record, jint offset, jint length)
+{
+	HRESULT hr = 0;
+	try {
+		MsmqQueue *q = GetSenderQueue(jniEnv, queue, NULL, &hr);
+		if (hr != 0) return (jint)hr;
+		if (q == NULL || q->getBatcher() == NULL) return MQ_ERROR_INVALID_HANDLE;
+
+		jbyte *pb = jniEnv->GetByteArrayElements(record, 0);
+		hr = q->getBatcher()->add((BYTE *)pb + offset, (DWORD)length);
+		jniEnv->ReleaseByteArrayElements(record, pb, JNI_ABORT);
+	}
+	catch (...) {
+		jniEnv->ExceptionDescribe();
+		jniEnv->ExceptionClear();
+		hr = -99;
+	}
+
+	return (jint)hr;
+}
+
+
+// static //
+JNIEXPORT jint JNICALL Java_ionic_Msmq_BatchingSender_nativeFlush
+(JNIEnv *jniEnv, jclass clazz, jobject queue)
+{
+	HRESULT hr = 0;
+	MsmqQueue *q = GetSenderQueue(jniEnv, queue, NULL, &hr);
+	if (hr != 0) return (jint)hr;
+	if (q == NULL || q->getBatcher() == NULL) return MQ_ERROR_INVALID_HANDLE;
+	return (jint)q->getBatcher()->flush();
+}
+
+
+// static //
+JNIEXPORT jint JNICALL Java_ionic_Msmq_BatchingSender_nativeClose
+(JNIEnv *jniEnv, jclass clazz, jobject queue)
+{
+	HRESULT hr = 0;
+	MsmqQueue *q = GetSenderQueue(jniEnv, queue, NULL, &hr);
+	if (hr != 0) return (jint)hr;
+	if (q != NULL) q->disableBatching();
+	return 0;
+}
+
+
+
+// ------------------------------------------------------------------
+// NativeLog
+// ------------------------------------------------------------------
+
+// static //
+JNIEXPORT void JNICALL Java_ionic_Msmq_NativeLog_nativeSetLevel
+(JNIEnv *jniEnv, jclass clazz, jint level)
+{
+	if (level < LOG_LEVEL_OFF) level = LOG_LEVEL_OFF;
+	if (level > LOG_LEVEL_TRACE) level = LOG_LEVEL_TRACE;
+	InterlockedExchange(&Log::level, level);
+}
+
+
+// static //
+JNIEXPORT jint JNICALL Java_ionic_Msmq_NativeLog_nativeGetLevel
+(JNIEnv *jniEnv, jclass clazz)
+{
+	return (jint)Log::level;
+}
+
+
+// static //
+JNIEXPORT jlong JNICALL Java_ionic_Msmq_NativeLog_nativeGetDropped
+(JNIEnv *jniEnv, jclass clazz)
+{
+	return (jlong)Log::dropped();
+}
+
+
+// static //
+JNIEXPORT void JNICALL Java_ionic_Msmq_NativeLog_nativeSetBridged
+(JNIEnv *jniEnv, jclass clazz, jboolean bridged)
+{
+	Log::setBridged(bridged ? TRUE : FALSE);
+}
+
+
+// static //
+// Returns the text of the oldest record, and stores its level and
+// thread id in info[0] and info[1]; or returns null if there is none.
+JNIEXPORT jstring JNICALL Java_ionic_Msmq_NativeLog_nativeTake
+(JNIEnv *jniEnv, jclass clazz, jintArray info)
+{
+	int lvl;
+	DWORD dwThreadId;
+	char szText[LOG_RECORD_LEN];
+
+	if (!Log::take(&lvl, &dwThreadId, szText)) return NULL;
+
+	jint values[2];
+	values[0] = lvl;
+	values[1] = (jint)dwThreadId;
+	jniEnv->SetIntArrayRegion(info, 0, 2, values);
+	return jniEnv->NewStringUTF(szText);
+}
+
+
 
 JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeClose
 (JNIEnv *jniEnv, jobject object)
@@ -565,15 +1982,16 @@ JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeClose
 		r = GetReceiverQueue(jniEnv, object, &slot, &hr_r);
 		s = GetSenderQueue(jniEnv, object, &slot, &hr_s);
 		if ((hr_r == 0) && (r != NULL)){
+			QueueSelector::detach(r);
 			hr_r = r->closeQueue();
 			delete r;
-			if (hr_r != 0) DIAG("Zowie, can't close receiver. (hr=0x%08x)\n", hr_r);
+			if (hr_r != 0) LOG_WARN("Zowie, can't close receiver. (hr=0x%08x)", hr_r);
 		}
 
 		if ((hr_s == 0) && (s != NULL)) {
 			hr_s = s->closeQueue();
 			delete s;
-			if (hr_s != 0) DIAG("Zowie, can't close sender. (hr=0x%08x)\n", hr_s);
+			if (hr_s != 0) LOG_WARN("Zowie, can't close sender. (hr=0x%08x)", hr_s);
 		}
 
 		FreeSlot(slot);
@@ -589,6 +2007,5 @@ JNIEXPORT jint JNICALL Java_ionic_Msmq_Queue_nativeClose
 		hr = -99;
 	}
 
-	fflush(stdout);
 	return (jint)hr;
 }
\ No newline at end of file
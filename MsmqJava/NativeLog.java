@@ -0,0 +1,176 @@
+//
+// NativeLog.java
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module controls the diagnostic log of the native layer.
+//
+// ------------------------------------------------------------------
+
+package ionic.Msmq;
+
+
+/**
+ * <p>Controls the diagnostic log of the MsmqJava native layer.</p>
+ *
+ * <p>The native layer queues its log records in memory, and a
+ * background thread writes them to stdout a few times a second, so
+ * that sending and receiving never wait on the log. If records are
+ * logged faster than they are written, the excess are dropped and
+ * counted.</p>
+ *
+ * <p>The level starts at WARN, or at the level named by the
+ * <tt>MSMQJAVA_LOG_LEVEL</tt> environment variable, e.g.
+ * <tt>MSMQJAVA_LOG_LEVEL=debug</tt>.</p>
+ *
+ * <blockquote class='code'><pre>
+ *   NativeLog.setLevel(NativeLog.DEBUG);
+ *   NativeLog.bridgeTo(java.util.logging.Logger.getLogger("ionic.Msmq"));
+ * </pre></blockquote>
+ *
+ */
+public final class NativeLog
+{
+    public static final int OFF = 0;
+    public static final int ERROR = 1;
+    public static final int WARN = 2;
+    public static final int INFO = 3;
+    public static final int DEBUG = 4;
+    public static final int TRACE = 5;
+
+
+    private NativeLog() { }
+
+
+    /**
+     * Sets the most verbose level that is logged.
+     *
+     * @param level  one of OFF, ERROR, WARN, INFO, DEBUG or TRACE.
+     **/
+    public static void setLevel(int level)
+    {
+        if (level < OFF || level > TRACE)
+            throw new IllegalArgumentException("level must be between OFF and TRACE");
+        nativeSetLevel(level);
+    }
+
+
+    /**
+     * @return the most verbose level that is logged.
+     **/
+    public static int getLevel() { return nativeGetLevel(); }
+
+
+    /**
+     * @return the number of records dropped because the log was full.
+     **/
+    public static long getDroppedCount() { return nativeGetDropped(); }
+
+
+    /**
+     * <p>Publish the native log records to a java.util.logging Logger,
+     * instead of writing them to stdout. A daemon thread takes the
+     * records, and publishes them at the matching level: ERROR as
+     * SEVERE, WARN as WARNING, INFO as INFO, DEBUG as FINE and TRACE as
+     * FINER.</p>
+     *
+     * <p>The native level still decides what is logged, so it
+     * should be set at least as verbose as the Logger's level.</p>
+     *
+     * @param logger  the logger to publish to, or null to go back to
+     *                writing to stdout.
+     **/
+    public static synchronized void bridgeTo(java.util.logging.Logger logger)
+    {
+        _logger= logger;
+        nativeSetBridged(logger != null);
+        if (logger != null && _thread == null) {
+            _thread= new Thread("MsmqJava native log") {
+                    public void run() { _pump(); }
+                };
+            _thread.setDaemon(true);
+            _thread.start();
+        }
+    }
+
+
+    private static void _pump()
+    {
+        int[] info= new int[2];
+        for (;;) {
+            java.util.logging.Logger logger;
+            synchronized (NativeLog.class) {
+                logger= _logger;
+                if (logger == null) {
+                    _thread= null;
+                    return;
+                }
+            }
+
+            String text= nativeTake(info);
+            if (text == null) {
+                try { Thread.sleep(POLL_MILLIS); }
+                catch (InterruptedException ex1) { }
+                continue;
+            }
+
+            java.util.logging.LogRecord r=
+                new java.util.logging.LogRecord(_toLevel(info[0]), text);
+            r.setLoggerName(logger.getName());
+            r.setThreadID(info[1]);
+            logger.log(r);
+        }
+    }
+
+
+    private static java.util.logging.Level _toLevel(int level)
+    {
+        switch (level) {
+            case ERROR: return java.util.logging.Level.SEVERE;
+            case WARN:  return java.util.logging.Level.WARNING;
+            case INFO:  return java.util.logging.Level.INFO;
+            case DEBUG: return java.util.logging.Level.FINE;
+            default:    return java.util.logging.Level.FINER;
+        }
+    }
+
+
+
+    // --------------------------------------------
+    // native methods
+    private static native void nativeSetLevel(int level);
+    private static native int nativeGetLevel();
+    private static native long nativeGetDropped();
+    private static native void nativeSetBridged(boolean bridged);
+    private static native String nativeTake(int[] info);
+
+
+    // --------------------------------------------
+    // private members
+    private static final int POLL_MILLIS = 100;
+
+    private static java.util.logging.Logger _logger;
+    private static Thread _thread;
+
+    // --------------------------------------------
+    // static initializer
+    static {
+        System.loadLibrary("MsmqJava");
+        // the native layer is initialized by the Queue class
+        try { Class.forName("ionic.Msmq.Queue"); }
+        catch (ClassNotFoundException ex1) { }
+    }
+}
@@ -0,0 +1,608 @@
+//
+// Outbox.cpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module keeps messages that could not be sent in a journal on
+// local disk, and forwards them in order when the destination is back.
+//
+// The journal is a directory of fixed-size segment files, named
+// outbox-<sequence>.seg, each mapped into memory.  Records are
+// appended to the newest segment; a background thread sends them from
+// the oldest, and deletes a segment once it has forwarded all of it.
+// Each segment header holds the offset of the first record not yet
+// forwarded, so a restart resumes where the forwarder stopped; the
+// record being sent at a crash may be sent twice.
+//
+// A record is a header, then the label, correlation ID and body.  The
+// magic number of the header is written last, and the header carries
+// a CRC-32C of the rest, so a record torn by a crash is seen as the
+// end of the journal.  Appends only write to the mapped view, and the
+// forwarder flushes views to disk when it is idle: a journaled message
+// survives the process dying at once, and a power loss after the next
+// flush.
+//
+// ------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <process.h>
+#include <WTypes.h>   // reqd for WinBase.h
+#include <WinBase.h>  // for CriticalSection
+#include <MqOai.h>
+#include <mq.h>
+
+#include "Log.hpp"
+#include "DedupWindow.hpp"
+#include "MsmqQueue.hpp"
+#include "Crc32c.hpp"
+#include "Outbox.hpp"
+
+
+#define OUTBOX_SEGMENT_MAGIC    0x584F424D   // "MBOX"
+#define OUTBOX_RECORD_MAGIC     0x4452424D   // "MBRD"
+#define OUTBOX_RECORD_MAGIC_ID  0x4952424D   // "MBRI": the sender's dedup ID comes first
+#define OUTBOX_MAX_FILES        4096         // looked at on recovery
+#define OUTBOX_IDLE_MILLIS      1000
+#define OUTBOX_FLUSH_BATCH      8            // segments flushed per idle pass
+#define OUTBOX_FIRST_BACKOFF    250          // ms, doubled up to the max
+#define OUTBOX_MAX_BACKOFF      30000
+
+#define OUTBOX_ALIGN(n)         (((n) + 7) & ~7)
+
+
+struct OutboxSegmentHeader
+{
+	DWORD           magic;
+	DWORD           cbSegment;
+	DWORD           dwSequence;
+	volatile LONG   readOffset;     // the records before it were forwarded
+	DWORD           reserved[4];
+};
+
+
+struct OutboxRecordHeader
+{
+	volatile DWORD  magic;          // written last
+	DWORD           crc;            // of the dedup ID, label, correlation ID and body
+	DWORD           cchLabel;       // including the terminator
+	DWORD           cbCorrelationId;
+	DWORD           cbBody;
+	DWORD           transaction;    // MQ_NO_TRANSACTION or MQ_SINGLE_MESSAGE
+	DWORD           priority;
+	DWORD           expires;        // time_t seconds, or 0 for never
+};
+
+
+struct OutboxSegment
+{
+	HANDLE          hFile;
+	HANDLE          hMapping;
+	BYTE            *pBase;
+	DWORD           cbSize;
+	DWORD           dwSequence;
+	DWORD           cbWritten;      // the append offset
+	BOOL            sealed;         // no more appends; a newer one exists
+	BOOL            dirty;          // appended to since the last flush
+	OutboxSegment   *next;
+	WCHAR           wszPath[MAX_PATH];
+};
+
+
+
+// the bytes of dedup ID ahead of the label, for a record with this magic
+static DWORD RecordIdSize(DWORD magic)
+{
+	return (magic == OUTBOX_RECORD_MAGIC_ID) ? MQJ_DEDUP_ID_SIZE : 0;
+}
+
+
+
+// the size of a record, or 0 if the header is not sane
+static DWORD RecordSize(const OutboxRecordHeader *r, DWORD cbId, DWORD cbRoom)
+{
+	ULONGLONG cb = (ULONGLONG)sizeof(OutboxRecordHeader)
+		+ cbId
+		+ (ULONGLONG)r->cchLabel * sizeof(WCHAR)
+		+ r->cbCorrelationId
+		+ r->cbBody;
+	cb = OUTBOX_ALIGN(cb);
+	return (cb > cbRoom) ? 0 : (DWORD)cb;
+}
+
+
+
+// only for a record RecordSize found sane
+static DWORD RecordCrc(const OutboxRecordHeader *r, DWORD cbId)
+{
+	DWORD cb = cbId + r->cchLabel * sizeof(WCHAR) + r->cbCorrelationId + r->cbBody;
+	return Crc32c::compute(0, (const BYTE *)(r + 1), cb);
+}
+
+
+
+Outbox::Outbox(MsmqQueue *q)
+{
+	queue = q;
+	wszDirectory[0] = L'\0';
+	cbSegment = MQJ_OUTBOX_DEFAULT_SEGMENT;
+	cMaxSegments = MQJ_OUTBOX_DEFAULT_SEGMENTS;
+	InitializeCriticalSection(&cs);
+	head = NULL;
+	tail = NULL;
+	cSegments = 0;
+	cPending = 0;
+	hWake = NULL;
+	hStop = NULL;
+	hThread = NULL;
+}
+
+
+
+Outbox::~Outbox()
+{
+	if (hThread != NULL) {
+		SetEvent(hStop);
+		WaitForSingleObject(hThread, INFINITE);
+		CloseHandle(hThread);
+	}
+	if (hWake != NULL) CloseHandle(hWake);
+	if (hStop != NULL) CloseHandle(hStop);
+
+	while (head != NULL) {
+		OutboxSegment *seg = head;
+		head = seg->next;
+		closeSegment(seg, FALSE);
+	}
+	DeleteCriticalSection(&cs);
+}
+
+
+
+BOOL Outbox::isTransient(HRESULT hr)
+{
+	return hr == MQ_ERROR_STALE_HANDLE ||
+		hr == MQ_ERROR_INVALID_HANDLE ||
+		hr == MQ_ERROR_SERVICE_NOT_AVAILABLE ||
+		hr == MQ_ERROR_REMOTE_MACHINE_NOT_AVAILABLE ||
+		hr == MQ_ERROR_QUEUE_NOT_AVAILABLE ||
+		hr == MQ_ERROR_NO_DS ||
+		hr == MQ_ERROR_INSUFFICIENT_RESOURCES;
+}
+
+
+
+HRESULT Outbox::open(const WCHAR *wszDir, DWORD cbSeg, int cMaxSeg)
+{
+	if (wszDir == NULL || wszDir[0] == L'\0' || cMaxSeg < 1)
+		return MQ_ERROR_INVALID_PARAMETER;
+	if (cbSeg < MQJ_OUTBOX_MIN_SEGMENT) cbSeg = MQJ_OUTBOX_MIN_SEGMENT;
+
+	wcsncpy_s(wszDirectory, MAX_PATH, wszDir, _TRUNCATE);
+	cbSegment = OUTBOX_ALIGN(cbSeg);
+	cMaxSegments = cMaxSeg;
+
+	if (!CreateDirectoryW(wszDirectory, NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+		return HRESULT_FROM_WIN32(GetLastError());
+
+	HRESULT hr = recover();
+	if (FAILED(hr)) return hr;
+
+	hWake = CreateEventW(NULL, FALSE, FALSE, NULL);
+	hStop = CreateEventW(NULL, TRUE, FALSE, NULL);
+	if (hWake == NULL || hStop == NULL)
+		return HRESULT_FROM_WIN32(GetLastError());
+
+	hThread = (HANDLE)_beginthreadex(NULL, 0, forwarderMain, this, 0, NULL);
+	if (hThread == NULL)
+		return MQ_ERROR_INSUFFICIENT_RESOURCES;
+
+	return MQ_OK;
+}
+
+
+
+HRESULT Outbox::openSegment(DWORD dwSequence, BOOL fCreate, OutboxSegment **ppSeg)
+{
+	OutboxSegment *seg = new OutboxSegment;
+	memset(seg, 0, sizeof(OutboxSegment));
+	seg->dwSequence = dwSequence;
+	swprintf_s(seg->wszPath, MAX_PATH, L"%s\\outbox-%08x.seg", wszDirectory, dwSequence);
+
+	HRESULT hr = MQ_OK;
+
+	// not shared: one outbox per directory
+	seg->hFile = CreateFileW(seg->wszPath, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+		fCreate ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (seg->hFile == INVALID_HANDLE_VALUE) {
+		seg->hFile = NULL;
+		hr = HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	if (SUCCEEDED(hr)) {
+		if (fCreate) {
+			seg->cbSize = cbSegment;
+		}
+		else {
+			LARGE_INTEGER size;
+			if (!GetFileSizeEx(seg->hFile, &size))
+				hr = HRESULT_FROM_WIN32(GetLastError());
+			else if (size.QuadPart < (LONGLONG)sizeof(OutboxSegmentHeader) || size.QuadPart > 0x7FFFFFFF)
+				hr = MQ_ERROR_INVALID_PARAMETER;
+			else
+				seg->cbSize = (DWORD)size.QuadPart;
+		}
+	}
+
+	if (SUCCEEDED(hr)) {
+		// mapping a new file extends it, with zeros
+		seg->hMapping = CreateFileMappingW(seg->hFile, NULL, PAGE_READWRITE, 0, seg->cbSize, NULL);
+		if (seg->hMapping == NULL)
+			hr = HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	if (SUCCEEDED(hr)) {
+		seg->pBase = (BYTE *)MapViewOfFile(seg->hMapping, FILE_MAP_WRITE, 0, 0, seg->cbSize);
+		if (seg->pBase == NULL)
+			hr = HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	if (SUCCEEDED(hr)) {
+		OutboxSegmentHeader *h = (OutboxSegmentHeader *)seg->pBase;
+		if (fCreate) {
+			h->cbSegment = seg->cbSize;
+			h->dwSequence = dwSequence;
+			h->readOffset = sizeof(OutboxSegmentHeader);
+			MemoryBarrier();
+			h->magic = OUTBOX_SEGMENT_MAGIC;
+			seg->cbWritten = sizeof(OutboxSegmentHeader);
+		}
+		else if (h->magic != OUTBOX_SEGMENT_MAGIC || h->cbSegment != seg->cbSize ||
+			h->readOffset < (LONG)sizeof(OutboxSegmentHeader) || (DWORD)h->readOffset > seg->cbSize) {
+			hr = MQ_ERROR_INVALID_PARAMETER;
+		}
+	}
+
+	if (FAILED(hr)) {
+		LOG_ERROR("Outbox: cannot open %ls (hr=0x%08x)", seg->wszPath, hr);
+		closeSegment(seg, FALSE);
+		return hr;
+	}
+
+	*ppSeg = seg;
+	return MQ_OK;
+}
+
+
+
+void Outbox::closeSegment(OutboxSegment *seg, BOOL fDelete)
+{
+	if (seg->pBase != NULL) {
+		if (!fDelete) FlushViewOfFile(seg->pBase, 0);
+		UnmapViewOfFile(seg->pBase);
+	}
+	if (seg->hMapping != NULL) CloseHandle(seg->hMapping);
+	if (seg->hFile != NULL) CloseHandle(seg->hFile);
+	if (fDelete) DeleteFileW(seg->wszPath);
+	delete seg;
+}
+
+
+
+// Finds the end of the records in a segment, and returns the number
+// not yet forwarded.
+LONG Outbox::scanSegment(OutboxSegment *seg)
+{
+	OutboxSegmentHeader *h = (OutboxSegmentHeader *)seg->pBase;
+	DWORD off = sizeof(OutboxSegmentHeader);
+	LONG cRecords = 0;
+
+	while (off + sizeof(OutboxRecordHeader) <= seg->cbSize) {
+		OutboxRecordHeader *r = (OutboxRecordHeader *)(seg->pBase + off);
+		if (r->magic != OUTBOX_RECORD_MAGIC && r->magic != OUTBOX_RECORD_MAGIC_ID) break;
+		DWORD cbId = RecordIdSize(r->magic);
+		DWORD cb = RecordSize(r, cbId, seg->cbSize - off);
+		if (cb == 0 || RecordCrc(r, cbId) != r->crc) {
+			LOG_WARN("Outbox: %ls ends with a torn record at %lu", seg->wszPath, off);
+			break;
+		}
+		if (off >= (DWORD)h->readOffset) cRecords++;
+		off += cb;
+	}
+
+	seg->cbWritten = off;
+	if ((DWORD)h->readOffset > off) h->readOffset = off;
+
+	// a torn record may have left its magic; clear it, so that the
+	// next append is not mistaken for it
+	if (off + sizeof(OutboxRecordHeader) <= seg->cbSize)
+		((OutboxRecordHeader *)(seg->pBase + off))->magic = 0;
+
+	return cRecords;
+}
+
+
+
+static int CompareSequences(const void *a, const void *b)
+{
+	DWORD x = *(const DWORD *)a, y = *(const DWORD *)b;
+	return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+
+
+HRESULT Outbox::recover()
+{
+	WCHAR wszPattern[MAX_PATH];
+	swprintf_s(wszPattern, MAX_PATH, L"%s\\outbox-*.seg", wszDirectory);
+
+	DWORD *sequences = new DWORD[OUTBOX_MAX_FILES];
+	int cFiles = 0;
+
+	WIN32_FIND_DATAW fd;
+	HANDLE hFind = FindFirstFileW(wszPattern, &fd);
+	if (hFind != INVALID_HANDLE_VALUE) {
+		do {
+			DWORD dwSequence;
+			if (swscanf_s(fd.cFileName, L"outbox-%x.seg", &dwSequence) == 1 && cFiles < OUTBOX_MAX_FILES)
+				sequences[cFiles++] = dwSequence;
+		} while (FindNextFileW(hFind, &fd));
+		FindClose(hFind);
+	}
+
+	qsort(sequences, cFiles, sizeof(DWORD), CompareSequences);
+
+	HRESULT hr = MQ_OK;
+	for (int i = 0; i < cFiles && SUCCEEDED(hr); i++) {
+		OutboxSegment *seg;
+		hr = openSegment(sequences[i], FALSE, &seg);
+		if (FAILED(hr)) break;
+		cPending += scanSegment(seg);
+		if (tail != NULL) {
+			tail->sealed = TRUE;
+			tail->next = seg;
+		}
+		else
+			head = seg;
+		tail = seg;
+		cSegments++;
+	}
+	delete[] sequences;
+	if (FAILED(hr)) return hr;
+
+	if (tail == NULL) {
+		hr = openSegment(1, TRUE, &head);
+		if (FAILED(hr)) return hr;
+		tail = head;
+		cSegments = 1;
+	}
+
+	if (cPending > 0)
+		LOG_INFO("Outbox: %ld messages to forward from %ls", cPending, wszDirectory);
+	return MQ_OK;
+}
+
+
+
+HRESULT Outbox::append(BYTE *pbBody, DWORD cbBody, WCHAR *wszLabel,
+	BYTE *pCorrelationId, DWORD cbCorrelationId,
+	ITransaction *pTransaction, int iPriority,
+	DWORD dwTimeToReachQueue, DWORD dwTimeToBeReceived,
+	const BYTE *pDedupId)
+{
+	DWORD dwTtl = min(dwTimeToReachQueue, dwTimeToBeReceived);
+	OutboxRecordHeader h;
+	h.cchLabel = (wszLabel != NULL) ? (DWORD)wcslen(wszLabel) + 1 : 1;
+	h.cbCorrelationId = (pCorrelationId != NULL) ? cbCorrelationId : 0;
+	h.cbBody = cbBody;
+	h.transaction = (DWORD)(INT_PTR)pTransaction;
+	h.priority = iPriority;
+	h.expires = (dwTtl == MQJ_NO_TTL) ? 0 : (DWORD)time(NULL) + dwTtl;
+
+	DWORD cbId = (pDedupId != NULL) ? MQJ_DEDUP_ID_SIZE : 0;
+	DWORD cbRecord = RecordSize(&h, cbId, cbSegment - sizeof(OutboxSegmentHeader));
+	if (cbRecord == 0) return MQ_ERROR_INVALID_PARAMETER;
+
+	HRESULT hr = MQ_OK;
+	EnterCriticalSection(&cs);
+
+	if (tail->cbWritten + cbRecord > tail->cbSize) {
+		OutboxSegment *seg;
+		if (cSegments >= cMaxSegments)
+			hr = MQJ_ERROR_OUTBOX_FULL;
+		else
+			hr = openSegment(tail->dwSequence + 1, TRUE, &seg);
+		if (SUCCEEDED(hr)) {
+			tail->sealed = TRUE;
+			tail->next = seg;
+			tail = seg;
+			cSegments++;
+		}
+	}
+
+	if (SUCCEEDED(hr)) {
+		OutboxRecordHeader *r = (OutboxRecordHeader *)(tail->pBase + tail->cbWritten);
+		BYTE *p = (BYTE *)(r + 1);
+
+		memcpy(r, &h, sizeof(h));
+		r->magic = 0;
+		if (cbId > 0)
+			memcpy(p, pDedupId, cbId);
+		p += cbId;
+		if (wszLabel != NULL)
+			memcpy(p, wszLabel, h.cchLabel * sizeof(WCHAR));
+		else
+			*(WCHAR *)p = L'\0';
+		p += h.cchLabel * sizeof(WCHAR);
+		if (h.cbCorrelationId > 0)
+			memcpy(p, pCorrelationId, h.cbCorrelationId);
+		p += h.cbCorrelationId;
+		memcpy(p, pbBody, cbBody);
+		r->crc = RecordCrc(r, cbId);
+
+		MemoryBarrier();
+		r->magic = (cbId > 0) ? OUTBOX_RECORD_MAGIC_ID : OUTBOX_RECORD_MAGIC;
+
+		tail->cbWritten += cbRecord;
+		tail->dirty = TRUE;
+		InterlockedIncrement(&cPending);
+	}
+
+	LeaveCriticalSection(&cs);
+
+	if (SUCCEEDED(hr)) SetEvent(hWake);
+	return hr;
+}
+
+
+
+HRESULT Outbox::send(BYTE *pbBody, DWORD cbBody, WCHAR *wszLabel,
+	BYTE *pCorrelationId, DWORD cbCorrelationId,
+	ITransaction *pTransaction, int iPriority,
+	DWORD dwTimeToReachQueue, DWORD dwTimeToBeReceived,
+	const BYTE *pDedupId, BOOL fAsync)
+{
+	BOOL fJournal = (pTransaction == MQ_NO_TRANSACTION || pTransaction == MQ_SINGLE_MESSAGE);
+
+	// while messages wait in the journal, later ones queue behind them
+	if (!fJournal || (!fAsync && cPending == 0)) {
+		HRESULT hr = queue->sendBytes(pbBody, cbBody, wszLabel,
+			pCorrelationId, cbCorrelationId, pTransaction, iPriority,
+			dwTimeToReachQueue, dwTimeToBeReceived, pDedupId);
+		if (!fJournal || !isTransient(hr))
+			return hr;
+		LOG_DEBUG("Outbox: send failed (hr=0x%08x), journaling", hr);
+	}
+
+	return append(pbBody, cbBody, wszLabel, pCorrelationId, cbCorrelationId,
+		pTransaction, iPriority, dwTimeToReachQueue, dwTimeToBeReceived, pDedupId);
+}
+
+
+
+LONG Outbox::pending()
+{
+	return cPending;
+}
+
+
+
+unsigned __stdcall Outbox::forwarderMain(void *pv)
+{
+	((Outbox *)pv)->forward();
+	return 0;
+}
+
+
+
+void Outbox::forward()
+{
+	DWORD dwBackoff = 0;
+	HANDLE waits[2] = { hStop, hWake };
+
+	while (WaitForSingleObject(hStop, 0) != WAIT_OBJECT_0) {
+		OutboxSegment *seg;
+		OutboxRecordHeader *r = NULL;
+		OutboxSegment *pDone = NULL;
+
+		EnterCriticalSection(&cs);
+		seg = head;
+		OutboxSegmentHeader *h = (OutboxSegmentHeader *)seg->pBase;
+		if ((DWORD)h->readOffset < seg->cbWritten) {
+			r = (OutboxRecordHeader *)(seg->pBase + h->readOffset);
+		}
+		else if (seg->sealed) {
+			// all forwarded, and no more will be appended
+			head = seg->next;
+			cSegments--;
+			pDone = seg;
+		}
+		LeaveCriticalSection(&cs);
+
+		if (pDone != NULL) {
+			closeSegment(pDone, TRUE);
+			continue;
+		}
+
+		if (r == NULL) {
+			// idle: make the journal durable, then wait for an append.
+			// Only this thread frees segments, so they can be flushed
+			// outside the lock, without holding up appends.
+			OutboxSegment *dirty[OUTBOX_FLUSH_BATCH];
+			int cDirty = 0;
+			EnterCriticalSection(&cs);
+			for (OutboxSegment *s = head; s != NULL && cDirty < OUTBOX_FLUSH_BATCH; s = s->next) {
+				if (s->dirty) {
+					s->dirty = FALSE;
+					dirty[cDirty++] = s;
+				}
+			}
+			LeaveCriticalSection(&cs);
+			for (int i = 0; i < cDirty; i++)
+				FlushViewOfFile(dirty[i]->pBase, 0);
+
+			WaitForMultipleObjects(2, waits, FALSE, OUTBOX_IDLE_MILLIS);
+			continue;
+		}
+
+		HRESULT hr;
+		DWORD dwNow = (DWORD)time(NULL);
+		DWORD cbId = RecordIdSize(r->magic);
+		DWORD cbRecord = RecordSize(r, cbId, seg->cbWritten - h->readOffset);
+		if (cbRecord == 0 || RecordCrc(r, cbId) != r->crc) {
+			hr = MQ_ERROR_INVALID_PARAMETER;
+		}
+		else if (r->expires != 0 && dwNow >= r->expires) {
+			// it waited longer than it was meant to live
+			LOG_DEBUG("Outbox: dropping an expired message");
+			hr = MQ_OK;
+		}
+		else {
+			DWORD dwTtl = (r->expires == 0) ? MQJ_NO_TTL : r->expires - dwNow;
+			BYTE *p = (BYTE *)(r + 1);
+			BYTE *pDedupId = (cbId > 0) ? p : NULL;
+			p += cbId;
+			WCHAR *wszLabel = (WCHAR *)p;
+			BYTE *pCorrelationId = p + r->cchLabel * sizeof(WCHAR);
+			BYTE *pbBody = pCorrelationId + r->cbCorrelationId;
+			hr = queue->sendBytes(pbBody, r->cbBody, wszLabel,
+				(r->cbCorrelationId > 0) ? pCorrelationId : NULL, r->cbCorrelationId,
+				(ITransaction *)(INT_PTR)r->transaction, (int)r->priority,
+				dwTtl, dwTtl, pDedupId);
+		}
+
+		if (isTransient(hr)) {
+			// the destination is still away; try the same record later
+			dwBackoff = (dwBackoff == 0) ? OUTBOX_FIRST_BACKOFF : min(dwBackoff * 2, OUTBOX_MAX_BACKOFF);
+			LOG_DEBUG("Outbox: forward failed (hr=0x%08x), retry in %lu ms", hr, dwBackoff);
+			WaitForSingleObject(hStop, dwBackoff);
+			continue;
+		}
+		dwBackoff = 0;
+
+		if (FAILED(hr)) {
+			// it will never go; drop it rather than block the rest
+			LOG_ERROR("Outbox: dropping a message that cannot be sent (hr=0x%08x)", hr);
+			if (cbRecord == 0) cbRecord = seg->cbWritten - h->readOffset;
+		}
+
+		EnterCriticalSection(&cs);
+		h->readOffset += cbRecord;
+		LeaveCriticalSection(&cs);
+		InterlockedDecrement(&cPending);
+	}
+}
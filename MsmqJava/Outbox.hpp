@@ -0,0 +1,89 @@
+//
+// Outbox.hpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This is an include for the Outbox class, a journal on local disk
+// for messages that cannot be sent right away.
+//
+// ------------------------------------------------------------------
+
+#define MQJ_OUTBOX_DEFAULT_SEGMENT      (16 * 1024 * 1024)
+#define MQJ_OUTBOX_MIN_SEGMENT          (4 * 1024 * 1024 + 64 * 1024)   // fits the largest MSMQ message
+#define MQJ_OUTBOX_DEFAULT_SEGMENTS     64
+
+struct OutboxSegment;
+
+
+class Outbox
+{
+private:
+	MsmqQueue       *queue;         // the send handle
+	WCHAR           wszDirectory[MAX_PATH];
+	DWORD           cbSegment;
+	int             cMaxSegments;
+
+	// guards the segment list, and the append and read offsets
+	CRITICAL_SECTION cs;
+	OutboxSegment   *head;          // the oldest; the forwarder reads here
+	OutboxSegment   *tail;          // the newest; appends go here
+	int             cSegments;
+	volatile LONG   cPending;       // records not yet forwarded
+
+	HANDLE          hWake;          // set on append
+	HANDLE          hStop;
+	HANDLE          hThread;
+
+	HRESULT recover(void);
+	HRESULT openSegment(DWORD dwSequence, BOOL fCreate, OutboxSegment **ppSeg);
+	void    closeSegment(OutboxSegment *seg, BOOL fDelete);
+	LONG    scanSegment(OutboxSegment *seg);
+	HRESULT append(BYTE *pbBody, DWORD cbBody, WCHAR *wszLabel,
+		BYTE *pCorrelationId, DWORD cbCorrelationId,
+		ITransaction *pTransaction, int iPriority,
+		DWORD dwTimeToReachQueue, DWORD dwTimeToBeReceived,
+		const BYTE *pDedupId);
+	void    forward(void);
+	static unsigned __stdcall forwarderMain(void *pv);
+
+public:
+	Outbox(MsmqQueue *q);
+
+	// stops the forwarder.  The journal stays on disk, and what it
+	// holds is forwarded when an outbox is next opened on it.
+	~Outbox();
+
+	// opens or creates the journal in wszDir, and starts the forwarder
+	HRESULT open(const WCHAR *wszDir, DWORD cbSegment, int cMaxSegments);
+
+	// whether a send failing with hr may succeed later
+	static BOOL isTransient(HRESULT hr);
+
+	// Sends a message, or journals it to be forwarded later: always if
+	// fAsync, else when earlier messages are still journaled, or the
+	// send fails with a transient error.  Messages in a DTC transaction
+	// are never journaled.  A journaled message with a time limit
+	// keeps the sooner of its two deadlines: it is dropped if that
+	// passes before it is forwarded, else forwarded with what is left.
+	HRESULT send(BYTE *pbBody, DWORD cbBody, WCHAR *wszLabel,
+		BYTE *pCorrelationId, DWORD cbCorrelationId,
+		ITransaction *pTransaction, int iPriority,
+		DWORD dwTimeToReachQueue, DWORD dwTimeToBeReceived,
+		const BYTE *pDedupId, BOOL fAsync);
+
+	// the number of journaled messages not yet forwarded
+	LONG pending(void);
+};
@@ -0,0 +1,100 @@
+//
+// ProvisionResult.java
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module holds the outcome for one queue of Queue.createAll() or
+// Queue.deleteAll().
+//
+// ------------------------------------------------------------------
+
+package ionic.Msmq;
+
+
+/**
+ * <p>The outcome for one queue of {@link Queue#createAll(java.util.List,
+ * int)} or {@link Queue#deleteAll(java.util.List, int)}.</p>
+ *
+ */
+public class ProvisionResult
+{
+    static final int MQ_ERROR_QUEUE_EXISTS = 0xC00E0005;
+
+    private String _name;
+    private String _formatName;
+    private int _hr;
+
+
+    ProvisionResult(String name, String formatName, int hr)
+    {
+        _name= name;
+        _formatName= formatName;
+        _hr= hr;
+    }
+
+
+    /**
+     * @return the path name of the queue created, or the name of the
+     *         queue deleted, as passed in.
+     */
+    public String getName()               { return _name; }
+
+    /**
+     * <p>Gets the format name of a queue that was created, or that
+     * already existed. It can be passed to the {@link Queue}
+     * constructors.</p>
+     *
+     * @return the format name, or null after a delete, or if the queue
+     *         could not be created.
+     */
+    public String getFormatName()         { return _formatName; }
+
+    /**
+     * @return the HRESULT from MSMQ; 0, or an informational code such
+     *         as MQ_INFORMATION_PROPERTY, on success.
+     */
+    public int getResult()                { return _hr; }
+
+    /**
+     * @return true if the queue was created, or deleted.
+     */
+    public boolean succeeded()            { return _hr >= 0; }
+
+    /**
+     * @return true if the queue was not created because it already
+     *         existed.
+     */
+    public boolean alreadyExisted()       { return _hr == MQ_ERROR_QUEUE_EXISTS; }
+
+
+    /**
+     * Get an exception describing a failure, for callers that want to
+     * throw it.
+     *
+     * @return the exception, or null if the operation succeeded.
+     */
+    public MessageQueueException getException()
+    {
+        return succeeded() ? null : new MessageQueueException("Cannot provision queue " + _name + ".", _hr);
+    }
+
+
+    public String toString()
+    {
+        return _name + ": " + (succeeded() ? "ok" : MessageQueueException.HrToString(_hr))
+            + ((_formatName == null) ? "" : " (" + _formatName + ")");
+    }
+}
@@ -96,6 +96,53 @@ public class Queue
     }
 
 
+    /**
+     * <p>
+     * The Queue.Compression enum lists the codecs that can be used to
+     * compress message bodies on send. See
+     * {@link Queue#setCompression(Queue.Compression, int)}.
+     * </p>
+     *
+     */
+    public enum Compression
+    {
+        /**
+         * Bodies are sent as-is.
+         *
+         **/
+        NONE(0),
+
+        /**
+         * Bodies are compressed with LZ4, a fast codec with a moderate
+         * compression ratio.
+         *
+         **/
+            LZ4(1);
+
+        int _codec;
+
+        Compression(int value)
+        {
+            _codec = value;
+        }
+
+        int getValue()   { return _codec; }
+    }
+
+
+    /**
+     * Chooses the messages that {@link Queue#purge(int, Queue.LabelFilter)}
+     * discards, by their label.
+     */
+    public interface LabelFilter
+    {
+        /**
+         * @return true to discard the message with this label.
+         */
+        boolean accept(String label);
+    }
+
+
     /**
      * <p>Call this constructor to open a queue by name for SEND and
      * RECEIVE operations.</p>
@@ -133,26 +180,31 @@ public class Queue
     private void _init(String queueName, int access)
         throws  MessageQueueException
     {
+        // a path name that createAll() has seen opens by its format name
+        String formatName= (queueName.indexOf('=') < 0) ? _formatNames.get(queueName.toLowerCase()) : null;
+        if (formatName == null)
+            formatName= queueName;
+
         // the openQueue native method causes the _queueSlot to be set.
         int rc = 0;
         if (access == 0x01) // RECEIVE
         {
-            rc= nativeOpenQueueForReceive(queueName);
+            rc= nativeOpenQueueForReceive(formatName);
         }
         else if (access == 0x02) // SEND
         {
-            rc= nativeOpenQueueForSend(queueName);
+            rc= nativeOpenQueueForSend(formatName);
         }
         else if (access == 0x03) // SEND+RECEIVE
         {
-            rc= nativeOpenQueue(queueName);
+            rc= nativeOpenQueue(formatName);
         }
         else { rc= 0xC00E0006; /* MQ_INVALID_PARAMETER */ }
 
         if (rc!=0) throw new  MessageQueueException("Cannot open queue.", rc);
 
         _name= queueName;
-        _formatName= "unknown";
+        _formatName= (formatName.indexOf('=') < 0) ? "unknown" : formatName;
         _label= "need to set this";
         _isTransactional= false; // TODO: get actual value in "openQueue"
     }
@@ -176,18 +228,14 @@ public class Queue
     public static Queue create(String queuePath, String queueLabel, boolean isTransactional)
         throws  MessageQueueException
     {
-        int rc= nativeCreateQueue( queuePath,  queueLabel,  (isTransactional)?1:0);
-        if (rc!=0)
-            throw new  MessageQueueException("Cannot create queue.", rc);
-        // DIRECT=OS  ?  or DIRECT=TCP ?
-        String a1= "OS";
-        char[] c= queuePath.toCharArray();
-        if ((c[0]>='1')
-            && (c[0]<='9')) a1= "TCP"; // assume ip address
-
-        Queue q= new Queue("DIRECT=" + a1 + ":" + queuePath);
+        java.util.List<QueueSpec> specs= new java.util.ArrayList<QueueSpec>();
+        specs.add(new QueueSpec(queuePath, queueLabel, isTransactional));
+        ProvisionResult result= createAll(specs, 1).get(0);
+        if (!result.succeeded())
+            throw new  MessageQueueException("Cannot create queue.", result.getResult());
+
+        Queue q= new Queue(result.getFormatName());
         q._name= queuePath;
-        //    q._formatName=queueFormatName;
         q._label=queueLabel;
         q._isTransactional= isTransactional;
         return q;
@@ -197,23 +245,170 @@ public class Queue
     /**
      * Delete a queue by the given name.
      *
+     * @param queuePath  the format name of the queue, or a path name
+     *                   that was created by this process.
      **/
     public static void delete(String queuePath)
         throws  MessageQueueException
     {
-        int rc= nativeDeleteQueue( queuePath );
+        ProvisionResult result= deleteAll(java.util.Collections.singletonList(queuePath), 1).get(0);
+        if (!result.succeeded())
+            throw new  MessageQueueException("Cannot delete queue.", result.getResult());
+    }
+
+
+    /**
+     * The number of queues created or deleted at once by {@link
+     * #createAll(java.util.List)} and {@link #deleteAll(java.util.List)}.
+     */
+    public static final int DEFAULT_PROVISION_PARALLELISM = 8;
+
+
+    /**
+     * <p>Create many queues at once.</p>
+     *
+     * <p>The queues are created by a pool of native threads, at most
+     * <tt>parallelism</tt> at a time, which is much faster than one
+     * at a time when each creation waits on the queue manager or the
+     * directory. This method returns when all are done.</p>
+     *
+     * <p>A queue that cannot be created does not stop the others; its
+     * result says why. A queue that exists already has the result
+     * MQ_ERROR_QUEUE_EXISTS, with its format name, so that a bootstrap
+     * can be run again.</p>
+     *
+     * <p>The format names are remembered, for the life of the process,
+     * so that later the path name can be passed to the {@link Queue}
+     * constructors in place of the format name, without a directory
+     * lookup.</p>
+     *
+     * <blockquote class='code'><pre>
+     *   List&lt;QueueSpec&gt; specs= new ArrayList&lt;QueueSpec&gt;();
+     *   for (int i=0; i &lt; 400; i++)
+     *       specs.add(new QueueSpec(".\\private$\\shard" + i, "shard " + i, true));
+     *   for (ProvisionResult r : Queue.createAll(specs, 16))
+     *       if (!r.succeeded() &amp;&amp; !r.alreadyExisted())
+     *           throw r.getException();
+     *   Queue q= new Queue(".\\private$\\shard7", Queue.Access.SEND);
+     * </pre></blockquote>
+     *
+     * @param specs        the queues to create.
+     * @param parallelism  the most queues to create at once, at least 1.
+     * @return the result for each queue, in the order of specs.
+     **/
+    public static java.util.List<ProvisionResult> createAll(java.util.List<QueueSpec> specs, int parallelism)
+        throws  MessageQueueException
+    {
+        if (parallelism < 1)
+            throw new IllegalArgumentException("parallelism must be at least 1");
+        int n= specs.size();
+        String[] paths= new String[n];
+        String[] labels= new String[n];
+        boolean[] transactional= new boolean[n];
+        for (int i=0; i < n; i++) {
+            QueueSpec spec= specs.get(i);
+            paths[i]= spec.getPath();
+            labels[i]= spec.getLabel();
+            transactional[i]= spec.isTransactional();
+        }
+
+        String[] formatNames= new String[n];
+        int[] results= new int[n];
+        int rc= nativeCreateAll(paths, labels, transactional, parallelism, formatNames, results);
+        if (rc!=0)
+            throw new  MessageQueueException("Cannot create queues.", rc);
+
+        java.util.List<ProvisionResult> list= new java.util.ArrayList<ProvisionResult>(n);
+        for (int i=0; i < n; i++) {
+            if (formatNames[i] != null)
+                _formatNames.put(paths[i].toLowerCase(), formatNames[i]);
+            list.add(new ProvisionResult(paths[i], formatNames[i], results[i]));
+        }
+        return list;
+    }
+
+
+    /**
+     * Create many queues at once, DEFAULT_PROVISION_PARALLELISM at a
+     * time.
+     *
+     * @see #createAll(java.util.List, int)
+     **/
+    public static java.util.List<ProvisionResult> createAll(java.util.List<QueueSpec> specs)
+        throws  MessageQueueException
+    {
+        return createAll(specs, DEFAULT_PROVISION_PARALLELISM);
+    }
+
+
+    /**
+     * <p>Delete many queues at once, on a pool of native threads, at
+     * most <tt>parallelism</tt> at a time.</p>
+     *
+     * <p>A queue that cannot be deleted does not stop the others; its
+     * result says why. Queues that are open in this process are not
+     * closed.</p>
+     *
+     * @param queueNames   the format names of the queues, or path names
+     *                     that were created by this process.
+     * @param parallelism  the most queues to delete at once, at least 1.
+     * @return the result for each queue, in the order of queueNames.
+     **/
+    public static java.util.List<ProvisionResult> deleteAll(java.util.List<String> queueNames, int parallelism)
+        throws  MessageQueueException
+    {
+        if (parallelism < 1)
+            throw new IllegalArgumentException("parallelism must be at least 1");
+        int n= queueNames.size();
+        String[] names= new String[n];
+        for (int i=0; i < n; i++) {
+            String name= queueNames.get(i);
+            String formatName= (name.indexOf('=') < 0) ? _formatNames.get(name.toLowerCase()) : null;
+            names[i]= (formatName != null) ? formatName : name;
+        }
+
+        int[] results= new int[n];
+        int rc= nativeDeleteAll(names, parallelism, results);
         if (rc!=0)
-            throw new  MessageQueueException("Cannot delete queue.", rc);
+            throw new  MessageQueueException("Cannot delete queues.", rc);
+
+        java.util.List<ProvisionResult> list= new java.util.ArrayList<ProvisionResult>(n);
+        for (int i=0; i < n; i++) {
+            String name= queueNames.get(i);
+            if (results[i] == 0)
+                _formatNames.remove(name.toLowerCase());
+            list.add(new ProvisionResult(name, null, results[i]));
+        }
+        return list;
+    }
+
+
+    /**
+     * Delete many queues at once, DEFAULT_PROVISION_PARALLELISM at a
+     * time.
+     *
+     * @see #deleteAll(java.util.List, int)
+     **/
+    public static java.util.List<ProvisionResult> deleteAll(java.util.List<String> queueNames)
+        throws  MessageQueueException
+    {
+        return deleteAll(queueNames, DEFAULT_PROVISION_PARALLELISM);
     }
 
 
+    // path names, in lower case, to the format names createAll() got
+    private static final java.util.Map<String, String> _formatNames =
+        new java.util.concurrent.ConcurrentHashMap<String, String>();
+
+
     // -------------------------------------------------------
     // Sending methods
     // -------------------------------------------------------
 
     /**
      * Send a Message, with the given transaction type, and with the
-     * given setting for high priority.
+     * given setting for high priority.  When highPriority is false,
+     * the message is sent with its own priority.
      **/
     public void send(Message msg, boolean highPriority, TransactionType t)
         throws  MessageQueueException
@@ -221,9 +416,41 @@ public class Queue
         int rc= nativeSendBytes(msg.getBody(),
                                 msg.getLabel(),
                                 msg.getCorrelationId(),
+                                msg._dedupIdForSend(),
                                 t.getValue(),
-                                highPriority
+                                highPriority ? Message.MAX_PRIORITY : msg.getPriority(),
+                                msg.getTimeToReachQueue(),
+                                msg.getTimeToBeReceived(),
+                                false
+                                );
+        if (rc!=0)
+            throw new MessageQueueException("Cannot send.", rc);
+    }
+
+
+    /**
+     * <p>Send a Message within the given transaction.</p>
+     *
+     * <p>The message becomes visible to receivers when the transaction
+     * commits. The queue must be transactional.</p>
+     *
+     **/
+    public void send(Message msg, Transaction tx)
+        throws  MessageQueueException
+    {
+        int rc;
+        synchronized (tx) {
+            rc= nativeSendBytes(msg.getBody(),
+                                msg.getLabel(),
+                                msg.getCorrelationId(),
+                                msg._dedupIdForSend(),
+                                _tx_handle(tx),
+                                msg.getPriority(),
+                                msg.getTimeToReachQueue(),
+                                msg.getTimeToBeReceived(),
+                                false
                                 );
+        }
         if (rc!=0)
             throw new MessageQueueException("Cannot send.", rc);
     }
@@ -274,8 +501,12 @@ public class Queue
         int rc= nativeSendBytes(s.getBytes("UTF-8"), // bytes of string
                                 "",                  // empty label
                                 null,                // empty correlationId
+                                null,                // no dedup ID
                                 0,                   // outside any transaction
-                                false                // false = not high priority
+                                Message.DEFAULT_PRIORITY,
+                                Message.NO_TIME_LIMIT,
+                                Message.NO_TIME_LIMIT,
+                                false
                                 );
         if (rc!=0)
             throw new MessageQueueException("Cannot send.", rc);
@@ -294,28 +525,170 @@ public class Queue
         int rc= nativeSendBytes(b,
                                 "",                 // empty label
                                 null,                 // empty correlationId
+                                null,                 // no dedup ID
                                 0,                  // outside any transaction
-                                false               // false = not high priority
+                                Message.DEFAULT_PRIORITY,
+                                Message.NO_TIME_LIMIT,
+                                Message.NO_TIME_LIMIT,
+                                false
+                                );
+        if (rc!=0)
+            throw new MessageQueueException("Cannot send.", rc);
+    }
+
+
+    /**
+     * <p>Send a Message through the outbox, without waiting for
+     * MSMQ.</p>
+     *
+     * <p>The message is appended to the outbox journal, and the
+     * forwarder sends it, in order with the other journaled messages.
+     * The call does not block on the queue manager or the network, but
+     * it fails if the outbox is full.</p>
+     *
+     * @see #enableOutbox(String, int, int)
+     **/
+    public void sendAsync(Message msg, TransactionType t)
+        throws  MessageQueueException
+    {
+        if (!_outbox)
+            throw new IllegalStateException("The outbox is not enabled.");
+        int rc= nativeSendBytes(msg.getBody(),
+                                msg.getLabel(),
+                                msg.getCorrelationId(),
+                                msg._dedupIdForSend(),
+                                t.getValue(),
+                                msg.getPriority(),
+                                msg.getTimeToReachQueue(),
+                                msg.getTimeToBeReceived(),
+                                true
                                 );
         if (rc!=0)
             throw new MessageQueueException("Cannot send.", rc);
     }
 
 
+    /**
+     * Send a Message through the outbox, outside of any transaction.
+     *
+     * @see #sendAsync(Message, TransactionType)
+     **/
+    public void sendAsync(Message msg)
+        throws  MessageQueueException
+    {
+        sendAsync(msg, TransactionType.None);
+    }
+
+
+    /**
+     * <p>Send the same Message to each of the given queues.</p>
+     *
+     * <p>This is cheaper than calling {@link #send(Message)} on each
+     * queue in turn: the body is passed to the native layer, and the
+     * label converted, once for all of the targets.</p>
+     *
+     * <p>A failure on one target does not stop the sends to the
+     * others, and no exception is thrown for it. Instead, the
+     * result for each target is returned. A failure that is not
+     * particular to a target, such as a priority out of range, is
+     * thrown.</p>
+     *
+     * @param targets  the queues to send to, each open for SEND access.
+     * @param msg      the message to send; it must have a body and a
+     *                 label.
+     * @param t        the transaction type for each send.
+     * @return the HRESULT for each target, in the order of targets; 0
+     *         where the send succeeded.
+     **/
+    public static int[] sendToAll(Queue[] targets, Message msg, TransactionType t)
+        throws  MessageQueueException
+    {
+        byte[] body= msg.getBody();
+        String label= msg.getLabel();
+        if (body == null)
+            throw new NullPointerException("The message has no body.");
+        if (label == null)
+            throw new NullPointerException("The message has no label.");
+
+        int[] results= new int[targets.length];
+        int rc= nativeSendToAll(targets,
+                        body,
+                        label,
+                        msg.getCorrelationId(),
+                        msg._dedupIdForSend(),
+                        t.getValue(),
+                        msg.getPriority(),
+                        msg.getTimeToReachQueue(),
+                        msg.getTimeToBeReceived(),
+                        results);
+
+        // rc is a failure that is not particular to a target, such as a
+        // bad priority; those of the targets are only in results
+        if (rc!=0)
+            throw new MessageQueueException("Cannot send.", rc);
+        return results;
+    }
+
+
+    /**
+     * Send the same Message to each of the given queues, outside of
+     * any transaction.
+     *
+     * @see #sendToAll(Queue[], Message, TransactionType)
+     **/
+    public static int[] sendToAll(Queue[] targets, Message msg)
+        throws  MessageQueueException
+    {
+        return sendToAll(targets, msg, TransactionType.None);
+    }
+
+
+    // The native transaction of tx.  Once it has been committed or
+    // aborted its handle is 0, which the native layer would take for
+    // MQ_NO_TRANSACTION, so the work would quietly happen outside of
+    // any transaction.  Callers hold the lock on tx until the native
+    // call returns, so that a commit or abort on another thread cannot
+    // release the handle while it is in use, and so that tx stays
+    // reachable and its cleaner does not abort it.
+    private static long _tx_handle(Transaction tx)
+        throws  MessageQueueException
+    {
+        long handle= tx._handle;
+        if (handle == 0)
+            throw new MessageQueueException("The transaction is not active.", MQ_ERROR_TRANSACTION_USAGE);
+        return handle;
+    }
+
+
     // -------------------------------------------------------
     // Receiving methods
     // -------------------------------------------------------
     private ionic.Msmq.Message _internal_receive(int timeout, int ReadOrPeek)
         throws  MessageQueueException
     {
-        Message msg = new Message();
+        return _internal_receive(timeout, ReadOrPeek, 0);
+    }
+
+    private ionic.Msmq.Message _internal_receive(int timeout, int ReadOrPeek, long tflag)
+        throws  MessageQueueException
+    {
+        Message msg = _try_receive(timeout, ReadOrPeek, tflag);
+        if (msg == null)
+            throw new MessageQueueException("Cannot receive.", MQ_ERROR_IO_TIMEOUT);
+        return msg;
+    }
 
-        int rc = nativeReceiveBytes(msg, timeout, ReadOrPeek);
-        //int rc = nativeReceiveBytes(timeout, ReadOrPeek);
+    // returns null if the timeout expires; other failures are thrown
+    // by the native method.
+    private ionic.Msmq.Message _try_receive(int timeout, int ReadOrPeek, long tflag)
+        throws  MessageQueueException
+    {
+        Message msg = new Message();
 
-        if (rc!=0)
-            throw new MessageQueueException("Cannot receive.", rc);
+        if (!nativeReceiveBytes(msg, timeout, ReadOrPeek, tflag))
+            return null;
 
+        msg.attachCleaner();
         return msg;
     }
 
@@ -326,6 +699,13 @@ public class Queue
      *
      * If the timeout expires before a message becomes available,
      * the method will throw an exception.
+     *
+     * <p>
+     *
+     * The body, label and correlation ID of the returned Message stay
+     * in native memory until first read, so that a consumer that only
+     * looks at the label does not pay for copying the body. See
+     * {@link Message#release()}.
      **/
     public ionic.Msmq.Message receive(int timeout)
         throws  MessageQueueException
@@ -334,6 +714,53 @@ public class Queue
     }
 
 
+    /**
+     * <p>Poll the queue to receive one message within the given
+     * transaction, with the given timeout.</p>
+     *
+     * <p>If the transaction aborts, the message goes back to the
+     * queue. The queue must be transactional.</p>
+     **/
+    public ionic.Msmq.Message receive(int timeout, Transaction tx)
+        throws  MessageQueueException
+    {
+        synchronized (tx) {
+            return _internal_receive(timeout, 1, _tx_handle(tx));
+        }
+    }
+
+
+    /**
+     * <p>Poll the queue to receive one message, with the given timeout,
+     * returning null if the timeout expires.</p>
+     *
+     * <p>Unlike {@link #receive(int)}, an empty poll costs no exception,
+     * so this is the cheaper way to poll with a short timeout.</p>
+     *
+     * @return the message, or null if none arrived within the timeout.
+     **/
+    public ionic.Msmq.Message tryReceive(int timeout)
+        throws  MessageQueueException
+    {
+        return _try_receive(timeout, 1, 0);
+    }
+
+
+    /**
+     * <p>Poll the queue to receive one message within the given
+     * transaction, returning null if the timeout expires.</p>
+     *
+     * @see #tryReceive(int)
+     **/
+    public ionic.Msmq.Message tryReceive(int timeout, Transaction tx)
+        throws  MessageQueueException
+    {
+        synchronized (tx) {
+            return _try_receive(timeout, 1, _tx_handle(tx));
+        }
+    }
+
+
     /**
      * Poll the queue to receive one message, with an infinite timeout.
      *
@@ -344,6 +771,48 @@ public class Queue
         return _internal_receive(0,1); // infinite timeout
     }
 
+    /**
+     * <p>Poll the queue to receive one message, with the given timeout,
+     * where the caller takes charge of the native buffer.</p>
+     *
+     * <p>Like every received message, the returned Message keeps its
+     * properties in a pooled native buffer until they are asked for.
+     * Unlike {@link #receive(int)}, no cleaner is registered to free
+     * that buffer when the Message is collected, which saves an
+     * allocation per message. The caller must call
+     * {@link Message#release()} when done with the message, to return
+     * the buffer to the pool.</p>
+     *
+     * <p>
+     *
+     * If the timeout expires before a message becomes available,
+     * the method will throw an exception.
+     **/
+    public ionic.Msmq.Message receivePooled(int timeout)
+        throws  MessageQueueException
+    {
+        Message msg = new Message();
+
+        if (!nativeReceiveBytes(msg, timeout, 1, 0))
+            throw new MessageQueueException("Cannot receive.", MQ_ERROR_IO_TIMEOUT);
+
+        return msg;
+    }
+
+
+    /**
+     * Poll the queue to receive one message into a pooled native
+     * buffer, with an infinite timeout.
+     *
+     * @see #receivePooled(int)
+     **/
+    public ionic.Msmq.Message receivePooled()
+        throws  MessageQueueException
+    {
+        return receivePooled(0); // infinite timeout
+    }
+
+
     /**
      * Peek at the queue and return a message without dequeueing it.
      *
@@ -369,47 +838,732 @@ public class Queue
     }
 
 
-
-
     /**
-     * Close the queue.
+     * <p>Peek at the message at the head of the queue, without its
+     * body.</p>
+     *
+     * <p>The label, correlation ID, body size, priority and times are
+     * read; the body is not, whatever its size. The message stays in
+     * the queue. Follow with {@link #receiveCurrent(MessageHeader)},
+     * {@link #fetchBody(MessageHeader)} or {@link
+     * #discardCurrent(MessageHeader)} to act on it.</p>
+     *
+     * <blockquote class='code'><pre>
+     *   MessageHeader h= queue.tryPeekHeader(1000);
+     *   if (h != null) {
+     *       if (h.getLabel().startsWith("order:"))
+     *           orders.send(queue.receiveCurrent(h));
+     *       else
+     *           queue.discardCurrent(h);
+     *   }
+     * </pre></blockquote>
+     *
+     * <p>If the timeout expires before a message becomes available,
+     * the method will throw an exception.</p>
      *
+     * @param timeout  the most time to wait for a message, in ms.
      **/
-    public void close()
+    public MessageHeader peekHeader(int timeout)
         throws  MessageQueueException
     {
-
-        int rc=nativeClose();
-        if (rc!=0)
-            throw new MessageQueueException("Cannot close.", rc);
+        MessageHeader h= tryPeekHeader(timeout);
+        if (h == null)
+            throw new MessageQueueException("Cannot peek.", MQ_ERROR_IO_TIMEOUT);
+        return h;
     }
 
 
-
-    // --------------------------------------------
-    // getters on the Queue properties
+    /**
+     * Peek at the message at the head of the queue, without its body,
+     * as {@link #peekHeader(int)} does, but return null if the timeout
+     * expires.
+     **/
+    public MessageHeader tryPeekHeader(int timeout)
+        throws  MessageQueueException
+    {
+        long[] values= new long[MessageHeader.COUNT];
+        String[] label= new String[1];
+        byte[] correlationId= new byte[MessageHeader.CORRELATION_ID_SIZE];
+        byte[] messageId= new byte[MessageHeader.MESSAGE_ID_SIZE];
+        int rc= nativePeekHeader(timeout, values, label, correlationId, messageId);
+        if (rc == MQ_ERROR_IO_TIMEOUT)
+            return null;
+        if (rc!=0)
+            throw new MessageQueueException("Cannot peek.", rc);
+        return new MessageHeader(values, label[0], correlationId, messageId);
+    }
 
 
     /**
-     * Gets the name of the queue.
+     * <p>Receive the message that was peeked with {@link
+     * #peekHeader(int)}, with its body.</p>
      *
-     * @return the name of the queue.
-     */
-    public String getName(){ return _name; }
+     * <p>This takes that message, wherever it now is in the queue, and
+     * not whatever message is at the head. The duplicate window and
+     * the max age are not applied: the caller has chosen the
+     * message.</p>
+     *
+     * @param header  the header of the message.
+     * @return the message, or null if another receiver has taken it.
+     **/
+    public Message receiveCurrent(MessageHeader header)
+        throws  MessageQueueException
+    {
+        return _receive_current(header, 1, 0);
+    }
 
 
     /**
-     * Gets the label on the queue.
+     * <p>Receive the message that was peeked with {@link
+     * #peekHeader(int)} within the given transaction.</p>
      *
-     * @return the label on the queue.
-     */
-    public String getLabel(){ return _label; }
+     * @see #receiveCurrent(MessageHeader)
+     **/
+    public Message receiveCurrent(MessageHeader header, Transaction tx)
+        throws  MessageQueueException
+    {
+        synchronized (tx) {
+            return _receive_current(header, 1, _tx_handle(tx));
+        }
+    }
 
 
     /**
-     * Gets the formatname on the queue.
+     * <p>Read the body of the message that was peeked with {@link
+     * #peekHeader(int)}, leaving the message in the queue.</p>
      *
-     * @return the formatname of the queue.
+     * @param header  the header of the message.
+     * @return the body, or null if another receiver has taken the
+     *         message.
+     **/
+    public byte[] fetchBody(MessageHeader header)
+        throws  MessageQueueException
+    {
+        Message msg= _receive_current(header, 0, 0);
+        if (msg == null)
+            return null;
+        byte[] body= msg.getBody();
+        msg.release();
+        return body;
+    }
+
+
+    /**
+     * <p>Remove the message that was peeked with {@link
+     * #peekHeader(int)}, without reading any of it.</p>
+     *
+     * @param header  the header of the message.
+     * @return false if another receiver has taken the message.
+     **/
+    public boolean discardCurrent(MessageHeader header)
+        throws  MessageQueueException
+    {
+        return _discard_current(header, 0);
+    }
+
+
+    /**
+     * Remove the message that was peeked with {@link
+     * #peekHeader(int)} within the given transaction.
+     *
+     * @see #discardCurrent(MessageHeader)
+     **/
+    public boolean discardCurrent(MessageHeader header, Transaction tx)
+        throws  MessageQueueException
+    {
+        synchronized (tx) {
+            return _discard_current(header, _tx_handle(tx));
+        }
+    }
+
+
+    private Message _receive_current(MessageHeader header, int ReadOrPeek, long tflag)
+        throws  MessageQueueException
+    {
+        Message msg = new Message();
+        if (!nativeReceiveCurrent(msg, header.getLookupId(), ReadOrPeek, tflag))
+            return null;
+        msg.attachCleaner();
+        return msg;
+    }
+
+
+    private boolean _discard_current(MessageHeader header, long tflag)
+        throws  MessageQueueException
+    {
+        int rc= nativeDiscardCurrent(header.getLookupId(), tflag);
+        if (rc == MQ_ERROR_MESSAGE_NOT_FOUND)
+            return false;
+        if (rc!=0)
+            throw new MessageQueueException("Cannot discard.", rc);
+        return true;
+    }
+
+
+    /**
+     * <p>Discard all the messages in the queue, and return how many
+     * there were.</p>
+     *
+     * <p>The queue is purged by the queue manager at once; no message
+     * is read. The count is the number of messages the queue held just
+     * before, so it is approximate while other applications send to or
+     * receive from the queue. Where the queue manager cannot report
+     * that, as for a remote queue, the messages are received one by one
+     * in the native layer instead, still without their bodies.</p>
+     *
+     * <p>The queue must be open for RECEIVE access. Purged messages are
+     * not captured, nor recorded in the duplicate window.</p>
+     *
+     * @return the number of messages discarded.
+     **/
+    public int purge()
+        throws  MessageQueueException
+    {
+        return purge(-1, null);
+    }
+
+
+    /**
+     * <p>Discard at most <tt>maxCount</tt> messages, and return how many
+     * were discarded. This does not wait for messages to arrive.</p>
+     *
+     * <p>The messages are received in the native layer without their
+     * bodies, so nothing but the label crosses into Java, and only
+     * when there is a filter. With a filter, the queue is walked with a
+     * cursor, and only the messages whose label it accepts are
+     * discarded; the others stay, in their order. An exception thrown
+     * by the filter stops the purge, and is thrown from here.</p>
+     *
+     * <blockquote class='code'><pre>
+     *   // drop the poison messages, keep the rest
+     *   int n= queue.purge(Integer.MAX_VALUE, new Queue.LabelFilter() {
+     *       public boolean accept(String label) { return label.startsWith("bad:"); }
+     *   });
+     * </pre></blockquote>
+     *
+     * @param maxCount  the most messages to discard, or -1 for all.
+     * @param filter    the messages to discard, or null for all.
+     * @return the number of messages discarded.
+     **/
+    public int purge(int maxCount, LabelFilter filter)
+        throws  MessageQueueException
+    {
+        int[] purged= new int[1];
+        int rc= nativePurge(maxCount, filter, purged);
+        if (rc!=0)
+            throw new MessageQueueException("Cannot purge queue.", rc);
+        return purged[0];
+    }
+
+
+
+
+    /**
+     * <p>Set the compression used for message bodies sent on this
+     * queue.</p>
+     *
+     * <p>Bodies of at least <tt>threshold</tt> bytes are compressed in
+     * the native layer before they are sent, and carry a marker in the
+     * message extension property. Smaller bodies, and bodies that do
+     * not shrink, are sent as-is. Receivers using this library
+     * decompress marked bodies transparently, whatever their own
+     * setting; other MSMQ clients will see the compressed bytes.</p>
+     *
+     * <p>The queue must be open for SEND access. The compression ratio
+     * and the time spent in the codec are reported by
+     * {@link #getStatistics()}.</p>
+     *
+     * @param codec      the codec, or Compression.NONE to turn it off.
+     * @param threshold  the smallest body size, in bytes, to compress.
+     **/
+    public void setCompression(Compression codec, int threshold)
+        throws  MessageQueueException
+    {
+        int rc= nativeSetCompression(codec.getValue(), threshold);
+        if (rc!=0)
+            throw new MessageQueueException("Cannot set compression.", rc);
+    }
+
+
+    /**
+     * <p>Send message bodies with a CRC-32C checksum, to catch bodies
+     * that are corrupted on the way, as by a bridge or relay.</p>
+     *
+     * <p>The checksum is computed in the native layer over the body as
+     * sent, after any compression, and carried in the message
+     * extension property. Receivers using this library check every
+     * body that carries one, whatever their own setting, before the
+     * body is decompressed or copied into Java. A body that does not
+     * match is removed from the queue, and the receive throws a
+     * MessageQueueException with hr = MQJ_ERROR_BAD_CHECKSUM
+     * (0xE00E0005).</p>
+     *
+     * <p>On processors with SSE4.2 the checksum costs well under a
+     * nanosecond per byte. The queue must be open for SEND access. The
+     * time spent on checksums, and the number of failures, are
+     * reported by {@link #getStatistics()}.</p>
+     *
+     * @param enabled  whether to send checksums.
+     **/
+    public void setChecksum(boolean enabled)
+        throws  MessageQueueException
+    {
+        int rc= nativeSetChecksum(enabled);
+        if (rc!=0)
+            throw new MessageQueueException("Cannot set checksum.", rc);
+    }
+
+
+    /**
+     * <p>Drop received messages that were already received on this
+     * queue recently.</p>
+     *
+     * <p>The native layer remembers the IDs of the last
+     * <tt>capacity</tt> messages received. A message that arrives again
+     * with one of those IDs is removed from the queue and discarded, and
+     * the receive waits for the next message. The ID is the dedup ID the
+     * sender gave the message, so a Message object that a producer sends
+     * again after a failed send is caught too; a message from a sender
+     * that sets none is known by its MSMQ message ID, which is new on
+     * every send. The window costs 24 bytes per ID, and the count of
+     * dropped messages is reported by {@link #getStatistics()}.</p>
+     *
+     * <p>Peeked messages are not checked, nor are messages received
+     * within a Transaction: if it aborts, the message goes back to the
+     * queue, and must not be taken for a duplicate when it comes
+     * again.</p>
+     *
+     * <p>The queue must be open for RECEIVE access. Setting the window
+     * forgets the IDs seen so far.</p>
+     *
+     * @param capacity  the number of IDs to remember, or 0 to turn this off.
+     **/
+    public void setDuplicateWindow(int capacity)
+        throws  MessageQueueException
+    {
+        int rc= nativeSetDedupWindow(capacity);
+        if (rc!=0)
+            throw new MessageQueueException("Cannot set duplicate window.", rc);
+    }
+
+
+    /**
+     * <p>Discard received messages that are older than
+     * <tt>seconds</tt>, rather than return them.</p>
+     *
+     * <p>Before each receive, the native layer peeks at the sent time of
+     * the message at the head of the queue, and discards the message,
+     * without reading its body, while it is too old. This sheds the
+     * stale work that piles up during an outage at the cost of one
+     * small peek per receive. The sent time is by the sender's clock,
+     * so the clocks should agree to well within the limit.</p>
+     *
+     * <p>The queue must be open for RECEIVE access. Peeks still return
+     * old messages. Discarded messages are counted by {@link
+     * QueueStatistics#getMessagesExpired()}. Senders can also give each
+     * message a time limit; see {@link
+     * Message#setTimeToBeReceived(int)}.</p>
+     *
+     * @param seconds  the oldest message to return, in seconds, or 0 to
+     *                 return messages of any age.
+     **/
+    public void setMaxAge(int seconds)
+        throws  MessageQueueException
+    {
+        if (seconds < 0)
+            throw new IllegalArgumentException("seconds must not be negative");
+        int rc= nativeSetMaxAge(seconds);
+        if (rc!=0)
+            throw new MessageQueueException("Cannot set max age.", rc);
+    }
+
+
+    /**
+     * <p>Send messages with a latency probe, so that receivers can
+     * measure the time from send to receive.</p>
+     *
+     * <p>The probe is the time of the send, to the best resolution
+     * Windows offers, and the producer ID, carried in the message
+     * extension property. Receivers using this library count the
+     * transit time of every message that carries one, whatever their
+     * own setting, in the histogram reported by {@link
+     * QueueStatistics#getTransitPercentile(double)}. The transit time
+     * includes the time the message waited in the queue. Across
+     * machines it is only as accurate as the clocks agree; a sender
+     * whose clock is ahead counts as zero.</p>
+     *
+     * <p>The queue must be open for SEND access.</p>
+     *
+     * @param enabled     whether to send probes.
+     * @param producerId  identifies this sender in the probes.
+     **/
+    public void setLatencyProbe(boolean enabled, int producerId)
+        throws  MessageQueueException
+    {
+        int rc= nativeSetLatencyProbe(enabled, producerId);
+        if (rc!=0)
+            throw new MessageQueueException("Cannot set latency probe.", rc);
+    }
+
+
+    /**
+     * <p>Send a heartbeat whenever nothing has been sent on this queue
+     * for <tt>intervalMillis</tt>, so that transit times are measured
+     * while the queue is idle too.</p>
+     *
+     * <p>A heartbeat is an empty message with the label "MsmqJava
+     * heartbeat" and a latency probe, sent by a native thread.
+     * Receivers using this library record its transit time, drop it,
+     * and go on waiting, so no receive or peek returns one; a peek
+     * that finds one removes it from the queue. Heartbeats that are
+     * not received within ten intervals expire. They are counted by
+     * {@link QueueStatistics#getHeartbeatsSent()} and {@link
+     * QueueStatistics#getHeartbeatsReceived()}.</p>
+     *
+     * <p>The queue must be open for SEND access. Closing the queue
+     * stops the heartbeat.</p>
+     *
+     * @param intervalMillis  the idle time before a heartbeat, or 0 to
+     *                        stop sending them.
+     **/
+    public void setHeartbeat(int intervalMillis)
+        throws  MessageQueueException
+    {
+        if (intervalMillis < 0)
+            throw new IllegalArgumentException("intervalMillis must not be negative");
+        int rc= nativeSetHeartbeat(intervalMillis);
+        if (rc!=0)
+            throw new MessageQueueException("Cannot set heartbeat.", rc);
+    }
+
+
+    /**
+     * <p>Keep messages that cannot be sent in a journal on local disk,
+     * and forward them when the destination is back.</p>
+     *
+     * <p>Once the outbox is enabled, a send that fails because the
+     * queue manager or the remote machine cannot be reached is
+     * appended to the journal instead, and returns normally. A
+     * background thread forwards journaled messages in the order they
+     * were appended, retrying with backoff until they go through;
+     * while any are waiting, later sends are journaled behind them, so
+     * that order is kept. Sends within a {@link Transaction} are never
+     * journaled.</p>
+     *
+     * <p>The journal is a set of memory-mapped segment files in
+     * <tt>directory</tt>, which is created if need be, and must not be
+     * shared with another queue or process. Each segment is deleted
+     * once all of it has been forwarded. Messages left in the journal
+     * when the queue is closed, or the process dies, are forwarded
+     * when an outbox is next enabled on the directory; one of them may
+     * then be sent twice. When all <tt>maxSegments</tt> segments are
+     * full, sends fail with MQJ_ERROR_OUTBOX_FULL.</p>
+     *
+     * <p>The queue must be open for SEND access, and the outbox can
+     * be enabled only once. It stops when the queue is closed.</p>
+     *
+     * @param directory    the directory to keep the journal in.
+     * @param segmentSize  the size of each segment file in bytes, at
+     *                     least 4.06MB so that any message fits; or 0
+     *                     for the default of 16MB.
+     * @param maxSegments  the most segment files to keep.
+     **/
+    public void enableOutbox(String directory, int segmentSize, int maxSegments)
+        throws  MessageQueueException
+    {
+        int rc= nativeEnableOutbox(directory, segmentSize, maxSegments);
+        if (rc!=0)
+            throw new MessageQueueException("Cannot enable outbox.", rc);
+        _outbox= true;
+    }
+
+
+    /**
+     * Keep messages that cannot be sent in a journal on local disk,
+     * of up to 64 segments of 16MB.
+     *
+     * @see #enableOutbox(String, int, int)
+     **/
+    public void enableOutbox(String directory)
+        throws  MessageQueueException
+    {
+        enableOutbox(directory, 0, 64);
+    }
+
+
+    /**
+     * Gets the number of messages in the outbox waiting to be
+     * forwarded.
+     *
+     * @return the number of messages, or -1 if the outbox is not enabled.
+     **/
+    public long getOutboxPending()
+    {
+        return nativeGetOutboxPending();
+    }
+
+
+    /**
+     * <p>Copy each message received from this queue to a capture
+     * file, which the MsmqReplay tool can send again, to reproduce the
+     * traffic at its original pace, or faster.</p>
+     *
+     * <p>The file keeps the body, label, correlation ID and priority
+     * of each message, and the time it was received. Messages that are
+     * only peeked, or dropped as duplicates, are not captured. The file
+     * is created at <tt>maxBytes</tt>, replacing any file at
+     * <tt>path</tt>, and is trimmed to what was captured when capturing
+     * stops. Once it is full, later messages are not captured.</p>
+     *
+     * <p>The queue must be open for RECEIVE access. Capturing stops on
+     * {@link #stopCapture()}, or when the queue is closed.</p>
+     *
+     * @param path      the capture file.
+     * @param maxBytes  the most bytes to capture, at least 4.06MB so
+     *                  that any message fits; or 0 for the default of
+     *                  256MB.
+     **/
+    public void startCapture(String path, int maxBytes)
+        throws  MessageQueueException
+    {
+        int rc= nativeStartCapture(path, maxBytes);
+        if (rc!=0)
+            throw new MessageQueueException("Cannot start capture.", rc);
+    }
+
+
+    /**
+     * Copy each message received from this queue to a capture file of
+     * up to 256MB.
+     *
+     * @see #startCapture(String, int)
+     **/
+    public void startCapture(String path)
+        throws  MessageQueueException
+    {
+        startCapture(path, 0);
+    }
+
+
+    /**
+     * Stop capturing received messages, and close the capture file.
+     * Does nothing if no capture is running.
+     *
+     **/
+    public void stopCapture()
+        throws  MessageQueueException
+    {
+        int rc= nativeStopCapture();
+        if (rc!=0)
+            throw new MessageQueueException("Cannot stop capture.", rc);
+    }
+
+
+    /**
+     * <p>Gets a snapshot of the counters kept by the native layer for
+     * this queue, summed over its send and receive handles.</p>
+     *
+     * @return the statistics for the queue.
+     **/
+    public QueueStatistics getStatistics()
+        throws  MessageQueueException
+    {
+        long[] values= new long[QueueStatistics.COUNT];
+        int rc= nativeGetStatistics(values);
+        if (rc!=0)
+            throw new MessageQueueException("Cannot get statistics.", rc);
+        return new QueueStatistics(values);
+    }
+
+
+
+    /**
+     * <p>Gets the backlog of the queue: the number of messages waiting,
+     * the bytes they take up, and the age of the oldest.</p>
+     *
+     * <p>The values come from the MSMQ queue manager, which is asked at
+     * most once per sample interval for each queue; calls in between
+     * return the cached values, so this is cheap enough to call from
+     * many threads. See {@link #setBacklogSampleInterval(int)}.</p>
+     *
+     * <p>For a remote queue, the counts are those of the local
+     * outgoing queue that feeds it.</p>
+     *
+     * @return the backlog of the queue.
+     **/
+    public QueueBacklog getBacklog()
+        throws  MessageQueueException
+    {
+        long[] values= new long[QueueBacklog.COUNT];
+        int rc= nativeGetBacklog(values);
+        if (rc!=0)
+            throw new MessageQueueException("Cannot get backlog.", rc);
+        return new QueueBacklog(values);
+    }
+
+
+    /**
+     * Gets the number of messages waiting in the queue, as sampled by
+     * {@link #getBacklog()}.
+     *
+     * @return the number of messages in the queue.
+     **/
+    public long getMessageCount()
+        throws  MessageQueueException
+    {
+        return getBacklog().getMessageCount();
+    }
+
+
+    /**
+     * <p>Set how old the cached backlog of this queue may get before
+     * {@link #getBacklog()} samples it again. The default is one
+     * second. Zero samples on every call.</p>
+     *
+     * @param millis  the sample interval, in milliseconds.
+     **/
+    public void setBacklogSampleInterval(int millis)
+        throws  MessageQueueException
+    {
+        int rc= nativeSetBacklogInterval(millis);
+        if (rc!=0)
+            throw new MessageQueueException("Cannot set backlog sample interval.", rc);
+    }
+
+
+
+    // -------------------------------------------------------
+    // Streaming methods
+    // -------------------------------------------------------
+
+    /**
+     * <p>Open a stream that writes a body of any size to the queue, as a
+     * sequence of chunk messages.</p>
+     *
+     * <p>Use this for payloads beyond the MSMQ message size limit of
+     * about 4 MB. Each chunk carries the given label, and a
+     * correlation ID that holds the stream ID and the chunk sequence
+     * number; see {@link MessageOutputStream}. Read the stream back with
+     * {@link #openInputStream(int)}.</p>
+     *
+     * <p>Chunks are sent as they fill up, outside of any transaction,
+     * so receivers may see a partial stream if the writer fails. Only
+     * one non-transactional writer should write to a queue at a
+     * time, as chunks from concurrent writers can interleave.</p>
+     *
+     * @param label  the label to use on each chunk message.
+     * @return the stream. Closing it sends the final chunk.
+     **/
+    public MessageOutputStream openOutputStream(String label)
+        throws  MessageQueueException
+    {
+        return new MessageOutputStream(this, label, false, MessageOutputStream.DEFAULT_CHUNK_SIZE);
+    }
+
+
+    /**
+     * <p>Open a stream that writes a body of any size to the queue, as a
+     * sequence of chunk messages, optionally as a single transaction.</p>
+     *
+     * <p>When transactional, the chunks become visible to receivers all
+     * at once when the stream is closed, or not at all if it is
+     * aborted. Also, the chunks of one transaction are never
+     * interleaved with those of another writer. The queue must be
+     * transactional.</p>
+     *
+     * @param label  the label to use on each chunk message.
+     * @param transactional  true to send the whole stream in one transaction.
+     * @return the stream. Closing it sends the final chunk.
+     **/
+    public MessageOutputStream openOutputStream(String label, boolean transactional)
+        throws  MessageQueueException
+    {
+        return new MessageOutputStream(this, label, transactional, MessageOutputStream.DEFAULT_CHUNK_SIZE);
+    }
+
+
+    /**
+     * <p>Open a stream that reads the next chunked body from the queue,
+     * as written by {@link #openOutputStream(String)}.</p>
+     *
+     * <p>Chunks are received as the stream is read, so at most one
+     * chunk is held in memory at a time.</p>
+     *
+     * @param timeout  the timeout, in milliseconds, for each chunk.
+     * @return the stream, positioned at the start of the body.
+     **/
+    public MessageInputStream openInputStream(int timeout)
+        throws  MessageQueueException, java.io.IOException
+    {
+        return new MessageInputStream(this, timeout, false);
+    }
+
+
+    /**
+     * <p>Open a stream that reads the next chunked body from the queue,
+     * optionally within a single transaction.</p>
+     *
+     * <p>When transactional, the chunks are removed from the queue only
+     * when the whole stream has been read and the stream closed. If the
+     * stream is closed early, or the reader fails, all of the chunks go
+     * back to the queue. The queue must be transactional.</p>
+     *
+     * @param timeout  the timeout, in milliseconds, for each chunk.
+     * @param transactional  true to receive the whole stream in one transaction.
+     * @return the stream, positioned at the start of the body.
+     **/
+    public MessageInputStream openInputStream(int timeout, boolean transactional)
+        throws  MessageQueueException, java.io.IOException
+    {
+        return new MessageInputStream(this, timeout, transactional);
+    }
+
+
+
+
+    /**
+     * Close the queue.
+     *
+     **/
+    public void close()
+        throws  MessageQueueException
+    {
+        QueueSelector sel= _selector;
+        _selector= null;
+        if (sel != null)
+            sel._forget(this);
+
+        int rc=nativeClose();
+        if (rc!=0)
+            throw new MessageQueueException("Cannot close.", rc);
+    }
+
+
+
+    // --------------------------------------------
+    // getters on the Queue properties
+
+
+    /**
+     * Gets the name of the queue.
+     *
+     * @return the name of the queue.
+     */
+    public String getName(){ return _name; }
+
+
+    /**
+     * Gets the label on the queue.
+     *
+     * @return the label on the queue.
+     */
+    public String getLabel(){ return _label; }
+
+
+    /**
+     * Gets the formatname on the queue.
+     *
+     * @return the formatname of the queue.
      */
     public String getFormatName(){ return _formatName; }
 
@@ -426,25 +1580,49 @@ public class Queue
     // --------------------------------------------
     // native methods
     private static native int nativeInit();
-    private static native int nativeCreateQueue(String queuePath, String queueLabel, int isTransactional);
-    private static native int nativeDeleteQueue(String queuePath);
+    private static native int nativeCreateAll(String[] paths, String[] labels, boolean[] transactional, int parallelism, String[] formatNames, int[] results);
+    private static native int nativeDeleteAll(String[] queueNames, int parallelism, int[] results);
     private native int nativeOpenQueue(String queueString);
     private native int nativeOpenQueueForSend(String queueString);
     private native int nativeOpenQueueForReceive(String queueString);
     private native int nativeSend(String messageString, int length, String label, String correlationId, int transactionFlag);
     //private native int nativeReceiveBytes(int timeout, int ReadOrPeek);
-    private native int nativeReceiveBytes(Message msg, int timeout, int ReadOrPeek);
-    private native int nativeSendBytes(byte [] messageBytes, String label, byte[] correlationId, int tflag, boolean priority );
+    private native boolean nativeReceiveBytes(Message msg, int timeout, int ReadOrPeek, long tflag);
+    private native boolean nativeReceiveCurrent(Message msg, long lookupId, int ReadOrPeek, long tflag);
+    private native int nativePeekHeader(int timeout, long[] values, String[] label, byte[] correlationId, byte[] messageId);
+    private native int nativeDiscardCurrent(long lookupId, long tflag);
+    private native int nativeSendBytes(byte [] messageBytes, String label, byte[] correlationId, byte[] dedupId, long tflag, int priority, int timeToReachQueue, int timeToBeReceived, boolean async );
+    private static native int nativeSendToAll(Queue[] targets, byte [] messageBytes, String label, byte[] correlationId, byte[] dedupId, long tflag, int priority, int timeToReachQueue, int timeToBeReceived, int[] results);
+    private native int nativeSetCompression(int codec, int threshold);
+    private native int nativeSetDedupWindow(int capacity);
+    private native int nativeSetChecksum(boolean enabled);
+    private native int nativePurge(int maxCount, LabelFilter filter, int[] purged);
+    private native int nativeSetMaxAge(int seconds);
+    private native int nativeSetLatencyProbe(boolean enabled, int producerId);
+    private native int nativeSetHeartbeat(int interval);
+    private native int nativeEnableOutbox(String directory, int segmentSize, int maxSegments);
+    private native long nativeGetOutboxPending();
+    private native int nativeStartCapture(String path, int maxBytes);
+    private native int nativeStopCapture();
+    private native int nativeGetStatistics(long[] values);
+    private native int nativeGetBacklog(long[] values);
+    private native int nativeSetBacklogInterval(int interval);
     private native int nativeClose();
 
 
     // --------------------------------------------
     // private members
+    static final int MQ_ERROR_IO_TIMEOUT = 0xC00E001B;
+    static final int MQ_ERROR_MESSAGE_NOT_FOUND = 0xC00E0088;
+    static final int MQ_ERROR_TRANSACTION_USAGE = 0xC00E0050;
+
     int   _queueSlot = 0;
+    volatile QueueSelector _selector;  // the one this is registered with, if any
     String _name;
     String _formatName;
     String _label;
     boolean _isTransactional;
+    volatile boolean _outbox;
 
     // --------------------------------------------
     // static initializer
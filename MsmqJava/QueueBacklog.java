@@ -0,0 +1,74 @@
+//
+// QueueBacklog.java
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module represents a sample of the backlog of a Queue.
+//
+// ------------------------------------------------------------------
+
+package ionic.Msmq;
+
+
+/**
+ * <p>A sample of the messages waiting in a {@link Queue}, as returned
+ * by {@link Queue#getBacklog()}.</p>
+ *
+ * <p>The values may be up to one sample interval old.</p>
+ *
+ */
+public class QueueBacklog
+{
+    // indexes into the values array; these must match the order of
+    // MsmqBacklogValue in MsmqQueue.hpp.
+    static final int MESSAGE_COUNT = 0;
+    static final int BYTES_IN_QUEUE = 1;
+    static final int OLDEST_AGE_MILLIS = 2;
+    static final int COUNT = 3;
+
+    private long[] _values;
+
+
+    QueueBacklog(long[] values) { _values= values; }
+
+
+    /**
+     * @return the number of messages in the queue.
+     */
+    public long getMessageCount()            { return _values[MESSAGE_COUNT]; }
+
+    /**
+     * @return the bytes taken up by the messages in the queue.
+     */
+    public long getBytesInQueue()            { return _values[BYTES_IN_QUEUE]; }
+
+    /**
+     * <p>Gets how long the message at the head of the queue has been
+     * waiting, in milliseconds, to a resolution of one second.</p>
+     *
+     * @return the age of the oldest message, or -1 if the queue is
+     *         empty, or is not open for RECEIVE access.
+     */
+    public long getOldestMessageAge()        { return _values[OLDEST_AGE_MILLIS]; }
+
+
+    public String toString()
+    {
+        return "messages=" + getMessageCount()
+            + ", bytes=" + getBytesInQueue()
+            + ", oldest=" + getOldestMessageAge() + " ms";
+    }
+}
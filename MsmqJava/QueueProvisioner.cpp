@@ -0,0 +1,125 @@
+//
+// QueueProvisioner.cpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module creates or deletes many queues at once.
+//
+// MQCreateQueue and MQDeleteQueue each wait on a round trip to the
+// queue manager, and to the directory for public queues, so a long
+// list goes much faster on a few threads than on one.  The threads
+// take the next request from a shared index until none are left.
+//
+// ------------------------------------------------------------------
+
+#include <stdio.h>
+#include <process.h>
+#include <WTypes.h>   // reqd for WinBase.h
+#include <WinBase.h>  // for CriticalSection
+#include <MqOai.h>
+#include <mq.h>
+
+#include "Log.hpp"
+#include "DedupWindow.hpp"
+#include "MsmqQueue.hpp"
+#include "QueueProvisioner.hpp"
+
+
+
+QueueProvisioner::QueueProvisioner(ProvisionRequest *pRequests, int count, BOOL fCreateQueues)
+{
+	requests = pRequests;
+	cRequests = count;
+	fCreate = fCreateQueues;
+	iNext = 0;
+}
+
+
+
+void QueueProvisioner::createAll(ProvisionRequest *pRequests, int count, int cThreads)
+{
+	QueueProvisioner p(pRequests, count, TRUE);
+	p.run(cThreads);
+}
+
+
+
+void QueueProvisioner::deleteAll(ProvisionRequest *pRequests, int count, int cThreads)
+{
+	QueueProvisioner p(pRequests, count, FALSE);
+	p.run(cThreads);
+}
+
+
+
+void QueueProvisioner::run(int cThreads)
+{
+	HANDLE threads[MQJ_PROVISION_MAX_THREADS];
+	int cStarted = 0;
+
+	if (cThreads > MQJ_PROVISION_MAX_THREADS) cThreads = MQJ_PROVISION_MAX_THREADS;
+	if (cThreads > cRequests) cThreads = cRequests;
+
+	// the calling thread is one of the workers
+	for (int i = 1; i < cThreads; i++) {
+		HANDLE h = (HANDLE)_beginthreadex(NULL, 0, workMain, this, 0, NULL);
+		if (h == NULL) break;   // make do with fewer
+		threads[cStarted++] = h;
+	}
+
+	LOG_DEBUG("provision: %d queues on %d threads", cRequests, cStarted + 1);
+	work();
+
+	if (cStarted > 0)
+		WaitForMultipleObjects(cStarted, threads, TRUE, INFINITE);
+	for (int i = 0; i < cStarted; i++)
+		CloseHandle(threads[i]);
+}
+
+
+
+unsigned __stdcall QueueProvisioner::workMain(void *pv)
+{
+	((QueueProvisioner *)pv)->work();
+	return 0;
+}
+
+
+
+void QueueProvisioner::work()
+{
+	for (;;) {
+		LONG i = InterlockedIncrement(&iNext) - 1;
+		if (i >= cRequests) break;
+
+		ProvisionRequest *r = &requests[i];
+		if (fCreate) {
+			DWORD cchFormatName = MQJ_FORMAT_NAME_LEN;
+			r->wszFormatName[0] = L'\0';
+			r->hr = MsmqQueue::createQueue(r->szPath,
+				r->szLabel,
+				r->wszFormatName,
+				&cchFormatName,
+				r->isTransactional);
+		}
+		else {
+			r->hr = MsmqQueue::deleteQueue(r->szPath);
+		}
+
+		if (FAILED(r->hr))
+			LOG_DEBUG("provision: %s %s: hr=0x%08x", fCreate ? "create" : "delete", r->szPath, r->hr);
+	}
+}
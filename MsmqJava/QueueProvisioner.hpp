@@ -0,0 +1,58 @@
+//
+// QueueProvisioner.hpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This is an include for the QueueProvisioner class, which creates
+// or deletes many queues at once on a pool of threads.
+//
+// ------------------------------------------------------------------
+
+#define MQJ_FORMAT_NAME_LEN             256
+#define MQJ_PROVISION_MAX_THREADS       64
+
+
+// one queue to create or delete, and the outcome
+struct ProvisionRequest
+{
+	char            *szPath;        // the path name to create, or the format name to delete
+	char            *szLabel;       // create only
+	int             isTransactional;
+	WCHAR           wszFormatName[MQJ_FORMAT_NAME_LEN];  // set by create
+	HRESULT         hr;
+};
+
+
+class QueueProvisioner
+{
+private:
+	ProvisionRequest *requests;
+	int             cRequests;
+	BOOL            fCreate;
+	volatile LONG   iNext;          // the next request to take
+
+	QueueProvisioner(ProvisionRequest *pRequests, int count, BOOL fCreateQueues);
+
+	void run(int cThreads);
+	void work(void);
+	static unsigned __stdcall workMain(void *pv);
+
+public:
+	// Each runs the requests on at most cThreads threads, and returns
+	// when all are done, with the outcome of each in its hr.
+	static void createAll(ProvisionRequest *pRequests, int count, int cThreads);
+	static void deleteAll(ProvisionRequest *pRequests, int count, int cThreads);
+};
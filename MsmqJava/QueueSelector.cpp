@@ -0,0 +1,368 @@
+//
+// QueueSelector.cpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module waits for messages on many queues at once.
+//
+// Each registered receive handle is bound to the selector's I/O
+// completion port, and keeps one overlapped peek outstanding.  When a
+// message arrives the peek completes, and select() hands back the
+// queue's slot.  The peek is not re-issued until the next call to
+// select(), by which time the caller has received from the queue; if
+// messages remain, the new peek completes right away.
+//
+// A completion port is used rather than one event per queue because
+// WaitForMultipleObjects is limited to MAXIMUM_WAIT_OBJECTS (64)
+// handles, and there is no such limit on the number of handles bound
+// to a port.
+//
+// ------------------------------------------------------------------
+
+#include <stdio.h>
+#include <WTypes.h>   // reqd for WinBase.h
+#include <WinBase.h>  // for CriticalSection
+#include <MqOai.h>
+#include <mq.h>
+
+#include "Log.hpp"
+#include "DedupWindow.hpp"
+#include "MsmqQueue.hpp"
+#include "QueueSelector.hpp"
+
+
+// A registered queue.  MSMQ writes to the OVERLAPPED when the peek
+// completes, so an entry with a peek outstanding is never freed until
+// its completion has been dequeued.  An entry removed while its peek
+// is outstanding has queue set to NULL, and is freed by select().
+struct SelectorEntry
+{
+	OVERLAPPED      overlapped;
+	MsmqQueue       *queue;
+	int             slot;
+	BOOL            pending;      // a peek is outstanding
+	BOOL            ready;        // handed out by select(), to be re-armed
+	SelectorEntry   *next;
+};
+
+
+CRITICAL_SECTION QueueSelector::lock;
+
+
+
+void QueueSelector::init()
+{
+	InitializeCriticalSection(&lock);
+}
+
+
+
+QueueSelector::QueueSelector()
+{
+	hPort = NULL;
+	entries = NULL;
+	closed = FALSE;
+}
+
+
+
+QueueSelector::~QueueSelector()
+{
+	if (hPort == NULL) return;
+
+	// free the entries whose peeks have completed.  Those still
+	// outstanding belong to queues that are open, and MSMQ will write
+	// to them later, so they are abandoned instead.
+	for (;;) {
+		DWORD cb;
+		ULONG_PTR key;
+		LPOVERLAPPED pov = NULL;
+		BOOL ok = GetQueuedCompletionStatus(hPort, &cb, &key, &pov, 0);
+		if (!ok && pov == NULL) break;
+		if (pov != NULL)
+			CONTAINING_RECORD(pov, SelectorEntry, overlapped)->pending = FALSE;
+	}
+
+	EnterCriticalSection(&lock);
+	while (entries != NULL) {
+		SelectorEntry *e = entries;
+		entries = e->next;
+		if (!e->pending) delete e;
+	}
+	LeaveCriticalSection(&lock);
+
+	CloseHandle(hPort);
+}
+
+
+
+HRESULT QueueSelector::open()
+{
+	hPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+	if (hPort == NULL)
+		return HRESULT_FROM_WIN32(GetLastError());
+	return MQ_OK;
+}
+
+
+
+// caller holds lock
+void QueueSelector::unlink(SelectorEntry *e)
+{
+	SelectorEntry **pp = &entries;
+	while (*pp != NULL && *pp != e)
+		pp = &(*pp)->next;
+	if (*pp != NULL)
+		*pp = e->next;
+}
+
+
+
+// Binds the handle of q to the port, if it is not yet, and starts a
+// peek on it.  Caller holds lock.
+HRESULT QueueSelector::addEntry(MsmqQueue *q, int slot)
+{
+	HRESULT hr = MQ_OK;
+
+	if (q->hCompletionPort == NULL) {
+		if (CreateIoCompletionPort(q->hQueue, hPort, 0, 0) == NULL)
+			return HRESULT_FROM_WIN32(GetLastError());
+		q->hCompletionPort = hPort;
+	}
+
+	SelectorEntry *e = new SelectorEntry;
+	e->queue = q;
+	e->slot = slot;
+	e->ready = FALSE;
+	hr = q->beginPeek(&e->overlapped);
+	if (hr == MQ_OK || hr == MQ_INFORMATION_OPERATION_PENDING) {
+		// even a peek that completes at once posts to the port
+		e->pending = TRUE;
+		e->next = entries;
+		entries = e;
+		q->selector = this;
+		hr = MQ_OK;
+	}
+	else
+		delete e;
+
+	return hr;
+}
+
+
+
+// caller holds lock
+void QueueSelector::removeEntry(MsmqQueue *q)
+{
+	for (SelectorEntry *e = entries; e != NULL; e = e->next) {
+		if (e->queue == q) {
+			e->queue = NULL;
+			if (!e->pending) {
+				unlink(e);
+				delete e;
+			}
+			break;
+		}
+	}
+	q->selector = NULL;
+}
+
+
+
+// caller holds lock
+void QueueSelector::rearm()
+{
+	SelectorEntry *e = entries;
+	while (e != NULL) {
+		SelectorEntry *next = e->next;
+		if (e->queue != NULL && e->ready && !e->pending) {
+			e->ready = FALSE;
+			HRESULT hr = e->queue->beginPeek(&e->overlapped);
+			if (hr == MQ_OK || hr == MQ_INFORMATION_OPERATION_PENDING) {
+				e->pending = TRUE;
+			}
+			else {
+				LOG_WARN("QueueSelector: cannot peek slot %d (hr=0x%08x)", e->slot, hr);
+				e->queue->selector = NULL;
+				unlink(e);
+				delete e;
+			}
+		}
+		e = next;
+	}
+}
+
+
+
+void QueueSelector::detach(MsmqQueue *q)
+{
+	EnterCriticalSection(&lock);
+	if (q->selector != NULL)
+		q->selector->removeEntry(q);
+	LeaveCriticalSection(&lock);
+}
+
+
+
+// The entry for the old handle is dropped as by remove(): its peek
+// completes, cancelled, when the old handle is closed, and select()
+// frees it then.  A new entry, with the same slot, peeks on the new
+// handle.
+void QueueSelector::reattach(MsmqQueue *q)
+{
+	EnterCriticalSection(&lock);
+	QueueSelector *s = q->selector;
+	if (s != NULL) {
+		int slot = 0;
+		for (SelectorEntry *e = s->entries; e != NULL; e = e->next) {
+			if (e->queue == q) {
+				slot = e->slot;
+				break;
+			}
+		}
+		s->removeEntry(q);
+
+		HRESULT hr = s->addEntry(q, slot);
+		if (FAILED(hr))
+			LOG_WARN("QueueSelector: cannot re-register slot %d (hr=0x%08x)", slot, hr);
+	}
+	LeaveCriticalSection(&lock);
+}
+
+
+
+HRESULT QueueSelector::add(MsmqQueue *q, int slot)
+{
+	HRESULT hr = MQ_OK;
+
+	EnterCriticalSection(&lock);
+	if (closed) {
+		hr = MQ_ERROR_INVALID_HANDLE;
+	}
+	else if (q->selector == this) {
+		// already registered
+	}
+	else if (q->selector != NULL ||
+		(q->hCompletionPort != NULL && q->hCompletionPort != hPort)) {
+		// a handle can be bound to only one completion port
+		hr = MQJ_ERROR_SELECTOR_CONFLICT;
+	}
+	else {
+		hr = addEntry(q, slot);
+	}
+	LeaveCriticalSection(&lock);
+
+	return hr;
+}
+
+
+
+HRESULT QueueSelector::remove(MsmqQueue *q)
+{
+	HRESULT hr = MQ_OK;
+
+	EnterCriticalSection(&lock);
+	if (q->selector == this)
+		removeEntry(q);
+	else
+		hr = MQ_ERROR_INVALID_PARAMETER;
+	LeaveCriticalSection(&lock);
+
+	return hr;
+}
+
+
+
+int QueueSelector::select(DWORD dwTimeout, int *pSlots, int cSlots)
+{
+	DWORD dwStart = GetTickCount();
+	DWORD dwWait = dwTimeout;
+	int n = 0;
+
+	EnterCriticalSection(&lock);
+	if (!closed) rearm();
+	LeaveCriticalSection(&lock);
+	if (closed) return MQ_ERROR_INVALID_HANDLE;
+
+	while (n < cSlots) {
+		DWORD cb;
+		ULONG_PTR key;
+		LPOVERLAPPED pov = NULL;
+		GetQueuedCompletionStatus(hPort, &cb, &key, &pov, dwWait);
+		if (pov == NULL) break;  // timed out, or woken up
+
+		SelectorEntry *e = CONTAINING_RECORD(pov, SelectorEntry, overlapped);
+		HRESULT hr = MQGetOverlappedResult(pov);
+
+		EnterCriticalSection(&lock);
+		e->pending = FALSE;
+		if (e->queue == NULL) {
+			// removed while the peek was outstanding
+			unlink(e);
+			delete e;
+		}
+		else if (FAILED(hr)) {
+			// the queue was closed or deleted under us
+			LOG_WARN("QueueSelector: peek on slot %d failed (hr=0x%08x)", e->slot, hr);
+			e->queue->selector = NULL;
+			unlink(e);
+			delete e;
+		}
+		else {
+			e->ready = TRUE;
+			pSlots[n++] = e->slot;
+		}
+		LeaveCriticalSection(&lock);
+
+		// once something is ready, collect whatever else is, without
+		// waiting.  Otherwise keep waiting out the timeout.
+		if (n > 0)
+			dwWait = 0;
+		else if (dwTimeout != INFINITE) {
+			DWORD dwElapsed = GetTickCount() - dwStart;
+			dwWait = (dwElapsed >= dwTimeout) ? 0 : dwTimeout - dwElapsed;
+		}
+	}
+
+	return n;
+}
+
+
+
+HRESULT QueueSelector::wakeup()
+{
+	if (!PostQueuedCompletionStatus(hPort, 0, 0, NULL))
+		return HRESULT_FROM_WIN32(GetLastError());
+	return MQ_OK;
+}
+
+
+
+void QueueSelector::close(int cWaiters)
+{
+	EnterCriticalSection(&lock);
+	closed = TRUE;
+	SelectorEntry *e = entries;
+	while (e != NULL) {
+		SelectorEntry *next = e->next;
+		if (e->queue != NULL) removeEntry(e->queue);
+		e = next;
+	}
+	LeaveCriticalSection(&lock);
+
+	for (int i = 0; i < cWaiters; i++)
+		wakeup();
+}
@@ -0,0 +1,75 @@
+//
+// QueueSelector.hpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This is an include for the QueueSelector class, which waits for a
+// message to arrive on any of a set of receive handles.
+//
+// ------------------------------------------------------------------
+
+struct SelectorEntry;
+
+
+class QueueSelector
+{
+private:
+	// one lock for all selectors, their entries, and the selector
+	// field of MsmqQueue.  Waiting is done outside of it.
+	static CRITICAL_SECTION lock;
+
+	HANDLE          hPort;
+	SelectorEntry   *entries;
+	BOOL            closed;
+
+	void unlink(SelectorEntry *e);
+	HRESULT addEntry(MsmqQueue *q, int slot);
+	void removeEntry(MsmqQueue *q);
+	void rearm(void);
+
+public:
+
+	// to be called once, before any other method
+	static void init(void);
+
+	// drops q from the selector it is registered with, if any.  To be
+	// called before the queue is closed.
+	static void detach(MsmqQueue *q);
+
+	// moves q's registration, if any, to its new handle after it
+	// reconnects, and issues a peek on it
+	static void reattach(MsmqQueue *q);
+
+	QueueSelector();
+	~QueueSelector();
+
+	HRESULT open(void);
+
+	// registers a receive handle; slot is what select() reports for it
+	HRESULT add(MsmqQueue *q, int slot);
+	HRESULT remove(MsmqQueue *q);
+
+	// waits up to dwTimeout for any registered queue to have a message,
+	// and stores the slots of the ready queues in pSlots.  Returns the
+	// number stored, 0 on timeout or wakeup, or a failed HRESULT.
+	int select(DWORD dwTimeout, int *pSlots, int cSlots);
+
+	// makes one waiting select() return early
+	HRESULT wakeup(void);
+
+	// drops all queues, and wakes up cWaiters threads in select()
+	void close(int cWaiters);
+};
@@ -0,0 +1,277 @@
+//
+// QueueSelector.java
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module waits for messages on any of a set of Queues.
+//
+// ------------------------------------------------------------------
+
+package ionic.Msmq;
+
+
+/**
+ * <p>A QueueSelector waits for a message to arrive on any of a set of
+ * queues, so that a few threads can serve many queues, without
+ * polling.</p>
+ *
+ * <blockquote class='code'><pre>
+ *   QueueSelector selector= new QueueSelector();
+ *   for (Queue q : queues)
+ *       selector.register(q);
+ *
+ *   for (;;) {
+ *       for (Queue q : selector.select(1000)) {
+ *           Message msg= q.tryReceive(0);
+ *           if (msg != null) ...
+ *       }
+ *   }
+ * </pre></blockquote>
+ *
+ * <p>A queue returned by {@link #select(int)} is not watched again until
+ * the next call to select() on this selector, so the caller should
+ * receive from it before selecting again. If messages remain on the
+ * queue, it is returned again right away. When several threads select
+ * on the same selector, another thread may receive the message first,
+ * so receive from a ready queue with {@link Queue#tryReceive(int)}
+ * and a short timeout.</p>
+ *
+ * <p>The queues must be open for RECEIVE access. Closing a queue drops
+ * it from its selector. A queue can be registered with only one
+ * selector during its lifetime, because its receive handle stays bound
+ * to that selector; it can be unregistered and registered again with
+ * the same one.</p>
+ *
+ */
+public class QueueSelector
+{
+    /**
+     * Create a selector, with no queues registered.
+     *
+     **/
+    public QueueSelector()
+        throws  MessageQueueException
+    {
+        int rc= nativeCreate();
+        if (rc!=0)
+            throw new MessageQueueException("Cannot create selector.", rc);
+    }
+
+
+    /**
+     * <p>Register a queue with the selector. Registering a queue that
+     * is already registered has no effect.</p>
+     *
+     * @param queue  a queue open for RECEIVE access.
+     **/
+    public void register(Queue queue)
+        throws  MessageQueueException
+    {
+        long handle= _acquire();
+        try {
+            synchronized (_queues) {
+                int rc= nativeRegister(handle, queue);
+                if (rc!=0)
+                    throw new MessageQueueException("Cannot register queue.", rc);
+                _queues.put(queue._queueSlot, queue);
+            }
+            queue._selector= this;
+        }
+        finally {
+            _release();
+        }
+    }
+
+
+    /**
+     * Stop watching a queue.
+     *
+     **/
+    public void unregister(Queue queue)
+        throws  MessageQueueException
+    {
+        long handle= _acquire();
+        try {
+            if (queue._selector == this)
+                queue._selector= null;
+            synchronized (_queues) {
+                _queues.remove(queue._queueSlot);
+                int rc= nativeUnregister(handle, queue);
+                if (rc!=0)
+                    throw new MessageQueueException("Cannot unregister queue.", rc);
+            }
+        }
+        finally {
+            _release();
+        }
+    }
+
+
+    /**
+     * <p>Wait until at least one registered queue has a message, or
+     * the timeout expires, or {@link #wakeup()} is called.</p>
+     *
+     * @param timeout  the timeout in milliseconds, or -1 to wait forever.
+     * @return the queues that have a message; empty on timeout or wakeup.
+     **/
+    public java.util.List<Queue> select(int timeout)
+        throws  MessageQueueException
+    {
+        int[] slots= new int[MAX_READY];
+        long handle= _acquire();
+        int n;
+        try {
+            n= nativeSelect(handle, timeout, slots);
+        }
+        finally {
+            _release();
+        }
+        if (n<0)
+            throw new MessageQueueException("Cannot select.", n);
+
+        java.util.List<Queue> ready= new java.util.ArrayList<Queue>(n);
+        synchronized (_queues) {
+            for (int i=0; i < n; i++) {
+                Queue q= _queues.get(slots[i]);
+                if (q != null) ready.add(q);
+            }
+        }
+        return ready;
+    }
+
+
+    /**
+     * Wait until at least one registered queue has a message.
+     *
+     * @see #select(int)
+     **/
+    public java.util.List<Queue> select()
+        throws  MessageQueueException
+    {
+        return select(-1);
+    }
+
+
+    /**
+     * Make one thread waiting in {@link #select(int)} return an empty
+     * list. If no thread is waiting, the next call to select returns
+     * at once.
+     *
+     **/
+    public void wakeup()
+        throws  MessageQueueException
+    {
+        long handle= _acquire();
+        try {
+            int rc= nativeWakeup(handle);
+            if (rc!=0)
+                throw new MessageQueueException("Cannot wake up selector.", rc);
+        }
+        finally {
+            _release();
+        }
+    }
+
+
+    /**
+     * <p>Close the selector. Threads waiting in {@link #select(int)}
+     * return an empty list, and later calls throw.</p>
+     *
+     **/
+    public synchronized void close()
+    {
+        if (_closed) return;
+        _closed= true;
+        nativeClose(_handle, _users);
+        if (_users == 0) {
+            nativeDestroy(_handle);
+            _handle= 0;
+        }
+        java.util.List<Queue> queues;
+        synchronized (_queues) {
+            queues= new java.util.ArrayList<Queue>(_queues.values());
+            _queues.clear();
+        }
+        for (Queue q : queues) {
+            if (q._selector == this)
+                q._selector= null;
+        }
+    }
+
+
+    // Called by Queue.close(), which detaches the queue in the native
+    // layer and frees its slot.  The slot may already belong to another
+    // queue, so only this one's entry is removed.
+    void _forget(Queue queue)
+    {
+        synchronized (_queues) {
+            if (_queues.get(queue._queueSlot) == queue)
+                _queues.remove(queue._queueSlot);
+        }
+    }
+
+
+    // The native selector is destroyed by the last user out after
+    // close(), so that close() can be called while other threads are
+    // blocked in select().
+    private synchronized long _acquire()
+        throws  MessageQueueException
+    {
+        if (_closed)
+            throw new MessageQueueException("Selector is closed.", 0xC00E0007); // MQ_ERROR_INVALID_HANDLE
+        _users++;
+        return _handle;
+    }
+
+    private synchronized void _release()
+    {
+        if (--_users == 0 && _closed) {
+            nativeDestroy(_handle);
+            _handle= 0;
+        }
+    }
+
+
+
+    // --------------------------------------------
+    // native methods
+    private native int nativeCreate();
+    private static native int nativeRegister(long handle, Queue queue);
+    private static native int nativeUnregister(long handle, Queue queue);
+    private static native int nativeSelect(long handle, int timeout, int[] readySlots);
+    private static native int nativeWakeup(long handle);
+    private static native void nativeClose(long handle, int waiters);
+    private static native void nativeDestroy(long handle);
+
+
+    // --------------------------------------------
+    // private members
+    private static final int MAX_READY = 256;  // queues returned per select
+
+    long _handle = 0;  // the native QueueSelector pointer
+    private int _users = 0;
+    private boolean _closed = false;
+    private java.util.Map<Integer, Queue> _queues = new java.util.HashMap<Integer, Queue>();
+
+    // --------------------------------------------
+    // static initializer
+    static {
+        System.loadLibrary("MsmqJava");
+        // the native layer is initialized by the Queue class
+        try { Class.forName("ionic.Msmq.Queue"); }
+        catch (ClassNotFoundException ex1) { }
+    }
+}
@@ -0,0 +1,86 @@
+//
+// QueueSpec.java
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module describes a queue to be created with Queue.createAll().
+//
+// ------------------------------------------------------------------
+
+package ionic.Msmq;
+
+
+/**
+ * <p>The path name, label and transactional setting of a queue to be
+ * created by {@link Queue#createAll(java.util.List, int)}.</p>
+ *
+ */
+public class QueueSpec
+{
+    private String _path;
+    private String _label;
+    private boolean _transactional;
+
+
+    /**
+     * Describe a queue.
+     *
+     * @param path           the path name, like <tt>.\private$\orders</tt>.
+     * @param label          the queue label, or null for none.
+     * @param transactional  whether the queue is transactional.
+     **/
+    public QueueSpec(String path, String label, boolean transactional)
+    {
+        if (path == null)
+            throw new IllegalArgumentException("path must not be null");
+        _path= path;
+        _label= (label == null) ? "" : label;
+        _transactional= transactional;
+    }
+
+
+    /**
+     * Describe a non-transactional queue with no label.
+     *
+     * @param path   the path name, like <tt>.\private$\orders</tt>.
+     **/
+    public QueueSpec(String path)
+    {
+        this(path, null, false);
+    }
+
+
+    /**
+     * @return the path name of the queue.
+     */
+    public String getPath()               { return _path; }
+
+    /**
+     * @return the queue label.
+     */
+    public String getLabel()              { return _label; }
+
+    /**
+     * @return whether the queue is transactional.
+     */
+    public boolean isTransactional()      { return _transactional; }
+
+
+    public String toString()
+    {
+        return _path + (_transactional ? " (transactional)" : "");
+    }
+}
@@ -0,0 +1,249 @@
+//
+// QueueStatistics.java
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module represents a snapshot of the native counters for a Queue.
+//
+// ------------------------------------------------------------------
+
+package ionic.Msmq;
+
+
+/**
+ * <p>A snapshot of the counters kept by the native layer for a
+ * {@link Queue}, as returned by {@link Queue#getStatistics()}.</p>
+ *
+ * <p>The counters start at zero when the queue is opened, and are
+ * never reset.</p>
+ *
+ */
+public class QueueStatistics
+{
+    // indexes into the values array; these must match the order of
+    // MsmqQueueStat in MsmqQueue.hpp.
+    static final int MESSAGES_SENT = 0;
+    static final int BYTES_SENT = 1;
+    static final int MESSAGES_RECEIVED = 2;
+    static final int BYTES_RECEIVED = 3;
+    static final int MESSAGES_COMPRESSED = 4;
+    static final int BYTES_BEFORE_COMPRESSION = 5;
+    static final int BYTES_AFTER_COMPRESSION = 6;
+    static final int COMPRESS_NANOS = 7;
+    static final int MESSAGES_DECOMPRESSED = 8;
+    static final int DECOMPRESS_NANOS = 9;
+    static final int DUPLICATES_DROPPED = 10;
+    static final int RECONNECTS = 11;
+    static final int CHECKSUM_NANOS = 12;
+    static final int CHECKSUM_FAILURES = 13;
+    static final int MESSAGES_EXPIRED = 14;
+    static final int HEARTBEATS_SENT = 15;
+    static final int HEARTBEATS_RECEIVED = 16;
+    static final int PROBES_RECEIVED = 17;
+    static final int TRANSIT_MICROS = 18;
+    static final int TRANSIT_HISTOGRAM = 19;
+    static final int TRANSIT_BUCKETS = 256;   // MQJ_TRANSIT_BUCKETS
+    static final int COUNT = TRANSIT_HISTOGRAM + TRANSIT_BUCKETS;
+
+    private long[] _values;
+
+
+    QueueStatistics(long[] values) { _values= values; }
+
+
+    /**
+     * @return the number of messages sent.
+     */
+    public long getMessagesSent()            { return _values[MESSAGES_SENT]; }
+
+    /**
+     * @return the number of body bytes sent, after any compression.
+     */
+    public long getBytesSent()               { return _values[BYTES_SENT]; }
+
+    /**
+     * @return the number of messages received or peeked.
+     */
+    public long getMessagesReceived()        { return _values[MESSAGES_RECEIVED]; }
+
+    /**
+     * @return the number of body bytes received, before any decompression.
+     */
+    public long getBytesReceived()           { return _values[BYTES_RECEIVED]; }
+
+    /**
+     * @return the number of messages that were sent compressed.
+     */
+    public long getMessagesCompressed()      { return _values[MESSAGES_COMPRESSED]; }
+
+    /**
+     * @return the body bytes of compressed messages, before compression.
+     */
+    public long getBytesBeforeCompression()  { return _values[BYTES_BEFORE_COMPRESSION]; }
+
+    /**
+     * @return the body bytes of compressed messages, after compression.
+     */
+    public long getBytesAfterCompression()   { return _values[BYTES_AFTER_COMPRESSION]; }
+
+    /**
+     * <p>Gets the compression ratio achieved on the messages that were
+     * sent compressed, as original size over compressed size.</p>
+     *
+     * @return the compression ratio, or 1.0 if nothing was compressed.
+     */
+    public double getCompressionRatio()
+    {
+        long after= _values[BYTES_AFTER_COMPRESSION];
+        return (after == 0) ? 1.0 : (double)_values[BYTES_BEFORE_COMPRESSION] / after;
+    }
+
+    /**
+     * <p>Gets the time spent compressing bodies on send, in
+     * nanoseconds, including attempts that did not shrink the body.</p>
+     *
+     * @return the time spent in the compressor.
+     */
+    public long getCompressNanos()           { return _values[COMPRESS_NANOS]; }
+
+    /**
+     * @return the number of received messages that were decompressed.
+     */
+    public long getMessagesDecompressed()    { return _values[MESSAGES_DECOMPRESSED]; }
+
+    /**
+     * @return the time spent decompressing bodies on receive, in nanoseconds.
+     */
+    public long getDecompressNanos()         { return _values[DECOMPRESS_NANOS]; }
+
+    /**
+     * @return the number of received messages dropped as duplicates.
+     * @see Queue#setDuplicateWindow(int)
+     */
+    public long getDuplicatesDropped()       { return _values[DUPLICATES_DROPPED]; }
+
+    /**
+     * <p>Gets the number of times a stale queue handle was reopened,
+     * as after a restart of the queue manager. The operation that
+     * found the handle stale is retried once on the new handle.</p>
+     *
+     * @return the number of reconnects.
+     */
+    public long getReconnects()              { return _values[RECONNECTS]; }
+
+    /**
+     * @return the time spent computing and checking body checksums, in
+     *         nanoseconds.
+     * @see Queue#setChecksum(boolean)
+     */
+    public long getChecksumNanos()           { return _values[CHECKSUM_NANOS]; }
+
+    /**
+     * @return the number of received messages whose body did not match
+     *         its checksum.
+     */
+    public long getChecksumFailures()        { return _values[CHECKSUM_FAILURES]; }
+
+    /**
+     * @return the number of messages discarded unread because they were
+     *         older than the maximum age.
+     * @see Queue#setMaxAge(int)
+     */
+    public long getMessagesExpired()         { return _values[MESSAGES_EXPIRED]; }
+
+    /**
+     * @return the number of heartbeats sent.
+     * @see Queue#setHeartbeat(int)
+     */
+    public long getHeartbeatsSent()          { return _values[HEARTBEATS_SENT]; }
+
+    /**
+     * @return the number of heartbeats received and dropped.
+     */
+    public long getHeartbeatsReceived()      { return _values[HEARTBEATS_RECEIVED]; }
+
+    /**
+     * @return the number of received messages that carried a latency
+     *         probe, heartbeats included.
+     * @see Queue#setLatencyProbe(boolean, int)
+     */
+    public long getProbesReceived()          { return _values[PROBES_RECEIVED]; }
+
+    /**
+     * @return the mean transit time of the probes received, in
+     *         microseconds, or 0 if there were none.
+     */
+    public double getMeanTransitMicros()
+    {
+        long n= _values[PROBES_RECEIVED];
+        return (n == 0) ? 0.0 : (double)_values[TRANSIT_MICROS] / n;
+    }
+
+    /**
+     * <p>Gets a percentile of the transit times of the probes received,
+     * from send to receive. Times are counted in buckets of 8 per power
+     * of two, so the result is within about 12% below the true
+     * value.</p>
+     *
+     * @param fraction  the fraction of probes, such as 0.99 for the
+     *                  99th percentile.
+     * @return the transit time in microseconds, or 0 if there were no
+     *         probes.
+     */
+    public long getTransitPercentile(double fraction)
+    {
+        long total= _values[PROBES_RECEIVED];
+        if (total == 0) return 0;
+        long target= (long)Math.ceil(total * fraction);
+        long seen= 0;
+        for (int b=0; b < TRANSIT_BUCKETS; b++) {
+            long count= _values[TRANSIT_HISTOGRAM + b];
+            seen += count;
+            if (seen >= target && count > 0)
+                return _bucketFloor(b);
+        }
+        return 0;
+    }
+
+
+    // the smallest time in bucket b; the inverse of TransitBucket() in
+    // MsmqQueue.cpp
+    private static long _bucketFloor(int b)
+    {
+        if (b < 16) return b;
+        int e= b / 8 - 1;
+        return (long)(b - 8 * e) << e;
+    }
+
+
+    public String toString()
+    {
+        return "sent=" + getMessagesSent() + " (" + getBytesSent() + " bytes)"
+            + ", received=" + getMessagesReceived() + " (" + getBytesReceived() + " bytes)"
+            + ", compressed=" + getMessagesCompressed()
+            + " (ratio " + getCompressionRatio() + ", " + getCompressNanos() + " ns)"
+            + ", decompressed=" + getMessagesDecompressed()
+            + " (" + getDecompressNanos() + " ns)"
+            + ", duplicates=" + getDuplicatesDropped()
+            + ", reconnects=" + getReconnects()
+            + ", checksum failures=" + getChecksumFailures()
+            + " (" + getChecksumNanos() + " ns)"
+            + ", expired=" + getMessagesExpired()
+            + ", heartbeats=" + getHeartbeatsSent() + "/" + getHeartbeatsReceived()
+            + ", probes=" + getProbesReceived()
+            + " (p50 " + getTransitPercentile(0.50) + " us, p99 " + getTransitPercentile(0.99) + " us)";
+    }
+}
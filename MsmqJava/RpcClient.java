@@ -0,0 +1,359 @@
+//
+// RpcClient.java
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module implements request/reply over a pair of queues, with
+// one thread reading the replies for all callers.
+//
+// ------------------------------------------------------------------
+
+package ionic.Msmq;
+
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.ConcurrentLinkedQueue;
+import java.util.concurrent.ExecutionException;
+import java.util.concurrent.Future;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.TimeoutException;
+import java.util.concurrent.atomic.AtomicInteger;
+
+
+/**
+ * <p>An RpcClient sends requests to one queue, and matches the replies
+ * that come back on another to the calls that are waiting for
+ * them.</p>
+ *
+ * <blockquote class='code'><pre>
+ *   RpcClient rpc= new RpcClient(requests, replies, 5000);
+ *   Future&lt;Message&gt; f= rpc.call(new Message("quote IBM", "quote", ""));
+ *   Message reply= f.get();
+ *   ...
+ *   rpc.close();
+ * </pre></blockquote>
+ *
+ * <p>Each request is stamped with a correlation ID unique to the call,
+ * and the server must copy it to the correlation ID of the reply.
+ * A single reader thread receives the replies, and completes the
+ * call with the same ID, so callers do not each block on the reply
+ * queue and take one another's replies. The body of a reply stays in
+ * native memory until it is read.</p>
+ *
+ * <p>A call that has no reply within the timeout fails with
+ * MQ_ERROR_IO_TIMEOUT. Replies that match no waiting call, because it
+ * timed out or was cancelled, or was made by another client, are
+ * dropped, and counted by {@link #getStrayReplies()}.</p>
+ *
+ * <p>The reply queue must be open for RECEIVE access, and should be
+ * read by this client alone. An RpcClient is safe to use from many
+ * threads. Closing it does not close the queues.</p>
+ *
+ */
+public class RpcClient
+{
+    /**
+     * The timeout of a call, if none is given.
+     */
+    public static final int DEFAULT_TIMEOUT = 30000;
+
+
+    /**
+     * Create a client, with the default timeout.
+     *
+     * @param requestQueue  where requests are sent; open for SEND access.
+     * @param replyQueue    where replies arrive; open for RECEIVE access.
+     **/
+    public RpcClient(Queue requestQueue, Queue replyQueue)
+    {
+        this(requestQueue, replyQueue, DEFAULT_TIMEOUT);
+    }
+
+
+    /**
+     * Create a client, and start its reader thread.
+     *
+     * @param requestQueue   where requests are sent; open for SEND access.
+     * @param replyQueue     where replies arrive; open for RECEIVE access.
+     * @param timeoutMillis  how long each call waits for its reply.
+     **/
+    public RpcClient(Queue requestQueue, Queue replyQueue, int timeoutMillis)
+    {
+        if (timeoutMillis <= 0)
+            throw new IllegalArgumentException("timeoutMillis must be positive");
+        _requestQueue= requestQueue;
+        _replyQueue= replyQueue;
+        _timeout= timeoutMillis;
+
+        // 16 bytes that tell this client's IDs from any other's, then
+        // the call number
+        java.util.UUID uuid= java.util.UUID.randomUUID();
+        _prefix= java.nio.ByteBuffer.allocate(PREFIX_SIZE)
+            .putLong(uuid.getMostSignificantBits())
+            .putLong(uuid.getLeastSignificantBits())
+            .array();
+
+        _reader= new Thread("MsmqJava rpc reader") {
+                public void run() { _read(); }
+            };
+        _reader.setDaemon(true);
+        _reader.start();
+    }
+
+
+    /**
+     * <p>Send a request, and return the reply to come.</p>
+     *
+     * <p>The correlation ID of the request is set to the ID of the call;
+     * the rest of the request is sent as it is, outside of any
+     * transaction.</p>
+     *
+     * @param request  the request to send.
+     * @return the reply, when it arrives.
+     **/
+    public Future<Message> call(Message request)
+        throws  MessageQueueException
+    {
+        if (_closed)
+            throw new MessageQueueException("RPC client is closed.", 0xC00E0007); // MQ_ERROR_INVALID_HANDLE
+
+        int id= _nextId.incrementAndGet();
+        Call c= new Call(id, System.currentTimeMillis() + _timeout);
+        _calls.put(id, c);
+        _byDeadline.add(c);
+
+        // a close() since the check above may have stopped the reader
+        // before it could see this call, and then nothing would
+        // complete it
+        if (_closed) {
+            MessageQueueException ex1= new MessageQueueException("RPC client is closed.", MQ_ERROR_OPERATION_CANCELLED);
+            if (_calls.remove(id) != null)
+                c._complete(null, ex1, false);
+            throw ex1;
+        }
+
+        byte[] correlationId= new byte[ID_SIZE];
+        System.arraycopy(_prefix, 0, correlationId, 0, PREFIX_SIZE);
+        correlationId[PREFIX_SIZE]=     (byte)(id >>> 24);
+        correlationId[PREFIX_SIZE + 1]= (byte)(id >>> 16);
+        correlationId[PREFIX_SIZE + 2]= (byte)(id >>> 8);
+        correlationId[PREFIX_SIZE + 3]= (byte)id;
+        request.setCorrelationId(correlationId);
+
+        try {
+            _requestQueue.send(request);
+        }
+        catch (MessageQueueException ex1) {
+            _calls.remove(id);
+            throw ex1;
+        }
+        return c;
+    }
+
+
+    /**
+     * @return the number of calls waiting for a reply.
+     */
+    public int getPending()                  { return _calls.size(); }
+
+
+    /**
+     * @return the number of replies dropped because no call was waiting
+     *         for them.
+     */
+    public long getStrayReplies()            { return _strays.get(); }
+
+
+    /**
+     * <p>Stop the reader thread. Calls still waiting fail with
+     * MQ_ERROR_OPERATION_CANCELLED.</p>
+     *
+     **/
+    public void close()
+    {
+        if (_closed) return;
+        _closed= true;
+        try { _reader.join(); }
+        catch (InterruptedException ex1) { Thread.currentThread().interrupt(); }
+    }
+
+
+
+    // The reader thread: it alone receives from the reply queue, and
+    // it completes calls as their replies arrive or their time runs
+    // out.  It polls, so that it sees close() and the deadlines.
+    private void _read()
+    {
+        MessageQueueException failure= null;
+        while (!_closed && failure == null) {
+            try {
+                Message reply= _replyQueue.tryReceive(POLL_INTERVAL);
+                if (reply != null)
+                    _dispatch(reply);
+            }
+            catch (MessageQueueException ex1) {
+                failure= ex1;
+            }
+            _expire(System.currentTimeMillis());
+        }
+
+        if (failure == null)
+            failure= new MessageQueueException("RPC client is closed.", MQ_ERROR_OPERATION_CANCELLED);
+        for (Integer id : _calls.keySet()) {
+            Call c= _calls.remove(id);
+            if (c != null) c._complete(null, failure, false);
+        }
+        _byDeadline.clear();
+    }
+
+
+    private void _dispatch(Message reply)
+    {
+        byte[] correlationId= reply.getCorrelationId();
+        Call c= null;
+        if (correlationId != null && correlationId.length >= ID_SIZE && _isOurs(correlationId)) {
+            int id= ((correlationId[PREFIX_SIZE] & 0xFF) << 24)
+                | ((correlationId[PREFIX_SIZE + 1] & 0xFF) << 16)
+                | ((correlationId[PREFIX_SIZE + 2] & 0xFF) << 8)
+                | (correlationId[PREFIX_SIZE + 3] & 0xFF);
+            c= _calls.remove(id);
+        }
+
+        if (c == null) {
+            _strays.incrementAndGet();
+            reply.release();
+            return;
+        }
+        c._complete(reply, null, false);
+    }
+
+
+    private boolean _isOurs(byte[] correlationId)
+    {
+        for (int i=0; i < PREFIX_SIZE; i++)
+            if (correlationId[i] != _prefix[i]) return false;
+        return true;
+    }
+
+
+    // Calls share one timeout, so they expire in the order they were
+    // made, and only the head of the queue needs looking at.
+    private void _expire(long now)
+    {
+        for (;;) {
+            Call c= _byDeadline.peek();
+            if (c == null || (!c.isDone() && c._deadline > now))
+                return;
+            _byDeadline.poll();
+            if (_calls.remove(c._id) != null)
+                c._complete(null, new MessageQueueException("No reply.", Queue.MQ_ERROR_IO_TIMEOUT), false);
+        }
+    }
+
+
+
+    /**
+     * The reply to one call.
+     */
+    private final class Call implements Future<Message>
+    {
+        final int _id;
+        final long _deadline;
+        private boolean _done;
+        private boolean _cancelled;
+        private Message _reply;
+        private MessageQueueException _failure;
+
+        Call(int id, long deadline)
+        {
+            _id= id;
+            _deadline= deadline;
+        }
+
+        synchronized void _complete(Message reply, MessageQueueException failure, boolean cancelled)
+        {
+            _reply= reply;
+            _failure= failure;
+            _cancelled= cancelled;
+            _done= true;
+            notifyAll();
+        }
+
+        public boolean cancel(boolean mayInterruptIfRunning)
+        {
+            // whoever takes the call out of the table completes it
+            if (_calls.remove(_id) == null)
+                return false;
+            _complete(null, null, true);
+            return true;
+        }
+
+        public synchronized boolean isCancelled() { return _cancelled; }
+
+        public synchronized boolean isDone()      { return _done; }
+
+        public synchronized Message get()
+            throws InterruptedException, ExecutionException
+        {
+            while (!_done)
+                wait();
+            return _result();
+        }
+
+        public synchronized Message get(long timeout, TimeUnit unit)
+            throws InterruptedException, ExecutionException, TimeoutException
+        {
+            long end= System.nanoTime() + unit.toNanos(timeout);
+            while (!_done) {
+                long left= end - System.nanoTime();
+                if (left <= 0)
+                    throw new TimeoutException();
+                TimeUnit.NANOSECONDS.timedWait(this, left);
+            }
+            return _result();
+        }
+
+        // caller holds the lock, and _done is set
+        private Message _result()
+            throws ExecutionException
+        {
+            if (_cancelled)
+                throw new java.util.concurrent.CancellationException();
+            if (_failure != null)
+                throw new ExecutionException(_failure);
+            return _reply;
+        }
+    }
+
+
+
+    // --------------------------------------------
+    // private members
+    private static final int ID_SIZE = 20;      // PROPID_M_CORRELATIONID_SIZE
+    private static final int PREFIX_SIZE = 16;
+    private static final int POLL_INTERVAL = 100;   // ms
+    private static final int MQ_ERROR_OPERATION_CANCELLED = 0xC00E0008;
+
+    private Queue _requestQueue;
+    private Queue _replyQueue;
+    private int _timeout;
+    private byte[] _prefix;
+    private AtomicInteger _nextId = new AtomicInteger();
+    private ConcurrentHashMap<Integer, Call> _calls = new ConcurrentHashMap<Integer, Call>();
+    private ConcurrentLinkedQueue<Call> _byDeadline = new ConcurrentLinkedQueue<Call>();
+    private java.util.concurrent.atomic.AtomicLong _strays = new java.util.concurrent.atomic.AtomicLong();
+    private Thread _reader;
+    private volatile boolean _closed = false;
+}
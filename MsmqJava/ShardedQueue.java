@@ -0,0 +1,279 @@
+//
+// ShardedQueue.java
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module spreads one logical queue over several MSMQ queues.
+//
+// ------------------------------------------------------------------
+
+package ionic.Msmq;
+
+import java.util.concurrent.atomic.AtomicInteger;
+import java.util.concurrent.atomic.AtomicLongArray;
+
+
+/**
+ * <p>A ShardedQueue is one logical queue made of several MSMQ queues,
+ * the shards, which can be on different machines. A single queue is
+ * limited by one queue manager and one disk; shards add to both.</p>
+ *
+ * <blockquote class='code'><pre>
+ *   Queue[] shards= new Queue[4];
+ *   for (int i=0; i &lt; shards.length; i++)
+ *       shards[i]= new Queue(".\\private$\\orders_" + i);
+ *   ShardedQueue orders= new ShardedQueue(shards);
+ *
+ *   orders.send(msg, customerId);        // in order, per customer
+ *   Message m= orders.tryReceive(1000);  // from any shard
+ * </pre></blockquote>
+ *
+ * <p>A message sent with a key goes to the shard chosen by the key's
+ * hashCode(), so messages with the same key stay in the order they
+ * were sent, as long as the set of shards does not change. A message
+ * sent without a key goes to the next shard in turn.</p>
+ *
+ * <p>Each receiving thread has a home shard, assigned in turn as
+ * threads first receive. It takes from its home shard while there is
+ * work there, and when the home shard is empty takes from the others,
+ * so a consumer is never idle while any shard has messages. Messages
+ * with the same key may be received by different threads, so a
+ * consumer that needs them in order must keep the order itself.</p>
+ *
+ * <p>The shards must be open for the access the caller needs. A
+ * ShardedQueue does not own them: closing the shards is up to the
+ * caller.</p>
+ *
+ */
+public class ShardedQueue
+{
+    /**
+     * Create a logical queue over the given shards.
+     *
+     * @param shards  the queues, at least one. The order matters: the
+     *                shard of a key is its index in this array.
+     **/
+    public ShardedQueue(Queue[] shards)
+    {
+        if (shards == null || shards.length == 0)
+            throw new IllegalArgumentException("at least one shard is required");
+        _shards= shards.clone();
+        _sent= new AtomicLongArray(_shards.length);
+        _received= new AtomicLongArray(_shards.length);
+        _stolen= new AtomicLongArray(_shards.length);
+    }
+
+
+    /**
+     * @return the number of shards.
+     */
+    public int getShardCount()               { return _shards.length; }
+
+
+    /**
+     * @return the shard at the given index.
+     */
+    public Queue getShard(int shard)         { return _shards[shard]; }
+
+
+    /**
+     * @return the index of the shard that messages with this key go to.
+     */
+    public int shardOf(Object key)
+    {
+        // spread the bits, as HashMap does, so that keys with
+        // sequential hash codes do not all land on a few shards
+        int h= key.hashCode();
+        h ^= (h >>> 20) ^ (h >>> 12);
+        h ^= (h >>> 7) ^ (h >>> 4);
+        return (h & 0x7FFFFFFF) % _shards.length;
+    }
+
+
+    /**
+     * Send a message to the next shard in turn.
+     *
+     **/
+    public void send(Message msg)
+        throws  MessageQueueException
+    {
+        int shard= (_next.getAndIncrement() & 0x7FFFFFFF) % _shards.length;
+        _shards[shard].send(msg);
+        _sent.incrementAndGet(shard);
+    }
+
+
+    /**
+     * Send a message to the shard of its key.
+     *
+     * @param msg  the message.
+     * @param key  the key, such as a customer or session ID.
+     **/
+    public void send(Message msg, Object key)
+        throws  MessageQueueException
+    {
+        int shard= shardOf(key);
+        _shards[shard].send(msg);
+        _sent.incrementAndGet(shard);
+    }
+
+
+    /**
+     * Send a message to the shard of its key, within the given
+     * transaction.
+     *
+     **/
+    public void send(Message msg, Object key, Transaction tx)
+        throws  MessageQueueException
+    {
+        int shard= shardOf(key);
+        _shards[shard].send(msg, tx);
+        _sent.incrementAndGet(shard);
+    }
+
+
+    /**
+     * <p>Receive one message from any shard, with the given timeout,
+     * returning null if the timeout expires.</p>
+     *
+     * <p>The calling thread's home shard is tried first. If every shard
+     * is empty, the thread waits on its home shard, looking at the
+     * others again every few milliseconds.</p>
+     *
+     * @param timeout  the timeout in milliseconds.
+     * @return the message, or null if none arrived within the timeout.
+     **/
+    public Message tryReceive(int timeout)
+        throws  MessageQueueException
+    {
+        int home= _home();
+        long end= System.currentTimeMillis() + timeout;
+        for (;;) {
+            for (int i=0; i < _shards.length; i++) {
+                int shard= (home + i) % _shards.length;
+                Message msg= _shards[shard].tryReceive(0);
+                if (msg != null) {
+                    _received.incrementAndGet(shard);
+                    if (shard != home)
+                        _stolen.incrementAndGet(shard);
+                    return msg;
+                }
+            }
+
+            long left= end - System.currentTimeMillis();
+            if (left <= 0)
+                return null;
+            Message msg= _shards[home].tryReceive((int)Math.min(left, STEAL_INTERVAL));
+            if (msg != null) {
+                _received.incrementAndGet(home);
+                return msg;
+            }
+        }
+    }
+
+
+    /**
+     * Receive one message from any shard, with the given timeout.
+     *
+     * @throws MessageQueueException  with MQ_ERROR_IO_TIMEOUT if no
+     *         message arrived within the timeout.
+     **/
+    public Message receive(int timeout)
+        throws  MessageQueueException
+    {
+        Message msg= tryReceive(timeout);
+        if (msg == null)
+            throw new MessageQueueException("Cannot receive.", Queue.MQ_ERROR_IO_TIMEOUT);
+        return msg;
+    }
+
+
+    /**
+     * @return the number of messages sent to the shard through this
+     *         object.
+     */
+    public long getMessagesSent(int shard)   { return _sent.get(shard); }
+
+
+    /**
+     * @return the number of messages received from the shard through
+     *         this object.
+     */
+    public long getMessagesReceived(int shard) { return _received.get(shard); }
+
+
+    /**
+     * <p>Gets the number of messages received from the shard by threads
+     * whose home is another shard. A high count means the load on the
+     * shards is uneven, for instance because a few keys carry most of
+     * the messages.</p>
+     *
+     * @return the number of messages taken from the shard by other
+     *         shards' threads.
+     */
+    public long getMessagesStolen(int shard) { return _stolen.get(shard); }
+
+
+    /**
+     * Gets the native statistics of one shard.
+     *
+     * @see Queue#getStatistics()
+     **/
+    public QueueStatistics getStatistics(int shard)
+        throws  MessageQueueException
+    {
+        return _shards[shard].getStatistics();
+    }
+
+
+    public String toString()
+    {
+        StringBuilder sb= new StringBuilder();
+        for (int i=0; i < _shards.length; i++) {
+            if (i > 0) sb.append("; ");
+            sb.append("shard ").append(i)
+                .append(": sent=").append(_sent.get(i))
+                .append(", received=").append(_received.get(i))
+                .append(", stolen=").append(_stolen.get(i));
+        }
+        return sb.toString();
+    }
+
+
+    private int _home()
+    {
+        Integer home= _homes.get();
+        if (home == null) {
+            home= Integer.valueOf((_nextHome.getAndIncrement() & 0x7FFFFFFF) % _shards.length);
+            _homes.set(home);
+        }
+        return home.intValue();
+    }
+
+
+
+    // --------------------------------------------
+    // private members
+    private static final int STEAL_INTERVAL = 20;   // ms
+
+    private Queue[] _shards;
+    private AtomicInteger _next = new AtomicInteger();
+    private AtomicInteger _nextHome = new AtomicInteger();
+    private ThreadLocal<Integer> _homes = new ThreadLocal<Integer>();
+    private AtomicLongArray _sent;
+    private AtomicLongArray _received;
+    private AtomicLongArray _stolen;
+}
@@ -0,0 +1,155 @@
+//
+// Transaction.java
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module represents an MSMQ internal transaction.
+//
+// ------------------------------------------------------------------
+
+package ionic.Msmq;
+
+
+/**
+ * <p>The Transaction class models an MSMQ internal transaction, which
+ * can span any number of send and receive operations on transactional
+ * queues.</p>
+ *
+ * <p>Unlike {@link TransactionType#SINGLE_MESSAGE}, which commits each
+ * message on its own, the messages sent within a Transaction become
+ * visible to receivers only when the transaction commits, and the
+ * messages received within it go back to their queue if it aborts.</p>
+ *
+ * <blockquote class='code'><pre>
+ *   Transaction tx= Transaction.begin();
+ *   try {
+ *       queue.send(msg1, tx);
+ *       queue.send(msg2, tx);
+ *       tx.commit();
+ *   }
+ *   finally {
+ *       tx.close();
+ *   }
+ * </pre></blockquote>
+ *
+ * <p>A transaction that is neither committed nor aborted is aborted
+ * by {@link #close()}, or else when it is garbage collected.</p>
+ *
+ */
+public class Transaction implements AutoCloseable
+{
+    /**
+     * Begin a new MSMQ internal transaction.
+     *
+     * @return the new transaction.
+     */
+    public static Transaction begin()
+        throws  MessageQueueException
+    {
+        Transaction tx= new Transaction();
+        int rc= tx.nativeBegin();
+        if (rc!=0)
+            throw new MessageQueueException("Cannot begin transaction.", rc);
+        tx._cleaner= MessageCleaner.register(tx, tx._handle);
+        return tx;
+    }
+
+
+    /**
+     * Commit the transaction.
+     *
+     **/
+    public void commit()
+        throws  MessageQueueException
+    {
+        int rc= nativeCommit(_take());
+        if (rc!=0)
+            throw new MessageQueueException("Cannot commit transaction.", rc);
+    }
+
+
+    /**
+     * Abort the transaction.
+     *
+     **/
+    public void abort()
+        throws  MessageQueueException
+    {
+        int rc= nativeAbort(_take());
+        if (rc!=0)
+            throw new MessageQueueException("Cannot abort transaction.", rc);
+    }
+
+
+    /**
+     * Abort the transaction, if it is still active. It is safe to call
+     * this method after {@link #commit()} or {@link #abort()}, and more
+     * than once.
+     *
+     **/
+    public synchronized void close()
+        throws  MessageQueueException
+    {
+        if (_handle != 0)
+            abort();
+    }
+
+
+    /**
+     * Gets whether the transaction has been begun and not yet committed
+     * or aborted.
+     *
+     * @return true if the transaction is still active.
+     */
+    public synchronized boolean isActive() { return _handle != 0; }
+
+
+    private Transaction() { }
+
+
+    // Ends the transaction's ownership of the native handle, so that of
+    // two threads committing or aborting at once, only one gets it; the
+    // other gets 0, which the natives reject.  Queue holds the same lock
+    // around each native call that uses the handle.
+    private synchronized long _take()
+    {
+        long handle= _handle;
+        _handle= 0;
+        if (_cleaner != null)
+            _cleaner.take();
+        _cleaner= null;
+        return handle;
+    }
+
+
+    // --------------------------------------------
+    // native methods
+    private native int nativeBegin();
+    private static native int nativeCommit(long handle);
+    static native int nativeAbort(long handle);
+
+
+    // --------------------------------------------
+    // private members
+    long _handle = 0;  // the native ITransaction pointer
+    private MessageCleaner _cleaner ;  // aborts the transaction if it is never ended
+
+    // --------------------------------------------
+    // static initializer
+    static {
+        System.loadLibrary("MsmqJava");
+    }
+}
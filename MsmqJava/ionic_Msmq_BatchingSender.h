@@ -0,0 +1,45 @@
+/* DO NOT EDIT THIS FILE - it is machine generated */
+#include <jni.h>
+/* Header for class ionic_Msmq_BatchingSender */
+
+#ifndef _Included_ionic_Msmq_BatchingSender
+#define _Included_ionic_Msmq_BatchingSender
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*
+ * Class:     ionic_Msmq_BatchingSender
+ * Method:    nativeOpen
+ * Signature: (Lionic/Msmq/Queue;IILjava/lang/String;Z)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_BatchingSender_nativeOpen
+  (JNIEnv *, jclass, jobject, jint, jint, jstring, jboolean);
+
+/*
+ * Class:     ionic_Msmq_BatchingSender
+ * Method:    nativeAdd
+ * Signature: (Lionic/Msmq/Queue;[BII)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_BatchingSender_nativeAdd
+  (JNIEnv *, jclass, jobject, jbyteArray, jint, jint);
+
+/*
+ * Class:     ionic_Msmq_BatchingSender
+ * Method:    nativeFlush
+ * Signature: (Lionic/Msmq/Queue;)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_BatchingSender_nativeFlush
+  (JNIEnv *, jclass, jobject);
+
+/*
+ * Class:     ionic_Msmq_BatchingSender
+ * Method:    nativeClose
+ * Signature: (Lionic/Msmq/Queue;)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_BatchingSender_nativeClose
+  (JNIEnv *, jclass, jobject);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
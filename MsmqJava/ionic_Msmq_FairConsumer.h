@@ -0,0 +1,69 @@
+/* DO NOT EDIT THIS FILE - it is machine generated */
+#include <jni.h>
+/* Header for class ionic_Msmq_FairConsumer */
+
+#ifndef _Included_ionic_Msmq_FairConsumer
+#define _Included_ionic_Msmq_FairConsumer
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*
+ * Class:     ionic_Msmq_FairConsumer
+ * Method:    nativeCreate
+ * Signature: ()I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_FairConsumer_nativeCreate
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     ionic_Msmq_FairConsumer
+ * Method:    nativeAdd
+ * Signature: (JLionic/Msmq/Queue;I)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_FairConsumer_nativeAdd
+  (JNIEnv *, jclass, jlong, jobject, jint);
+
+/*
+ * Class:     ionic_Msmq_FairConsumer
+ * Method:    nativeRemove
+ * Signature: (JLionic/Msmq/Queue;I)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_FairConsumer_nativeRemove
+  (JNIEnv *, jclass, jlong, jobject, jint);
+
+/*
+ * Class:     ionic_Msmq_FairConsumer
+ * Method:    nativeNext
+ * Signature: (JI)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_FairConsumer_nativeNext
+  (JNIEnv *, jclass, jlong, jint);
+
+/*
+ * Class:     ionic_Msmq_FairConsumer
+ * Method:    nativeDrained
+ * Signature: (JI)V
+ */
+JNIEXPORT void JNICALL Java_ionic_Msmq_FairConsumer_nativeDrained
+  (JNIEnv *, jclass, jlong, jint);
+
+/*
+ * Class:     ionic_Msmq_FairConsumer
+ * Method:    nativeClose
+ * Signature: (JI)V
+ */
+JNIEXPORT void JNICALL Java_ionic_Msmq_FairConsumer_nativeClose
+  (JNIEnv *, jclass, jlong, jint);
+
+/*
+ * Class:     ionic_Msmq_FairConsumer
+ * Method:    nativeDestroy
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL Java_ionic_Msmq_FairConsumer_nativeDestroy
+  (JNIEnv *, jclass, jlong);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,69 @@
+/* DO NOT EDIT THIS FILE - it is machine generated */
+#include <jni.h>
+/* Header for class ionic_Msmq_Message */
+
+#ifndef _Included_ionic_Msmq_Message
+#define _Included_ionic_Msmq_Message
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*
+ * Class:     ionic_Msmq_Message
+ * Method:    nativeGetBody
+ * Signature: (J)[B
+ */
+JNIEXPORT jbyteArray JNICALL Java_ionic_Msmq_Message_nativeGetBody
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     ionic_Msmq_Message
+ * Method:    nativeGetLabel
+ * Signature: (J)Ljava/lang/String;
+ */
+JNIEXPORT jstring JNICALL Java_ionic_Msmq_Message_nativeGetLabel
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     ionic_Msmq_Message
+ * Method:    nativeGetCorrelationId
+ * Signature: (J)[B
+ */
+JNIEXPORT jbyteArray JNICALL Java_ionic_Msmq_Message_nativeGetCorrelationId
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     ionic_Msmq_Message
+ * Method:    nativeGetMessageId
+ * Signature: (J)[B
+ */
+JNIEXPORT jbyteArray JNICALL Java_ionic_Msmq_Message_nativeGetMessageId
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     ionic_Msmq_Message
+ * Method:    nativeGetPriority
+ * Signature: (J)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Message_nativeGetPriority
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     ionic_Msmq_Message
+ * Method:    nativeGetRecordCount
+ * Signature: (J)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Message_nativeGetRecordCount
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     ionic_Msmq_Message
+ * Method:    nativeReleaseBuffer
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL Java_ionic_Msmq_Message_nativeReleaseBuffer
+  (JNIEnv *, jclass, jlong);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,65 @@
+/* DO NOT EDIT THIS FILE - it is machine generated */
+#include <jni.h>
+/* Header for class ionic_Msmq_NativeLog */
+
+#ifndef _Included_ionic_Msmq_NativeLog
+#define _Included_ionic_Msmq_NativeLog
+#ifdef __cplusplus
+extern "C" {
+#endif
+#undef ionic_Msmq_NativeLog_OFF
+#define ionic_Msmq_NativeLog_OFF 0L
+#undef ionic_Msmq_NativeLog_ERROR
+#define ionic_Msmq_NativeLog_ERROR 1L
+#undef ionic_Msmq_NativeLog_WARN
+#define ionic_Msmq_NativeLog_WARN 2L
+#undef ionic_Msmq_NativeLog_INFO
+#define ionic_Msmq_NativeLog_INFO 3L
+#undef ionic_Msmq_NativeLog_DEBUG
+#define ionic_Msmq_NativeLog_DEBUG 4L
+#undef ionic_Msmq_NativeLog_TRACE
+#define ionic_Msmq_NativeLog_TRACE 5L
+/*
+ * Class:     ionic_Msmq_NativeLog
+ * Method:    nativeSetLevel
+ * Signature: (I)V
+ */
+JNIEXPORT void JNICALL Java_ionic_Msmq_NativeLog_nativeSetLevel
+  (JNIEnv *, jclass, jint);
+
+/*
+ * Class:     ionic_Msmq_NativeLog
+ * Method:    nativeGetLevel
+ * Signature: ()I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_NativeLog_nativeGetLevel
+  (JNIEnv *, jclass);
+
+/*
+ * Class:     ionic_Msmq_NativeLog
+ * Method:    nativeGetDropped
+ * Signature: ()J
+ */
+JNIEXPORT jlong JNICALL Java_ionic_Msmq_NativeLog_nativeGetDropped
+  (JNIEnv *, jclass);
+
+/*
+ * Class:     ionic_Msmq_NativeLog
+ * Method:    nativeSetBridged
+ * Signature: (Z)V
+ */
+JNIEXPORT void JNICALL Java_ionic_Msmq_NativeLog_nativeSetBridged
+  (JNIEnv *, jclass, jboolean);
+
+/*
+ * Class:     ionic_Msmq_NativeLog
+ * Method:    nativeTake
+ * Signature: ([I)Ljava/lang/String;
+ */
+JNIEXPORT jstring JNICALL Java_ionic_Msmq_NativeLog_nativeTake
+  (JNIEnv *, jclass, jintArray);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
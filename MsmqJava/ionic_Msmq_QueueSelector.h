@@ -0,0 +1,69 @@
+/* DO NOT EDIT THIS FILE - it is machine generated */
+#include <jni.h>
+/* Header for class ionic_Msmq_QueueSelector */
+
+#ifndef _Included_ionic_Msmq_QueueSelector
+#define _Included_ionic_Msmq_QueueSelector
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*
+ * Class:     ionic_Msmq_QueueSelector
+ * Method:    nativeCreate
+ * Signature: ()I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_QueueSelector_nativeCreate
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     ionic_Msmq_QueueSelector
+ * Method:    nativeRegister
+ * Signature: (JLionic/Msmq/Queue;)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_QueueSelector_nativeRegister
+  (JNIEnv *, jclass, jlong, jobject);
+
+/*
+ * Class:     ionic_Msmq_QueueSelector
+ * Method:    nativeUnregister
+ * Signature: (JLionic/Msmq/Queue;)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_QueueSelector_nativeUnregister
+  (JNIEnv *, jclass, jlong, jobject);
+
+/*
+ * Class:     ionic_Msmq_QueueSelector
+ * Method:    nativeSelect
+ * Signature: (JI[I)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_QueueSelector_nativeSelect
+  (JNIEnv *, jclass, jlong, jint, jintArray);
+
+/*
+ * Class:     ionic_Msmq_QueueSelector
+ * Method:    nativeWakeup
+ * Signature: (J)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_QueueSelector_nativeWakeup
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     ionic_Msmq_QueueSelector
+ * Method:    nativeClose
+ * Signature: (JI)V
+ */
+JNIEXPORT void JNICALL Java_ionic_Msmq_QueueSelector_nativeClose
+  (JNIEnv *, jclass, jlong, jint);
+
+/*
+ * Class:     ionic_Msmq_QueueSelector
+ * Method:    nativeDestroy
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL Java_ionic_Msmq_QueueSelector_nativeDestroy
+  (JNIEnv *, jclass, jlong);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,37 @@
+/* DO NOT EDIT THIS FILE - it is machine generated */
+#include <jni.h>
+/* Header for class ionic_Msmq_Transaction */
+
+#ifndef _Included_ionic_Msmq_Transaction
+#define _Included_ionic_Msmq_Transaction
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*
+ * Class:     ionic_Msmq_Transaction
+ * Method:    nativeBegin
+ * Signature: ()I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Transaction_nativeBegin
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     ionic_Msmq_Transaction
+ * Method:    nativeCommit
+ * Signature: (J)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Transaction_nativeCommit
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     ionic_Msmq_Transaction
+ * Method:    nativeAbort
+ * Signature: (J)I
+ */
+JNIEXPORT jint JNICALL Java_ionic_Msmq_Transaction_nativeAbort
+  (JNIEnv *, jclass, jlong);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,851 @@
+//
+// MsmqLoad.cpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module is a console load generator, that drives a queue
+// through MsmqQueue, without a JVM in the loop.
+//
+//   MsmqLoad [options] <format name | LOCAL>
+//
+// It runs producer threads that send at a target rate, and consumer
+// threads that receive, and every second prints the rates and the
+// percentiles of the latency from send to receive.  Each producer and
+// consumer opens a handle of its own.
+//
+// Each body starts with the QueryPerformanceCounter value at send, so
+// latencies are meaningful only when the producers and consumers run
+// on one machine, in this process or in two.
+//
+// The target LOCAL is an in-process queue instead of MSMQ, to measure
+// the overhead of the tool and of MsmqQueue's callers, and to run on
+// a machine without MSMQ.
+//
+// With -crc, bodies are sent with a CRC-32C, and checked on receive,
+// as by Queue.setChecksum(); the time spent on it is reported at the
+// end, with the raw speed of the checksum on this machine.
+//
+// With -shards <n>, the target is n queues, named by the format name
+// with _0, _1, ... appended, used as ShardedQueue uses them: producers
+// send to each shard in turn, or with -shardkey each producer to one
+// shard; each consumer has a home shard, and takes from the others
+// when its home is empty.  The counts per shard are printed at the
+// end.  Running with 1, 2, 4, ... shards at a fixed number of threads
+// shows how throughput scales with the number of queues.
+//
+// ------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <process.h>
+#include <WTypes.h>   // reqd for WinBase.h
+#include <WinBase.h>  // for CriticalSection
+#include <MqOai.h>
+#include <mq.h>
+
+#include "Log.hpp"
+#include "DedupWindow.hpp"
+#include "MsmqQueue.hpp"
+#include "QueueSelector.hpp"
+#include "Crc32c.hpp"
+#include "BufferPool.hpp"
+
+
+#define LOAD_MAX_THREADS        256
+#define LOAD_MIN_BODY           sizeof(LONGLONG)          // the send timestamp
+#define LOAD_MAX_BODY           (4 * 1024 * 1024 - 1024)  // under the MSMQ limit
+#define LOAD_RECEIVE_TIMEOUT    100                       // ms, to notice the stop
+#define LOAD_MAX_SHARDS         64
+#define LOAD_STEAL_INTERVAL     20                        // ms between looks at the other shards
+
+// Latencies are counted in buckets of 32 per power of two, which
+// keeps percentiles within about 3% of the true value.
+#define LATENCY_BUCKETS         1024
+
+enum SizeDistribution
+{
+	SIZE_FIXED = 0,
+	SIZE_UNIFORM,
+	SIZE_EXPONENTIAL
+};
+
+
+struct LoadOptions
+{
+	int             cProducers;
+	int             cConsumers;
+	int             sizeDistribution;
+	DWORD           cbMin;              // fixed size, or uniform range
+	DWORD           cbMax;
+	double          cbMean;             // exponential
+	double          rate;               // messages/s over all producers; 0 for no limit
+	int             seconds;
+	WCHAR           wszLabel[MQ_MAX_MSG_LABEL_LEN];
+	BOOL            fCorrelationId;
+	BOOL            fTransactional;
+	BOOL            fChecksum;
+	BOOL            fLocal;
+	int             cShards;            // 0 for one queue
+	BOOL            fShardByProducer;
+	char            *szFormatName;
+};
+
+static LoadOptions      g_opt;
+static HANDLE           g_hStop;
+static LARGE_INTEGER    g_liFrequency;
+
+static volatile LONGLONG g_cSent;
+static volatile LONGLONG g_cbSent;
+static volatile LONGLONG g_cReceived;
+static volatile LONGLONG g_cErrors;
+static volatile LONGLONG g_llChecksumNanos;
+static volatile LONG     g_latency[LATENCY_BUCKETS];   // since the last report
+
+static char              *g_shardNames[LOAD_MAX_SHARDS];
+static volatile LONGLONG g_cShardSent[LOAD_MAX_SHARDS];
+static volatile LONGLONG g_cShardReceived[LOAD_MAX_SHARDS];
+static volatile LONGLONG g_cShardStolen[LOAD_MAX_SHARDS];
+
+
+
+// ------------------------------------------------------------------
+// targets
+
+class LoadTarget
+{
+public:
+	virtual ~LoadTarget() { }
+
+	virtual HRESULT send(BYTE *pbBody, DWORD cbBody, WCHAR *wszLabel,
+		BYTE *pCorrelationId, DWORD cbCorrelationId) = 0;
+
+	// the body comes from the BufferPool, and is released by the caller
+	virtual HRESULT receive(BYTE **ppbBody, DWORD *pcbBody, WCHAR *wszLabel,
+		BYTE *pCorrelationId, DWORD dwTimeout) = 0;
+};
+
+
+
+class MsmqTarget : public LoadTarget
+{
+private:
+	MsmqQueue       queue;
+	ITransaction    *pTransaction;
+
+public:
+	MsmqTarget(BOOL fTransactional)
+	{
+		pTransaction = fTransactional ? MQ_SINGLE_MESSAGE : MQ_NO_TRANSACTION;
+	}
+
+	~MsmqTarget()
+	{
+		InterlockedExchangeAdd64(&g_llChecksumNanos, queue.getStat(STAT_CHECKSUM_NANOS));
+		queue.closeQueue();
+	}
+
+	HRESULT open(char *szFormatName, int openmode)
+	{
+		HRESULT hr = queue.openQueue(szFormatName, openmode);
+		if (SUCCEEDED(hr))
+			queue.setChecksum(g_opt.fChecksum);
+		return hr;
+	}
+
+	HRESULT send(BYTE *pbBody, DWORD cbBody, WCHAR *wszLabel,
+		BYTE *pCorrelationId, DWORD cbCorrelationId)
+	{
+		return queue.sendBytes(pbBody, cbBody, wszLabel, pCorrelationId, cbCorrelationId,
+			pTransaction, MQ_DEFAULT_PRIORITY, MQJ_NO_TTL, MQJ_NO_TTL, NULL);
+	}
+
+	HRESULT receive(BYTE **ppbBody, DWORD *pcbBody, WCHAR *wszLabel,
+		BYTE *pCorrelationId, DWORD dwTimeout)
+	{
+		return queue.receiveBytes(ppbBody, pcbBody, wszLabel, pCorrelationId,
+			NULL, NULL, NULL, dwTimeout, 1, pTransaction);
+	}
+};
+
+
+
+// The stand-in for MSMQ: an unbounded list, guarded by a critical
+// section, with a semaphore counting the messages in it.
+struct LocalMessage
+{
+	LocalMessage    *next;
+	BYTE            *pbBody;            // from the BufferPool
+	DWORD           cbBody;
+	DWORD           crc;                // with -crc
+	BYTE            correlationId[PROPID_M_CORRELATIONID_SIZE];
+	WCHAR           wszLabel[MQ_MAX_MSG_LABEL_LEN];
+};
+
+
+class LocalTarget : public LoadTarget
+{
+private:
+	static CRITICAL_SECTION cs;
+	static HANDLE           hAvailable;
+	static LocalMessage     *head;
+	static LocalMessage     *tail;
+
+public:
+	static void init(void)
+	{
+		InitializeCriticalSection(&cs);
+		hAvailable = CreateSemaphoreW(NULL, 0, 0x7FFFFFFF, NULL);
+		head = NULL;
+		tail = NULL;
+	}
+
+	HRESULT send(BYTE *pbBody, DWORD cbBody, WCHAR *wszLabel,
+		BYTE *pCorrelationId, DWORD cbCorrelationId)
+	{
+		LocalMessage *m = new LocalMessage;
+		m->next = NULL;
+		m->pbBody = BufferPool::alloc(cbBody);
+		if (m->pbBody == NULL) {
+			delete m;
+			return MQ_ERROR_INSUFFICIENT_RESOURCES;
+		}
+		memcpy(m->pbBody, pbBody, cbBody);
+		m->cbBody = cbBody;
+		m->crc = g_opt.fChecksum ? checksum(pbBody, cbBody) : 0;
+		memset(m->correlationId, 0, sizeof(m->correlationId));
+		if (pCorrelationId != NULL)
+			memcpy(m->correlationId, pCorrelationId, min(cbCorrelationId, PROPID_M_CORRELATIONID_SIZE));
+		wcsncpy_s(m->wszLabel, MQ_MAX_MSG_LABEL_LEN, wszLabel, _TRUNCATE);
+
+		EnterCriticalSection(&cs);
+		if (tail != NULL) tail->next = m;
+		else head = m;
+		tail = m;
+		LeaveCriticalSection(&cs);
+
+		ReleaseSemaphore(hAvailable, 1, NULL);
+		return MQ_OK;
+	}
+
+	// the same work as MsmqQueue does with setChecksum(TRUE)
+	static DWORD checksum(const BYTE *pb, DWORD cb)
+	{
+		LARGE_INTEGER start, end, freq;
+		QueryPerformanceCounter(&start);
+		DWORD crc = Crc32c::compute(0, pb, cb);
+		QueryPerformanceCounter(&end);
+		QueryPerformanceFrequency(&freq);
+		InterlockedExchangeAdd64(&g_llChecksumNanos,
+			(LONGLONG)((double)(end.QuadPart - start.QuadPart) * 1e9 / (double)freq.QuadPart));
+		return crc;
+	}
+
+	HRESULT receive(BYTE **ppbBody, DWORD *pcbBody, WCHAR *wszLabel,
+		BYTE *pCorrelationId, DWORD dwTimeout)
+	{
+		if (WaitForSingleObject(hAvailable, dwTimeout) != WAIT_OBJECT_0)
+			return MQ_ERROR_IO_TIMEOUT;
+
+		EnterCriticalSection(&cs);
+		LocalMessage *m = head;
+		head = m->next;
+		if (head == NULL) tail = NULL;
+		LeaveCriticalSection(&cs);
+
+		*ppbBody = m->pbBody;
+		*pcbBody = m->cbBody;
+		memcpy(pCorrelationId, m->correlationId, PROPID_M_CORRELATIONID_SIZE);
+		wcsncpy_s(wszLabel, MQ_MAX_MSG_LABEL_LEN, m->wszLabel, _TRUNCATE);
+		HRESULT hr = MQ_OK;
+		if (g_opt.fChecksum && checksum(m->pbBody, m->cbBody) != m->crc) {
+			BufferPool::release(m->pbBody);
+			*ppbBody = NULL;
+			hr = MQJ_ERROR_BAD_CHECKSUM;
+		}
+		delete m;
+		return hr;
+	}
+};
+
+CRITICAL_SECTION LocalTarget::cs;
+HANDLE           LocalTarget::hAvailable;
+LocalMessage     *LocalTarget::head;
+LocalMessage     *LocalTarget::tail;
+
+
+
+// One queue per shard.  The producer or consumer index picks the home
+// shard, so the threads spread evenly over the shards.
+class ShardedTarget : public LoadTarget
+{
+private:
+	MsmqTarget      *shards[LOAD_MAX_SHARDS];
+	int             cShards;
+	int             home;
+	int             next;               // round-robin; this thread's own
+
+public:
+	ShardedTarget(int index)
+	{
+		cShards = 0;
+		home = index % g_opt.cShards;
+		next = home;
+	}
+
+	~ShardedTarget()
+	{
+		for (int i = 0; i < cShards; i++)
+			delete shards[i];
+	}
+
+	HRESULT open(int openmode)
+	{
+		for (int i = 0; i < g_opt.cShards; i++) {
+			MsmqTarget *t = new MsmqTarget(g_opt.fTransactional);
+			HRESULT hr = t->open(g_shardNames[i], openmode);
+			if (FAILED(hr)) {
+				delete t;
+				return hr;
+			}
+			shards[cShards++] = t;
+		}
+		return MQ_OK;
+	}
+
+	HRESULT send(BYTE *pbBody, DWORD cbBody, WCHAR *wszLabel,
+		BYTE *pCorrelationId, DWORD cbCorrelationId)
+	{
+		int s = home;
+		if (!g_opt.fShardByProducer) {
+			s = next;
+			next = (next + 1) % cShards;
+		}
+		HRESULT hr = shards[s]->send(pbBody, cbBody, wszLabel, pCorrelationId, cbCorrelationId);
+		if (SUCCEEDED(hr))
+			InterlockedIncrement64(&g_cShardSent[s]);
+		return hr;
+	}
+
+	HRESULT receive(BYTE **ppbBody, DWORD *pcbBody, WCHAR *wszLabel,
+		BYTE *pCorrelationId, DWORD dwTimeout)
+	{
+		DWORD dwStart = GetTickCount();
+		for (;;) {
+			// home first, then the others, without waiting
+			for (int i = 0; i < cShards; i++) {
+				int s = (home + i) % cShards;
+				HRESULT hr = shards[s]->receive(ppbBody, pcbBody, wszLabel, pCorrelationId, 0);
+				if (hr == MQ_ERROR_IO_TIMEOUT)
+					continue;
+				if (SUCCEEDED(hr)) {
+					InterlockedIncrement64(&g_cShardReceived[s]);
+					if (s != home)
+						InterlockedIncrement64(&g_cShardStolen[s]);
+				}
+				return hr;
+			}
+
+			// all empty: wait on home for a while, then look again
+			DWORD dwElapsed = GetTickCount() - dwStart;
+			if (dwElapsed >= dwTimeout)
+				return MQ_ERROR_IO_TIMEOUT;
+			HRESULT hr = shards[home]->receive(ppbBody, pcbBody, wszLabel, pCorrelationId,
+				min(dwTimeout - dwElapsed, (DWORD)LOAD_STEAL_INTERVAL));
+			if (hr == MQ_ERROR_IO_TIMEOUT)
+				continue;
+			if (SUCCEEDED(hr))
+				InterlockedIncrement64(&g_cShardReceived[home]);
+			return hr;
+		}
+	}
+};
+
+
+
+static LoadTarget *OpenTarget(int openmode, int index, HRESULT *pHr)
+{
+	*pHr = MQ_OK;
+	if (g_opt.fLocal)
+		return new LocalTarget();
+
+	if (g_opt.cShards > 0) {
+		ShardedTarget *t = new ShardedTarget(index);
+		*pHr = t->open(openmode);
+		if (FAILED(*pHr)) {
+			delete t;
+			return NULL;
+		}
+		return t;
+	}
+
+	MsmqTarget *t = new MsmqTarget(g_opt.fTransactional);
+	*pHr = t->open(g_opt.szFormatName, openmode);
+	if (FAILED(*pHr)) {
+		delete t;
+		return NULL;
+	}
+	return t;
+}
+
+
+
+// ------------------------------------------------------------------
+// latency histogram
+
+static int LatencyBucket(LONGLONG llMicros)
+{
+	if (llMicros < 0) return 0;
+	if (llMicros < 32) return (int)llMicros;
+	int e = 0;
+	while ((llMicros >> e) >= 64) e++;
+	int b = 32 * e + (int)(llMicros >> e);
+	return (b < LATENCY_BUCKETS) ? b : LATENCY_BUCKETS - 1;
+}
+
+
+
+// the smallest latency that falls in bucket b
+static LONGLONG BucketFloor(int b)
+{
+	if (b < 64) return b;
+	int e = b / 32 - 1;
+	return (LONGLONG)(b - 32 * e) << e;
+}
+
+
+
+// the latency below which the given fraction of the counts fall
+static LONGLONG Percentile(const LONGLONG *counts, LONGLONG total, double fraction)
+{
+	LONGLONG target = (LONGLONG)ceil(total * fraction);
+	LONGLONG seen = 0;
+	for (int b = 0; b < LATENCY_BUCKETS; b++) {
+		seen += counts[b];
+		if (seen >= target && counts[b] > 0)
+			return BucketFloor(b);
+	}
+	return 0;
+}
+
+
+
+static void PrintLatency(const LONGLONG *counts)
+{
+	LONGLONG total = 0;
+	int bMax = 0;
+	for (int b = 0; b < LATENCY_BUCKETS; b++) {
+		total += counts[b];
+		if (counts[b] > 0) bMax = b;
+	}
+	if (total == 0) {
+		printf("  latency -\n");
+		return;
+	}
+	printf("  latency us p50 %I64d  p90 %I64d  p99 %I64d  p99.9 %I64d  max %I64d\n",
+		Percentile(counts, total, 0.50),
+		Percentile(counts, total, 0.90),
+		Percentile(counts, total, 0.99),
+		Percentile(counts, total, 0.999),
+		BucketFloor(bMax));
+}
+
+
+
+static LONGLONG NowTicks()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+}
+
+
+
+static LONGLONG TicksToMicros(LONGLONG ticks)
+{
+	return (ticks / g_liFrequency.QuadPart) * 1000000
+		+ (ticks % g_liFrequency.QuadPart) * 1000000 / g_liFrequency.QuadPart;
+}
+
+
+
+// ------------------------------------------------------------------
+// threads
+
+// xorshift; one state per thread
+static DWORD NextRandom(DWORD *pState)
+{
+	DWORD x = *pState;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *pState = x;
+}
+
+
+
+static DWORD NextSize(DWORD *pState)
+{
+	double cb;
+	switch (g_opt.sizeDistribution) {
+	case SIZE_UNIFORM:
+		cb = g_opt.cbMin + (double)NextRandom(pState) / 4294967296.0 * (g_opt.cbMax - g_opt.cbMin + 1);
+		break;
+	case SIZE_EXPONENTIAL:
+		cb = -g_opt.cbMean * log(((double)NextRandom(pState) + 1.0) / 4294967296.0);
+		break;
+	default:
+		cb = g_opt.cbMin;
+		break;
+	}
+	if (cb < LOAD_MIN_BODY) cb = LOAD_MIN_BODY;
+	if (cb > LOAD_MAX_BODY) cb = LOAD_MAX_BODY;
+	return (DWORD)cb;
+}
+
+
+
+static unsigned __stdcall ProducerMain(void *pv)
+{
+	int iProducer = (int)(INT_PTR)pv;
+	DWORD dwRandom = 2463534242UL + iProducer * 7919;
+
+	HRESULT hr;
+	LoadTarget *target = OpenTarget(MQ_SEND_ACCESS, iProducer, &hr);
+	if (target == NULL) {
+		printf("MsmqLoad: producer %d cannot open %s (hr=0x%08x)\n", iProducer, g_opt.szFormatName, hr);
+		InterlockedIncrement64(&g_cErrors);
+		return 1;
+	}
+
+	DWORD cbBuffer = (g_opt.sizeDistribution == SIZE_FIXED) ? max(g_opt.cbMin, (DWORD)LOAD_MIN_BODY) : LOAD_MAX_BODY;
+	BYTE *pbBody = new BYTE[cbBuffer];
+	for (DWORD i = 0; i < cbBuffer; i++)
+		pbBody[i] = (BYTE)i;
+
+	BYTE correlationId[PROPID_M_CORRELATIONID_SIZE];
+	memset(correlationId, 0, sizeof(correlationId));
+	memcpy(correlationId, &iProducer, sizeof(int));
+
+	// each producer takes an equal share of the rate, on its own schedule
+	LONGLONG llInterval = (g_opt.rate > 0.0)
+		? (LONGLONG)(g_liFrequency.QuadPart * g_opt.cProducers / g_opt.rate) : 0;
+	LONGLONG llNext = NowTicks();
+	LONGLONG llSequence = 0;
+
+	while (WaitForSingleObject(g_hStop, 0) != WAIT_OBJECT_0) {
+		if (llInterval > 0) {
+			LONGLONG llAhead = llNext - NowTicks();
+			if (llAhead > 0) {
+				DWORD dwMillis = (DWORD)(TicksToMicros(llAhead) / 1000);
+				if (dwMillis > 0) {
+					if (WaitForSingleObject(g_hStop, dwMillis) == WAIT_OBJECT_0) break;
+				}
+				continue;
+			}
+			llNext += llInterval;
+		}
+
+		DWORD cbBody = NextSize(&dwRandom);
+		if (g_opt.fCorrelationId) {
+			llSequence++;
+			memcpy(correlationId + sizeof(int), &llSequence, sizeof(LONGLONG));
+		}
+
+		LONGLONG llSent = NowTicks();
+		memcpy(pbBody, &llSent, sizeof(LONGLONG));
+		hr = target->send(pbBody, cbBody, g_opt.wszLabel,
+			g_opt.fCorrelationId ? correlationId : NULL, PROPID_M_CORRELATIONID_SIZE);
+		if (FAILED(hr)) {
+			if (InterlockedIncrement64(&g_cErrors) == 1)
+				printf("MsmqLoad: send failed (hr=0x%08x)\n", hr);
+			continue;
+		}
+		InterlockedIncrement64(&g_cSent);
+		InterlockedExchangeAdd64(&g_cbSent, cbBody);
+	}
+
+	delete[] pbBody;
+	delete target;
+	return 0;
+}
+
+
+
+static unsigned __stdcall ConsumerMain(void *pv)
+{
+	int iConsumer = (int)(INT_PTR)pv;
+
+	HRESULT hr;
+	LoadTarget *target = OpenTarget(MQ_RECEIVE_ACCESS, iConsumer, &hr);
+	if (target == NULL) {
+		printf("MsmqLoad: consumer %d cannot open %s (hr=0x%08x)\n", iConsumer, g_opt.szFormatName, hr);
+		InterlockedIncrement64(&g_cErrors);
+		return 1;
+	}
+
+	WCHAR wszLabel[MQ_MAX_MSG_LABEL_LEN];
+	BYTE  correlationId[PROPID_M_CORRELATIONID_SIZE];
+
+	while (WaitForSingleObject(g_hStop, 0) != WAIT_OBJECT_0) {
+		BYTE  *pbBody = NULL;
+		DWORD cbBody = 0;
+		hr = target->receive(&pbBody, &cbBody, wszLabel, correlationId, LOAD_RECEIVE_TIMEOUT);
+		if (hr == MQ_ERROR_IO_TIMEOUT)
+			continue;
+		if (FAILED(hr)) {
+			if (InterlockedIncrement64(&g_cErrors) == 1)
+				printf("MsmqLoad: receive failed (hr=0x%08x)\n", hr);
+			Sleep(LOAD_RECEIVE_TIMEOUT);
+			continue;
+		}
+
+		LONGLONG llNow = NowTicks();
+		if (pbBody != NULL && cbBody >= sizeof(LONGLONG)) {
+			LONGLONG llSent;
+			memcpy(&llSent, pbBody, sizeof(LONGLONG));
+			InterlockedIncrement(&g_latency[LatencyBucket(TicksToMicros(llNow - llSent))]);
+		}
+		BufferPool::release(pbBody);
+		InterlockedIncrement64(&g_cReceived);
+	}
+
+	delete target;
+	return 0;
+}
+
+
+
+// ------------------------------------------------------------------
+// main
+
+static void Usage()
+{
+	printf("usage: MsmqLoad [options] <format name | LOCAL>\n"
+		"  -producers <n>        sending threads (default 1)\n"
+		"  -consumers <n>        receiving threads (default 1)\n"
+		"  -size <n>             body size in bytes (default 1024)\n"
+		"  -size <min>-<max>     sizes uniform over the range\n"
+		"  -size exp:<mean>      sizes exponential with the mean\n"
+		"  -rate <n>             messages/s over all producers (default no limit)\n"
+		"  -seconds <n>          how long to run (default 10)\n"
+		"  -label <text>         the label of each message (default MsmqLoad)\n"
+		"  -corrid               give each message a correlation ID\n"
+		"  -tx                   send and receive in single-message transactions\n"
+		"  -crc                  send with a CRC-32C of the body, checked on receive\n"
+		"  -shards <n>           spread over n queues, <format name>_0 to _<n-1>\n"
+		"  -shardkey             with -shards, each producer sends to one shard\n");
+}
+
+
+
+// the speed of Crc32c alone, over a buffer that fits in the cache, as
+// compute() runs it and with the tables only
+static void PrintChecksumSpeed()
+{
+	const DWORD cb = 256 * 1024;
+	const int cPasses = 400;
+	BYTE *pb = new BYTE[cb];
+	for (DWORD i = 0; i < cb; i++)
+		pb[i] = (BYTE)(i * 2654435761u >> 24);
+
+	DWORD crc = 0;
+	LONGLONG llStart = NowTicks();
+	for (int i = 0; i < cPasses; i++)
+		crc = Crc32c::compute(crc, pb, cb);
+	double micros = (double)TicksToMicros(NowTicks() - llStart);
+
+	DWORD crcTable = 0;
+	llStart = NowTicks();
+	for (int i = 0; i < cPasses; i++)
+		crcTable = Crc32c::computeTable(crcTable, pb, cb);
+	double microsTable = (double)TicksToMicros(NowTicks() - llStart);
+	delete[] pb;
+
+	printf("MsmqLoad: crc32c %s, %.0f MB/s (0x%08x)\n",
+		Crc32c::isHardware() ? "sse4.2" : "table",
+		(micros <= 0.0) ? 0.0 : (double)cb * cPasses / micros, crc);
+	printf("MsmqLoad: crc32c table, %.0f MB/s (0x%08x)\n",
+		(microsTable <= 0.0) ? 0.0 : (double)cb * cPasses / microsTable, crcTable);
+}
+
+
+
+static BOOL ParseSize(const char *sz)
+{
+	if (_strnicmp(sz, "exp:", 4) == 0) {
+		g_opt.sizeDistribution = SIZE_EXPONENTIAL;
+		g_opt.cbMean = atof(sz + 4);
+		return g_opt.cbMean >= 1.0;
+	}
+
+	const char *szDash = strchr(sz, '-');
+	g_opt.cbMin = (DWORD)strtoul(sz, NULL, 10);
+	if (szDash == NULL) {
+		g_opt.sizeDistribution = SIZE_FIXED;
+		g_opt.cbMax = g_opt.cbMin;
+		return g_opt.cbMin <= LOAD_MAX_BODY;
+	}
+	g_opt.sizeDistribution = SIZE_UNIFORM;
+	g_opt.cbMax = (DWORD)strtoul(szDash + 1, NULL, 10);
+	return g_opt.cbMin <= g_opt.cbMax && g_opt.cbMax <= LOAD_MAX_BODY;
+}
+
+
+
+int main(int argc, char **argv)
+{
+	g_opt.cProducers = 1;
+	g_opt.cConsumers = 1;
+	g_opt.sizeDistribution = SIZE_FIXED;
+	g_opt.cbMin = g_opt.cbMax = 1024;
+	g_opt.cbMean = 0.0;
+	g_opt.rate = 0.0;
+	g_opt.seconds = 10;
+	wcscpy_s(g_opt.wszLabel, MQ_MAX_MSG_LABEL_LEN, L"MsmqLoad");
+	g_opt.fCorrelationId = FALSE;
+	g_opt.fTransactional = FALSE;
+	g_opt.fChecksum = FALSE;
+	g_opt.fLocal = FALSE;
+	g_opt.cShards = 0;
+	g_opt.fShardByProducer = FALSE;
+	g_opt.szFormatName = NULL;
+
+	BOOL fUsage = FALSE;
+	for (int i = 1; i < argc && !fUsage; i++) {
+		BOOL fValue = (i + 1 < argc);
+		if (_stricmp(argv[i], "-producers") == 0 && fValue)
+			g_opt.cProducers = atoi(argv[++i]);
+		else if (_stricmp(argv[i], "-consumers") == 0 && fValue)
+			g_opt.cConsumers = atoi(argv[++i]);
+		else if (_stricmp(argv[i], "-size") == 0 && fValue)
+			fUsage = !ParseSize(argv[++i]);
+		else if (_stricmp(argv[i], "-rate") == 0 && fValue)
+			g_opt.rate = atof(argv[++i]);
+		else if (_stricmp(argv[i], "-seconds") == 0 && fValue)
+			g_opt.seconds = atoi(argv[++i]);
+		else if (_stricmp(argv[i], "-label") == 0 && fValue)
+			fUsage = MultiByteToWideChar(CP_ACP, 0, argv[++i], -1, g_opt.wszLabel, MQ_MAX_MSG_LABEL_LEN) == 0;
+		else if (_stricmp(argv[i], "-corrid") == 0)
+			g_opt.fCorrelationId = TRUE;
+		else if (_stricmp(argv[i], "-tx") == 0)
+			g_opt.fTransactional = TRUE;
+		else if (_stricmp(argv[i], "-crc") == 0)
+			g_opt.fChecksum = TRUE;
+		else if (_stricmp(argv[i], "-shards") == 0 && fValue)
+			g_opt.cShards = atoi(argv[++i]);
+		else if (_stricmp(argv[i], "-shardkey") == 0)
+			g_opt.fShardByProducer = TRUE;
+		else if (argv[i][0] == '-' || g_opt.szFormatName != NULL)
+			fUsage = TRUE;
+		else
+			g_opt.szFormatName = argv[i];
+	}
+	if (fUsage || g_opt.szFormatName == NULL ||
+		g_opt.cProducers < 0 || g_opt.cConsumers < 0 ||
+		g_opt.cProducers + g_opt.cConsumers == 0 ||
+		g_opt.cProducers + g_opt.cConsumers > LOAD_MAX_THREADS ||
+		g_opt.rate < 0.0 || g_opt.seconds < 1 ||
+		g_opt.cShards < 0 || g_opt.cShards > LOAD_MAX_SHARDS) {
+		Usage();
+		return 1;
+	}
+	g_opt.fLocal = (_stricmp(g_opt.szFormatName, "LOCAL") == 0);
+	if (g_opt.fLocal && g_opt.cShards > 0) {
+		printf("MsmqLoad: -shards needs MSMQ queues, not LOCAL\n");
+		return 1;
+	}
+	for (int i = 0; i < g_opt.cShards; i++) {
+		size_t cch = strlen(g_opt.szFormatName) + 8;
+		g_shardNames[i] = new char[cch];
+		sprintf_s(g_shardNames[i], cch, "%s_%d", g_opt.szFormatName, i);
+	}
+
+	Log::init();
+	Crc32c::init();
+	BufferPool::init();
+	QueueSelector::init();
+	LocalTarget::init();
+	QueryPerformanceFrequency(&g_liFrequency);
+	g_hStop = CreateEventW(NULL, TRUE, FALSE, NULL);
+
+	printf("MsmqLoad: %d producers, %d consumers, %s for %d s\n",
+		g_opt.cProducers, g_opt.cConsumers, g_opt.szFormatName, g_opt.seconds);
+	if (g_opt.cShards > 0)
+		printf("MsmqLoad: %d shards, %s\n", g_opt.cShards,
+			g_opt.fShardByProducer ? "one per producer" : "round-robin");
+	if (g_opt.fChecksum)
+		PrintChecksumSpeed();
+
+	HANDLE threads[LOAD_MAX_THREADS];
+	int cThreads = 0;
+	for (int i = 0; i < g_opt.cConsumers; i++)
+		threads[cThreads++] = (HANDLE)_beginthreadex(NULL, 0, ConsumerMain, (void *)(INT_PTR)i, 0, NULL);
+	for (int i = 0; i < g_opt.cProducers; i++)
+		threads[cThreads++] = (HANDLE)_beginthreadex(NULL, 0, ProducerMain, (void *)(INT_PTR)i, 0, NULL);
+
+	// report once a second, on the schedule of the start
+	LONGLONG *interval = new LONGLONG[LATENCY_BUCKETS];
+	LONGLONG *total = new LONGLONG[LATENCY_BUCKETS];
+	memset(total, 0, LATENCY_BUCKETS * sizeof(LONGLONG));
+	LONGLONG llStart = NowTicks();
+	LONGLONG cLastSent = 0, cLastReceived = 0, cbLastSent = 0;
+
+	for (int s = 1; s <= g_opt.seconds; s++) {
+		LONGLONG llDue = llStart + s * g_liFrequency.QuadPart;
+		LONGLONG llAhead = llDue - NowTicks();
+		if (llAhead > 0)
+			Sleep((DWORD)(TicksToMicros(llAhead) / 1000));
+
+		for (int b = 0; b < LATENCY_BUCKETS; b++) {
+			interval[b] = InterlockedExchange(&g_latency[b], 0);
+			total[b] += interval[b];
+		}
+		LONGLONG cSent = g_cSent, cReceived = g_cReceived, cbSent = g_cbSent;
+		printf("%4d s  sent %I64d/s (%I64d KB/s)  received %I64d/s  errors %I64d\n",
+			s, cSent - cLastSent, (cbSent - cbLastSent) / 1024, cReceived - cLastReceived, g_cErrors);
+		PrintLatency(interval);
+		cLastSent = cSent;
+		cLastReceived = cReceived;
+		cbLastSent = cbSent;
+	}
+
+	SetEvent(g_hStop);
+	for (int i = 0; i < cThreads; i++) {
+		// one at a time: there may be more than MAXIMUM_WAIT_OBJECTS
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+	}
+
+	double seconds = TicksToMicros(NowTicks() - llStart) / 1e6;
+	printf("MsmqLoad: sent %I64d, received %I64d, errors %I64d in %.1f s (%.0f/s sent, %.0f/s received)\n",
+		g_cSent, g_cReceived, g_cErrors, seconds, g_cSent / seconds, g_cReceived / seconds);
+	PrintLatency(total);
+	if (g_opt.fChecksum && g_cSent + g_cReceived > 0)
+		printf("  checksum %.0f ns per send or receive\n",
+			(double)g_llChecksumNanos / (double)(g_cSent + g_cReceived));
+	for (int i = 0; i < g_opt.cShards; i++) {
+		printf("  shard %d  sent %I64d  received %I64d  stolen %I64d\n",
+			i, g_cShardSent[i], g_cShardReceived[i], g_cShardStolen[i]);
+		delete[] g_shardNames[i];
+	}
+
+	delete[] interval;
+	delete[] total;
+	CloseHandle(g_hStop);
+	return (g_cErrors > 0) ? 2 : 0;
+}
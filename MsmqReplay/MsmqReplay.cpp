@@ -0,0 +1,186 @@
+//
+// MsmqReplay.cpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module is a console tool that sends the messages in a capture
+// file, as written by Queue.startCapture(), to a queue again.
+//
+//   MsmqReplay [-speed <factor> | -max] [-tx] <capture file> <format name>
+//
+// By default the messages are sent at the pace they were captured;
+// -speed 2 sends them twice as fast, and -max as fast as the queue
+// takes them.  The pace is kept against the start of the replay, so a
+// send that is late does not delay the ones after it.  -tx sends each
+// message in its own transaction, for a transactional queue.
+//
+// ------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <WTypes.h>   // reqd for WinBase.h
+#include <WinBase.h>  // for CriticalSection
+#include <MqOai.h>
+#include <mq.h>
+
+#include "Log.hpp"
+#include "DedupWindow.hpp"
+#include "MsmqQueue.hpp"
+#include "QueueSelector.hpp"
+#include "Crc32c.hpp"
+#include "BufferPool.hpp"
+#include "CaptureLog.hpp"
+
+
+static void Usage()
+{
+	printf("usage: MsmqReplay [-speed <factor> | -max] [-tx] <capture file> <format name>\n"
+		"  -speed <factor>  send <factor> times as fast as captured (default 1)\n"
+		"  -max             send as fast as possible\n"
+		"  -tx              send each message in its own transaction\n");
+}
+
+
+
+// microseconds elapsed since *pStart
+static LONGLONG ElapsedMicros(const LARGE_INTEGER *pStart, const LARGE_INTEGER *pFrequency)
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	LONGLONG ticks = now.QuadPart - pStart->QuadPart;
+	return (ticks / pFrequency->QuadPart) * 1000000
+		+ (ticks % pFrequency->QuadPart) * 1000000 / pFrequency->QuadPart;
+}
+
+
+
+int main(int argc, char **argv)
+{
+	double  speed = 1.0;           // 0 for as fast as possible
+	BOOL    fTransactional = FALSE;
+	char    *szCapture = NULL;
+	char    *szFormatName = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (_stricmp(argv[i], "-speed") == 0 && i + 1 < argc) {
+			speed = atof(argv[++i]);
+			if (speed <= 0.0) {
+				Usage();
+				return 1;
+			}
+		}
+		else if (_stricmp(argv[i], "-max") == 0)
+			speed = 0.0;
+		else if (_stricmp(argv[i], "-tx") == 0)
+			fTransactional = TRUE;
+		else if (argv[i][0] == '-') {
+			Usage();
+			return 1;
+		}
+		else if (szCapture == NULL)
+			szCapture = argv[i];
+		else if (szFormatName == NULL)
+			szFormatName = argv[i];
+		else {
+			Usage();
+			return 1;
+		}
+	}
+	if (szFormatName == NULL) {
+		Usage();
+		return 1;
+	}
+
+	Log::init();
+	Crc32c::init();
+	BufferPool::init();
+	QueueSelector::init();
+
+	WCHAR wszCapture[MAX_PATH];
+	if (MultiByteToWideChar(CP_ACP, 0, szCapture, -1, wszCapture, MAX_PATH) == 0) {
+		printf("MsmqReplay: bad capture file name\n");
+		return 1;
+	}
+
+	CaptureReader reader;
+	HRESULT hr = reader.open(wszCapture);
+	if (FAILED(hr)) {
+		printf("MsmqReplay: cannot open %s (hr=0x%08x)\n", szCapture, hr);
+		return 1;
+	}
+
+	MsmqQueue queue;
+	hr = queue.openQueue(szFormatName, MQ_SEND_ACCESS);
+	if (FAILED(hr)) {
+		printf("MsmqReplay: cannot open %s (hr=0x%08x)\n", szFormatName, hr);
+		return 1;
+	}
+
+	LARGE_INTEGER liFrequency, liStart;
+	QueryPerformanceFrequency(&liFrequency);
+	QueryPerformanceCounter(&liStart);
+
+	CaptureRecord rec;
+	WCHAR   wszLabel[MQ_MAX_MSG_LABEL_LEN + 1];
+	LONG    cSent = 0;
+	LONGLONG cbSent = 0;
+	LONGLONG llNextReport = 1000000;
+
+	while (reader.next(&rec)) {
+		if (speed > 0.0) {
+			// wait for the record's time on the scaled clock
+			LONGLONG llDue = (LONGLONG)(rec.llMicros / speed);
+			LONGLONG llElapsed = ElapsedMicros(&liStart, &liFrequency);
+			if (llDue > llElapsed)
+				Sleep((DWORD)((llDue - llElapsed) / 1000));
+		}
+
+		memcpy(wszLabel, rec.pwchLabel, rec.cchLabel * sizeof(WCHAR));
+		wszLabel[rec.cchLabel] = L'\0';
+
+		// a batch goes out as one again, with its record count
+		if (rec.cBatchRecords > 0)
+			hr = queue.sendBatch((BYTE *)rec.pbBody, rec.cbBody, rec.cBatchRecords, wszLabel,
+				fTransactional ? MQ_SINGLE_MESSAGE : MQ_NO_TRANSACTION,
+				rec.iPriority);
+		else
+			hr = queue.sendBytes((BYTE *)rec.pbBody, rec.cbBody, wszLabel,
+				(BYTE *)rec.pCorrelationId, rec.cbCorrelationId,
+				fTransactional ? MQ_SINGLE_MESSAGE : MQ_NO_TRANSACTION,
+				rec.iPriority, MQJ_NO_TTL, MQJ_NO_TTL, NULL);
+		if (FAILED(hr)) {
+			printf("MsmqReplay: send failed after %ld messages (hr=0x%08x)\n", cSent, hr);
+			queue.closeQueue();
+			return 2;
+		}
+		cSent++;
+		cbSent += rec.cbBody;
+
+		LONGLONG llElapsed = ElapsedMicros(&liStart, &liFrequency);
+		if (llElapsed >= llNextReport) {
+			printf("%8.1f s  %ld messages  %I64d bytes\n", llElapsed / 1e6, cSent, cbSent);
+			llNextReport = llElapsed + 1000000;
+		}
+	}
+
+	double seconds = ElapsedMicros(&liStart, &liFrequency) / 1e6;
+	printf("MsmqReplay: sent %ld messages, %I64d bytes, in %.3f s (%.0f msg/s)\n",
+		cSent, cbSent, seconds, (seconds > 0.0) ? cSent / seconds : 0.0);
+
+	queue.closeQueue();
+	return 0;
+}
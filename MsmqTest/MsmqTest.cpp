@@ -0,0 +1,632 @@
+//
+// MsmqTest.cpp
+// ------------------------------------------------------------------
+//
+// Copyright (c) 2006-2010 Dino Chiesa.
+// All rights reserved.
+//
+// This code module is part of MsmqJava, a JNI library that provides
+// access to MSMQ for Java on Windows.
+//
+// ------------------------------------------------------------------
+//
+// This code is licensed under the Microsoft Public License.
+// See the file License.txt for the license details.
+// More info on: http://dotnetzip.codeplex.com
+//
+// ------------------------------------------------------------------
+//
+// This module is a console tool that tests the native parts of
+// MsmqJava that don't need a queue: the LZ4 codec, the batch
+// envelope, the records of the message extension, the dedup window,
+// the CRC-32C, and the recovery of the outbox journal.
+//
+//   MsmqTest
+//
+// Each test round-trips good input, and feeds malformed input to the
+// parsers, which must reject it without reading or writing out of
+// bounds.  Failed checks are printed with their line; the exit code
+// is the number of them, so 0 means all passed.
+//
+// The outbox test journals to a directory under %TEMP%, and deletes
+// it at the end.  It opens no queue, so MSMQ need not be running.
+//
+// ------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <WTypes.h>   // reqd for WinBase.h
+#include <WinBase.h>  // for CriticalSection
+#include <MqOai.h>
+#include <mq.h>
+
+#include "Log.hpp"
+#include "DedupWindow.hpp"
+#include "MsmqQueue.hpp"
+#include "QueueSelector.hpp"
+#include "Crc32c.hpp"
+#include "BufferPool.hpp"
+#include "Lz4Codec.hpp"
+#include "BatchEnvelope.hpp"
+#include "MessageExtension.hpp"
+#include "Outbox.hpp"
+
+
+#define CRC32C_POLY             0x82F63B78   // reflected
+#define CRC_MAX_LENGTH          (3 * 8192 + 300)   // past the three long lanes
+#define LZ4_MAX_TEST_SIZE       (256 * 1024)
+#define DEDUP_TEST_CAPACITY     1000
+
+// the layout of the journal, as written by Outbox.cpp
+#define OUTBOX_SEGMENT_HEADER   32
+#define OUTBOX_RECORD_HEADER    32
+#define OUTBOX_TEST_RECORDS     10
+#define OUTBOX_TEST_BODY        120
+#define OUTBOX_TEST_RECORD      (((OUTBOX_RECORD_HEADER + sizeof(WCHAR) + OUTBOX_TEST_BODY) + 7) & ~7)
+
+#define CHECK(cond)   do { g_cChecks++; if (!(cond)) Fail(#cond, __LINE__); } while (0)
+
+
+static int  g_cChecks;
+static int  g_cFailures;
+
+
+
+static void Fail(const char *szCondition, int iLine)
+{
+	printf("  FAILED at line %d: %s\n", iLine, szCondition);
+	g_cFailures++;
+}
+
+
+
+// xorshift
+static DWORD NextRandom(DWORD *pState)
+{
+	DWORD x = *pState;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *pState = x;
+}
+
+
+
+// Fills pb with data of the given kind: 0 random, 1 a short
+// repeating pattern, 2 long runs of one byte, 3 text-like, with
+// repeats at varying distances.
+static void FillTestData(BYTE *pb, DWORD cb, int kind, DWORD *pState)
+{
+	static const char *words[] = { "queue ", "message ", "body ", "label ", "MSMQ ", "Java ", "\r\n" };
+
+	DWORD i = 0;
+	while (i < cb) {
+		switch (kind) {
+		case 0:
+			pb[i++] = (BYTE)NextRandom(pState);
+			break;
+		case 1:
+			pb[i] = (BYTE)("abcdefg"[i % 7]);
+			i++;
+			break;
+		case 2: {
+			BYTE b = (BYTE)NextRandom(pState);
+			DWORD run = NextRandom(pState) % 1000;
+			for (DWORD k = 0; k < run && i < cb; k++)
+				pb[i++] = b;
+			break;
+		}
+		default: {
+			const char *w = words[NextRandom(pState) % (sizeof(words) / sizeof(words[0]))];
+			while (*w != '\0' && i < cb)
+				pb[i++] = (BYTE)*w++;
+			break;
+		}
+		}
+	}
+}
+
+
+
+// ------------------------------------------------------------------
+// Lz4Codec
+
+static BOOL Lz4RoundTrip(const BYTE *pbSrc, DWORD cbSrc, BYTE *pbPacked, BYTE *pbOut)
+{
+	DWORD cbBound = Lz4Codec::bound(cbSrc);
+	DWORD cbPacked = Lz4Codec::compress(pbSrc, cbSrc, pbPacked, cbBound);
+	if (cbPacked == 0 || cbPacked > cbBound)
+		return FALSE;
+	int cbOut = Lz4Codec::decompress(pbPacked, cbPacked, pbOut, cbSrc);
+	return cbOut == (int)cbSrc && memcmp(pbSrc, pbOut, cbSrc) == 0;
+}
+
+
+
+static void TestLz4(void)
+{
+	printf("Lz4Codec\n");
+
+	BYTE *pbSrc = new BYTE[LZ4_MAX_TEST_SIZE];
+	BYTE *pbPacked = new BYTE[Lz4Codec::bound(LZ4_MAX_TEST_SIZE)];
+	BYTE *pbOut = new BYTE[LZ4_MAX_TEST_SIZE + 16];
+	DWORD dwRandom = 2463534242UL;
+
+	static const DWORD sizes[] = { 0, 1, 4, 5, 12, 13, 14, 15, 16, 17, 19, 20, 31, 64, 255,
+		269, 270, 271, 524, 525, 1000, 4096, 65535, 65536, 65537, 100000, LZ4_MAX_TEST_SIZE };
+
+	for (int kind = 0; kind < 4; kind++) {
+		for (DWORD i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+			FillTestData(pbSrc, sizes[i], kind, &dwRandom);
+			CHECK(Lz4RoundTrip(pbSrc, sizes[i], pbPacked, pbOut));
+		}
+	}
+
+	// literal runs and matches whose lengths need the 255-byte
+	// continuation, at and around each of its steps
+	for (DWORD cb = 250; cb < 800; cb++) {
+		FillTestData(pbSrc, cb, 0, &dwRandom);
+		memset(pbSrc + cb, 'x', cb);
+		FillTestData(pbSrc + 2 * cb, 16, 0, &dwRandom);
+		CHECK(Lz4RoundTrip(pbSrc, 2 * cb + 16, pbPacked, pbOut));
+	}
+
+	// compress must not overrun a destination that is too small
+	FillTestData(pbSrc, 4096, 0, &dwRandom);
+	pbPacked[1000] = 0xCD;
+	CHECK(Lz4Codec::compress(pbSrc, 4096, pbPacked, 1000) == 0);
+	CHECK(pbPacked[1000] == 0xCD);
+	CHECK(Lz4Codec::bound(0x7E000001) == 0);
+
+	// decompress into a destination one byte too small
+	FillTestData(pbSrc, 10000, 3, &dwRandom);
+	DWORD cbPacked = Lz4Codec::compress(pbSrc, 10000, pbPacked, Lz4Codec::bound(10000));
+	CHECK(cbPacked > 0);
+	pbOut[9999] = 0xCD;
+	CHECK(Lz4Codec::decompress(pbPacked, cbPacked, pbOut, 9999) == -1);
+	CHECK(pbOut[9999] == 0xCD);
+
+	// every truncation of a good block either fails or comes up short
+	BOOL fTruncatedOk = TRUE;
+	for (DWORD cb = 0; cb < cbPacked; cb++) {
+		if (Lz4Codec::decompress(pbPacked, cb, pbOut, 10000) == 10000)
+			fTruncatedOk = FALSE;
+	}
+	CHECK(fTruncatedOk);
+
+	// hand-made blocks
+	static const BYTE offsetZero[]     = { 0x10, 'a', 0x00, 0x00 };
+	static const BYTE offsetTooFar[]   = { 0x10, 'a', 0x02, 0x00 };
+	static const BYTE literalsShort[]  = { 0x50, 'a', 'b' };
+	static const BYTE offsetCut[]      = { 0x10, 'a', 0x01 };
+	static const BYTE lengthCut[]      = { 0xF0, 0xFF, 0xFF };
+	static const BYTE matchLengthCut[] = { 0x1F, 'a', 0x01, 0x00, 0xFF };
+	static const BYTE goodRun[]        = { 0x1F, 'a', 0x01, 0x00, 0x00, 0x10, 'b' };
+	CHECK(Lz4Codec::decompress(offsetZero, sizeof(offsetZero), pbOut, 100) == -1);
+	CHECK(Lz4Codec::decompress(offsetTooFar, sizeof(offsetTooFar), pbOut, 100) == -1);
+	CHECK(Lz4Codec::decompress(literalsShort, sizeof(literalsShort), pbOut, 100) == -1);
+	CHECK(Lz4Codec::decompress(offsetCut, sizeof(offsetCut), pbOut, 100) == -1);
+	CHECK(Lz4Codec::decompress(lengthCut, sizeof(lengthCut), pbOut, 100) == -1);
+	CHECK(Lz4Codec::decompress(matchLengthCut, sizeof(matchLengthCut), pbOut, 100) == -1);
+	CHECK(Lz4Codec::decompress(pbPacked, 0, pbOut, 100) == -1);
+
+	// 'a', then a match of 19 at offset 1, then 'b'
+	CHECK(Lz4Codec::decompress(goodRun, sizeof(goodRun), pbOut, 100) == 21);
+	CHECK(pbOut[0] == 'a' && pbOut[19] == 'a' && pbOut[20] == 'b');
+	CHECK(Lz4Codec::decompress(goodRun, sizeof(goodRun), pbOut, 20) == -1);
+
+	// garbage must be rejected or decoded within bounds, never overrun
+	for (int i = 0; i < 2000; i++) {
+		DWORD cb = 1 + NextRandom(&dwRandom) % 512;
+		FillTestData(pbPacked, cb, 0, &dwRandom);
+		pbOut[256] = 0xCD;
+		int cbOut = Lz4Codec::decompress(pbPacked, cb, pbOut, 256);
+		CHECK(cbOut >= -1 && cbOut <= 256);
+		CHECK(pbOut[256] == 0xCD);
+	}
+
+	delete[] pbSrc;
+	delete[] pbPacked;
+	delete[] pbOut;
+}
+
+
+
+// ------------------------------------------------------------------
+// BatchEnvelope
+
+static void TestBatchEnvelope(void)
+{
+	printf("BatchEnvelope\n");
+
+	BYTE records[3][300];
+	static const DWORD cbRecords[3] = { 0, 5, 300 };
+	for (int i = 0; i < 3; i++)
+		memset(records[i], 'a' + i, sizeof(records[i]));
+
+	BYTE body[1024];
+	DWORD cbBody = 0;
+	for (int i = 0; i < 3; i++) {
+		BatchEnvelope::write(body + cbBody, records[i], cbRecords[i]);
+		cbBody += BatchEnvelope::frameSize(cbRecords[i]);
+	}
+	CHECK(cbBody == 3 * sizeof(DWORD) + 305);
+
+	DWORD off = 0;
+	const BYTE *pbRecord;
+	DWORD cbRecord;
+	for (int i = 0; i < 3; i++) {
+		CHECK(BatchEnvelope::next(body, cbBody, &off, &pbRecord, &cbRecord));
+		CHECK(cbRecord == cbRecords[i]);
+		CHECK(memcmp(pbRecord, records[i], cbRecord) == 0);
+	}
+	CHECK(off == cbBody);
+	CHECK(!BatchEnvelope::next(body, cbBody, &off, &pbRecord, &cbRecord));
+
+	CHECK(BatchEnvelope::check(body, cbBody, 3));
+	CHECK(!BatchEnvelope::check(body, cbBody, 2));      // trailing bytes
+	CHECK(!BatchEnvelope::check(body, cbBody, 4));      // too few frames
+	CHECK(!BatchEnvelope::check(body, cbBody - 1, 3));  // the last frame runs past the body
+	CHECK(!BatchEnvelope::check(body, cbBody + 1, 3));  // a stray byte at the end
+	CHECK(BatchEnvelope::check(body, 0, 0));
+	CHECK(!BatchEnvelope::check(NULL, 0, 1));
+
+	// a length that runs past the body, or wraps it
+	BYTE bad[16];
+	memset(bad, 0, sizeof(bad));
+	DWORD cbHuge = 0xFFFFFFFF;
+	memcpy(bad, &cbHuge, sizeof(DWORD));
+	off = 0;
+	CHECK(!BatchEnvelope::next(bad, sizeof(bad), &off, &pbRecord, &cbRecord));
+	CHECK(off == 0);
+	DWORD cbOver = sizeof(bad) - sizeof(DWORD) + 1;
+	memcpy(bad, &cbOver, sizeof(DWORD));
+	CHECK(!BatchEnvelope::check(bad, sizeof(bad), 1));
+
+	// a body too short for a length
+	off = 0;
+	CHECK(!BatchEnvelope::next(bad, sizeof(DWORD) - 1, &off, &pbRecord, &cbRecord));
+}
+
+
+
+// ------------------------------------------------------------------
+// MessageExtension
+
+static void TestMessageExtension(void)
+{
+	printf("MessageExtension\n");
+
+	MessageExtension ext;
+	CHECK(ext.isEmpty());
+
+	BYTE compression[5] = { 1, 0x10, 0x20, 0x30, 0x40 };
+	DWORD dwCrc = 0xE3069283;
+	CHECK(ext.add(MQJ_EXT_COMPRESSION, compression, sizeof(compression)));
+	CHECK(ext.add(MQJ_EXT_HEARTBEAT, NULL, 0));
+	CHECK(ext.add(MQJ_EXT_CHECKSUM, &dwCrc, sizeof(dwCrc)));
+	CHECK(!ext.isEmpty());
+	CHECK(ext.length() == 4 + (2 + 5) + 2 + (2 + 4));
+
+	BYTE cb = 0;
+	const BYTE *p = MessageExtension::find(ext.data(), ext.length(), MQJ_EXT_COMPRESSION, &cb);
+	CHECK(p != NULL && cb == sizeof(compression) && memcmp(p, compression, cb) == 0);
+	p = MessageExtension::find(ext.data(), ext.length(), MQJ_EXT_CHECKSUM, &cb);
+	CHECK(p != NULL && cb == sizeof(DWORD) && memcmp(p, &dwCrc, cb) == 0);
+	p = MessageExtension::find(ext.data(), ext.length(), MQJ_EXT_HEARTBEAT, &cb);
+	CHECK(p != NULL && cb == 0);
+	CHECK(MessageExtension::find(ext.data(), ext.length(), MQJ_EXT_CHECKSUM, NULL) != NULL);
+	CHECK(MessageExtension::find(ext.data(), ext.length(), MQJ_EXT_BATCH, &cb) == NULL);
+
+	// a record cut short hides itself, but not those before it
+	CHECK(MessageExtension::find(ext.data(), ext.length() - 1, MQJ_EXT_CHECKSUM, &cb) == NULL);
+	CHECK(MessageExtension::find(ext.data(), ext.length() - 1, MQJ_EXT_COMPRESSION, &cb) != NULL);
+	CHECK(MessageExtension::find(ext.data(), 4 + 3, MQJ_EXT_COMPRESSION, &cb) == NULL);
+
+	// not ours: no preamble, another version, too short, or none
+	BYTE other[MQJ_MAX_EXTENSION_LEN];
+	memcpy(other, ext.data(), ext.length());
+	other[0] = 'X';
+	CHECK(MessageExtension::find(other, ext.length(), MQJ_EXT_COMPRESSION, &cb) == NULL);
+	memcpy(other, ext.data(), ext.length());
+	other[2] = MQJ_EXTENSION_VERSION + 1;
+	CHECK(MessageExtension::find(other, ext.length(), MQJ_EXT_COMPRESSION, &cb) == NULL);
+	CHECK(MessageExtension::find(ext.data(), 3, MQJ_EXT_COMPRESSION, &cb) == NULL);
+	CHECK(MessageExtension::find(NULL, 0, MQJ_EXT_COMPRESSION, &cb) == NULL);
+
+	// records of an unknown type are skipped
+	static const BYTE unknown[] = { 'M', 'J', MQJ_EXTENSION_VERSION, 0,
+		99, 3, 'x', 'y', 'z',
+		MQJ_EXT_BATCH, 4, 7, 0, 0, 0 };
+	p = MessageExtension::find(unknown, sizeof(unknown), MQJ_EXT_BATCH, &cb);
+	CHECK(p != NULL && cb == 4 && p[0] == 7);
+
+	// a record that would overflow the buffer is refused, and the
+	// extension is left as it was
+	MessageExtension full;
+	BYTE big[250];
+	memset(big, 'b', sizeof(big));
+	CHECK(full.add(MQJ_EXT_PROBE, big, 250));
+	CHECK(full.length() == MQJ_MAX_EXTENSION_LEN);
+	CHECK(!full.add(MQJ_EXT_HEARTBEAT, NULL, 0));
+	CHECK(full.length() == MQJ_MAX_EXTENSION_LEN);
+	MessageExtension tooBig;
+	CHECK(!tooBig.add(MQJ_EXT_PROBE, big, 251));
+	CHECK(tooBig.isEmpty());
+}
+
+
+
+// ------------------------------------------------------------------
+// DedupWindow
+
+static void MakeId(BYTE *pId, DWORD n)
+{
+	memset(pId, 0, MQJ_DEDUP_ID_SIZE);
+	memcpy(pId, &n, sizeof(n));
+	pId[MQJ_DEDUP_ID_SIZE - 1] = 0x5A;
+}
+
+
+
+static void TestDedupWindow(void)
+{
+	printf("DedupWindow\n");
+
+	DedupWindow window;
+	BYTE id[MQJ_DEDUP_ID_SIZE];
+
+	// disabled until resized
+	MakeId(id, 1);
+	CHECK(!window.checkAndAdd(id));
+	CHECK(!window.checkAndAdd(id));
+
+	CHECK(window.resize(DEDUP_MAX_CAPACITY + 1) == MQ_ERROR_INVALID_PARAMETER);
+	CHECK(window.resize(4) == MQ_OK);
+
+	for (DWORD n = 0; n < 4; n++) {
+		MakeId(id, n);
+		CHECK(!window.checkAndAdd(id));
+	}
+	for (DWORD n = 0; n < 4; n++) {
+		MakeId(id, n);
+		CHECK(window.checkAndAdd(id));
+	}
+
+	// a fifth evicts the oldest
+	MakeId(id, 4);
+	CHECK(!window.checkAndAdd(id));
+	MakeId(id, 0);
+	CHECK(!window.checkAndAdd(id));   // forgotten; now evicts 1
+	MakeId(id, 1);
+	CHECK(!window.checkAndAdd(id));
+	MakeId(id, 4);
+	CHECK(window.checkAndAdd(id));
+
+	// many evictions, to exercise the deletes from the probe runs
+	CHECK(window.resize(DEDUP_TEST_CAPACITY) == MQ_OK);
+	BOOL fAllNew = TRUE;
+	for (DWORD n = 0; n < 10 * DEDUP_TEST_CAPACITY; n++) {
+		MakeId(id, n);
+		if (window.checkAndAdd(id)) fAllNew = FALSE;
+	}
+	CHECK(fAllNew);
+	BOOL fAllSeen = TRUE;
+	for (DWORD n = 9 * DEDUP_TEST_CAPACITY; n < 10 * DEDUP_TEST_CAPACITY; n++) {
+		MakeId(id, n);
+		if (!window.checkAndAdd(id)) fAllSeen = FALSE;
+	}
+	CHECK(fAllSeen);
+	MakeId(id, 9 * DEDUP_TEST_CAPACITY - 1);
+	CHECK(!window.checkAndAdd(id));
+
+	// resizing forgets, and 0 disables
+	CHECK(window.resize(DEDUP_TEST_CAPACITY) == MQ_OK);
+	CHECK(!window.checkAndAdd(id));
+	CHECK(window.resize(0) == MQ_OK);
+	CHECK(!window.checkAndAdd(id));
+	CHECK(!window.checkAndAdd(id));
+}
+
+
+
+// ------------------------------------------------------------------
+// Crc32c
+
+// one bit at a time, as the reference
+static DWORD Crc32cBitwise(DWORD crc, const BYTE *pb, DWORD cb)
+{
+	crc = ~crc;
+	for (DWORD i = 0; i < cb; i++) {
+		crc ^= pb[i];
+		for (int k = 0; k < 8; k++)
+			crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+	}
+	return ~crc;
+}
+
+
+
+static void TestCrc32c(void)
+{
+	printf("Crc32c (%s)\n", Crc32c::isHardware() ? "hardware" : "tables");
+
+	static const BYTE check[] = "123456789";
+	CHECK(Crc32c::compute(0, check, 9) == 0xE3069283);
+	CHECK(Crc32c::computeTable(0, check, 9) == 0xE3069283);
+	CHECK(Crc32cBitwise(0, check, 9) == 0xE3069283);
+	CHECK(Crc32c::compute(0, check, 0) == 0);
+
+	BYTE *pb = new BYTE[CRC_MAX_LENGTH + 8];
+	DWORD dwRandom = 88172645UL;
+	FillTestData(pb, CRC_MAX_LENGTH + 8, 0, &dwRandom);
+
+	// every alignment, and lengths around the lanes of the hardware path
+	static const DWORD lengths[] = { 1, 2, 3, 4, 7, 8, 9, 15, 16, 17, 63, 64, 255, 256, 257,
+		767, 768, 769, 1000, 4095, 8191, 8192, 8193, 3 * 256, 3 * 256 + 8, 3 * 8192 - 1,
+		3 * 8192, 3 * 8192 + 1, 3 * 8192 + 8, CRC_MAX_LENGTH };
+	for (int align = 0; align < 8; align++) {
+		for (DWORD i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+			DWORD expected = Crc32cBitwise(0, pb + align, lengths[i]);
+			CHECK(Crc32c::compute(0, pb + align, lengths[i]) == expected);
+			CHECK(Crc32c::computeTable(0, pb + align, lengths[i]) == expected);
+		}
+	}
+
+	// incremental, in pieces of every size, is the same as one shot
+	DWORD whole = Crc32c::compute(0, pb, CRC_MAX_LENGTH);
+	for (DWORD piece = 1; piece < 40000; piece = piece * 3 + 1) {
+		DWORD crc = 0;
+		for (DWORD off = 0; off < CRC_MAX_LENGTH; off += piece) {
+			DWORD cb = (CRC_MAX_LENGTH - off < piece) ? CRC_MAX_LENGTH - off : piece;
+			crc = Crc32c::compute(crc, pb + off, cb);
+		}
+		CHECK(crc == whole);
+	}
+
+	// a flipped bit changes it
+	pb[12345] ^= 0x10;
+	CHECK(Crc32c::compute(0, pb, CRC_MAX_LENGTH) != whole);
+
+	delete[] pb;
+}
+
+
+
+// ------------------------------------------------------------------
+// Outbox
+
+static void RemoveJournal(const WCHAR *wszDir)
+{
+	WCHAR wszPath[MAX_PATH];
+	swprintf_s(wszPath, MAX_PATH, L"%s\\outbox-*.seg", wszDir);
+
+	WIN32_FIND_DATAW fd;
+	HANDLE hFind = FindFirstFileW(wszPath, &fd);
+	if (hFind != INVALID_HANDLE_VALUE) {
+		do {
+			swprintf_s(wszPath, MAX_PATH, L"%s\\%s", wszDir, fd.cFileName);
+			DeleteFileW(wszPath);
+		} while (FindNextFileW(hFind, &fd));
+		FindClose(hFind);
+	}
+	RemoveDirectoryW(wszDir);
+}
+
+
+
+// flips one byte of the first segment, as a crash in mid-append may leave it
+static BOOL CorruptJournal(const WCHAR *wszDir, DWORD dwOffset)
+{
+	WCHAR wszPath[MAX_PATH];
+	swprintf_s(wszPath, MAX_PATH, L"%s\\outbox-%08x.seg", wszDir, 1);
+
+	HANDLE hFile = CreateFileW(wszPath, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	LARGE_INTEGER li;
+	li.QuadPart = dwOffset;
+	BYTE b = 0;
+	DWORD cb = 0;
+	BOOL fOk = SetFilePointerEx(hFile, li, NULL, FILE_BEGIN) &&
+		ReadFile(hFile, &b, 1, &cb, NULL) && cb == 1;
+	if (fOk) {
+		b ^= 0xFF;
+		fOk = SetFilePointerEx(hFile, li, NULL, FILE_BEGIN) &&
+			WriteFile(hFile, &b, 1, &cb, NULL) && cb == 1;
+	}
+	CloseHandle(hFile);
+	return fOk;
+}
+
+
+
+// Journals with fAsync, to a queue that is not open, so that the
+// forwarder can never drain the journal, and reopens it.
+static LONG JournalAndReopen(const WCHAR *wszDir, MsmqQueue *q, int cSends, HRESULT *phr)
+{
+	BYTE body[OUTBOX_TEST_BODY];
+
+	Outbox *outbox = new Outbox(q);
+	HRESULT hr = outbox->open(wszDir, 0, MQJ_OUTBOX_DEFAULT_SEGMENTS);
+	for (int i = 0; i < cSends && SUCCEEDED(hr); i++) {
+		memset(body, 'A' + i, sizeof(body));
+		hr = outbox->send(body, sizeof(body), NULL, NULL, 0, MQ_NO_TRANSACTION,
+			MQ_DEFAULT_PRIORITY, MQJ_NO_TTL, MQJ_NO_TTL, NULL, TRUE);
+	}
+	LONG cPending = outbox->pending();
+	delete outbox;
+	*phr = hr;
+	return cPending;
+}
+
+
+
+static void TestOutbox(void)
+{
+	printf("Outbox\n");
+
+	WCHAR wszTemp[MAX_PATH];
+	WCHAR wszDir[MAX_PATH];
+	if (GetTempPathW(MAX_PATH, wszTemp) == 0) {
+		Fail("GetTempPathW", __LINE__);
+		return;
+	}
+	swprintf_s(wszDir, MAX_PATH, L"%sMsmqTest-%lu", wszTemp, GetCurrentProcessId());
+	RemoveJournal(wszDir);
+
+	MsmqQueue q;
+	HRESULT hr;
+
+	CHECK(JournalAndReopen(wszDir, &q, OUTBOX_TEST_RECORDS, &hr) == OUTBOX_TEST_RECORDS);
+	CHECK(hr == MQ_OK);
+
+	// all are recovered from a clean shutdown
+	CHECK(JournalAndReopen(wszDir, &q, 0, &hr) == OUTBOX_TEST_RECORDS);
+	CHECK(hr == MQ_OK);
+
+	// a torn last record ends the journal
+	DWORD dwLastBody = OUTBOX_SEGMENT_HEADER + (OUTBOX_TEST_RECORDS - 1) * OUTBOX_TEST_RECORD
+		+ OUTBOX_RECORD_HEADER + sizeof(WCHAR);
+	CHECK(CorruptJournal(wszDir, dwLastBody + OUTBOX_TEST_BODY / 2));
+	CHECK(JournalAndReopen(wszDir, &q, 0, &hr) == OUTBOX_TEST_RECORDS - 1);
+
+	// and is overwritten by the next append, which is recovered
+	CHECK(JournalAndReopen(wszDir, &q, 1, &hr) == OUTBOX_TEST_RECORDS);
+	CHECK(hr == MQ_OK);
+	CHECK(JournalAndReopen(wszDir, &q, 0, &hr) == OUTBOX_TEST_RECORDS);
+
+	// a torn header is no better
+	CHECK(CorruptJournal(wszDir, OUTBOX_SEGMENT_HEADER + OUTBOX_TEST_RECORD + 16));
+	CHECK(JournalAndReopen(wszDir, &q, 0, &hr) == 1);
+
+	// a segment that is not a segment fails the open
+	CHECK(CorruptJournal(wszDir, 0));
+	JournalAndReopen(wszDir, &q, 0, &hr);
+	CHECK(FAILED(hr));
+
+	RemoveJournal(wszDir);
+}
+
+
+
+int main(int argc, char **argv)
+{
+	Log::init();
+	Crc32c::init();
+	BufferPool::init();
+	QueueSelector::init();
+
+	TestLz4();
+	TestBatchEnvelope();
+	TestMessageExtension();
+	TestDedupWindow();
+	TestCrc32c();
+	TestOutbox();
+
+	printf("MsmqTest: %d checks, %d failed\n", g_cChecks, g_cFailures);
+	return g_cFailures;
+}